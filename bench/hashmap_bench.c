@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Micro benchmark of the shell symbol lookup: linked list vs. hash map
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "list.h"
+#include "hashmap.h"
+
+#define LOOKUPS   2000000
+
+double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void run(size_t count)
+{
+  size_t idx, hits = 0, collisions = 0;
+  char **names = (char**) malloc(sizeof(char*) * count);
+  struct NodeList list = { NULL, NULL };
+  struct HashMap map = HMAP_INITIALIZER;
+  struct NodeItem *item;
+  size_t lookups = LOOKUPS;
+  double t_list, t_map, t0;
+  for (idx = 0; idx < count; ++idx) {
+    names[idx] = (char*) malloc(32);
+    snprintf(names[idx], 32, "buffer_%u", (unsigned int)idx);
+    item = push_back(&list, names[idx], 0);
+    item->hash = hash_sdbm(0, names[idx], strlen(names[idx]));
+    hmap_put(&map, names[idx], names[idx]);
+  }
+  /* Names whose hash is already used by another name, the list can't tell them apart */
+  for (idx = 0; idx < count; ++idx) {
+    item = find_item(&list, hash_sdbm(0, names[idx], strlen(names[idx])));
+    if (item->data != names[idx]) ++collisions;
+  }
+  /* Keep the total list work bounded for large tables */
+  if (count > 1024) lookups = LOOKUPS / (count / 1024);
+  srand(1);
+  t0 = now();
+  for (idx = 0; idx < lookups; ++idx) {
+    char *key = names[rand() % count];
+    item = find_item(&list, hash_sdbm(0, key, strlen(key)));
+    hits += (item != NULL);
+  }
+  t_list = (now() - t0) / lookups;
+  srand(1);
+  t0 = now();
+  for (idx = 0; idx < lookups; ++idx) {
+    hits += (hmap_get(&map, names[rand() % count]) != NULL);
+  }
+  t_map = (now() - t0) / lookups;
+  printf("%8u %14.1f %14.1f %10.1fx %12u\n", (unsigned int)count, t_list * 1e9, t_map * 1e9,
+    t_list / t_map, (unsigned int)collisions);
+  /* Remove every second entry and look them up again to exercise the tombstones */
+  for (idx = 0; idx < count; idx += 2) hmap_remove(&map, names[idx]);
+  for (idx = 0; idx < count; ++idx) {
+    if ((hmap_get(&map, names[idx]) != NULL) != (idx & 1)) {
+      printf("hash map inconsistent after removal: %s\n", names[idx]);
+      exit(1);
+    }
+  }
+  for (idx = 0; idx < count; ++idx) free(names[idx]);
+  free(names);
+  delete_list(&list);
+  hmap_free(&map);
+  if (hits == 0) printf("no hits\n");
+}
+
+int main(int argc, char **argv)
+{
+  size_t count;
+  printf("%8s %14s %14s %11s %12s\n", "symbols", "list ns/op", "hmap ns/op", "speedup", "collisions");
+  for (count = 16; count <= 65536; count *= 4) {
+    run(count);
+  }
+  return 0;
+}
@@ -0,0 +1,483 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Micro benchmark of the library kernels, reports throughput and writes JSON results
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fsynth.h"
+
+#define MAX_SIZES      8
+#define MIN_RUN_TIME   0.01
+#define SEQ_NOTES      16
+
+typedef size_t (*FBenchFunc)(size_t size, int arg);
+
+typedef struct {
+  const char *name;
+  FBenchFunc func;
+  int arg;
+} FBench;
+
+typedef struct {
+  double mean;           /* Mean time per call in seconds */
+  double stddev;
+  double min;
+  double samples;        /* Output samples per call */
+  double bytes;          /* Bytes moved per call, taken from the kernel statistics */
+} FBenchResult;
+
+FSampleBuffer *bench_buffer = NULL;
+FSampleBuffer *bench_source = NULL;
+FSampleBuffer *bench_hull = NULL;
+FSampleBuffer *bench_stereo = NULL;   /* Two channels of the benchmark size each */
+FSFixedBuffer *bench_fixed[2] = { NULL, NULL };   /* Q15 and Q31 */
+FSFixedBuffer *bench_fixed_source[2] = { NULL, NULL };
+char bench_file[256];
+
+double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+size_t bench_generate(size_t size, int arg)
+{
+  fs_generate_wave_func(bench_buffer, arg, 440, 1);
+  return size;
+}
+
+size_t bench_modulate(size_t size, int arg)
+{
+  fs_modulate_buffer(bench_buffer, bench_source, arg);
+  return size;
+}
+
+size_t bench_normalize(size_t size, int arg)
+{
+  fs_normalize_buffer(bench_buffer);
+  return size;
+}
+
+size_t bench_convert(size_t size, int arg)
+{
+  free(fs_convert_samples(bench_buffer, arg));
+  return size;
+}
+
+size_t bench_resample(size_t size, int arg)
+{
+  FSampleBuffer *pout = fs_resample_buffer(bench_buffer, arg);
+  size = (pout != NULL) ? pout->sample_count : 0;
+  fs_delete_sample_buffer(&pout);
+  return size;
+}
+
+size_t bench_filter(size_t size, int arg)
+{
+  FSFilter *filter = fs_create_filter(arg & FS_FILTER_SVF);
+  int idx, sections = arg >> 1;
+  for (idx = 0; idx < sections; ++idx) {
+    fs_add_filter_section(filter, FS_FILTER_LOWPASS, 1000, M_SQRT1_2, 0);
+  }
+  fs_apply_filter(bench_buffer, filter);
+  fs_delete_filter(&filter);
+  return size;
+}
+
+size_t bench_stereo_filter(size_t size, int arg)
+{
+  FSFilter *filter = fs_create_filter(FS_FILTER_BIQUAD);
+  fs_add_filter_section(filter, FS_FILTER_LOWPASS, 1000, M_SQRT1_2, 0);
+  fs_apply_filter(bench_stereo, filter);
+  fs_delete_filter(&filter);
+  return size * 2;
+}
+
+size_t bench_stereo_convert(size_t size, int arg)
+{
+  free(fs_convert_samples(bench_stereo, arg));
+  return size * 2;
+}
+
+size_t bench_partials(size_t size, int arg)
+{
+  int idx;
+  FSPartial *partials = (FSPartial*) malloc(sizeof(FSPartial) * arg);
+  if (partials == NULL) return 0;
+  /* Slightly inharmonic partials which all stay below the Nyquist frequency */
+  for (idx = 0; idx < arg; ++idx) {
+    partials[idx].freq = 20 + idx * 19000. / arg;
+    partials[idx].amp = 1. / (idx + 1);
+    partials[idx].phase = idx;
+  }
+  fs_generate_partials(bench_buffer, partials, arg, 0);
+  free(partials);
+  return size;
+}
+
+/* Exponentially decaying noise with an absolute sum of one, so repeated convolution can't grow the signal */
+FSampleBuffer *create_impulse(size_t length)
+{
+  size_t idx;
+  double sum = 0;
+  FSampleBuffer *ir = fs_create_sample_buffer_raw(44100, length);
+  if (ir == NULL) return NULL;
+  for (idx = 0; idx < length; ++idx) {
+    ir->samples[idx] = (rand() / (double)RAND_MAX - 0.5) * exp(-6.9 * idx / length);
+    sum += fabs(ir->samples[idx]);
+  }
+  fs_scale_samples(ir, 1 / sum);
+  return ir;
+}
+
+size_t bench_convolve(size_t size, int arg)
+{
+  FSampleBuffer *ir = create_impulse(arg);
+  FSampleBuffer *pout = fs_clone_sample_buffer(bench_buffer);
+  fs_convolve_buffer(pout, ir, 1);
+  size = (pout != NULL) ? pout->sample_count : 0;
+  fs_delete_sample_buffer(&pout);
+  fs_delete_sample_buffer(&ir);
+  return size;
+}
+
+size_t bench_convolve_stream(size_t size, int arg)
+{
+  size_t pos;
+  FSampleBuffer *ir = create_impulse(44100);
+  FSConvolver *conv = fs_create_convolver(ir, arg);
+  for (pos = 0; pos + arg <= size; pos += arg) {
+    fs_convolve_block(conv, &bench_buffer->samples[pos], &bench_buffer->samples[pos]);
+  }
+  fs_delete_convolver(&conv);
+  fs_delete_sample_buffer(&ir);
+  return pos;
+}
+
+size_t bench_attack_decay(size_t size, int arg)
+{
+  bench_buffer->hull_ptr = 0;
+  bench_buffer->hull_level = 0;
+  fs_attack_decay(bench_buffer, arg, fs_get_buffer_duration(bench_buffer), 1);
+  return size;
+}
+
+/* A stack of operators with integer ratios and feedback on the top one */
+void init_bench_patch(FSFMPatch *patch, size_t operators)
+{
+  size_t idx;
+  memset(patch, 0, sizeof(FSFMPatch));
+  patch->operator_count = operators;
+  for (idx = 0; idx < operators; ++idx) {
+    patch->operators[idx].ratio = idx + 1;
+    patch->operators[idx].level = 1;
+  }
+  patch->operators[operators - 1].feedback = 0.5;
+  fs_set_fm_algorithm(patch, FS_FM_STACK);
+}
+
+size_t bench_fm(size_t size, int arg)
+{
+  FSFMPatch patch;
+  init_bench_patch(&patch, arg);
+  fs_generate_fm(bench_buffer, &patch, 440, 1);
+  return size;
+}
+
+size_t bench_fixed_generate(size_t size, int arg)
+{
+  fs_generate_fixed_wave(bench_fixed[arg == FS_FIXED_Q31], FS_WAVE_SINE, 440, 1);
+  return size;
+}
+
+/* The argument carries the modulation type in the low bits and the fixed point format above */
+size_t bench_fixed_modulate(size_t size, int arg)
+{
+  int q31 = (arg >> 8) == FS_FIXED_Q31;
+  fs_modulate_fixed_buffer(bench_fixed[q31], bench_fixed_source[q31], arg & 0xff);
+  return size;
+}
+
+size_t bench_fixed_envelope(size_t size, int arg)
+{
+  FSEnvelope env;
+  memset(&env, 0, sizeof(env));
+  fs_add_envelope_segment(&env, FS_CURVE_LINEAR, fs_get_buffer_duration(bench_buffer) / 2, 1);
+  fs_add_envelope_segment(&env, FS_CURVE_LINEAR, fs_get_buffer_duration(bench_buffer) / 2, 0);
+  fs_apply_fixed_envelope(bench_fixed[arg == FS_FIXED_Q31], &env);
+  return size;
+}
+
+/* A frequency sweep up and down over the whole buffer, or a gain lane of unit levels
+ * which keeps the samples unchanged for the next runs */
+size_t bench_automation(size_t size, int arg)
+{
+  double duration = fs_get_buffer_duration(bench_buffer);
+  double top = (arg == FS_CURVE_EXP) ? 1760 : 1, low = (arg == FS_CURVE_EXP) ? 110 : 1;
+  FSAutomation *lane = fs_create_automation();
+  fs_add_automation_point(lane, 0, FS_CURVE_LINEAR, low);
+  fs_add_automation_point(lane, duration / 2, arg, top);
+  fs_add_automation_point(lane, duration, arg, low);
+  if (arg == FS_CURVE_EXP) {
+    fs_generate_automated_wave(bench_buffer, FS_WAVE_SINE, lane, NULL);
+  } else {
+    fs_apply_automation(bench_buffer, lane);
+  }
+  fs_delete_automation(&lane);
+  return size;
+}
+
+size_t bench_track_sequence(size_t size, int arg)
+{
+  FSFMPatch patch;
+  static const char notes[] = "C D E F G A H C5 H4 A G F E D C C";
+  uint16_t data[SEQ_NOTES];
+  size_t length = fs_parse_notes(notes, data, SEQ_NOTES);
+  FSTrackChannel channel;
+  memset(&channel, 0, sizeof(channel));
+  channel.func_type = arg;
+  channel.hull_curve = bench_hull;
+  if (arg == FS_WAVE_FM) {
+    init_bench_patch(&patch, 2);
+    channel.fm_patch = &patch;
+  }
+  fs_track_sequence(&channel, 0, data, length);
+  fs_delete_sample_buffer(&channel.output);
+  return bench_hull->sample_count * length;
+}
+
+size_t bench_wave_file(size_t size, int arg)
+{
+  fs_samples_to_wave_file(bench_buffer, bench_file, arg, 1);
+  return size;
+}
+
+const FBench benchmarks[] = {
+  { "generate/sine", bench_generate, FS_WAVE_SINE },
+  { "generate/cosine", bench_generate, FS_WAVE_COSINE },
+  { "generate/saw", bench_generate, FS_WAVE_SAW },
+  { "generate/triangle", bench_generate, FS_WAVE_TRIANGLE },
+  { "generate/rect", bench_generate, FS_WAVE_RECT },
+  { "generate/noise", bench_generate, FS_WAVE_NOISE },
+  { "modulate/add", bench_modulate, FS_MOD_ADD },
+  { "modulate/sub", bench_modulate, FS_MOD_SUB },
+  { "modulate/mult", bench_modulate, FS_MOD_MULT },
+  { "modulate/div", bench_modulate, FS_MOD_DIV },
+  { "modulate/square", bench_modulate, FS_MOD_SQUARE },
+  { "modulate/root", bench_modulate, FS_MOD_ROOT },
+  { "modulate/log", bench_modulate, FS_MOD_LOG },
+  { "modulate/log10", bench_modulate, FS_MOD_LOG10 },
+  { "normalize", bench_normalize, 0 },
+  { "convert/pcm8", bench_convert, WAVE_PCM_8BIT },
+  { "convert/pcm16", bench_convert, WAVE_PCM_16BIT },
+  { "convert/pcm24", bench_convert, WAVE_PCM_24BIT },
+  { "convert/pcm32", bench_convert, WAVE_PCM_32BIT },
+  { "convert/float32", bench_convert, WAVE_FLOAT_32BIT },
+  { "resample/48000", bench_resample, 48000 },
+  { "resample/22050", bench_resample, 22050 },
+  { "resample/44117", bench_resample, 44117 },
+  { "filter/biquad", bench_filter, (1 << 1) | FS_FILTER_BIQUAD },
+  { "filter/biquad_x4", bench_filter, (4 << 1) | FS_FILTER_BIQUAD },
+  { "filter/svf", bench_filter, (1 << 1) | FS_FILTER_SVF },
+  { "filter/svf_x4", bench_filter, (4 << 1) | FS_FILTER_SVF },
+  { "stereo/filter", bench_stereo_filter, 0 },
+  { "stereo/convert_pcm16", bench_stereo_convert, WAVE_PCM_16BIT },
+  { "fm/stack2", bench_fm, 2 },
+  { "fm/stack6", bench_fm, 6 },
+  { "fixed/sine_q15", bench_fixed_generate, FS_FIXED_Q15 },
+  { "fixed/sine_q31", bench_fixed_generate, FS_FIXED_Q31 },
+  { "fixed/add_q15", bench_fixed_modulate, (FS_FIXED_Q15 << 8) | FS_MOD_ADD },
+  { "fixed/add_q31", bench_fixed_modulate, (FS_FIXED_Q31 << 8) | FS_MOD_ADD },
+  { "fixed/mult_q15", bench_fixed_modulate, (FS_FIXED_Q15 << 8) | FS_MOD_MULT },
+  { "fixed/mult_q31", bench_fixed_modulate, (FS_FIXED_Q31 << 8) | FS_MOD_MULT },
+  { "fixed/envelope_q15", bench_fixed_envelope, FS_FIXED_Q15 },
+  { "fixed/envelope_q31", bench_fixed_envelope, FS_FIXED_Q31 },
+  { "partials/16", bench_partials, 16 },
+  { "partials/256", bench_partials, 256 },
+  { "convolve/ir_4096", bench_convolve, 4096 },
+  { "convolve/ir_1s", bench_convolve, 44100 },
+  { "convolve/stream_256", bench_convolve_stream, 256 },
+  { "automation/apply_linear", bench_automation, FS_CURVE_LINEAR },
+  { "automation/sweep_exp", bench_automation, FS_CURVE_EXP },
+  { "attack_decay/linear", bench_attack_decay, FS_CURVE_LINEAR },
+  { "attack_decay/tan", bench_attack_decay, FS_CURVE_TAN },
+  { "attack_decay/cubic", bench_attack_decay, FS_CURVE_CUBIC },
+  { "track_sequence/sine", bench_track_sequence, FS_WAVE_SINE },
+  { "track_sequence/fm", bench_track_sequence, FS_WAVE_FM },
+  { "wave_file/pcm16", bench_wave_file, WAVE_PCM_16BIT },
+  { "wave_file/pcm24", bench_wave_file, WAVE_PCM_24BIT },
+  { NULL, NULL, 0 }
+};
+
+int setup_buffers(size_t size)
+{
+  size_t idx;
+  bench_buffer = fs_create_sample_buffer_raw(44100, size);
+  bench_source = fs_create_sample_buffer_raw(44100, size);
+  bench_stereo = fs_create_multichannel_buffer(44100, size, 2);
+  /* The tone length is chosen so that the whole sequence has about the requested size */
+  bench_hull = fs_create_sample_buffer_raw(44100, MAX(1, size / SEQ_NOTES));
+  for (idx = 0; idx < 2; ++idx) {
+    bench_fixed[idx] = fs_create_fixed_buffer(44100, size, idx ? FS_FIXED_Q31 : FS_FIXED_Q15);
+    bench_fixed_source[idx] = fs_create_fixed_buffer(44100, size, idx ? FS_FIXED_Q31 : FS_FIXED_Q15);
+    if (bench_fixed[idx] == NULL || bench_fixed_source[idx] == NULL) {
+      return FS_ERROR;
+    }
+    fs_generate_fixed_wave(bench_fixed[idx], FS_WAVE_SINE, 440, 1);
+    /* A slow rectangle is a constant of minus one, repeated products keep their magnitude */
+    fs_generate_fixed_wave(bench_fixed_source[idx], FS_WAVE_RECT, 0.1, 1);
+  }
+  if (bench_buffer == NULL || bench_source == NULL || bench_hull == NULL || bench_stereo == NULL) {
+    return FS_ERROR;
+  }
+  fs_generate_wave_func(bench_buffer, FS_WAVE_SINE, 440, 1);
+  fs_generate_wave_func(bench_stereo, FS_WAVE_SINE, 440, 1);
+  /* A source of ones keeps the repeatedly modulated values finite and free of denormals */
+  for (idx = 0; idx < size; ++idx) {
+    bench_source->samples[idx] = 1;
+  }
+  fs_attack_decay(bench_hull, FS_CURVE_LINEAR, fs_get_buffer_duration(bench_hull) / 2, 1);
+  fs_release(bench_hull, FS_CURVE_LINEAR);
+  return FS_OK;
+}
+
+void cleanup_buffers(void)
+{
+  fs_delete_sample_buffer(&bench_buffer);
+  fs_delete_sample_buffer(&bench_source);
+  fs_delete_sample_buffer(&bench_hull);
+  fs_delete_sample_buffer(&bench_stereo);
+  fs_delete_fixed_buffer(&bench_fixed[0]);
+  fs_delete_fixed_buffer(&bench_fixed[1]);
+  fs_delete_fixed_buffer(&bench_fixed_source[0]);
+  fs_delete_fixed_buffer(&bench_fixed_source[1]);
+}
+
+void measure(const FBench *bench, size_t size, int runs, FBenchResult *result)
+{
+  int run;
+  size_t idx, calls;
+  double t0, t, sum = 0, sum_sq = 0;
+  FSStats before, after;
+  /* Every benchmark starts with the same content, e.g. the log modulation leaves only zeros behind */
+  fs_generate_wave_func(bench_buffer, FS_WAVE_SINE, 440, 1);
+  /* The first call warms up the caches and determines the work per call */
+  fs_get_stats(&before);
+  t0 = now();
+  result->samples = bench->func(size, bench->arg);
+  t = now() - t0;
+  fs_get_stats(&after);
+  result->bytes = after.bytes_moved - before.bytes_moved;
+  calls = (t > 0) ? (size_t)(MIN_RUN_TIME / t) + 1 : 1000;
+  result->min = 1e300;
+  for (run = 0; run < runs; ++run) {
+    t0 = now();
+    for (idx = 0; idx < calls; ++idx) {
+      bench->func(size, bench->arg);
+    }
+    t = (now() - t0) / calls;
+    sum += t;
+    sum_sq += t * t;
+    result->min = MIN(result->min, t);
+  }
+  result->mean = sum / runs;
+  result->stddev = (runs > 1) ? sqrt(MAX(0, (sum_sq - sum * sum / runs) / (runs - 1))) : 0;
+}
+
+void print_usage(const char *name)
+{
+  printf("usage: %s [-r runs] [-s samples]... [-f filter] [-o json_file] [-t temp_dir]\n", name);
+  printf("\t-r runs\t\tNumber of timed runs per benchmark (default 10)\n");
+  printf("\t-s samples\tBuffer size, can be given several times (default 4096, 65536, 1048576)\n");
+  printf("\t-f filter\tOnly runs the benchmarks which contain the given text\n");
+  printf("\t-o file\t\tWrites the results as JSON file\n");
+  printf("\t-t dir\t\tDirectory for the WAVE file benchmarks (default /tmp)\n");
+}
+
+int main(int argc, char **argv)
+{
+  int opt, runs = 10, first = 1;
+  size_t sizes[MAX_SIZES] = { 4096, 65536, 1048576 };
+  size_t size_count = 0, s;
+  const char *filter = NULL, *json_name = NULL, *temp_dir = "/tmp";
+  const FBench *bench;
+  FBenchResult result;
+  FILE *json = NULL;
+  while ((opt = getopt(argc, argv, "r:s:f:o:t:h")) != -1) {
+    switch (opt) {
+    case 'r':
+      runs = MAX(1, atoi(optarg));
+      break;
+    case 's':
+      if (size_count < MAX_SIZES) sizes[size_count++] = MAX(SEQ_NOTES, atol(optarg));
+      break;
+    case 'f':
+      filter = optarg;
+      break;
+    case 'o':
+      json_name = optarg;
+      break;
+    case 't':
+      temp_dir = optarg;
+      break;
+    default:
+      print_usage(argv[0]);
+      return (opt == 'h') ? 0 : 2;
+    }
+  }
+  if (size_count == 0) size_count = 3;
+  snprintf(bench_file, sizeof(bench_file), "%s/fsynth_bench_%d.wav", temp_dir, (int)getpid());
+  if (json_name != NULL) {
+    json = fopen(json_name, "w");
+    if (json == NULL) {
+      fprintf(stderr, "Can't open %s\n", json_name);
+      return 1;
+    }
+    fprintf(json, "{\n  \"version\": \"%s\",\n  \"compiler\": \"%s\",\n  \"sample_size\": %u,\n"
+      "  \"runs\": %d,\n  \"results\": [", FS_VERSION, __VERSION__, (unsigned int)sizeof(sample_t), runs);
+  }
+  printf("%-22s %9s %12s %10s %8s %12s %9s\n", "benchmark", "samples", "mean us", "min us", "stddev",
+    "Msamples/s", "GB/s");
+  for (s = 0; s < size_count; ++s) {
+    if (setup_buffers(sizes[s]) != FS_OK) {
+      fprintf(stderr, "Can't allocate buffers of %u samples\n", (unsigned int)sizes[s]);
+      return 1;
+    }
+    for (bench = benchmarks; bench->name != NULL; ++bench) {
+      if (filter != NULL && strstr(bench->name, filter) == NULL) continue;
+      measure(bench, sizes[s], runs, &result);
+      printf("%-22s %9u %12.2f %10.2f %7.1f%% %12.2f %9.3f\n", bench->name, (unsigned int)sizes[s],
+        result.mean * 1e6, result.min * 1e6, result.stddev * 100 / result.mean,
+        result.samples / result.mean * 1e-6, result.bytes / result.mean * 1e-9);
+      if (json != NULL) {
+        fprintf(json, "%s\n    { \"name\": \"%s\", \"samples\": %u, \"mean_ns\": %.1f, \"min_ns\": %.1f, "
+          "\"stddev_ns\": %.1f, \"samples_per_s\": %.1f, \"gb_per_s\": %.4f }", first ? "" : ",",
+          bench->name, (unsigned int)sizes[s], result.mean * 1e9, result.min * 1e9, result.stddev * 1e9,
+          result.samples / result.mean, result.bytes / result.mean * 1e-9);
+        first = 0;
+      }
+    }
+    cleanup_buffers();
+  }
+  unlink(bench_file);
+  if (json != NULL) {
+    fprintf(json, "\n  ]\n}\n");
+    fclose(json);
+  }
+  return 0;
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Automation lanes, breakpoint curves which are evaluated block by block
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <memory.h>
+#include <math.h>
+#include "fsynth.h"
+#include "trace.h"
+
+#define AUTOMATION_BLOCK       256   /* Levels which are rendered at once */
+#define AUTOMATION_MIN_POINTS  16
+
+int wave_func_intern(sample_t *out, int func_type, double phase, double amp);
+
+typedef struct {
+  double time;
+  int curve_type;       /* Curve from the previous breakpoint to this one */
+  double level;
+} AutomationPoint;
+
+struct FSAutomation {
+  AutomationPoint *points;
+  size_t count;
+  size_t capacity;
+};
+
+/* Level of a segment at the progress t from 0 to 1 */
+double curve_level(int curve_type, double from, double to, double t)
+{
+  switch (curve_type) {
+  case FS_CURVE_LINEAR: return from + (to - from) * t;
+  case FS_CURVE_SQUARE: return from + (to - from) * t * t;
+  case FS_CURVE_CUBIC: return from + (to - from) * t * t * t;
+  case FS_CURVE_TAN: return from + (to - from) * tan(t * M_PI / 4.);
+  case FS_CURVE_EXP: return from * pow(to / from, t);
+  default: return from;
+  }
+}
+
+uint64_t point_position(const AutomationPoint *point, uint32_t sample_rate)
+{
+  return (uint64_t)llround(point->time * sample_rate);
+}
+
+FSAutomation *fs_create_automation(void)
+{
+  FSAutomation *lane;
+  fs_clear_error();
+  lane = (FSAutomation*) malloc(sizeof(FSAutomation));
+  if (lane == NULL) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  memset(lane, 0, sizeof(FSAutomation));
+  return lane;
+}
+
+void fs_delete_automation(FSAutomation **lane)
+{
+  if (lane != NULL && (*lane) != NULL) {
+    free((*lane)->points);
+    free(*lane);
+    *lane = NULL;
+  }
+}
+
+int fs_add_automation_point(FSAutomation *lane, double time, int curve_type, double level)
+{
+  size_t capacity;
+  AutomationPoint *points, *last;
+  fs_clear_error();
+  if (lane == NULL || !(time >= 0) || curve_type < FS_CURVE_LINEAR || curve_type > FS_CURVE_EXP) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  last = (lane->count > 0) ? &lane->points[lane->count - 1] : NULL;
+  if (last != NULL && (time < last->time || (curve_type == FS_CURVE_EXP && !(last->level * level > 0)))) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  if (lane->count == lane->capacity) {
+    capacity = MAX(AUTOMATION_MIN_POINTS, lane->capacity * 2);
+    points = (AutomationPoint*) realloc(lane->points, sizeof(AutomationPoint) * capacity);
+    if (points == NULL) {
+      fs_set_error(FS_OUT_OF_MEMORY);
+      return fs_get_error();
+    }
+    lane->points = points;
+    lane->capacity = capacity;
+  }
+  lane->points[lane->count].time = time;
+  lane->points[lane->count].curve_type = curve_type;
+  lane->points[lane->count].level = level;
+  ++lane->count;
+  return fs_get_error();
+}
+
+double fs_get_automation_level(const FSAutomation *lane, double time)
+{
+  size_t low, high, mid;
+  const AutomationPoint *a, *b;
+  if (lane == NULL || lane->count == 0) return 0;
+  if (time <= lane->points[0].time) return lane->points[0].level;
+  if (time >= lane->points[lane->count - 1].time) return lane->points[lane->count - 1].level;
+  /* First breakpoint after the time, the one before it starts the segment */
+  low = 1;
+  high = lane->count - 1;
+  while (low < high) {
+    mid = (low + high) / 2;
+    if (lane->points[mid].time > time) high = mid;
+    else low = mid + 1;
+  }
+  a = &lane->points[low - 1];
+  b = &lane->points[low];
+  return curve_level(b->curve_type, a->level, b->level, (time - a->time) / (b->time - a->time));
+}
+
+double fs_get_automation_duration(const FSAutomation *lane)
+{
+  return (lane != NULL && lane->count > 0) ? lane->points[lane->count - 1].time : 0;
+}
+
+void fs_automation_start(FSAutomationState *state, const FSAutomation *lane, uint32_t sample_rate)
+{
+  memset(state, 0, sizeof(FSAutomationState));
+  state->lane = lane;
+  state->sample_rate = sample_rate;
+}
+
+void fs_automation_seek(FSAutomationState *state, uint64_t position)
+{
+  /* The segment is looked up again by the next render call */
+  state->position = position;
+  state->end = position;
+  state->point = 0;
+}
+
+/* Sets up the segment which contains the current position */
+void automation_segment_begin(FSAutomationState *state)
+{
+  uint64_t start;
+  const FSAutomation *lane = state->lane;
+  const AutomationPoint *points = (lane != NULL) ? lane->points : NULL;
+  size_t count = (lane != NULL) ? lane->count : 0;
+  while (state->point < count && point_position(&points[state->point], state->sample_rate) <= state->position) {
+    ++state->point;
+  }
+  state->curve_type = FS_CURVE_HOLD;
+  state->end = UINT64_MAX;
+  if (count == 0) {
+    state->from = state->to = 0;
+  } else if (state->point == 0) {
+    state->from = state->to = points[0].level;
+    state->end = point_position(&points[0], state->sample_rate);
+  } else if (state->point == count) {
+    state->from = state->to = points[count - 1].level;
+  } else {
+    start = point_position(&points[state->point - 1], state->sample_rate);
+    state->end = point_position(&points[state->point], state->sample_rate);
+    state->curve_type = points[state->point].curve_type;
+    state->from = points[state->point - 1].level;
+    state->to = points[state->point].level;
+    state->step = 1. / (state->end - start);
+    state->x = (state->position - start) * state->step;
+    if (state->curve_type == FS_CURVE_EXP) {
+      state->value = curve_level(FS_CURVE_EXP, state->from, state->to, state->x);
+      state->factor = pow(state->to / state->from, state->step);
+    } else if (state->curve_type == FS_CURVE_TAN) {
+      state->tan_value = tan(state->x * M_PI / 4.);
+      state->tan_step = tan(state->step * M_PI / 4.);
+    }
+  }
+}
+
+/* Writes the next count levels of the current segment, count must not exceed its end */
+void automation_segment_run(FSAutomationState *state, sample_t *out, size_t count)
+{
+  size_t idx;
+  double x = state->x, t = state->tan_value, v = state->value;
+  double from = state->from, diff = state->to - state->from;
+  switch (state->curve_type) {
+  case FS_CURVE_LINEAR:
+    for (idx = 0; idx < count; ++idx, x += state->step) out[idx] = from + diff * x;
+    break;
+  case FS_CURVE_SQUARE:
+    for (idx = 0; idx < count; ++idx, x += state->step) out[idx] = from + diff * x * x;
+    break;
+  case FS_CURVE_CUBIC:
+    for (idx = 0; idx < count; ++idx, x += state->step) out[idx] = from + diff * x * x * x;
+    break;
+  case FS_CURVE_TAN:
+    /* tan(a + b) = (tan(a) + tan(b)) / (1 - tan(a) * tan(b)) */
+    for (idx = 0; idx < count; ++idx) {
+      out[idx] = from + diff * t;
+      t = (t + state->tan_step) / (1 - t * state->tan_step);
+    }
+    x += state->step * count;
+    break;
+  case FS_CURVE_EXP:
+    for (idx = 0; idx < count; ++idx, v *= state->factor) out[idx] = v;
+    x += state->step * count;
+    break;
+  default:
+    for (idx = 0; idx < count; ++idx) out[idx] = from;
+    break;
+  }
+  state->x = x;
+  state->tan_value = t;
+  state->value = v;
+  state->position += count;
+}
+
+void fs_automation_render(FSAutomationState *state, sample_t *out, size_t count)
+{
+  size_t n;
+  while (count > 0) {
+    if (state->position >= state->end) {
+      automation_segment_begin(state);
+      continue;
+    }
+    n = (size_t)MIN((uint64_t)count, state->end - state->position);
+    automation_segment_run(state, out, n);
+    out += n;
+    count -= n;
+  }
+}
+
+int fs_apply_automation(FSampleBuffer *buffer, const FSAutomation *lane)
+{
+  size_t pos, idx, n;
+  unsigned int ch;
+  sample_t *samples, levels[AUTOMATION_BLOCK];
+  FSAutomationState state;
+  fs_clear_error();
+  if (INVALID_BUFFER(buffer) || lane == NULL) {
+    fs_set_error(INVALID_BUFFER(buffer) ? FS_INVALID_BUFFER : FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  if (fs_unshare_samples(buffer, 1) != FS_OK) {
+    return fs_get_error();
+  }
+  fs_automation_start(&state, lane, buffer->sample_rate);
+  FS_TRACE_KERNEL("fs_apply_automation", FS_TOTAL_SAMPLES(buffer));
+  for (pos = 0; pos < buffer->sample_count; pos += n) {
+    n = MIN(AUTOMATION_BLOCK, buffer->sample_count - pos);
+    fs_automation_render(&state, levels, n);
+    for (ch = 0; ch < buffer->channels; ++ch) {
+      samples = &FS_CHANNEL(buffer, ch)[pos];
+      for (idx = 0; idx < n; ++idx) {
+        samples[idx] *= levels[idx];
+      }
+    }
+  }
+  fs_add_stats(FS_TOTAL_SAMPLES(buffer), buffer->buffer_size * 2);
+  FS_TRACE_END();
+  return fs_get_error();
+}
+
+int fs_generate_automated_wave(FSampleBuffer *buffer, int func_type, const FSAutomation *freq, const FSAutomation *amp)
+{
+  size_t pos, idx, n;
+  double scale, phase = 0;
+  sample_t *out, freqs[AUTOMATION_BLOCK], amps[AUTOMATION_BLOCK];
+  FSAutomationState freq_state, amp_state;
+  fs_clear_error();
+  if (INVALID_BUFFER(buffer)) {
+    fs_set_error(FS_INVALID_BUFFER);
+    return fs_get_error();
+  }
+  if (func_type < FS_WAVE_SINE || func_type > FS_WAVE_NOISE || freq == NULL) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  if (fs_unshare_samples(buffer, 0) != FS_OK) {
+    return fs_get_error();
+  }
+  fs_automation_start(&freq_state, freq, buffer->sample_rate);
+  fs_automation_start(&amp_state, amp, buffer->sample_rate);
+  scale = M_PI * 2. / buffer->sample_rate;
+  out = buffer->samples;
+  FS_TRACE_KERNEL("fs_generate_automated_wave", buffer->sample_count);
+  for (pos = 0; pos < buffer->sample_count; pos += n) {
+    n = MIN(AUTOMATION_BLOCK, buffer->sample_count - pos);
+    fs_automation_render(&freq_state, freqs, n);
+    if (amp != NULL) fs_automation_render(&amp_state, amps, n);
+    for (idx = 0; idx < n; ++idx) {
+      wave_func_intern(&out[pos + idx], func_type, phase, 1);
+      if (amp != NULL) out[pos + idx] *= amps[idx];
+      phase += scale * freqs[idx];
+      if (phase >= M_PI * 2. || phase <= -M_PI * 2.) phase = fmod(phase, M_PI * 2.);
+    }
+  }
+  fs_spread_channel(buffer);
+  fs_add_stats(buffer->sample_count, sizeof(sample_t) * buffer->sample_count);
+  FS_TRACE_END();
+  return fs_get_error();
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Batch rendering of independent scripts on a pool of worker threads
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "buffers.h"
+#include "logging.h"
+#include "memo.h"
+#include "trace.h"
+
+int shell_run_script(const char *fname);
+
+__thread int batch_worker_flag = 0;
+
+struct BatchJob {
+  char *script;
+  int result;
+  double time;            /* Wall time of the job in seconds */
+  FSStats stats;          /* Kernel statistics of the job, collected by its worker thread */
+};
+
+struct BatchRun {
+  struct BatchJob *jobs;
+  size_t count;
+  atomic_size_t next;     /* Index of the next job which isn't taken by a worker */
+};
+
+double elapsed_seconds(const struct timespec *start, const struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+int batch_worker_thread(void)
+{
+  return batch_worker_flag;
+}
+
+void *batch_worker(void *arg)
+{
+  struct BatchRun *run = (struct BatchRun*) arg;
+  struct BatchJob *job;
+  struct timespec t_start, t_end;
+  size_t idx;
+  batch_worker_flag = 1;
+  trace_thread_name("batch worker");
+  while ((idx = atomic_fetch_add(&run->next, 1)) < run->count) {
+    job = &run->jobs[idx];
+    /* The buffers and statistics of the worker are thread local, every job starts with empty ones */
+    fs_reset_stats();
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    job->result = shell_run_script(job->script);
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    job->time = elapsed_seconds(&t_start, &t_end);
+    fs_get_stats(&job->stats);
+    delete_buffers();
+    memo_enable(0, 0);
+    fs_reset_stats();
+  }
+  trace_thread_exit();
+  return NULL;
+}
+
+/* Reads the script names, one per line, empty lines and comments starting with '#' are skipped */
+int read_jobs(const char *job_file, struct BatchRun *run)
+{
+  FILE *fin;
+  char *line = NULL, *p, *end;
+  size_t line_size = 0, capacity = 0;
+  struct BatchJob *jobs;
+  int result = FS_OK;
+  fin = (strcmp(job_file, "-") == 0) ? stdin : fopen(job_file, "r");
+  if (fin == NULL) {
+    FS_LOG_ERR("Can't open job file: %s", job_file);
+    return FS_ERROR | FS_FILE_IO_ERROR;
+  }
+  while (getline(&line, &line_size, fin) >= 0) {
+    for (p = line; *p == ' ' || *p == '\t'; ++p);
+    end = p + strlen(p);
+    while (end > p && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) {
+      *--end = 0;
+    }
+    if (*p == 0 || *p == '#') continue;
+    if (run->count == capacity) {
+      capacity = (capacity > 0) ? capacity * 2 : 16;
+      jobs = (struct BatchJob*) realloc(run->jobs, sizeof(struct BatchJob) * capacity);
+      if (jobs == NULL) {
+        result = FS_ERROR | FS_OUT_OF_MEMORY;
+        break;
+      }
+      run->jobs = jobs;
+    }
+    memset(&run->jobs[run->count], 0, sizeof(struct BatchJob));
+    run->jobs[run->count].script = strdup(p);
+    if (run->jobs[run->count].script == NULL) {
+      result = FS_ERROR | FS_OUT_OF_MEMORY;
+      break;
+    }
+    ++run->count;
+  }
+  free(line);
+  if (fin != stdin) {
+    fclose(fin);
+  }
+  return result;
+}
+
+void print_batch_report(FILE *out, const struct BatchRun *run, int threads, double wall_time)
+{
+  size_t idx, failed = 0;
+  double job_time = 0;
+  const struct BatchJob *job;
+  fprintf(out, "%5s %-7s %10s %14s %14s  %s\n", "job", "status", "time [s]", "samples", "peak bytes", "script");
+  for (idx = 0; idx < run->count; ++idx) {
+    job = &run->jobs[idx];
+    if (FAILED(job->result)) ++failed;
+    job_time += job->time;
+    fprintf(out, "%5u %-7s %10.3f %14llu %14llu  %s\n", (unsigned int)(idx + 1),
+      FAILED(job->result) ? "failed" : "ok", job->time,
+      (unsigned long long)job->stats.samples_processed, (unsigned long long)job->stats.bytes_peak, job->script);
+  }
+  fprintf(out, "\n%u jobs, %u ok, %u failed on %d threads\n", (unsigned int)run->count,
+    (unsigned int)(run->count - failed), (unsigned int)failed, threads);
+  fprintf(out, "wall time %.3f s, job time %.3f s, speedup %.2f\n", wall_time, job_time,
+    (wall_time > 0) ? job_time / wall_time : 0.0);
+}
+
+/* Runs every script of the job file, each job has its own buffer namespace and the results
+ * are reported in job order when all are finished */
+int run_batch(const char *job_file, int threads)
+{
+  int idx, started = 0, result = FS_OK;
+  size_t jdx;
+  pthread_t *workers;
+  struct timespec t_start, t_end;
+  struct BatchRun run;
+  memset(&run, 0, sizeof(struct BatchRun));
+  atomic_init(&run.next, 0);
+  result = read_jobs(job_file, &run);
+  if (FAILED(result)) {
+    FS_LOG_ERR("Can't read the jobs from: %s", job_file);
+  } else if (run.count == 0) {
+    FS_LOG_WARN("No jobs in: %s", job_file);
+  }
+  if (threads <= 0) {
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  threads = (int)MIN((size_t)MAX(threads, 1), MAX(run.count, 1));
+  workers = (pthread_t*) malloc(sizeof(pthread_t) * threads);
+  if (workers == NULL) {
+    result = FS_ERROR | FS_OUT_OF_MEMORY;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t_start);
+  for (idx = 0; !FAILED(result) && idx < threads; ++idx) {
+    if (pthread_create(&workers[idx], NULL, batch_worker, &run) != 0) {
+      FS_LOG_ERR("Can't start batch worker %d", idx);
+      break;
+    }
+    ++started;
+  }
+  if (!FAILED(result) && started == 0 && run.count > 0) {
+    result = FS_ERROR;
+  }
+  for (idx = 0; idx < started; ++idx) {
+    pthread_join(workers[idx], NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t_end);
+  if (!FAILED(result)) {
+    print_batch_report(stderr, &run, started, elapsed_seconds(&t_start, &t_end));
+    for (jdx = 0; jdx < run.count; ++jdx) {
+      if (FAILED(run.jobs[jdx].result)) result = FS_ERROR;
+    }
+  }
+  for (jdx = 0; jdx < run.count; ++jdx) {
+    free(run.jobs[jdx].script);
+  }
+  free(run.jobs);
+  free(workers);
+  return result;
+}
@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Batch rendering of independent scripts on a pool of worker threads
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+int run_batch(const char *job_file, int threads);
+
+/* Non zero within a batch worker, whose jobs must not change settings of the whole process */
+int batch_worker_thread(void);
+
+#endif /* _BATCH_H_ */
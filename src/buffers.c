@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Named sample buffers of the shell with memory accounting and a memory budget
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "buffers.h"
+#include "hashmap.h"
+#include "logging.h"
+#include "memo.h"
+
+struct ShellBuffer {
+  const char *name;         /* Interned key within the buffer table */
+  FSampleBuffer *sb;        /* NULL while the samples are spilled */
+  uint64_t last_use;        /* Number of the command which used the buffer last */
+  size_t peak_size;         /* Largest size of the samples */
+  char *spill_name;         /* Temporary file which holds the samples of a spilled buffer */
+  FSampleBuffer spilled;    /* Properties of a spilled buffer, without samples */
+  uint64_t version;         /* Hash of the commands which produced the samples, 0 if unknown */
+  struct MemoSnapshot *snapshot;  /* Memoized samples which are copied on the next access */
+};
+
+/* Each thread has its own buffer namespace and budget, so batch jobs can't see each other */
+__thread struct HashMap sb_map = HMAP_INITIALIZER; /* Sample buffer table */
+__thread uint64_t use_clock = 0;
+__thread size_t memory_budget = 0;                 /* Limit of all resident buffers, 0 for no limit */
+__thread int budget_policy = BUDGET_SPILL;
+__thread uint64_t evictions = 0;
+
+void touch_buffer(struct ShellBuffer *entry)
+{
+  entry->last_use = use_clock;
+  entry->peak_size = MAX(entry->peak_size, entry->sb->buffer_size);
+}
+
+void remove_spill_file(struct ShellBuffer *entry)
+{
+  if (entry->spill_name != NULL) {
+    unlink(entry->spill_name);
+    free(entry->spill_name);
+    entry->spill_name = NULL;
+  }
+}
+
+void release_snapshot(struct ShellBuffer *entry)
+{
+  if (entry->snapshot != NULL) {
+    memo_release(entry->snapshot);
+    entry->snapshot = NULL;
+  }
+}
+
+void delete_shell_buffer(struct ShellBuffer *entry)
+{
+  fs_delete_sample_buffer(&entry->sb);
+  remove_spill_file(entry);
+  release_snapshot(entry);
+  free(entry);
+}
+
+/* Samples of the buffer wherever they are, the properties only for a spilled one */
+const FSampleBuffer *buffer_samples(const struct ShellBuffer *entry)
+{
+  if (entry->sb != NULL) return entry->sb;
+  return (entry->snapshot != NULL) ? entry->snapshot->sb : &entry->spilled;
+}
+
+/* Stores a buffer under the given name, a buffer with the same name is replaced and deleted */
+int register_buffer(const char *name, FSampleBuffer *sb)
+{
+  struct ShellBuffer *entry;
+  struct HashEntry *sbEntry = hmap_find(&sb_map, name);
+  if (sbEntry != NULL) {
+    entry = (struct ShellBuffer*) sbEntry->value;
+    if (entry->sb != sb) {
+      fs_delete_sample_buffer(&entry->sb);
+    }
+    remove_spill_file(entry);
+    release_snapshot(entry);
+    entry->sb = sb;
+    entry->peak_size = 0;
+    entry->version = 0;
+    touch_buffer(entry);
+    return FS_OK;
+  }
+  entry = (struct ShellBuffer*) calloc(1, sizeof(struct ShellBuffer));
+  if (entry == NULL || (sbEntry = hmap_put(&sb_map, name, entry)) == NULL) {
+    FS_LOG_ERR("Can't register buffer: %s", name);
+    free(entry);
+    fs_delete_sample_buffer(&sb);
+    return FS_ERROR;
+  }
+  entry->name = sbEntry->key;
+  entry->sb = sb;
+  touch_buffer(entry);
+  return FS_OK;
+}
+
+int write_all(int fd, const void *data, size_t size)
+{
+  ssize_t result;
+  const char *p = (const char*) data;
+  while (size > 0) {
+    result = write(fd, p, size);
+    if (result < 0) {
+      if (errno == EINTR) continue;
+      return FS_ERROR;
+    }
+    p += result;
+    size -= result;
+  }
+  return FS_OK;
+}
+
+int read_all(int fd, void *data, size_t size)
+{
+  ssize_t result;
+  char *p = (char*) data;
+  while (size > 0) {
+    result = read(fd, p, size);
+    if (result <= 0) {
+      if (result < 0 && errno == EINTR) continue;
+      return FS_ERROR;
+    }
+    p += result;
+    size -= result;
+  }
+  return FS_OK;
+}
+
+int spill_buffer(struct ShellBuffer *entry)
+{
+  int fd;
+  char path[PATH_MAX];
+  const char *dir = getenv("TMPDIR");
+  snprintf(path, sizeof(path), "%s/fsynth_spill_XXXXXX", (dir != NULL) ? dir : "/tmp");
+  fd = mkstemp(path);
+  if (fd < 0) return FS_ERROR;
+  if (write_all(fd, entry->sb->samples, entry->sb->buffer_size) != FS_OK || close(fd) != 0) {
+    unlink(path);
+    return FS_ERROR;
+  }
+  entry->spill_name = strdup(path);
+  if (entry->spill_name == NULL) {
+    unlink(path);
+    return FS_ERROR;
+  }
+  entry->spilled = *entry->sb;
+  entry->spilled.samples = NULL;
+  entry->spilled.map_addr = NULL;
+  entry->spilled.refs = NULL;
+  fs_delete_sample_buffer(&entry->sb);
+  return FS_OK;
+}
+
+int reload_buffer(struct ShellBuffer *entry)
+{
+  int fd, result;
+  FSampleBuffer *sb = fs_create_sample_buffer_prop(&entry->spilled);
+  if (sb == NULL) return FS_ERROR;
+  fd = open(entry->spill_name, O_RDONLY);
+  result = (fd >= 0) ? read_all(fd, sb->samples, sb->buffer_size) : FS_ERROR;
+  if (fd >= 0) close(fd);
+  if (result != FS_OK) {
+    fs_delete_sample_buffer(&sb);
+    return FS_ERROR;
+  }
+  sb->hull_ptr = entry->spilled.hull_ptr;
+  sb->hull_level = entry->spilled.hull_level;
+  remove_spill_file(entry);
+  entry->sb = sb;
+  FS_LOG_DEBUG("Buffer reloaded: %s", entry->name);
+  return FS_OK;
+}
+
+/* Copies the memoized samples, the command which accesses the buffer may change them */
+int restore_snapshot(struct ShellBuffer *entry)
+{
+  FSampleBuffer *sb = fs_clone_sample_buffer(entry->snapshot->sb);
+  if (sb == NULL) return FS_ERROR;
+  release_snapshot(entry);
+  entry->sb = sb;
+  return FS_OK;
+}
+
+FSampleBuffer *get_buffer_by_name(const char *name)
+{
+  struct ShellBuffer *entry = (struct ShellBuffer*) hmap_get(&sb_map, name);
+  if (entry == NULL) {
+    FS_LOG_ERR("Unknown buffer identifier: %s", name);
+    return NULL;
+  }
+  if (entry->snapshot != NULL && restore_snapshot(entry) != FS_OK) {
+    FS_LOG_ERR("Can't restore memoized buffer: %s", name);
+    return NULL;
+  }
+  if (entry->sb == NULL && reload_buffer(entry) != FS_OK) {
+    FS_LOG_ERR("Can't reload spilled buffer: %s", name);
+    return NULL;
+  }
+  touch_buffer(entry);
+  return entry->sb;
+}
+
+int get_buffer_version(const char *name, uint64_t *version)
+{
+  struct ShellBuffer *entry = (struct ShellBuffer*) hmap_get(&sb_map, name);
+  if (entry == NULL) return FS_ERROR;
+  *version = entry->version;
+  return FS_OK;
+}
+
+void set_buffer_version(const char *name, uint64_t version)
+{
+  struct ShellBuffer *entry = (struct ShellBuffer*) hmap_get(&sb_map, name);
+  if (entry != NULL) {
+    entry->version = version;
+  }
+}
+
+/* Lets the buffer refer to memoized samples instead of computing them, they are
+ * only copied if a later command accesses the buffer */
+int attach_snapshot(const char *name, struct MemoSnapshot *snapshot, uint64_t version)
+{
+  struct HashEntry *sbEntry = hmap_find(&sb_map, name);
+  struct ShellBuffer *entry;
+  if (sbEntry != NULL) {
+    entry = (struct ShellBuffer*) sbEntry->value;
+    fs_delete_sample_buffer(&entry->sb);
+    remove_spill_file(entry);
+    release_snapshot(entry);
+  } else {
+    entry = (struct ShellBuffer*) calloc(1, sizeof(struct ShellBuffer));
+    if (entry == NULL || (sbEntry = hmap_put(&sb_map, name, entry)) == NULL) {
+      FS_LOG_ERR("Can't register buffer: %s", name);
+      free(entry);
+      return FS_ERROR;
+    }
+    entry->name = sbEntry->key;
+  }
+  ++snapshot->refs;
+  entry->snapshot = snapshot;
+  entry->version = version;
+  entry->last_use = use_clock;
+  entry->peak_size = MAX(entry->peak_size, snapshot->sb->buffer_size);
+  return FS_OK;
+}
+
+int free_buffer(const char *name)
+{
+  struct ShellBuffer *entry = (struct ShellBuffer*) hmap_get(&sb_map, name);
+  if (entry == NULL) {
+    return FS_ERROR;
+  }
+  hmap_remove(&sb_map, name);
+  delete_shell_buffer(entry);
+  return FS_OK;
+}
+
+void delete_buffers(void)
+{
+  size_t iter = 0;
+  struct HashEntry *entry;
+  while ((entry = hmap_next(&sb_map, &iter)) != NULL) {
+    delete_shell_buffer((struct ShellBuffer*) entry->value);
+  }
+  hmap_free(&sb_map);
+  memory_budget = 0;
+  budget_policy = BUDGET_SPILL;
+  evictions = 0;
+}
+
+/* Starts a new command, buffers used by it are not evicted until the next one */
+void buffer_tick(void)
+{
+  ++use_clock;
+}
+
+void set_memory_budget(size_t bytes, int policy)
+{
+  memory_budget = bytes;
+  budget_policy = policy;
+}
+
+/* Samples shared by clones count once, each clone takes its part */
+size_t resident_size(const FSampleBuffer *sb)
+{
+  unsigned int refs = (sb->refs != NULL) ? __atomic_load_n(sb->refs, __ATOMIC_RELAXED) : 1;
+  return sb->buffer_size / MAX(refs, 1);
+}
+
+void enforce_memory_budget(void)
+{
+  size_t iter = 0, resident = 0;
+  struct HashEntry *entry;
+  struct ShellBuffer *sbe, *lru;
+  while ((entry = hmap_next(&sb_map, &iter)) != NULL) {
+    sbe = (struct ShellBuffer*) entry->value;
+    if (sbe->sb != NULL) {
+      /* Buffers may have grown during the last command */
+      sbe->peak_size = MAX(sbe->peak_size, sbe->sb->buffer_size);
+      if (sbe->sb->storage == FS_STORAGE_HEAP) resident += resident_size(sbe->sb);
+    }
+  }
+  while (memory_budget > 0 && resident > memory_budget) {
+    lru = NULL;
+    iter = 0;
+    while ((entry = hmap_next(&sb_map, &iter)) != NULL) {
+      sbe = (struct ShellBuffer*) entry->value;
+      /* File storage is paged out by the kernel itself */
+      if (sbe->sb != NULL && sbe->sb->storage == FS_STORAGE_HEAP && sbe->last_use < use_clock &&
+          (lru == NULL || sbe->last_use < lru->last_use)) {
+        lru = sbe;
+      }
+    }
+    if (lru == NULL) {
+      FS_LOG_WARN("Memory budget exceeded by the buffers of the last command");
+      break;
+    }
+    resident -= resident_size(lru->sb);
+    if (budget_policy == BUDGET_SPILL) {
+      if (spill_buffer(lru) != FS_OK) {
+        FS_LOG_ERR("Can't spill buffer: %s", lru->name);
+        break;
+      }
+      FS_LOG_DEBUG("Buffer spilled: %s", lru->name);
+    } else {
+      FS_LOG_WARN("Buffer dropped: %s", lru->name);
+      hmap_remove(&sb_map, lru->name);
+      delete_shell_buffer(lru);
+    }
+    ++evictions;
+  }
+}
+
+const char *buffer_state(const struct ShellBuffer *entry)
+{
+  if (entry->snapshot != NULL) return "memo";
+  if (entry->sb == NULL) return "spilled";
+  if (entry->sb->refs != NULL && *entry->sb->refs > 1) return "shared";
+  if (entry->sb->storage == FS_STORAGE_FILE) return "file";
+  return (entry->sb->map_addr != NULL) ? "mapped" : "resident";
+}
+
+int compare_buffer_names(const void *a, const void *b)
+{
+  return strcmp((*(const struct ShellBuffer**)a)->name, (*(const struct ShellBuffer**)b)->name);
+}
+
+void print_memory_usage(FILE *out)
+{
+  size_t iter = 0, idx, count = 0, resident = 0, spilled = 0, spill_count = 0, filed = 0, memo_count = 0;
+  struct HashEntry *entry;
+  struct ShellBuffer *sbe, **list;
+  const FSampleBuffer *samples;
+  FSStats stats;
+  list = (struct ShellBuffer**) malloc(sizeof(struct ShellBuffer*) * (sb_map.count + 1));
+  if (list == NULL) return;
+  while ((entry = hmap_next(&sb_map, &iter)) != NULL) {
+    list[count++] = (struct ShellBuffer*) entry->value;
+  }
+  qsort(list, count, sizeof(struct ShellBuffer*), compare_buffer_names);
+  fprintf(out, "%-16s %12s %14s %14s %-9s %6s\n", "buffer", "samples", "bytes", "peak", "state", "idle");
+  for (idx = 0; idx < count; ++idx) {
+    sbe = list[idx];
+    samples = buffer_samples(sbe);
+    if (sbe->snapshot != NULL) {
+      ++memo_count;
+    } else if (sbe->sb != NULL && sbe->sb->storage == FS_STORAGE_FILE) {
+      filed += resident_size(sbe->sb);
+    } else if (sbe->sb != NULL) {
+      resident += resident_size(sbe->sb);
+    } else {
+      spilled += sbe->spilled.buffer_size;
+      ++spill_count;
+    }
+    fprintf(out, "%-16s %12llu %14llu %14llu %-9s %6llu\n", sbe->name,
+      (unsigned long long)samples->sample_count, (unsigned long long)samples->buffer_size,
+      (unsigned long long)sbe->peak_size, buffer_state(sbe),
+      (unsigned long long)(use_clock - sbe->last_use));
+  }
+  free(list);
+  fs_get_stats(&stats);
+  fprintf(out, "\nbuffers:\t%llu byte resident, %llu byte in file storage, %u spilled with %llu byte, "
+    "%u in the memo cache\n", (unsigned long long)resident, (unsigned long long)filed,
+    (unsigned int)spill_count, (unsigned long long)spilled, (unsigned int)memo_count);
+  fprintf(out, "all samples:\t%llu byte live, %llu byte peak\n", (unsigned long long)stats.bytes_live,
+    (unsigned long long)stats.bytes_peak);
+  if (memory_budget > 0) {
+    fprintf(out, "budget:\t\t%llu byte, %s least recently used buffers, %llu evictions\n",
+      (unsigned long long)memory_budget, (budget_policy == BUDGET_SPILL) ? "spills" : "drops",
+      (unsigned long long)evictions);
+  } else {
+    fprintf(out, "budget:\t\tunlimited\n");
+  }
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Named sample buffers of the shell with memory accounting and a memory budget
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#ifndef _BUFFERS_H_
+#define _BUFFERS_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fsynth.h"
+
+/* What happens to the least recently used buffers if the budget is exceeded */
+#define BUDGET_SPILL   0  /* The samples are moved to a temporary file and loaded again on the next access */
+#define BUDGET_DROP    1  /* The buffer is deleted */
+
+struct MemoSnapshot;
+
+int register_buffer(const char *name, FSampleBuffer *sb);
+FSampleBuffer *get_buffer_by_name(const char *name);
+int get_buffer_version(const char *name, uint64_t *version);
+void set_buffer_version(const char *name, uint64_t version);
+int attach_snapshot(const char *name, struct MemoSnapshot *snapshot, uint64_t version);
+int free_buffer(const char *name);
+void delete_buffers(void);
+void buffer_tick(void);
+int write_all(int fd, const void *data, size_t size);
+int read_all(int fd, void *data, size_t size);
+void set_memory_budget(size_t bytes, int policy);
+void enforce_memory_budget(void);
+void print_memory_usage(FILE *out);
+
+#endif /* _BUFFERS_H_ */
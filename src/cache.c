@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Content addressed render cache on disk, shared by all threads and runs
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "buffers.h"
+#include "logging.h"
+
+#define CACHE_MAGIC           "FSCACHE"
+#define CACHE_FORMAT          2
+#define CACHE_EXTENSION       ".fsc"
+#define CACHE_DEFAULT_BUDGET  ((size_t)1024 * 1048576)
+#define CACHE_LOW_WATER       0.9   /* Eviction stops at this part of the budget */
+
+/* Every entry holds the samples of one buffer behind the header, so it can be mapped as buffer view */
+struct CacheHeader {
+  char magic[7];
+  uint8_t format;
+  uint32_t sample_size;   /* Size of sample_t of the build which wrote the entry */
+  uint32_t sample_rate;
+  uint64_t sample_count;
+  uint64_t hull_ptr;
+  double hull_level;
+  uint64_t key;
+  uint32_t channels;
+  uint32_t reserved[3];
+};
+
+struct CacheFile {
+  char name[32];
+  size_t size;
+  struct timespec mtime;
+};
+
+pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+atomic_int cache_active = 0;
+char *cache_dir = NULL;
+size_t cache_budget = CACHE_DEFAULT_BUDGET;
+FCacheStats cache_stats = { 0, 0, 0, 0, 0, 0 };  /* Guarded by cache_lock, bytes is tracked since the scan */
+
+int is_cache_file(const char *name)
+{
+  size_t length = strlen(name), ext = strlen(CACHE_EXTENSION);
+  return (name[0] != '.' && length > ext && strcmp(name + length - ext, CACHE_EXTENSION) == 0);
+}
+
+int compare_cache_files(const void *a, const void *b)
+{
+  const struct CacheFile *fa = (const struct CacheFile*) a, *fb = (const struct CacheFile*) b;
+  if (fa->mtime.tv_sec != fb->mtime.tv_sec) return (fa->mtime.tv_sec < fb->mtime.tv_sec) ? -1 : 1;
+  if (fa->mtime.tv_nsec != fb->mtime.tv_nsec) return (fa->mtime.tv_nsec < fb->mtime.tv_nsec) ? -1 : 1;
+  return 0;
+}
+
+/* Lists all entries of the cache directory, the caller holds the lock */
+struct CacheFile *scan_cache(size_t *count, size_t *bytes)
+{
+  DIR *dir;
+  struct dirent *de;
+  struct stat st;
+  struct CacheFile *files = NULL, *grown;
+  size_t capacity = 0;
+  char path[PATH_MAX];
+  *count = 0;
+  *bytes = 0;
+  dir = opendir(cache_dir);
+  if (dir == NULL) return NULL;
+  while ((de = readdir(dir)) != NULL) {
+    if (!is_cache_file(de->d_name) || strlen(de->d_name) >= sizeof(files->name)) continue;
+    snprintf(path, sizeof(path), "%s/%s", cache_dir, de->d_name);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+    if (*count == capacity) {
+      capacity = (capacity > 0) ? capacity * 2 : 64;
+      grown = (struct CacheFile*) realloc(files, sizeof(struct CacheFile) * capacity);
+      if (grown == NULL) break;
+      files = grown;
+    }
+    strcpy(files[*count].name, de->d_name);
+    files[*count].size = st.st_size;
+    files[*count].mtime = st.st_mtim;
+    *bytes += st.st_size;
+    ++*count;
+  }
+  closedir(dir);
+  return files;
+}
+
+/* Removes the least recently used entries until the cache fits into the budget again */
+void evict_cache_files(void)
+{
+  size_t idx, count, bytes;
+  char path[PATH_MAX];
+  struct CacheFile *files;
+  pthread_mutex_lock(&cache_lock);
+  if (cache_dir != NULL && cache_stats.bytes > cache_budget) {
+    files = scan_cache(&count, &bytes);
+    if (files != NULL) {
+      qsort(files, count, sizeof(struct CacheFile), compare_cache_files);
+      for (idx = 0; idx < count && bytes > cache_budget * CACHE_LOW_WATER; ++idx) {
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, files[idx].name);
+        if (unlink(path) == 0) {
+          bytes -= files[idx].size;
+          ++cache_stats.evictions;
+        }
+      }
+      free(files);
+    }
+    cache_stats.bytes = bytes;
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
+
+int cache_open(const char *dir, size_t budget)
+{
+  struct stat st;
+  size_t count;
+  struct CacheFile *files;
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) return FS_ERROR;
+  if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) return FS_ERROR;
+  pthread_mutex_lock(&cache_lock);
+  free(cache_dir);
+  cache_dir = strdup(dir);
+  if (budget > 0) {
+    cache_budget = budget;
+  }
+  if (cache_dir != NULL) {
+    files = scan_cache(&count, &cache_stats.bytes);
+    free(files);
+  }
+  atomic_store(&cache_active, cache_dir != NULL);
+  pthread_mutex_unlock(&cache_lock);
+  if (cache_dir == NULL) return FS_ERROR;
+  evict_cache_files();
+  return FS_OK;
+}
+
+void cache_close(void)
+{
+  pthread_mutex_lock(&cache_lock);
+  atomic_store(&cache_active, 0);
+  free(cache_dir);
+  cache_dir = NULL;
+  pthread_mutex_unlock(&cache_lock);
+}
+
+int cache_enabled(void)
+{
+  return atomic_load(&cache_active);
+}
+
+int cache_path(char *path, size_t size, uint64_t key)
+{
+  int result = FS_ERROR;
+  pthread_mutex_lock(&cache_lock);
+  if (cache_dir != NULL) {
+    snprintf(path, size, "%s/%016llx" CACHE_EXTENSION, cache_dir, (unsigned long long)key);
+    result = FS_OK;
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return result;
+}
+
+void count_lookup(int hit)
+{
+  pthread_mutex_lock(&cache_lock);
+  if (hit) {
+    ++cache_stats.hits;
+  } else {
+    ++cache_stats.misses;
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
+
+/* Maps an entry as private buffer view, the samples are read on demand and copied on write */
+FSampleBuffer *cache_load(uint64_t key)
+{
+  int fd;
+  struct stat st;
+  struct CacheHeader header;
+  FSampleBuffer *buffer;
+  void *addr;
+  char path[PATH_MAX];
+  if (cache_path(path, sizeof(path), key) != FS_OK) return NULL;
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    count_lookup(0);
+    return NULL;
+  }
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header) ||
+      pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+      memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 || header.format != CACHE_FORMAT ||
+      header.sample_size != sizeof(sample_t) || header.key != key ||
+      header.channels == 0 || header.channels > FS_MAX_CHANNELS ||
+      (uint64_t)st.st_size != sizeof(header) + header.sample_count * header.channels * sizeof(sample_t)) {
+    FS_LOG_WARN("Invalid cache entry: %s", path);
+    close(fd);
+    count_lookup(0);
+    return NULL;
+  }
+  buffer = (FSampleBuffer*) malloc(sizeof(FSampleBuffer));
+  addr = (buffer != NULL) ? mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  /* The modification time orders the entries for the eviction */
+  futimens(fd, NULL);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    free(buffer);
+    count_lookup(0);
+    return NULL;
+  }
+  madvise(addr, st.st_size, MADV_SEQUENTIAL);
+  memset(buffer, 0, sizeof(FSampleBuffer));
+  buffer->sample_rate = header.sample_rate;
+  buffer->sample_count = header.sample_count;
+  buffer->channels = header.channels;
+  buffer->buffer_size = sizeof(sample_t) * header.sample_count * header.channels;
+  buffer->hull_ptr = header.hull_ptr;
+  buffer->hull_level = header.hull_level;
+  buffer->samples = (sample_t*)((unsigned char*)addr + sizeof(header));
+  buffer->map_addr = addr;
+  buffer->map_size = st.st_size;
+  fs_add_live_bytes(buffer->buffer_size);
+  count_lookup(1);
+  return buffer;
+}
+
+/* Writes the entry under a temporary name first, so other threads and processes never map a part of it */
+int cache_store(uint64_t key, const FSampleBuffer *sb)
+{
+  int fd, result;
+  int over_budget;
+  char path[PATH_MAX], tmp_path[PATH_MAX];
+  struct CacheHeader header;
+  if (cache_path(path, sizeof(path), key) != FS_OK) return FS_ERROR;
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d.%lx.tmp", path, (int)getpid(),
+      (unsigned long)pthread_self()) >= (int)sizeof(tmp_path)) {
+    return FS_ERROR;
+  }
+  fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) return FS_ERROR;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.format = CACHE_FORMAT;
+  header.sample_size = sizeof(sample_t);
+  header.sample_rate = sb->sample_rate;
+  header.sample_count = sb->sample_count;
+  header.channels = sb->channels;
+  header.hull_ptr = sb->hull_ptr;
+  header.hull_level = sb->hull_level;
+  header.key = key;
+  result = write_all(fd, &header, sizeof(header));
+  if (result == FS_OK) result = write_all(fd, sb->samples, sb->buffer_size);
+  if (close(fd) != 0) result = FS_ERROR;
+  if (result != FS_OK || rename(tmp_path, path) != 0) {
+    unlink(tmp_path);
+    return FS_ERROR;
+  }
+  pthread_mutex_lock(&cache_lock);
+  cache_stats.bytes += sizeof(header) + sb->buffer_size;
+  ++cache_stats.stores;
+  over_budget = (cache_stats.bytes > cache_budget);
+  pthread_mutex_unlock(&cache_lock);
+  if (over_budget) {
+    evict_cache_files();
+  }
+  return FS_OK;
+}
+
+int cache_clear(void)
+{
+  size_t idx, count, bytes;
+  char path[PATH_MAX];
+  struct CacheFile *files;
+  pthread_mutex_lock(&cache_lock);
+  if (cache_dir == NULL) {
+    pthread_mutex_unlock(&cache_lock);
+    return FS_ERROR;
+  }
+  files = scan_cache(&count, &bytes);
+  for (idx = 0; idx < count; ++idx) {
+    snprintf(path, sizeof(path), "%s/%s", cache_dir, files[idx].name);
+    if (unlink(path) == 0) bytes -= files[idx].size;
+  }
+  free(files);
+  cache_stats.bytes = bytes;
+  pthread_mutex_unlock(&cache_lock);
+  return FS_OK;
+}
+
+void cache_get_stats(FCacheStats *stats)
+{
+  pthread_mutex_lock(&cache_lock);
+  *stats = cache_stats;
+  stats->budget = cache_budget;
+  pthread_mutex_unlock(&cache_lock);
+}
+
+void cache_print_stats(FILE *out)
+{
+  FCacheStats stats;
+  cache_get_stats(&stats);
+  pthread_mutex_lock(&cache_lock);
+  fprintf(out, "cache:\t\t%s\n", (cache_dir != NULL) ? cache_dir : "off");
+  pthread_mutex_unlock(&cache_lock);
+  fprintf(out, "size:\t\t%llu byte, budget %llu byte\n", (unsigned long long)stats.bytes,
+    (unsigned long long)stats.budget);
+  fprintf(out, "lookups:\t%llu hits, %llu misses, %llu stored, %llu evicted\n",
+    (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+    (unsigned long long)stats.stores, (unsigned long long)stats.evictions);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Content addressed render cache on disk, shared by all threads and runs
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "fsynth.h"
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t stores;
+  uint64_t evictions;
+  size_t bytes;         /* Size of all entries */
+  size_t budget;
+} FCacheStats;
+
+int cache_open(const char *dir, size_t budget);
+void cache_close(void);
+int cache_enabled(void);
+FSampleBuffer *cache_load(uint64_t key);
+int cache_store(uint64_t key, const FSampleBuffer *sb);
+int cache_clear(void);
+void cache_get_stats(FCacheStats *stats);
+void cache_print_stats(FILE *out);
+
+#endif /* _CACHE_H_ */
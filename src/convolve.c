@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Uniformly partitioned FFT convolution with impulse responses
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <memory.h>
+#include <math.h>
+
+#include "fsynth.h"
+#include "fft.h"
+#include "trace.h"
+
+#define CONVOLVE_MIN_BLOCK   64      /* Block size limits of fs_convolve_buffer */
+#define CONVOLVE_MAX_BLOCK   16384
+
+/* The impulse response is cut into partitions of one block, each one is transformed once. Every
+ * input block is transformed together with its predecessor (overlap-save), the spectra of the
+ * last blocks are kept in a delay line and multiplied with the partitions of the same age. */
+struct FSConvolver {
+  size_t block_size;
+  size_t partitions;
+  size_t bins;          /* block_size + 1 bins of the 2 * block_size transform */
+  size_t fdl_pos;       /* Slot of the newest spectrum within the delay line */
+  struct FFTPlan plan;
+  double *ir_re;        /* Spectra of the partitions, partitions * bins */
+  double *ir_im;
+  double *fdl_re;       /* Spectra of the recent input blocks, partitions * bins */
+  double *fdl_im;
+  double *acc_re;       /* Sum of the products, bins */
+  double *acc_im;
+  double *frame;        /* Previous and current input block */
+  double *result;       /* Inverse transform of the summed spectra */
+};
+
+size_t next_power_of_two(size_t value)
+{
+  size_t result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+FSConvolver *fs_create_convolver(const FSampleBuffer *ir, size_t block_size)
+{
+  size_t part, idx, count, spectra;
+  double *re, *im;
+  FSConvolver *conv;
+  fs_clear_error();
+  if (INVALID_BUFFER(ir) || ir->sample_count == 0 || block_size < 2 || (block_size & (block_size - 1)) != 0) {
+    fs_set_error((INVALID_BUFFER(ir) || ir->sample_count == 0) ? FS_INVALID_BUFFER : FS_INVALID_ARGUMENT);
+    return NULL;
+  }
+  conv = (FSConvolver*) calloc(1, sizeof(FSConvolver));
+  if (conv == NULL) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  conv->block_size = block_size;
+  conv->partitions = (ir->sample_count + block_size - 1) / block_size;
+  conv->bins = block_size + 1;
+  spectra = conv->partitions * conv->bins;
+  conv->ir_re = (double*) malloc(sizeof(double) * spectra * 2);
+  conv->fdl_re = (double*) calloc(spectra * 2, sizeof(double));
+  conv->acc_re = (double*) malloc(sizeof(double) * conv->bins * 2);
+  conv->frame = (double*) calloc(block_size * 4, sizeof(double));
+  if (fft_init(&conv->plan, block_size * 2) != FS_OK || conv->ir_re == NULL || conv->fdl_re == NULL ||
+      conv->acc_re == NULL || conv->frame == NULL) {
+    fs_delete_convolver(&conv);
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  conv->ir_im = conv->ir_re + spectra;
+  conv->fdl_im = conv->fdl_re + spectra;
+  conv->acc_im = conv->acc_re + conv->bins;
+  conv->result = conv->frame + block_size * 2;
+  FS_TRACE_KERNEL("fs_create_convolver", ir->sample_count);
+  for (part = 0; part < conv->partitions; ++part) {
+    /* Each partition is zero padded to the transform length */
+    count = MIN(block_size, ir->sample_count - part * block_size);
+    for (idx = 0; idx < count; ++idx) {
+      conv->frame[idx] = ir->samples[part * block_size + idx];
+    }
+    memset(&conv->frame[count], 0, sizeof(double) * (block_size * 2 - count));
+    re = &conv->ir_re[part * conv->bins];
+    im = &conv->ir_im[part * conv->bins];
+    fft_real_forward(&conv->plan, conv->frame, re, im);
+  }
+  memset(conv->frame, 0, sizeof(double) * block_size * 2);
+  fs_add_stats(ir->sample_count, ir->buffer_size);
+  FS_TRACE_END();
+  return conv;
+}
+
+void fs_delete_convolver(FSConvolver **conv)
+{
+  if (conv != NULL && *conv != NULL) {
+    fft_free(&(*conv)->plan);
+    free((*conv)->ir_re);
+    free((*conv)->fdl_re);
+    free((*conv)->acc_re);
+    free((*conv)->frame);
+    free(*conv);
+    *conv = NULL;
+  }
+}
+
+size_t fs_get_convolver_block_size(const FSConvolver *conv)
+{
+  return (conv != NULL) ? conv->block_size : 0;
+}
+
+void fs_reset_convolver(FSConvolver *conv)
+{
+  if (conv != NULL) {
+    memset(conv->fdl_re, 0, sizeof(double) * conv->partitions * conv->bins * 2);
+    memset(conv->frame, 0, sizeof(double) * conv->block_size * 2);
+    conv->fdl_pos = 0;
+  }
+}
+
+int fs_convolve_block(FSConvolver *conv, const sample_t *in, sample_t *out)
+{
+  size_t idx, part, slot, n;
+  double *frame;
+  fs_clear_error();
+  if (conv == NULL || in == NULL || out == NULL) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  n = conv->block_size;
+  frame = conv->frame;
+  memmove(frame, frame + n, sizeof(double) * n);
+  for (idx = 0; idx < n; ++idx) {
+    frame[n + idx] = in[idx];
+  }
+  conv->fdl_pos = (conv->fdl_pos + 1) % conv->partitions;
+  fft_real_forward(&conv->plan, frame, &conv->fdl_re[conv->fdl_pos * conv->bins],
+    &conv->fdl_im[conv->fdl_pos * conv->bins]);
+  memset(conv->acc_re, 0, sizeof(double) * conv->bins * 2);
+  for (part = 0; part < conv->partitions; ++part) {
+    /* The input of 'part' blocks ago meets the partition which starts 'part' blocks into the response */
+    slot = (conv->fdl_pos + conv->partitions - part) % conv->partitions;
+    fft_spectrum_mac(conv->acc_re, conv->acc_im, &conv->fdl_re[slot * conv->bins], &conv->fdl_im[slot * conv->bins],
+      &conv->ir_re[part * conv->bins], &conv->ir_im[part * conv->bins], conv->bins);
+  }
+  fft_real_inverse(&conv->plan, conv->acc_re, conv->acc_im, conv->result);
+  /* The first half is wrapped around by the circular convolution, the second one is valid */
+  for (idx = 0; idx < n; ++idx) {
+    out[idx] = conv->result[n + idx];
+  }
+  return fs_get_error();
+}
+
+int fs_convolve_buffer(FSampleBuffer *buffer, const FSampleBuffer *ir, double wet)
+{
+  size_t pos, idx, count, old_count, ir_count, block_size;
+  unsigned int ch, conv_count;
+  sample_t *block, *samples;
+  FSConvolver *conv[FS_MAX_CHANNELS];
+  FSampleBuffer view;
+  fs_clear_error();
+  if (INVALID_BUFFER(buffer) || INVALID_BUFFER(ir) || ir->sample_count == 0) {
+    fs_set_error(FS_INVALID_BUFFER);
+    return fs_get_error();
+  }
+  if (buffer->sample_rate != ir->sample_rate) {
+    fs_set_error(FS_DIFF_SAMPLE_RATE);
+    return fs_get_error();
+  }
+  if (ir->channels != 1 && ir->channels != buffer->channels) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  ir_count = ir->sample_count;
+  /* Offline the whole response fits into a few partitions, which keeps the spectral products cheap */
+  block_size = next_power_of_two(ir_count);
+  block_size = MIN(MAX(block_size, CONVOLVE_MIN_BLOCK), CONVOLVE_MAX_BLOCK);
+  /* A mono response is shared by all channels, otherwise each channel has its own */
+  conv_count = ir->channels;
+  memset(conv, 0, sizeof(conv));
+  for (ch = 0; ch < conv_count; ++ch) {
+    view = fs_channel_view(ir, ch);
+    if ((conv[ch] = fs_create_convolver(&view, block_size)) == NULL) break;
+  }
+  block = (sample_t*) malloc(sizeof(sample_t) * block_size * 2);
+  if (ch < conv_count || block == NULL) {
+    for (ch = 0; ch < conv_count; ++ch) fs_delete_convolver(&conv[ch]);
+    free(block);
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return fs_get_error();
+  }
+  /* The buffer grows by the reverb tail, which starts in silence. The response may be the buffer
+   * itself, its spectra are complete at this point. */
+  old_count = buffer->sample_count;
+  if (FAILED(fs_resize_sample_buffer(buffer, old_count + ir_count - 1))) {
+    for (ch = 0; ch < conv_count; ++ch) fs_delete_convolver(&conv[ch]);
+    free(block);
+    return fs_get_error();
+  }
+  FS_TRACE_KERNEL("fs_convolve_buffer", FS_TOTAL_SAMPLES(buffer));
+  for (ch = 0; ch < buffer->channels; ++ch) {
+    samples = FS_CHANNEL(buffer, ch);
+    memset(&samples[old_count], 0, sizeof(sample_t) * (ir_count - 1));
+    if (conv_count == 1 && ch > 0) fs_reset_convolver(conv[0]);
+    for (pos = 0; pos < buffer->sample_count; pos += block_size) {
+      count = MIN(block_size, buffer->sample_count - pos);
+      memcpy(block, &samples[pos], sizeof(sample_t) * count);
+      memset(&block[count], 0, sizeof(sample_t) * (block_size - count));
+      fs_convolve_block(conv[(conv_count == 1) ? 0 : ch], block, block + block_size);
+      for (idx = 0; idx < count; ++idx) {
+        samples[pos + idx] = (1 - wet) * block[idx] + wet * block[block_size + idx];
+      }
+    }
+  }
+  fs_add_stats(FS_TOTAL_SAMPLES(buffer), buffer->buffer_size * 2);
+  FS_TRACE_END();
+  for (ch = 0; ch < conv_count; ++ch) fs_delete_convolver(&conv[ch]);
+  free(block);
+  return fs_get_error();
+}
@@ -16,40 +16,78 @@
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <readline/readline.h>
 #include <readline/history.h>
 
 #include "fsynth.h"
 #include "logging.h"
-#include "list.h"
+#include "hashmap.h"
+#include "buffers.h"
+#include "cache.h"
+#include "memo.h"
+#include "profiler.h"
+#include "trace.h"
+#include "batch.h"
 
 #define MAX_PARAM      32
 #define CBUFFER_SIZE   1024
 
 #define CHECK_ARGC(x) \
   if (argc < x) { \
-    fs_log(LOG_ERR, "To few arguments!"); \
+    FS_LOG_ERR("To few arguments!"); \
     return FS_ERROR; \
   }
 
-struct NodeList cb_list = { NULL, NULL }; /* Shell command list */
-struct NodeList sb_list = { NULL, NULL }; /* Sample buffer list */
+/* Logging, tracing, profiling, the stream ring, the storage threshold and the cache apply to
+ * the whole process, a batch job can't change them while other jobs run */
+#define CHECK_NOT_BATCH(x) \
+  if (batch_worker_thread()) { \
+    FS_LOG_ERR("'%s' changes the whole process and can't be used in batch jobs", x); \
+    return FS_ERROR; \
+  }
+
+struct ShellCommand {
+  FShellCallback func;
+  const char *args;     /* Kind of every argument for the memo, NULL if the command is always executed */
+};
 
-void register_shell_command(FShellCallback *fptr, const char *fname)
+struct HashMap cb_map = HMAP_INITIALIZER; /* Shell command table */
+
+void register_shell_command(FShellCallback *fptr, const char *fname, const char *args)
 {
-  struct NodeItem *cb = push_back(&cb_list, fptr, 0);
-  cb->hash = hash_sdbm(0, fname, strlen(fname));
+  struct ShellCommand *command = (struct ShellCommand*) malloc(sizeof(struct ShellCommand));
+  if (command == NULL) return;
+  command->func = (FShellCallback) fptr;
+  command->args = args;
+  if (hmap_put(&cb_map, fname, command) == NULL) {
+    free(command);
+  }
+}
+
+int run_command(const struct ShellCommand *command, int argc, char **argv)
+{
+  int result;
+  FMemoCall call;
+  if (memo_begin(&call, argc, argv, command->args) == MEMO_HIT) {
+    return FS_OK;
+  }
+  result = (command->func)(argc, argv);
+  memo_end(&call, argv, result);
+  return result;
 }
 
 int shell_pchar(const char *cmd)
 {
-  int hc, result = FS_OK;
+  int result = FS_OK;
   int cb_ptr = 0, ch, argc = 0;
   char *param = NULL, *argv[MAX_PARAM];
   char cbuffer[CBUFFER_SIZE];
-  FShellCallback cmdFunc;
-  struct NodeItem *cbItem;
+  const char *line = cmd;
+  struct ShellCommand *command;
+  FProfileMark mark;
   while (1) {
     if (cmd == NULL) {
       result = FS_EXIT;
@@ -65,25 +103,32 @@ int shell_pchar(const char *cmd)
       if (argc < MAX_PARAM)
         argv[argc++] = param;
       else
-        fs_log(LOG_WARN, "Parameter limit reached");
+        FS_LOG_WARN("Parameter limit reached");
       if (ch == 0) {
         cb_ptr = 0;
-        hc = hash_sdbm(0, argv[0], strlen(argv[0]));
-        cbItem = find_item(&cb_list, hc);
-        if (cbItem != NULL) {
-          cmdFunc = cbItem->data;
-          result = (cmdFunc)(argc, argv);
+        command = (struct ShellCommand*) hmap_get(&cb_map, argv[0]);
+        buffer_tick();
+        if (command != NULL && (profile_enabled() || trace_active) &&
+            strcmp(argv[0], "profile") != 0 && strcmp(argv[0], "trace") != 0) {
+          FS_TRACE_BEGIN(TRACE_COMMAND, argv[0], (argc > 1) ? argv[1] : NULL, 0);
+          if (profile_enabled()) profile_begin(&mark);
+          result = run_command(command, argc, argv);
+          if (profile_enabled()) profile_end(&mark, argv[0], line);
+          FS_TRACE_END();
+        } else if (command != NULL) {
+          result = run_command(command, argc, argv);
         } else {
-          fs_log(LOG_ERR, "Unknown command: %s", argv[0]);
+          FS_LOG_ERR("Unknown command: %s", argv[0]);
           result = FS_ERROR;
         }
+        enforce_memory_budget();
         break;
       }
       if (ch == 32) {
         cbuffer[cb_ptr++] = 0;
         param = &cbuffer[cb_ptr];
       }
-    } else if (isprint(ch)) {
+    } else if (isprint(ch) && cb_ptr < CBUFFER_SIZE - 1) {
       cbuffer[cb_ptr++] = ch;
     }
   }
@@ -97,32 +142,82 @@ int shell_cmd_exit(int argc, char **argv)
 
 int shell_cmd_buffer(int argc, char **argv)
 {
+  int idx, storage = -1;
+  unsigned int channels = 1;
   uint32_t sample_rate;
   double duration;
   FSampleBuffer *sb;
-  struct NodeItem *sbItem;
   CHECK_ARGC(4);
   sample_rate = atoi(argv[2]);
   duration = atof(argv[3]);
-  sb = fs_create_sample_buffer(sample_rate, duration);
-  sbItem = push_back(&sb_list, sb, 0);
-  sbItem->hash = hash_sdbm(0, argv[1], strlen(argv[1]));
-  fs_log(LOG_DEBUG, "Buffer created: %s, sample_rate: %d, duration: %f", argv[1], sample_rate, duration);
+  for (idx = 4; idx < argc; ++idx) {
+    if (strcmp(argv[idx], "file") == 0) {
+      storage = FS_STORAGE_FILE;
+    } else if (strcmp(argv[idx], "heap") == 0) {
+      storage = FS_STORAGE_HEAP;
+    } else if (strcmp(argv[idx], "channels") == 0 && idx + 1 < argc) {
+      channels = (unsigned int)atoi(argv[++idx]);
+    } else {
+      FS_LOG_ERR("Unknown buffer option: %s", argv[idx]);
+      return FS_ERROR;
+    }
+  }
+  if (channels > 1) {
+    sb = fs_create_multichannel_buffer(sample_rate, (size_t)(sample_rate * duration), channels);
+    if (sb != NULL && storage >= 0 && FAILED(fs_set_buffer_storage(sb, storage))) {
+      fs_delete_sample_buffer(&sb);
+    }
+  } else if (storage >= 0) {
+    sb = fs_create_sample_buffer_storage(sample_rate, (size_t)(sample_rate * duration), storage);
+  } else if (channels == 1) {
+    sb = fs_create_sample_buffer(sample_rate, duration);
+  } else {
+    sb = NULL;
+  }
+  if (INVALID_BUFFER(sb)) {
+    FS_LOG_ERR("Invalid buffer parameters: %s", argv[1]);
+    fs_delete_sample_buffer(&sb);
+    return FS_ERROR;
+  }
+  if (register_buffer(argv[1], sb) != FS_OK) {
+    return FS_ERROR;
+  }
+  FS_LOG_DEBUG("Buffer created: %s, sample_rate: %d, duration: %f, channels: %u", argv[1], sample_rate, duration, channels);
   return FS_OK;
 }
 
-FSampleBuffer *get_buffer_by_name(char *name)
+int shell_cmd_clone(int argc, char **argv)
 {
-  FSampleBuffer *sb = NULL;
-  struct NodeItem *sbItem;
-  int hv = hash_sdbm(0, name, strlen(name));
-  sbItem = find_item(&sb_list, hv);
-  if (sbItem == NULL) {
-    fs_log(LOG_ERR, "Unknown buffer identifier: %s", name);
-  } else {
-    sb = (FSampleBuffer*) sbItem->data;
+  FSampleBuffer *sb, *clone;
+  CHECK_ARGC(3);
+  sb = get_buffer_by_name(argv[1]);
+  if (sb == NULL) return FS_ERROR;
+  clone = fs_clone_sample_buffer(sb);
+  if (clone == NULL) {
+    fs_print_error(fs_get_error());
+    return FS_ERROR;
+  }
+  if (register_buffer(argv[2], clone) != FS_OK) {
+    return FS_ERROR;
   }
-  return sb;
+  FS_LOG_DEBUG("Clone(%s): %s", argv[1], argv[2]);
+  return FS_OK;
+}
+
+int shell_cmd_channel(int argc, char **argv)
+{
+  unsigned int dest_channel, src_channel = 0;
+  FSampleBuffer *dest, *src;
+  CHECK_ARGC(4);
+  dest_channel = (unsigned int)atoi(argv[2]);
+  if (argc > 4) src_channel = (unsigned int)atoi(argv[4]);
+  dest = get_buffer_by_name(argv[1]);
+  src = get_buffer_by_name(argv[3]);
+  if (dest == NULL || src == NULL) return FS_ERROR;
+  fs_copy_channel(dest, dest_channel, src, src_channel);
+  fs_print_error(fs_get_error());
+  FS_LOG_DEBUG("Channel(%s): channel: %u, source: %s, source channel: %u", argv[1], dest_channel, argv[3], src_channel);
+  return fs_get_error();
 }
 
 int shell_cmd_func(int argc, char **argv)
@@ -137,60 +232,768 @@ int shell_cmd_func(int argc, char **argv)
   if (strcmp(argv[0], "sine") == 0) {
     fs_generate_wave_func(sb, FS_WAVE_SINE, freq, amp);
     fs_print_error(fs_get_error());
-    fs_log(LOG_DEBUG, "FuncSine(%s): freq: %f, level: %f", argv[1], freq, amp);
+    FS_LOG_DEBUG("FuncSine(%s): freq: %f, level: %f", argv[1], freq, amp);
   }
   if (strcmp(argv[0], "rect") == 0) {
     fs_generate_wave_func(sb, FS_WAVE_RECT, freq, amp);
     fs_print_error(fs_get_error());
-    fs_log(LOG_DEBUG, "FuncRectangle(%s): freq: %f, level: %f", argv[1], freq, amp);
+    FS_LOG_DEBUG("FuncRectangle(%s): freq: %f, level: %f", argv[1], freq, amp);
   }
   if (strcmp(argv[0], "tri") == 0) {
     fs_generate_wave_func(sb, FS_WAVE_TRIANGLE, freq, amp);
     fs_print_error(fs_get_error());
-    fs_log(LOG_DEBUG, "FuncTriangle(%s): freq: %f, level: %f", argv[1], freq, amp);
+    FS_LOG_DEBUG("FuncTriangle(%s): freq: %f, level: %f", argv[1], freq, amp);
   }
   if (strcmp(argv[0], "saw") == 0) {
     fs_generate_wave_func(sb, FS_WAVE_SAW, freq, amp);
     fs_print_error(fs_get_error());
-    fs_log(LOG_DEBUG, "FuncSaw(%s): freq: %f, level: %f", argv[1], freq, amp);
+    FS_LOG_DEBUG("FuncSaw(%s): freq: %f, level: %f", argv[1], freq, amp);
   }
-  return FS_OK;
+  return fs_get_error();
+}
+
+int shell_cmd_fm(int argc, char **argv)
+{
+  int idx, algorithm;
+  double freq, amp, feedback = 0;
+  FSFMPatch patch;
+  FSampleBuffer *sb;
+  CHECK_ARGC(7);
+  sb = get_buffer_by_name(argv[1]);
+  if (sb == NULL) return FS_ERROR;
+  freq = atof(argv[2]);
+  amp = atof(argv[3]);
+  if (strcmp(argv[4], "stack") == 0) {
+    algorithm = FS_FM_STACK;
+  } else if (strcmp(argv[4], "parallel") == 0) {
+    algorithm = FS_FM_PARALLEL;
+  } else if (strcmp(argv[4], "pairs") == 0) {
+    algorithm = FS_FM_PAIRS;
+  } else {
+    FS_LOG_ERR("Unknown FM algorithm: %s", argv[4]);
+    return FS_ERROR;
+  }
+  memset(&patch, 0, sizeof(patch));
+  for (idx = 5; idx < argc; idx += 2) {
+    if (strcmp(argv[idx], "feedback") == 0 && idx + 1 < argc) {
+      feedback = atof(argv[idx + 1]);
+    } else if (idx + 1 < argc && patch.operator_count < FS_MAX_FM_OPERATORS && atof(argv[idx]) >= 0) {
+      patch.operators[patch.operator_count].ratio = atof(argv[idx]);
+      patch.operators[patch.operator_count].level = atof(argv[idx + 1]);
+      ++patch.operator_count;
+    } else {
+      FS_LOG_ERR("Invalid FM operator: %s", argv[idx]);
+      return FS_ERROR;
+    }
+  }
+  /* The last operator is the top of a stack or the modulator of the last pair */
+  if (patch.operator_count > 0) patch.operators[patch.operator_count - 1].feedback = feedback;
+  fs_set_fm_algorithm(&patch, algorithm);
+  if (!FAILED(fs_get_error())) fs_generate_fm(sb, &patch, freq, amp);
+  fs_print_error(fs_get_error());
+  FS_LOG_DEBUG("FM(%s): freq: %f, level: %f, algorithm: %s, operators: %u, feedback: %f", argv[1], freq, amp,
+    argv[4], (unsigned int)patch.operator_count, feedback);
+  return fs_get_error();
+}
+
+int shell_cmd_harmonics(int argc, char **argv)
+{
+  int idx, count;
+  double amp, freq, slope = 1;
+  FSPartial *partials;
+  FSampleBuffer *sb;
+  CHECK_ARGC(5);
+  sb = get_buffer_by_name(argv[1]);
+  if (sb == NULL) return FS_ERROR;
+  freq = atof(argv[2]);
+  amp = atof(argv[3]);
+  count = atoi(argv[4]);
+  if (argc > 5) slope = atof(argv[5]);
+  if (count < 1) {
+    FS_LOG_ERR("Invalid number of harmonics: %s", argv[4]);
+    return FS_ERROR;
+  }
+  partials = (FSPartial*) malloc(sizeof(FSPartial) * count);
+  if (partials == NULL) return FS_ERROR;
+  for (idx = 0; idx < count; ++idx) {
+    partials[idx].freq = freq * (idx + 1);
+    partials[idx].amp = amp / pow(idx + 1, slope);
+    partials[idx].phase = 0;
+  }
+  fs_generate_partials(sb, partials, count, 0);
+  free(partials);
+  fs_print_error(fs_get_error());
+  FS_LOG_DEBUG("Harmonics(%s): freq: %f, level: %f, count: %d, slope: %f", argv[1], freq, amp, count, slope);
+  return fs_get_error();
 }
 
 int shell_cmd_wave_out(int argc, char **argv)
 {
-  int bits;
+  int idx, bits, flags = 0;
   FSampleBuffer *sb;
+  FWaveStream *ws;
+  FWaveStreamStats stats;
   CHECK_ARGC(4);
   bits = atoi(argv[3]);
-  if (bits != 8 && bits != 16) {
-    fs_log(LOG_ERR, "Invalid sample format");
+  if (bits != 8 && bits != 16 && bits != 24 && bits != 32) {
+    FS_LOG_ERR("Invalid sample format");
     return FS_ERROR;
   }
+  for (idx = 4; idx < argc; ++idx) {
+    if (strcmp(argv[idx], "direct") == 0) flags |= FS_STREAM_DIRECT;
+    if (strcmp(argv[idx], "raw") == 0) flags |= FS_STREAM_RAW;
+  }
+  if (strcmp(argv[0], "pcmout") == 0) {
+    flags |= FS_STREAM_RAW;
+  }
   sb = get_buffer_by_name(argv[1]);
   if (sb != NULL) {
-    fs_log(LOG_DEBUG, "WaveOut(%s): file: %s, bits: %d", argv[1], argv[2], bits);
+    FS_LOG_DEBUG("WaveOut(%s): file: %s, bits: %d", argv[1], argv[2], bits);
     fs_normalize_buffer(sb);
-    fs_samples_to_wave_file(sb, argv[2], bits, 1);
+    ws = fs_open_wave_stream(argv[2], sb->sample_rate, bits, sb->channels, flags);
+    if (ws != NULL) {
+      fs_write_wave_stream_buffer(ws, sb);
+      fs_print_error(fs_get_error());
+      fs_close_wave_stream(&ws, &stats);
+      FS_LOG_DEBUG("WaveOut(%s): ring: %u/%u blocks, stalls: %u/%u",
+        argv[1], (unsigned int)stats.high_water, (unsigned int)stats.block_count,
+        (unsigned int)stats.producer_stalls, (unsigned int)stats.consumer_stalls);
+    }
+    fs_print_error(fs_get_error());
+    return fs_get_error();
+  }
+  return FS_ERROR;
+}
+
+/* Returns the waveform type of a name or 0 for an unknown one */
+int wave_type_by_name(const char *name)
+{
+  int idx;
+  const char *names[] = { "sine", "cosine", "saw", "tri", "rect", "noise" };
+  const int types[] = { FS_WAVE_SINE, FS_WAVE_COSINE, FS_WAVE_SAW, FS_WAVE_TRIANGLE, FS_WAVE_RECT, FS_WAVE_NOISE };
+  for (idx = 0; idx < 6; ++idx) {
+    if (strcmp(name, names[idx]) == 0) return types[idx];
+  }
+  return 0;
+}
+
+/* Builds an automation lane from breakpoints like "0:100,2:2000:exp,4:100", the curve
+ * to a breakpoint is linear if it isn't given */
+FSAutomation *parse_automation_lane(const char *text)
+{
+  int idx, curve_type;
+  double time, level;
+  char curve[16];
+  const char *names[] = { "linear", "tan", "square", "cubic", "hold", "exp" };
+  const char *point = text;
+  FSAutomation *lane = fs_create_automation();
+  while (lane != NULL && *point != 0) {
+    curve[0] = 0;
+    if (sscanf(point, "%lf:%lf:%15[a-z]", &time, &level, curve) < 2) {
+      fs_set_error(FS_INVALID_ARGUMENT);
+      fs_delete_automation(&lane);
+      break;
+    }
+    curve_type = (curve[0] == 0) ? FS_CURVE_LINEAR : 0;
+    for (idx = 0; idx < 6 && curve_type == 0; ++idx) {
+      if (strcmp(curve, names[idx]) == 0) curve_type = FS_CURVE_LINEAR + idx;
+    }
+    if (curve_type == 0 || fs_add_automation_point(lane, time, curve_type, level) != FS_OK) {
+      if (curve_type == 0) fs_set_error(FS_INVALID_ARGUMENT);
+      fs_delete_automation(&lane);
+      break;
+    }
+    point = strchr(point, ',');
+    point = (point != NULL) ? point + 1 : "";
+  }
+  if (lane == NULL) FS_LOG_ERR("Invalid automation lane: %s", text);
+  return lane;
+}
+
+int shell_cmd_automate(int argc, char **argv)
+{
+  int func_type = 0;
+  FSampleBuffer *sb;
+  FSAutomation *lane, *amp = NULL;
+  CHECK_ARGC(4);
+  sb = get_buffer_by_name(argv[1]);
+  if (sb == NULL) return FS_ERROR;
+  if (strcmp(argv[2], "gain") != 0) {
+    func_type = wave_type_by_name(argv[2]);
+    if (func_type == 0) {
+      FS_LOG_ERR("Unknown wave form: %s", argv[2]);
+      return FS_ERROR;
+    }
+  }
+  lane = parse_automation_lane(argv[3]);
+  if (lane != NULL && func_type != 0 && argc > 4) amp = parse_automation_lane(argv[4]);
+  if (lane == NULL || (argc > 4 && func_type != 0 && amp == NULL)) {
+    fs_print_error(fs_get_error());
+    fs_delete_automation(&lane);
+    return FS_ERROR;
+  }
+  if (func_type == 0) {
+    fs_apply_automation(sb, lane);
+  } else {
+    fs_generate_automated_wave(sb, func_type, lane, amp);
+  }
+  FS_LOG_DEBUG("Automate(%s): %s, lane: %s, duration: %f", argv[1], argv[2], argv[3], fs_get_automation_duration(lane));
+  fs_delete_automation(&lane);
+  fs_delete_automation(&amp);
+  fs_print_error(fs_get_error());
+  return fs_get_error();
+}
+
+int shell_cmd_pcm_tone(int argc, char **argv)
+{
+  int idx, bits, func_type, flags = 0;
+  uint32_t sample_rate;
+  double duration, freq, amp, attack = 0, release = 0;
+  FSFixedBuffer *fb;
+  FSEnvelope *env = NULL;
+  FWaveStream *ws;
+  CHECK_ARGC(8);
+  bits = atoi(argv[2]);
+  sample_rate = (uint32_t)atoi(argv[3]);
+  duration = atof(argv[4]);
+  freq = atof(argv[6]);
+  amp = atof(argv[7]);
+  if (bits != 16 && bits != 32) {
+    FS_LOG_ERR("Invalid sample format");
+    return FS_ERROR;
+  }
+  func_type = wave_type_by_name(argv[5]);
+  if (func_type == 0) {
+    FS_LOG_ERR("Unknown wave form: %s", argv[5]);
+    return FS_ERROR;
+  }
+  for (idx = 8; idx < argc; ++idx) {
+    if (strcmp(argv[idx], "attack") == 0 && idx + 1 < argc) {
+      attack = atof(argv[++idx]);
+    } else if (strcmp(argv[idx], "release") == 0 && idx + 1 < argc) {
+      release = atof(argv[++idx]);
+    } else if (strcmp(argv[idx], "raw") == 0) {
+      flags |= FS_STREAM_RAW;
+    } else {
+      FS_LOG_ERR("Unknown pcmtone option: %s", argv[idx]);
+      return FS_ERROR;
+    }
+  }
+  if (sample_rate == 0 || duration <= 0 || attack < 0 || release < 0 || attack + release > duration) {
+    FS_LOG_ERR("Invalid tone parameters");
+    return FS_ERROR;
+  }
+  fb = fs_create_fixed_buffer(sample_rate, (size_t)(sample_rate * duration), (bits == 16) ? FS_FIXED_Q15 : FS_FIXED_Q31);
+  if (fb == NULL) {
+    fs_print_error(fs_get_error());
+    return FS_ERROR;
+  }
+  fs_generate_fixed_wave(fb, func_type, freq, amp);
+  if (!FAILED(fs_get_error()) && (attack > 0 || release > 0)) {
+    env = fs_create_envelope();
+    if (env != NULL) {
+      fs_add_envelope_segment(env, FS_CURVE_LINEAR, attack, 1);
+      fs_add_envelope_segment(env, FS_CURVE_HOLD, duration - attack - release, 1);
+      fs_add_envelope_segment(env, FS_CURVE_LINEAR, release, 0);
+      fs_apply_fixed_envelope(fb, env);
+      fs_delete_envelope(&env);
+    }
+  }
+  if (!FAILED(fs_get_error())) {
+    ws = fs_open_wave_stream(argv[1], sample_rate, bits, 1, flags);
+    if (ws != NULL) {
+      fs_write_wave_stream_fixed(ws, fb);
+      fs_print_error(fs_get_error());
+      fs_close_wave_stream(&ws, NULL);
+    }
+  }
+  fs_print_error(fs_get_error());
+  FS_LOG_DEBUG("PcmTone(%s): bits: %d, %s: freq: %f, level: %f, attack: %f, release: %f",
+    argv[1], bits, argv[5], freq, amp, attack, release);
+  fs_delete_fixed_buffer(&fb);
+  return fs_get_error();
+}
+
+/* Queues an event given as beat:type:arguments, e.g. 1.5:on:60:0.8 */
+int schedule_event_token(FSScheduler *scheduler, const char *token)
+{
+  int note;
+  double beat, value = 1;
+  char kind[16], arg[64];
+  if (sscanf(token, "%lf:%15[a-z]:%63s", &beat, kind, arg) != 3) {
+    return FS_ERROR;
+  }
+  if (strcmp(kind, "on") == 0 && sscanf(arg, "%d:%lf", &note, &value) >= 1) {
+    return fs_schedule_event(scheduler, beat, FS_EVENT_NOTE_ON, note, value);
+  } else if (strcmp(kind, "off") == 0 && sscanf(arg, "%d", &note) == 1) {
+    return fs_schedule_event(scheduler, beat, FS_EVENT_NOTE_OFF, note, 0);
+  } else if (strcmp(kind, "tempo") == 0) {
+    return fs_schedule_event(scheduler, beat, FS_EVENT_TEMPO, 0, atof(arg));
+  } else if (strcmp(kind, "gain") == 0) {
+    return fs_schedule_event(scheduler, beat, FS_EVENT_PARAM, FS_PARAM_GAIN, atof(arg));
+  } else if (strcmp(kind, "detune") == 0) {
+    return fs_schedule_event(scheduler, beat, FS_EVENT_PARAM, FS_PARAM_DETUNE, atof(arg));
+  } else if (strcmp(kind, "wave") == 0) {
+    return fs_schedule_event(scheduler, beat, FS_EVENT_PARAM, FS_PARAM_WAVEFORM, wave_type_by_name(arg));
+  }
+  return FS_ERROR;
+}
+
+int shell_cmd_schedule(int argc, char **argv)
+{
+  int idx, func_type, valid = 1;
+  uint32_t sample_rate;
+  double bpm, length = 0, attack = 0.01, decay = 0.1, sustain = 0.7, release = 0.2;
+  FSAutomation *lane, **target, *gain_lane = NULL, *detune_lane = NULL;
+  FSScheduler *scheduler = NULL;
+  FSSchedulerStats stats;
+  FSampleBuffer *sb = NULL;
+  CHECK_ARGC(5);
+  sample_rate = (uint32_t)atoi(argv[2]);
+  bpm = atof(argv[3]);
+  func_type = wave_type_by_name(argv[4]);
+  if (func_type == 0) {
+    FS_LOG_ERR("Unknown wave form: %s", argv[4]);
+    return FS_ERROR;
+  }
+  /* Tokens with a colon are events which are queued below, all others are options with a value */
+  for (idx = 5; idx < argc && valid; ++idx) {
+    if (strchr(argv[idx], ':') != NULL) continue;
+    if (idx + 1 >= argc) {
+      valid = 0;
+    } else if (strcmp(argv[idx], "attack") == 0) {
+      attack = atof(argv[++idx]);
+    } else if (strcmp(argv[idx], "decay") == 0) {
+      decay = atof(argv[++idx]);
+    } else if (strcmp(argv[idx], "sustain") == 0) {
+      sustain = atof(argv[++idx]);
+    } else if (strcmp(argv[idx], "release") == 0) {
+      release = atof(argv[++idx]);
+    } else if (strcmp(argv[idx], "length") == 0) {
+      length = atof(argv[++idx]);
+    } else if (strcmp(argv[idx], "gainlane") == 0 || strcmp(argv[idx], "detunelane") == 0) {
+      target = (strcmp(argv[idx], "gainlane") == 0) ? &gain_lane : &detune_lane;
+      lane = parse_automation_lane(argv[++idx]);
+      fs_delete_automation(target);
+      *target = lane;
+      if (lane == NULL) {
+        valid = 0;
+        break;
+      }
+    } else {
+      valid = 0;
+    }
+    if (!valid) FS_LOG_ERR("Unknown schedule option: %s", argv[idx]);
+  }
+  if (valid) scheduler = fs_create_scheduler(sample_rate, bpm);
+  if (scheduler == NULL || FAILED(fs_set_scheduler_voice(scheduler, func_type, attack, decay, sustain, release)) ||
+      FAILED(fs_set_scheduler_automation(scheduler, FS_PARAM_GAIN, gain_lane)) ||
+      FAILED(fs_set_scheduler_automation(scheduler, FS_PARAM_DETUNE, detune_lane))) {
+    fs_print_error(fs_get_error());
+    fs_delete_scheduler(&scheduler);
+    fs_delete_automation(&gain_lane);
+    fs_delete_automation(&detune_lane);
+    return FS_ERROR;
+  }
+  for (idx = 5; idx < argc; ++idx) {
+    if (strchr(argv[idx], ':') == NULL) {
+      /* The options have been checked above, this skips their value */
+      ++idx;
+      continue;
+    }
+    if (schedule_event_token(scheduler, argv[idx]) != FS_OK) {
+      FS_LOG_ERR("Invalid event: %s", argv[idx]);
+      break;
+    }
+  }
+  if (idx >= argc) {
+    /* Without a length the buffer ends when the last note has faded out */
+    if (length <= 0) length = fs_get_schedule_duration(scheduler);
+    sb = fs_create_sample_buffer(sample_rate, length);
+    if (!INVALID_BUFFER(sb)) {
+      fs_render_schedule(scheduler, sb);
+    }
+    if (INVALID_BUFFER(sb) || FAILED(fs_get_error())) {
+      FS_LOG_ERR("Can't render the schedule: %s", argv[1]);
+      fs_print_error(fs_get_error());
+      fs_delete_sample_buffer(&sb);
+    }
+  }
+  fs_get_scheduler_stats(scheduler, &stats);
+  fs_delete_scheduler(&scheduler);
+  fs_delete_automation(&gain_lane);
+  fs_delete_automation(&detune_lane);
+  if (sb == NULL || register_buffer(argv[1], sb) != FS_OK) {
+    return FS_ERROR;
+  }
+  FS_LOG_DEBUG("Schedule(%s): length: %f, events: %u, blocks: %u, pending: %u", argv[1], length,
+    (unsigned int)stats.events, (unsigned int)stats.blocks, (unsigned int)stats.pending);
+  return FS_OK;
+}
+
+int shell_cmd_stream(int argc, char **argv)
+{
+  FWaveStreamStats stats;
+  CHECK_ARGC(2);
+  if (strcmp(argv[1], "ring") == 0) {
+    CHECK_NOT_BATCH("stream ring");
+    CHECK_ARGC(4);
+    fs_set_wave_stream_ring(atoi(argv[2]), atoi(argv[3]) * 1024);
+    FS_LOG_DEBUG("StreamRing: blocks: %s, block size: %s KiB", argv[2], argv[3]);
+  } else if (strcmp(argv[1], "stats") == 0) {
+    fs_get_wave_stream_stats(&stats);
+    printf("ring blocks:\t%u\n", (unsigned int)stats.block_count);
+    printf("block size:\t%u byte\n", (unsigned int)stats.block_size);
+    printf("high water:\t%u blocks\n", (unsigned int)stats.high_water);
+    printf("render stalls:\t%u\n", (unsigned int)stats.producer_stalls);
+    printf("writer stalls:\t%u\n", (unsigned int)stats.consumer_stalls);
+    printf("bytes written:\t%llu byte\n", (unsigned long long)stats.bytes_written);
+    printf("bytes spliced:\t%llu byte\n", (unsigned long long)stats.bytes_spliced);
+    printf("direct io:\t%s\n", stats.direct_io ? "yes" : "no");
+  } else {
+    FS_LOG_ERR("Unknown stream option: %s", argv[1]);
+    return FS_ERROR;
+  }
+  return FS_OK;
+}
+
+int shell_cmd_profile(int argc, char **argv)
+{
+  CHECK_ARGC(2);
+  if (strcmp(argv[1], "report") != 0 && strcmp(argv[1], "dump") != 0) {
+    CHECK_NOT_BATCH("profile");
+  }
+  if (strcmp(argv[1], "on") == 0) {
+    profile_enable(1);
+  } else if (strcmp(argv[1], "off") == 0) {
+    profile_enable(0);
+  } else if (strcmp(argv[1], "report") == 0) {
+    profile_report(stdout);
+  } else if (strcmp(argv[1], "reset") == 0) {
+    profile_reset();
+  } else if (strcmp(argv[1], "dump") == 0) {
+    CHECK_ARGC(3);
+    if (profile_dump(argv[2]) != FS_OK) {
+      FS_LOG_ERR("Can't write profile: %s", argv[2]);
+      return FS_ERROR;
+    }
+  } else {
+    FS_LOG_ERR("Unknown profile option: %s", argv[1]);
+    return FS_ERROR;
+  }
+  return FS_OK;
+}
+
+int shell_cmd_trace(int argc, char **argv)
+{
+  CHECK_ARGC(2);
+  CHECK_NOT_BATCH("trace");
+  if (strcmp(argv[1], "start") == 0) {
+    CHECK_ARGC(3);
+    if (trace_start(argv[2]) != 0) {
+      FS_LOG_ERR("Can't start the trace: %s", argv[2]);
+      return FS_ERROR;
+    }
+  } else if (strcmp(argv[1], "stop") == 0) {
+    if (trace_stop() != 0) {
+      FS_LOG_ERR("Can't write the trace file");
+      return FS_ERROR;
+    }
+  } else {
+    FS_LOG_ERR("Unknown trace option: %s", argv[1]);
+    return FS_ERROR;
+  }
+  return FS_OK;
+}
+
+int shell_cmd_log(int argc, char **argv)
+{
+  size_t rings;
+  uint64_t records, dropped;
+  int result = 0;
+  CHECK_ARGC(2);
+  if (strcmp(argv[1], "stats") != 0) {
+    CHECK_NOT_BATCH("log");
+  }
+  if (strcmp(argv[1], "sync") == 0) {
+    fs_log_stop();
+  } else if (strcmp(argv[1], "async") == 0) {
+    result = fs_log_start(LOG_MODE_ASYNC, NULL);
+  } else if (strcmp(argv[1], "binary") == 0) {
+    CHECK_ARGC(3);
+    result = fs_log_start(LOG_MODE_BINARY, argv[2]);
+  } else if (strcmp(argv[1], "level") == 0) {
+    CHECK_ARGC(3);
+    if (strcmp(argv[2], "debug") == 0) {
+      fs_set_log_level(LOG_DEBUG | LOG_INFO | LOG_WARN | LOG_ERR);
+    } else if (strcmp(argv[2], "info") == 0) {
+      fs_set_log_level(LOG_INFO | LOG_WARN | LOG_ERR);
+    } else if (strcmp(argv[2], "warn") == 0) {
+      fs_set_log_level(LOG_WARN | LOG_ERR);
+    } else if (strcmp(argv[2], "error") == 0) {
+      fs_set_log_level(LOG_ERR);
+    } else {
+      FS_LOG_ERR("Unknown log level: %s", argv[2]);
+      return FS_ERROR;
+    }
+  } else if (strcmp(argv[1], "stats") == 0) {
+    fs_get_log_stats(&rings, &records, &dropped);
+    printf("thread rings:\t%u\n", (unsigned int)rings);
+    printf("records:\t%llu\n", (unsigned long long)records);
+    printf("dropped:\t%llu\n", (unsigned long long)dropped);
+  } else {
+    FS_LOG_ERR("Unknown log option: %s", argv[1]);
+    return FS_ERROR;
+  }
+  if (result != 0) {
+    FS_LOG_ERR("Can't start the log thread");
+    return FS_ERROR;
+  }
+  return FS_OK;
+}
+
+int shell_cmd_wave_in(int argc, char **argv)
+{
+  int channel = 0;
+  FSampleBuffer *sb;
+  CHECK_ARGC(3);
+  if (argc > 3) {
+    channel = (strcmp(argv[3], "all") == 0) ? FS_ALL_CHANNELS : atoi(argv[3]);
+  }
+  sb = fs_load_wave_file(argv[2], channel);
+  if (sb == NULL) {
     fs_print_error(fs_get_error());
+    return FS_ERROR;
+  }
+  if (register_buffer(argv[1], sb) != FS_OK) {
+    return FS_ERROR;
   }
+  FS_LOG_DEBUG("WaveIn(%s): file: %s, channel: %d, sample_rate: %d, samples: %u, mapped: %s",
+    argv[1], argv[2], channel, sb->sample_rate, (unsigned int)sb->sample_count, sb->map_addr ? "yes" : "no");
   return FS_OK;
 }
 
 int shell_cmd_info(int argc, char **argv)
 {
   FSampleBuffer *sb;
-  CHECK_ARGC(1);
+  CHECK_ARGC(2);
   sb = get_buffer_by_name(argv[1]);
   if (sb == NULL) return FS_ERROR;
   printf("buffer address:\t0x%04llX\n", (unsigned long long)sb);
   printf("sample count:\t%u\n", (unsigned int)sb->sample_count);
+  printf("channels:\t%u\n", sb->channels);
   printf("sample rate:\t%u\n", (unsigned int)sb->sample_rate);
   printf("buffer size:\t%llu byte\n", (unsigned long long)sb->buffer_size);
+  printf("storage:\t%s\n", (sb->storage == FS_STORAGE_FILE) ? "file" : (sb->map_addr ? "mapped view" : "heap"));
   printf("buffer length:\t%f\n", fs_get_buffer_duration(sb));
   return FS_OK;
 }
 
+int shell_cmd_free(int argc, char **argv)
+{
+  int idx;
+  CHECK_ARGC(2);
+  for (idx = 1; idx < argc; ++idx) {
+    if (free_buffer(argv[idx]) != FS_OK) {
+      FS_LOG_ERR("Unknown buffer identifier: %s", argv[idx]);
+      return FS_ERROR;
+    }
+    FS_LOG_DEBUG("Buffer deleted: %s", argv[idx]);
+  }
+  return FS_OK;
+}
+
+int shell_cmd_mem(int argc, char **argv)
+{
+  int policy = BUDGET_SPILL;
+  double megabytes;
+  if (argc < 2) {
+    print_memory_usage(stdout);
+  } else if (strcmp(argv[1], "budget") == 0) {
+    CHECK_ARGC(3);
+    megabytes = atof(argv[2]);
+    if (megabytes <= 0) {
+      FS_LOG_ERR("Invalid memory budget: %s", argv[2]);
+      return FS_ERROR;
+    }
+    if (argc > 3 && strcmp(argv[3], "drop") == 0) {
+      policy = BUDGET_DROP;
+    } else if (argc > 3 && strcmp(argv[3], "spill") != 0) {
+      FS_LOG_ERR("Unknown eviction policy: %s", argv[3]);
+      return FS_ERROR;
+    }
+    set_memory_budget((size_t)(megabytes * 1048576.0), policy);
+    enforce_memory_budget();
+  } else if (strcmp(argv[1], "off") == 0) {
+    set_memory_budget(0, BUDGET_SPILL);
+  } else {
+    FS_LOG_ERR("Unknown mem option: %s", argv[1]);
+    return FS_ERROR;
+  }
+  return FS_OK;
+}
+
+int shell_cmd_storage(int argc, char **argv)
+{
+  double megabytes;
+  FSampleBuffer *sb;
+  CHECK_ARGC(2);
+  if (strcmp(argv[1], "threshold") == 0) {
+    CHECK_NOT_BATCH("storage threshold");
+    CHECK_ARGC(3);
+    megabytes = atof(argv[2]);
+    if (megabytes <= 0) {
+      FS_LOG_ERR("Invalid storage threshold: %s", argv[2]);
+      return FS_ERROR;
+    }
+    fs_set_storage_threshold((size_t)(megabytes * 1048576.0));
+    return FS_OK;
+  }
+  if (strcmp(argv[1], "off") == 0) {
+    CHECK_NOT_BATCH("storage off");
+    fs_set_storage_threshold(0);
+    return FS_OK;
+  }
+  CHECK_ARGC(3);
+  sb = get_buffer_by_name(argv[1]);
+  if (sb == NULL) return FS_ERROR;
+  if (strcmp(argv[2], "file") == 0) {
+    fs_set_buffer_storage(sb, FS_STORAGE_FILE);
+  } else if (strcmp(argv[2], "heap") == 0) {
+    fs_set_buffer_storage(sb, FS_STORAGE_HEAP);
+  } else {
+    FS_LOG_ERR("Unknown buffer storage: %s", argv[2]);
+    return FS_ERROR;
+  }
+  FS_LOG_DEBUG("Storage(%s): %s", argv[1], argv[2]);
+  fs_print_error(fs_get_error());
+  return fs_get_error();
+}
+
+int shell_cmd_resample(int argc, char **argv)
+{
+  uint32_t sample_rate;
+  FSampleBuffer *sb, *pout;
+  CHECK_ARGC(3);
+  sb = get_buffer_by_name(argv[1]);
+  if (sb == NULL) return FS_ERROR;
+  sample_rate = atoi(argv[2]);
+  if (argc > 3) {
+    pout = fs_resample_buffer(sb, sample_rate);
+    if (pout == NULL) {
+      fs_print_error(fs_get_error());
+      return FS_ERROR;
+    }
+    if (register_buffer(argv[3], pout) != FS_OK) {
+      return FS_ERROR;
+    }
+  } else {
+    fs_resample_buffer_inplace(sb, sample_rate);
+    fs_print_error(fs_get_error());
+  }
+  FS_LOG_DEBUG("Resample(%s): sample_rate: %u, output: %s", argv[1], (unsigned int)sample_rate,
+    (argc > 3) ? argv[3] : argv[1]);
+  return fs_get_error();
+}
+
+int parse_filter_type(const char *name)
+{
+  static const char *names[] = { "lowpass", "highpass", "bandpass", "notch", "peak", "lowshelf", "highshelf" };
+  int idx;
+  for (idx = 0; idx < 7; ++idx) {
+    if (strcmp(name, names[idx]) == 0) return FS_FILTER_LOWPASS + idx;
+  }
+  return -1;
+}
+
+/* Sets value only if the whole string is a number */
+int parse_number(const char *str, double *value)
+{
+  char *end;
+  double number = strtod(str, &end);
+  if (end == str || *end != 0) return 0;
+  *value = number;
+  return 1;
+}
+
+int shell_cmd_filter(int argc, char **argv)
+{
+  int filter_type, structure = FS_FILTER_BIQUAD, sections = 1, idx = 4;
+  double cutoff, q = M_SQRT1_2, gain = 0, depth = 0;
+  FSampleBuffer *sb, *mod = NULL;
+  FSAutomation *lane = NULL;
+  FSFilter *filter;
+  CHECK_ARGC(4);
+  sb = get_buffer_by_name(argv[1]);
+  if (sb == NULL) return FS_ERROR;
+  filter_type = parse_filter_type(argv[2]);
+  if (filter_type < 0) {
+    FS_LOG_ERR("Unknown filter type: %s", argv[2]);
+    return FS_ERROR;
+  }
+  cutoff = atof(argv[3]);
+  if (idx < argc && parse_number(argv[idx], &q)) ++idx;
+  if (idx < argc && parse_number(argv[idx], &gain)) ++idx;
+  for (; idx < argc; ++idx) {
+    if (strcmp(argv[idx], "svf") == 0) {
+      structure = FS_FILTER_SVF;
+    } else if (strcmp(argv[idx], "cascade") == 0 && idx + 1 < argc) {
+      sections = atoi(argv[++idx]);
+    } else if (strcmp(argv[idx], "mod") == 0 && idx + 2 < argc) {
+      mod = get_buffer_by_name(argv[++idx]);
+      if (mod == NULL) return FS_ERROR;
+      depth = atof(argv[++idx]);
+    } else if (strcmp(argv[idx], "lane") == 0 && idx + 2 < argc && lane == NULL) {
+      lane = parse_automation_lane(argv[++idx]);
+      if (lane == NULL) {
+        fs_print_error(fs_get_error());
+        return FS_ERROR;
+      }
+      depth = atof(argv[++idx]);
+    } else {
+      FS_LOG_ERR("Unknown filter option: %s", argv[idx]);
+      fs_delete_automation(&lane);
+      return FS_ERROR;
+    }
+  }
+  filter = fs_create_filter(structure);
+  if (filter == NULL) {
+    fs_print_error(fs_get_error());
+    fs_delete_automation(&lane);
+    return FS_ERROR;
+  }
+  for (idx = 0; idx < sections && !FAILED(fs_get_error()); ++idx) {
+    fs_add_filter_section(filter, filter_type, cutoff, q, gain);
+  }
+  if (!FAILED(fs_get_error())) {
+    if (lane != NULL) fs_set_filter_automation(filter, lane, depth);
+    else fs_set_filter_modulation(filter, mod, depth);
+  }
+  if (!FAILED(fs_get_error())) fs_apply_filter(sb, filter);
+  FS_LOG_DEBUG("Filter(%s): type: %s, cutoff: %f, q: %f, gain: %f, sections: %d, %s", argv[1], argv[2],
+    cutoff, q, gain, sections, (structure == FS_FILTER_SVF) ? "svf" : "biquad");
+  fs_delete_filter(&filter);
+  fs_delete_automation(&lane);
+  fs_print_error(fs_get_error());
+  return fs_get_error();
+}
+
+int shell_cmd_convolve(int argc, char **argv)
+{
+  double wet = 1.0;
+  FSampleBuffer *sb, *ir;
+  CHECK_ARGC(3);
+  sb = get_buffer_by_name(argv[1]);
+  if (sb == NULL) return FS_ERROR;
+  ir = get_buffer_by_name(argv[2]);
+  if (ir == NULL) return FS_ERROR;
+  if (argc > 3) wet = atof(argv[3]);
+  fs_convolve_buffer(sb, ir, wet);
+  FS_LOG_DEBUG("Convolve(%s): ir: %s, wet: %f", argv[1], argv[2], wet);
+  fs_print_error(fs_get_error());
+  return fs_get_error();
+}
+
 int shell_cmd_repeat(int argc, char **argv)
 {
   int times;
@@ -201,7 +1004,7 @@ int shell_cmd_repeat(int argc, char **argv)
   times = atoi(argv[2]);
   fs_repeat_sample_buffer_inplace(sb, times);
   fs_print_error(fs_get_error());
-  return FS_OK;
+  return fs_get_error();
 }
 
 int shell_cmd_scale(int argc, char **argv)
@@ -214,61 +1017,65 @@ int shell_cmd_scale(int argc, char **argv)
   sv = atof(argv[2]);
   fs_scale_samples(sb, sv);
   fs_print_error(fs_get_error());
-  return FS_OK;
+  return fs_get_error();
 }
 
 int shell_cmd_attack(int argc, char **argv)
 {
   double level, time;
   FSampleBuffer *sb;
-  CHECK_ARGC(4);
+  CHECK_ARGC(5);
   sb = get_buffer_by_name(argv[1]);
   if (sb == NULL) return FS_ERROR;
   time = atof(argv[3]);
   level = atof(argv[4]);
-  if (strcmp(argv[0], "attack")) {
+  if (strcmp(argv[0], "attack") == 0) {
     level = fabs(level);
   }
-  if (strcmp(argv[0], "decay")) {
+  if (strcmp(argv[0], "decay") == 0) {
     level = -fabs(level);
   }
   if (time > fs_get_buffer_duration(sb)) {
-    fs_log(LOG_ERR, "Invalid time value: %f", time);
+    FS_LOG_ERR("Invalid time value: %f", time);
     return FS_ERROR;
   }
   if (strcmp(argv[2], "linear") == 0) {
-    fs_log(LOG_DEBUG, "Attack linear(%s): time: %f, level:%f", argv[1], time, level);
+    FS_LOG_DEBUG("Attack linear(%s): time: %f, level:%f", argv[1], time, level);
     fs_attack_decay(sb, FS_CURVE_LINEAR, time, level);
     fs_print_error(fs_get_error());
   } else if (strcmp(argv[2], "square") == 0) {
-    fs_log(LOG_DEBUG, "Attack square(%s): time: %f, level:%f", argv[1], time, level);
+    FS_LOG_DEBUG("Attack square(%s): time: %f, level:%f", argv[1], time, level);
     fs_attack_decay(sb, FS_CURVE_SQUARE, time, level);
     fs_print_error(fs_get_error());
   } else if (strcmp(argv[2], "tan") == 0) {
-    fs_log(LOG_DEBUG, "Attack tan(%s): time: %f, level:%f", argv[1], time, level);
+    FS_LOG_DEBUG("Attack tan(%s): time: %f, level:%f", argv[1], time, level);
     fs_attack_decay(sb, FS_CURVE_TAN, time, level);
     fs_print_error(fs_get_error());
   } else if (strcmp(argv[2], "cubic") == 0) {
-    fs_log(LOG_DEBUG, "Attack cubic(%s): time: %f, level:%f", argv[1], time, level);
+    FS_LOG_DEBUG("Attack cubic(%s): time: %f, level:%f", argv[1], time, level);
     fs_attack_decay(sb, FS_CURVE_CUBIC, time, level);
     fs_print_error(fs_get_error());
+  } else {
+    FS_LOG_ERR("Unknown hull type: %s", argv[2]);
+    return FS_ERROR;
   }
-  return FS_OK;
+  return fs_get_error();
 }
 
 int shell_cmd_sustain(int argc, char **argv)
 {
   double time;
   FSampleBuffer *sb;
-  CHECK_ARGC(2);
+  CHECK_ARGC(3);
   sb = get_buffer_by_name(argv[1]);
   if (sb != NULL) {
     time = atof(argv[2]);
     fs_sustain(sb, time);
-    fs_log(LOG_DEBUG, "Sustain(%s): time: %f", argv[1], time);
+    FS_LOG_DEBUG("Sustain(%s): time: %f", argv[1], time);
     fs_print_error(fs_get_error());
+    return fs_get_error();
   }
-  return FS_OK;
+  return FS_ERROR;
 }
 
 int shell_cmd_mod(int argc, char **argv)
@@ -277,55 +1084,131 @@ int shell_cmd_mod(int argc, char **argv)
   CHECK_ARGC(3);
   sb1 = get_buffer_by_name(argv[1]);
   sb2 = get_buffer_by_name(argv[2]);
-  if (sb1 != NULL || sb2 != NULL) {
+  if (sb1 != NULL && sb2 != NULL) {
     if (strcmp(argv[0], "mult") == 0) {
-      fs_log(LOG_DEBUG, "Multiply(%s, %s)", argv[1], argv[2]);
+      FS_LOG_DEBUG("Multiply(%s, %s)", argv[1], argv[2]);
       fs_modulate_buffer(sb1, sb2, FS_MOD_MULT);
       fs_print_error(fs_get_error());
     }
     if (strcmp(argv[0], "div") == 0) {
-      fs_log(LOG_DEBUG, "Divide(%s, %s)", argv[1], argv[2]);
+      FS_LOG_DEBUG("Divide(%s, %s)", argv[1], argv[2]);
       fs_modulate_buffer(sb1, sb2, FS_MOD_DIV);
       fs_print_error(fs_get_error());
     }
     if (strcmp(argv[0], "add") == 0) {
-      fs_log(LOG_DEBUG, "Add(%s, %s)", argv[1], argv[2]);
+      FS_LOG_DEBUG("Add(%s, %s)", argv[1], argv[2]);
       fs_modulate_buffer(sb1, sb2, FS_MOD_ADD);
       fs_print_error(fs_get_error());
     }
     if (strcmp(argv[0], "sub") == 0) {
-      fs_log(LOG_DEBUG, "Subtract(%s, %s)", argv[1], argv[2]);
+      FS_LOG_DEBUG("Subtract(%s, %s)", argv[1], argv[2]);
       fs_modulate_buffer(sb1, sb2, FS_MOD_SUB);
       fs_print_error(fs_get_error());
     }
     if (strcmp(argv[0], "cat") == 0) {
-      fs_log(LOG_DEBUG, "Concat(%s, %s)", argv[1], argv[2]);
+      FS_LOG_DEBUG("Concat(%s, %s)", argv[1], argv[2]);
       fs_cat_sample_buffers_inplace(sb1, sb2);
       fs_print_error(fs_get_error());
     }
   } else {
     if (sb1 == NULL) {
-      fs_log(LOG_ERR, "Invalid buffer identifier: %s", argv[1]);
+      FS_LOG_ERR("Invalid buffer identifier: %s", argv[1]);
     }
     if (sb2 == NULL) {
-      fs_log(LOG_ERR, "Invalid buffer identifier: %s", argv[2]);
+      FS_LOG_ERR("Invalid buffer identifier: %s", argv[2]);
     }
+    return FS_ERROR;
+  }
+  return fs_get_error();
+}
+
+int shell_cmd_memo(int argc, char **argv)
+{
+  double megabytes = 0;
+  if (argc < 2) {
+    memo_print_stats(stdout);
+  } else if (strcmp(argv[1], "on") == 0) {
+    if (argc > 2) {
+      megabytes = atof(argv[2]);
+      if (megabytes <= 0) {
+        FS_LOG_ERR("Invalid memo budget: %s", argv[2]);
+        return FS_ERROR;
+      }
+    }
+    memo_enable(1, (size_t)(megabytes * 1048576.0));
+  } else if (strcmp(argv[1], "off") == 0) {
+    memo_enable(0, 0);
+  } else if (strcmp(argv[1], "clear") == 0) {
+    memo_clear();
+  } else {
+    FS_LOG_ERR("Unknown memo option: %s", argv[1]);
+    return FS_ERROR;
   }
   return FS_OK;
 }
 
+int shell_cmd_cache(int argc, char **argv)
+{
+  double megabytes = 0;
+  if (argc >= 2) {
+    CHECK_NOT_BATCH("cache");
+  }
+  if (argc < 2) {
+    cache_print_stats(stdout);
+  } else if (strcmp(argv[1], "off") == 0) {
+    cache_close();
+  } else if (strcmp(argv[1], "clear") == 0) {
+    if (cache_clear() != FS_OK) {
+      FS_LOG_ERR("The cache is off");
+      return FS_ERROR;
+    }
+  } else {
+    if (argc > 2) {
+      megabytes = atof(argv[2]);
+      if (megabytes <= 0) {
+        FS_LOG_ERR("Invalid cache budget: %s", argv[2]);
+        return FS_ERROR;
+      }
+    }
+    if (cache_open(argv[1], (size_t)(megabytes * 1048576.0)) != FS_OK) {
+      FS_LOG_ERR("Can't open the cache directory: %s", argv[1]);
+      return FS_ERROR;
+    }
+  }
+  return FS_OK;
+}
+
+int shell_cmd_watch(int argc, char **argv)
+{
+  CHECK_ARGC(2);
+  return watch_script(argv[1]);
+}
+
 int shell_cmd_help(int argc, char **argv)
 {
   if (argc == 1) {
     printf("Available commands:\n");
     printf("\tbuffer\tCreates a new sample buffer object\n");
+    printf("\tclone\tCopies a buffer, the samples are shared until one of them changes\n");
+    printf("\tchannel\tCopies one channel of a buffer into a channel of another one\n");
     printf("\tsine\tGenerates a sine wave form\n");
     printf("\trect\tGenerates a rectangle wave form\n");
     printf("\ttri\tGenerates a triangle wave form\n");
     printf("\tsaw\tGenerates a saw tooth wave form\n");
+    printf("\tharmonics\tGenerates a tone from a series of sine partials\n");
+    printf("\tfm\tGenerates a tone with frequency modulated operators\n");
     printf("\thelp\tGet help in generel or for a specific command\n");
     printf("\texit\tExit FSynth\n");
     printf("\twaveout\tWrites the buffer content to a WAVE file\n");
+    printf("\twavein\tLoads a WAVE or RF64 file into a new buffer\n");
+    printf("\tpcmout\tStreams raw PCM data to a file, a pipe or stdout\n");
+    printf("\tpcmtone\tRenders a tone with fixed point arithmetic straight into a PCM file\n");
+    printf("\tschedule\tRenders timed note, parameter and tempo events into a new buffer\n");
+    printf("\tautomate\tApplies breakpoint automation lanes to the gain or a generated wave\n");
+    printf("\tstream\tConfigures the output ring or shows its statistics\n");
+    printf("\tprofile\tMeasures the time and throughput of every command\n");
+    printf("\tlog\tSelects the log output mode and level\n");
+    printf("\ttrace\tRecords command and kernel spans as Chrome trace file\n");
     printf("\tmult\tMultiplies the content of two buffers\n");
     printf("\tdiv\tDivides the content of two buffers\n");
     printf("\tadd\tAdds the content of two buffers\n");
@@ -334,15 +1217,37 @@ int shell_cmd_help(int argc, char **argv)
     printf("\trepeat\tRepeats the content of an sample buffer n-times\n");
     printf("\tscale\tScales the samples of a given buffer object\n");
     printf("\tinfo\tProvides detailed information about the given object\n");
+    printf("\tfree\tDeletes sample buffers\n");
+    printf("\tmem\tShows the memory of all buffers or sets a memory budget\n");
+    printf("\tstorage\tMoves buffers into memory mapped temporary files\n");
+    printf("\tresample\tConverts a buffer to another sample rate\n");
+    printf("\tfilter\tRuns a buffer through biquad or state variable filters\n");
+    printf("\tconvolve\tApplies an impulse response like the reverb of a room\n");
     printf("\tattack\tAdds an 'attack' hull curve to the output buffer\n");
     printf("\tdecay\tAdds an 'decay' hull curve to the output buffer\n");
     printf("\tsustain\tAdds an 'sustain' hull curve to the output buffer\n");
+    printf("\tmemo\tSkips commands whose inputs didn't change since they were executed\n");
+    printf("\twatch\tRuns a script again after every change of the file\n");
+    printf("\tcache\tKeeps rendered buffers on disk for later runs\n");
     printf("\nType help [command] to get help for a specific command\n");
   } else {
     if (strcmp(argv[1], "buffer") == 0) {
       printf("Creates a new sample buffer object\n");
-      printf("with given sample rate and playing duration\n");
-      printf("usage: buffer <buffer_name> <sample_rate> <duration>\n");
+      printf("with given sample rate and playing duration,\n");
+      printf("'file' keeps the samples in a memory mapped temporary file, 'channels'\n");
+      printf("stores up to 8 channels one after the other, generators fill every channel\n");
+      printf("usage: buffer <buffer_name> <sample_rate> <duration> [heap|file] [channels <count>]\n");
+    }
+    if (strcmp(argv[1], "clone") == 0) {
+      printf("Creates a copy of a buffer under a new name, both refer to the same samples\n");
+      printf("until a command modifies one of them, so a snapshot before a destructive\n");
+      printf("command costs no memory as long as it isn't needed\n");
+      printf("usage: clone <buffer_name> <new_buffer_name>\n");
+    }
+    if (strcmp(argv[1], "channel") == 0) {
+      printf("Copies a channel of the source buffer into the given channel of the buffer,\n");
+      printf("e.g. to build a stereo buffer from two mono buffers\n");
+      printf("usage: channel <buffer_name> <channel> <source_buffer_name> [source_channel]\n");
     }
     if (strcmp(argv[1], "sine") == 0) {
       printf("Generates a sine wave form\n");
@@ -360,6 +1265,89 @@ int shell_cmd_help(int argc, char **argv)
       printf("Generates a saw tooth wave form\n");
       printf("usage: saw <buffer_name> <frequency> <amplitude>\n");
     }
+    if (strcmp(argv[1], "harmonics") == 0) {
+      printf("Generates a tone from sine partials at multiples of the frequency, the level of\n");
+      printf("partial n is amplitude / n^slope, the default slope of 1 gives a band limited saw tooth\n");
+      printf("usage: harmonics <buffer_name> <frequency> <amplitude> <count> [slope]\n");
+    }
+    if (strcmp(argv[1], "fm") == 0) {
+      printf("Generates a tone with up to 8 operators, each one given by its frequency ratio, which\n");
+      printf("must not be negative, and level. Operator levels of modulators are phase deviations in\n");
+      printf("radians, 'stack' lets every operator modulate the one before, 'pairs' builds modulator\n");
+      printf("and carrier pairs and 'parallel' adds all operators. 'feedback' modulates the last\n");
+      printf("operator by itself\n");
+      printf("usage: fm <buffer_name> <frequency> <amplitude> <stack|parallel|pairs>\n");
+      printf("         <ratio> <level> [<ratio> <level>]... [feedback <radians>]\n");
+    }
+    if (strcmp(argv[1], "waveout") == 0) {
+      printf("Normalizes the buffer and writes it to a WAVE file with the channels of the buffer\n");
+      printf("conversion and disk writes run concurrently, 'direct' bypasses the page cache\n");
+      printf("a file name '-' streams to stdout, 'raw' omits the WAVE header\n");
+      printf("usage: waveout <buffer_name> <file_name|-> <bits{8|16|24|32}> [direct] [raw]\n");
+    }
+    if (strcmp(argv[1], "pcmout") == 0) {
+      printf("Normalizes the buffer and streams it as raw PCM data\n");
+      printf("pipes are fed with vmsplice, use '-' for stdout\n");
+      printf("usage: pcmout <buffer_name> <file_name|-> <bits{8|16|24|32}>\n");
+    }
+    if (strcmp(argv[1], "pcmtone") == 0) {
+      printf("Renders a tone into Q15 or Q31 samples, which are written to the file without conversion,\n");
+      printf("so it needs a quarter or half of the memory of a buffer. The level rises linearly during\n");
+      printf("'attack' and falls to zero during 'release', 'raw' omits the WAVE header\n");
+      printf("usage: pcmtone <file_name|-> <bits{16|32}> <sample_rate> <duration>\n");
+      printf("         <sine|cosine|saw|tri|rect|noise> <frequency> <amplitude>\n");
+      printf("         [attack <seconds>] [release <seconds>] [raw]\n");
+    }
+    if (strcmp(argv[1], "schedule") == 0) {
+      printf("Renders events at the exact sample of their time in beats, the audio between two\n");
+      printf("events is rendered as one block. Events are 'on:<note>[:<velocity>]', 'off:<note>',\n");
+      printf("'tempo:<bpm>', 'gain:<level>', 'detune:<cents>' and 'wave:<name>', notes are MIDI\n");
+      printf("numbers. Without 'length' the buffer ends when the last note has faded out\n");
+      printf("usage: schedule <buffer_name> <sample_rate> <bpm> <sine|cosine|saw|tri|rect|noise>\n");
+      printf("         <beat>:<event>... [attack <seconds>] [decay <seconds>] [sustain <level>]\n");
+      printf("         [release <seconds>] [length <seconds>] [gainlane <lane>] [detunelane <lane>]\n");
+      printf("'gainlane' multiplies the gain and 'detunelane' adds cents, lanes as for 'automate'\n");
+    }
+    if (strcmp(argv[1], "automate") == 0) {
+      printf("Multiplies a buffer with the levels of an automation lane or fills it with a wave whose\n");
+      printf("frequency and amplitude follow lanes. A lane is a list of breakpoints, each one with\n");
+      printf("its time in seconds, its level and the curve which leads to it: linear (default), tan,\n");
+      printf("square, cubic, hold or exp, e.g. 0:110,2:1760:exp,3:1760:hold,4:110\n");
+      printf("usage: automate <buffer_name> gain <lane>\n");
+      printf("usage: automate <buffer_name> <sine|cosine|saw|tri|rect|noise> <freq_lane> [amp_lane]\n");
+    }
+    if (strcmp(argv[1], "stream") == 0) {
+      printf("Sets the number and size of the blocks used by the output ring\n");
+      printf("or shows high water mark and stall counts of the last written file\n");
+      printf("usage: stream ring <blocks> <block_size_kb>\n");
+      printf("usage: stream stats\n");
+    }
+    if (strcmp(argv[1], "profile") == 0) {
+      printf("Records wall time, cpu time, processed samples, moved bytes and allocations\n");
+      printf("of every command, 'report' lists the commands sorted by their total wall time\n");
+      printf("and the most expensive single calls, 'dump' writes the report as CSV file\n");
+      printf("usage: profile <on|off|report|reset>\n");
+      printf("usage: profile dump <file_name>\n");
+    }
+    if (strcmp(argv[1], "trace") == 0) {
+      printf("Records begin and end of every command, kernel and output block with thread\n");
+      printf("and buffer name, 'stop' writes a trace event JSON file for chrome://tracing or Perfetto\n");
+      printf("usage: trace start <file_name>\n");
+      printf("usage: trace stop\n");
+    }
+    if (strcmp(argv[1], "log") == 0) {
+      printf("Selects how log messages are written, 'async' formats them into a ring per thread\n");
+      printf("which is printed by a background thread, 'binary' stores the raw arguments in a file\n");
+      printf("which can be decoded with 'fsynth -d <file>', 'sync' prints every message immediately\n");
+      printf("usage: log <sync|async|stats>\n");
+      printf("usage: log binary <file_name>\n");
+      printf("usage: log level <debug|info|warn|error>\n");
+    }
+    if (strcmp(argv[1], "wavein") == 0) {
+      printf("Loads one channel of a WAVE or RF64 file into a new sample buffer, 'all' loads\n");
+      printf("every channel, mono float files in the native sample format are mapped without copying\n");
+      printf("usage: wavein <buffer_name> <file_name> [channel|all]\n");
+    }
     if (strcmp(argv[1], "mult") == 0) {
       printf("Multiplies the content of two sample buffers\n");
       printf("and store the result back into the first one\n");
@@ -385,6 +1373,47 @@ int shell_cmd_help(int argc, char **argv)
       printf("and store the combined content back into the first one\n");
       printf("usage: sub <buffer_name_1> <buffer_name_2>\n");
     }
+    if (strcmp(argv[1], "free") == 0) {
+      printf("Deletes sample buffers and releases their memory\n");
+      printf("usage: free <buffer_name> [buffer_name ...]\n");
+    }
+    if (strcmp(argv[1], "mem") == 0) {
+      printf("Lists size, peak size, state and idle commands of every buffer and the totals,\n");
+      printf("a budget limits the memory of all buffers, after each command the least recently\n");
+      printf("used buffers are spilled to a temporary file and reloaded on the next access,\n");
+      printf("or dropped, until the buffers fit into the budget again\n");
+      printf("usage: mem\n");
+      printf("usage: mem budget <megabytes> [spill|drop]\n");
+      printf("usage: mem off\n");
+    }
+    if (strcmp(argv[1], "storage") == 0) {
+      printf("Moves the samples of a buffer to the heap or into a memory mapped temporary file,\n");
+      printf("file storage lets buffers grow beyond the physical memory, with a threshold all\n");
+      printf("new or growing buffers of at least the given size use file storage\n");
+      printf("usage: storage <buffer_name> <heap|file>\n");
+      printf("usage: storage threshold <megabytes>\n");
+      printf("usage: storage off\n");
+    }
+    if (strcmp(argv[1], "resample") == 0) {
+      printf("Converts a buffer to another sample rate with a polyphase windowed sinc filter,\n");
+      printf("the result replaces the buffer or is stored as a new buffer\n");
+      printf("usage: resample <buffer_name> <sample_rate> [new_buffer_name]\n");
+    }
+    if (strcmp(argv[1], "filter") == 0) {
+      printf("Runs a buffer through a cascade of equal second order sections, the default\n");
+      printf("q is 0.7071, gain in dB applies to peak and shelf filters, 'svf' uses state variable\n");
+      printf("filters and 'mod' moves the cut-off by the value of a buffer times the given octaves,\n");
+      printf("'lane' by the level of an automation lane like 'automate' takes it\n");
+      printf("usage: filter <buffer_name> <lowpass|highpass|bandpass|notch|peak|lowshelf|highshelf>\n");
+      printf("         <cutoff> [q] [gain] [svf] [cascade <sections>] [mod <buffer_name> <octaves>]\n");
+      printf("         [lane <time>:<level>[:<curve>],... <octaves>]\n");
+    }
+    if (strcmp(argv[1], "convolve") == 0) {
+      printf("Convolves a buffer with an impulse response of the same sample rate, for example\n");
+      printf("a recorded room, and appends the tail. 'wet' mixes the result with the dry signal,\n");
+      printf("the default of 1 keeps only the convolved signal\n");
+      printf("usage: convolve <buffer_name> <ir_buffer_name> [wet]\n");
+    }
     if (strcmp(argv[1], "repeat") == 0) {
       printf("Repeats an sample buffer n-times\n");
       printf("usage: repeat <buffer_name> <times>\n");
@@ -409,50 +1438,158 @@ int shell_cmd_help(int argc, char **argv)
       printf("Adds an 'sustain' hull curve to the given buffer\n");
       printf("usage: attck <buffer_name> <time>\n");
     }
+    if (strcmp(argv[1], "memo") == 0) {
+      printf("Remembers the buffers written by every command together with a hash of the command\n");
+      printf("line and the versions of its input buffers and files. A command with the same hash\n");
+      printf("isn't executed again, its buffers use the remembered samples. Results which are faster\n");
+      printf("computed than copied aren't kept, the default budget is 256 megabytes\n");
+      printf("usage: memo [on [megabytes]|off|clear]\n");
+    }
+    if (strcmp(argv[1], "watch") == 0) {
+      printf("Runs a script and again every time the file is saved, with the memo enabled only\n");
+      printf("the changed commands and the commands depending on them are executed. Every run\n");
+      printf("starts without buffers, stop with Ctrl-C\n");
+      printf("usage: watch <script_file>\n");
+    }
+    if (strcmp(argv[1], "cache") == 0) {
+      printf("Stores the buffers of expensive commands in a directory, named by a hash of the\n");
+      printf("commands and parameters which produced them and the library version. Later runs\n");
+      printf("and other batch jobs map the files instead of computing the buffers again, the\n");
+      printf("least recently used files are removed beyond the budget, 1024 megabytes by default\n");
+      printf("usage: cache <directory> [megabytes]\n");
+      printf("usage: cache [off|clear]\n");
+    }
   }
   return FS_OK;
 }
 
 void shell_register(void)
 {
-  register_shell_command((FShellCallback*)&shell_cmd_exit, "exit");
-  register_shell_command((FShellCallback*)&shell_cmd_buffer, "buffer");
-  register_shell_command((FShellCallback*)&shell_cmd_func, "sine");
-  register_shell_command((FShellCallback*)&shell_cmd_func, "rect");
-  register_shell_command((FShellCallback*)&shell_cmd_func, "tri");
-  register_shell_command((FShellCallback*)&shell_cmd_func, "saw");
-  register_shell_command((FShellCallback*)&shell_cmd_wave_out, "waveout");
-  register_shell_command((FShellCallback*)&shell_cmd_help, "help");
-  register_shell_command((FShellCallback*)&shell_cmd_mod, "mult");
-  register_shell_command((FShellCallback*)&shell_cmd_mod, "div");
-  register_shell_command((FShellCallback*)&shell_cmd_mod, "add");
-  register_shell_command((FShellCallback*)&shell_cmd_mod, "sub");
-  register_shell_command((FShellCallback*)&shell_cmd_mod, "cat");
-  register_shell_command((FShellCallback*)&shell_cmd_repeat, "repeat");
-  register_shell_command((FShellCallback*)&shell_cmd_scale, "scale");
-  register_shell_command((FShellCallback*)&shell_cmd_info, "info");
-  register_shell_command((FShellCallback*)&shell_cmd_attack, "attack");
-  register_shell_command((FShellCallback*)&shell_cmd_attack, "decay");
-  register_shell_command((FShellCallback*)&shell_cmd_sustain, "sustain");
+  register_shell_command((FShellCallback*)&shell_cmd_exit, "exit", NULL);
+  register_shell_command((FShellCallback*)&shell_cmd_buffer, "buffer", "n");
+  register_shell_command((FShellCallback*)&shell_cmd_clone, "clone", "rn");
+  register_shell_command((FShellCallback*)&shell_cmd_channel, "channel", "b-r");
+  register_shell_command((FShellCallback*)&shell_cmd_func, "sine", "b");
+  register_shell_command((FShellCallback*)&shell_cmd_func, "rect", "b");
+  register_shell_command((FShellCallback*)&shell_cmd_func, "tri", "b");
+  register_shell_command((FShellCallback*)&shell_cmd_func, "saw", "b");
+  register_shell_command((FShellCallback*)&shell_cmd_harmonics, "harmonics", "b");
+  register_shell_command((FShellCallback*)&shell_cmd_fm, "fm", "b");
+  register_shell_command((FShellCallback*)&shell_cmd_wave_out, "waveout", "bF");
+  register_shell_command((FShellCallback*)&shell_cmd_wave_in, "wavein", "nf");
+  register_shell_command((FShellCallback*)&shell_cmd_wave_out, "pcmout", "bF");
+  register_shell_command((FShellCallback*)&shell_cmd_pcm_tone, "pcmtone", NULL);
+  register_shell_command((FShellCallback*)&shell_cmd_schedule, "schedule", "n");
+  register_shell_command((FShellCallback*)&shell_cmd_automate, "automate", "b");
+  register_shell_command((FShellCallback*)&shell_cmd_stream, "stream", NULL);
+  register_shell_command((FShellCallback*)&shell_cmd_profile, "profile", NULL);
+  register_shell_command((FShellCallback*)&shell_cmd_log, "log", NULL);
+  register_shell_command((FShellCallback*)&shell_cmd_trace, "trace", NULL);
+  register_shell_command((FShellCallback*)&shell_cmd_help, "help", NULL);
+  register_shell_command((FShellCallback*)&shell_cmd_mod, "mult", "br");
+  register_shell_command((FShellCallback*)&shell_cmd_mod, "div", "br");
+  register_shell_command((FShellCallback*)&shell_cmd_mod, "add", "br");
+  register_shell_command((FShellCallback*)&shell_cmd_mod, "sub", "br");
+  register_shell_command((FShellCallback*)&shell_cmd_mod, "cat", "br");
+  register_shell_command((FShellCallback*)&shell_cmd_repeat, "repeat", "b");
+  register_shell_command((FShellCallback*)&shell_cmd_scale, "scale", "b");
+  register_shell_command((FShellCallback*)&shell_cmd_info, "info", NULL);
+  register_shell_command((FShellCallback*)&shell_cmd_free, "free", NULL);
+  register_shell_command((FShellCallback*)&shell_cmd_mem, "mem", NULL);
+  register_shell_command((FShellCallback*)&shell_cmd_storage, "storage", NULL);
+  register_shell_command((FShellCallback*)&shell_cmd_resample, "resample", "b-n");
+  register_shell_command((FShellCallback*)&shell_cmd_filter, "filter", "b");
+  register_shell_command((FShellCallback*)&shell_cmd_convolve, "convolve", "br");
+  register_shell_command((FShellCallback*)&shell_cmd_attack, "attack", "b");
+  register_shell_command((FShellCallback*)&shell_cmd_attack, "decay", "b");
+  register_shell_command((FShellCallback*)&shell_cmd_sustain, "sustain", "b");
+  register_shell_command((FShellCallback*)&shell_cmd_memo, "memo", NULL);
+  register_shell_command((FShellCallback*)&shell_cmd_watch, "watch", NULL);
+  register_shell_command((FShellCallback*)&shell_cmd_cache, "cache", NULL);
 }
 
 void shell_cleanup(void)
 {
-  struct NodeItem *item = sb_list.head;
-  while (item != NULL) {
-    fs_delete_sample_buffer((FSampleBuffer**)&item->data);
-    item = item->next;
+  size_t iter = 0;
+  struct HashEntry *entry;
+  delete_buffers();
+  memo_enable(0, 0);
+  cache_close();
+  while ((entry = hmap_next(&cb_map, &iter)) != NULL) {
+    free(entry->value);
   }
-  delete_list(&sb_list);
-  delete_list(&cb_list);
+  hmap_free(&cb_map);
+  profile_reset();
 }
 
 void shell_loop(void)
 {
   char *input;
+  if (!isatty(STDOUT_FILENO)) {
+    /* Keep stdout clean for audio data, which is streamed by waveout - */
+    rl_outstream = stderr;
+  }
   do {
     input = readline("fs>");
     add_history(input);
     if (shell_pchar(input) & FS_EXIT) break;
   } while (1);
 }
+
+/* Trims the line and collapses white space, so that every parameter is separated by one blank */
+void normalize_line(char *line)
+{
+  char *src = line, *dst = line;
+  int blank = 0;
+  while (*src != 0 && isspace((int)*src)) ++src;
+  while (*src != 0) {
+    if (isspace((int)*src)) {
+      blank = 1;
+    } else {
+      if (blank) *dst++ = ' ';
+      *dst++ = *src;
+      blank = 0;
+    }
+    ++src;
+  }
+  *dst = 0;
+}
+
+int shell_run_script(const char *fname)
+{
+  FILE *fin;
+  char *line = NULL;
+  size_t line_size = 0, line_no = 0, commands = 0;
+  int result = FS_OK;
+  struct timespec t_start, t_end;
+  fin = (strcmp(fname, "-") == 0) ? stdin : fopen(fname, "r");
+  if (fin == NULL) {
+    FS_LOG_ERR("Can't open script file: %s", fname);
+    return FS_ERROR | FS_FILE_IO_ERROR;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t_start);
+  while (getline(&line, &line_size, fin) >= 0) {
+    ++line_no;
+    normalize_line(line);
+    if (line[0] == 0 || line[0] == '#') continue;
+    ++commands;
+    result = shell_pchar(line);
+    if (result & FS_EXIT) {
+      result = FS_OK;
+      break;
+    }
+    if (FAILED(result)) {
+      FS_LOG_ERR("%s:%u: command failed: %s", fname, (unsigned int)line_no, line);
+      break;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t_end);
+  FS_LOG_INFO("%s: %u commands in %.3f s%s", fname, (unsigned int)commands,
+    (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) * 1e-9,
+    FAILED(result) ? ", aborted" : "");
+  free(line);
+  if (fin != stdin) {
+    fclose(fin);
+  }
+  return result;
+}
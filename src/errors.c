@@ -15,7 +15,7 @@
 #include "fsynth.h"
 #include "logging.h"
 
-int error_code = 0;
+__thread int error_code = 0;  /* Every thread has its own error state */
 
 void fs_set_error(int code)
 {
@@ -42,28 +42,28 @@ void fs_print_error(int code)
 {
   if (code & FS_ERROR) {
     if (code & FS_INVALID_BUFFER) {
-      fs_log(LOG_ERR, "Invalid buffer instance");
+      FS_LOG_ERR("Invalid buffer instance");
     }
     if (code & FS_INVALID_ARGUMENT) {
-      fs_log(LOG_ERR, "Invalid argument");
+      FS_LOG_ERR("Invalid argument");
     }
     if (code & FS_INVALID_OPERATION) {
-      fs_log(LOG_ERR, "Invalid operation");
+      FS_LOG_ERR("Invalid operation");
     }
     if (code & FS_DIVIDED_BY_ZERO) {
-      fs_log(LOG_ERR, "Division by zero");
+      FS_LOG_ERR("Division by zero");
     }
     if (code & FS_FILE_IO_ERROR) {
-      fs_log(LOG_ERR, "File IO error");
+      FS_LOG_ERR("File IO error");
     }
     if (code & FS_WRONG_BUF_SIZE) {
-      fs_log(LOG_ERR, "Wrong buffer size");
+      FS_LOG_ERR("Wrong buffer size");
     }
     if (code & FS_DIFF_SAMPLE_RATE) {
-      fs_log(LOG_ERR, "Input buffers with different sample rates\n");
+      FS_LOG_ERR("Input buffers with different sample rates\n");
     }
     if (code & FS_INDEX_OUT_OF_RANGE) {
-      fs_log(LOG_ERR, "Buffer index out of range\n");
+      FS_LOG_ERR("Buffer index out of range\n");
     }
   }
 }
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Real input FFT with a radix 4 Stockham kernel on split complex arrays
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <memory.h>
+#include <math.h>
+
+#include "fft.h"
+#include "fsynth.h"
+
+int fft_init(struct FFTPlan *plan, size_t size)
+{
+  size_t k;
+  memset(plan, 0, sizeof(struct FFTPlan));
+  if (size < 4 || (size & (size - 1)) != 0) {
+    return FS_ERROR;
+  }
+  plan->size = size;
+  plan->half = size / 2;
+  plan->w_re = (double*) malloc(sizeof(double) * plan->half * 2);
+  plan->r_re = (double*) malloc(sizeof(double) * plan->half * 2);
+  plan->work = (double*) malloc(sizeof(double) * plan->half * 4);
+  if (plan->w_re == NULL || plan->r_re == NULL || plan->work == NULL) {
+    fft_free(plan);
+    return FS_ERROR;
+  }
+  plan->w_im = plan->w_re + plan->half;
+  plan->r_im = plan->r_re + plan->half;
+  for (k = 0; k < plan->half; ++k) {
+    plan->w_re[k] = cos(2 * M_PI * k / plan->half);
+    plan->w_im[k] = -sin(2 * M_PI * k / plan->half);
+    plan->r_re[k] = cos(2 * M_PI * k / size);
+    plan->r_im[k] = -sin(2 * M_PI * k / size);
+  }
+  return FS_OK;
+}
+
+void fft_free(struct FFTPlan *plan)
+{
+  free(plan->w_re);
+  free(plan->r_re);
+  free(plan->work);
+  memset(plan, 0, sizeof(struct FFTPlan));
+}
+
+/* Vector of complex parts from adjacent butterflies, loaded and stored without alignment */
+typedef double fft_vec_t __attribute__((vector_size(sizeof(double) * FFT_LANES)));
+
+#define FFT_LOAD(v, ptr)   memcpy(&(v), (ptr), sizeof(fft_vec_t))
+#define FFT_STORE(ptr, v)  memcpy((ptr), &(v), sizeof(fft_vec_t))
+
+/* Radix 4 butterfly with the twiddles w1..w3, T is double or fft_vec_t. The loads and stores
+ * are done by the caller, jbmd is i * (b - d). */
+#define FFT_BUTTERFLY(T) \
+  T apcr = ar + cr, apci = ai + ci, amcr = ar - cr, amci = ai - ci; \
+  T bpdr = br + dr, bpdi = bi + di, jbmdr = di - bi, jbmdi = br - dr, tr, ti; \
+  y0r = apcr + bpdr; \
+  y0i = apci + bpdi; \
+  tr = amcr - jbmdr; \
+  ti = amci - jbmdi; \
+  y1r = w1r * tr - w1i * ti; \
+  y1i = w1r * ti + w1i * tr; \
+  tr = apcr - bpdr; \
+  ti = apci - bpdi; \
+  y2r = w2r * tr - w2i * ti; \
+  y2i = w2r * ti + w2i * tr; \
+  tr = amcr + jbmdr; \
+  ti = amci + jbmdi; \
+  y3r = w3r * tr - w3i * ti; \
+  y3i = w3r * ti + w3i * tr
+
+/* One radix 4 pass of the Stockham algorithm, n is the length of the sub transforms and s their
+ * number. The output is in natural order after the last pass, no bit reversal is needed. The sub
+ * transforms are interleaved with stride s, so the butterflies of one twiddle are contiguous and
+ * FFT_LANES of them are computed at once, except within the first pass. */
+void fft_radix4_pass(const struct FFTPlan *plan, size_t n, size_t s, const double *xr, const double *xi,
+  double *yr, double *yi)
+{
+  size_t m = n / 4, p, q, a, b, c, d, y;
+  double w1r, w1i, w2r, w2i, w3r, w3i;
+  for (p = 0; p < m; ++p) {
+    w1r = plan->w_re[s * p];
+    w1i = plan->w_im[s * p];
+    w2r = plan->w_re[2 * s * p];
+    w2i = plan->w_im[2 * s * p];
+    w3r = plan->w_re[3 * s * p];
+    w3i = plan->w_im[3 * s * p];
+    a = s * p;
+    b = a + s * m;
+    c = b + s * m;
+    d = c + s * m;
+    y = s * 4 * p;
+    for (q = 0; q + FFT_LANES <= s; q += FFT_LANES) {
+      fft_vec_t ar, ai, br, bi, cr, ci, dr, di, y0r, y0i, y1r, y1i, y2r, y2i, y3r, y3i;
+      FFT_LOAD(ar, &xr[a + q]);
+      FFT_LOAD(ai, &xi[a + q]);
+      FFT_LOAD(br, &xr[b + q]);
+      FFT_LOAD(bi, &xi[b + q]);
+      FFT_LOAD(cr, &xr[c + q]);
+      FFT_LOAD(ci, &xi[c + q]);
+      FFT_LOAD(dr, &xr[d + q]);
+      FFT_LOAD(di, &xi[d + q]);
+      {
+        FFT_BUTTERFLY(fft_vec_t);
+      }
+      FFT_STORE(&yr[y + q], y0r);
+      FFT_STORE(&yi[y + q], y0i);
+      FFT_STORE(&yr[y + s + q], y1r);
+      FFT_STORE(&yi[y + s + q], y1i);
+      FFT_STORE(&yr[y + 2 * s + q], y2r);
+      FFT_STORE(&yi[y + 2 * s + q], y2i);
+      FFT_STORE(&yr[y + 3 * s + q], y3r);
+      FFT_STORE(&yi[y + 3 * s + q], y3i);
+    }
+    for (; q < s; ++q) {
+      double ar = xr[a + q], ai = xi[a + q], br = xr[b + q], bi = xi[b + q];
+      double cr = xr[c + q], ci = xi[c + q], dr = xr[d + q], di = xi[d + q];
+      double y0r, y0i, y1r, y1i, y2r, y2i, y3r, y3i;
+      {
+        FFT_BUTTERFLY(double);
+      }
+      yr[y + q] = y0r;
+      yi[y + q] = y0i;
+      yr[y + s + q] = y1r;
+      yi[y + s + q] = y1i;
+      yr[y + 2 * s + q] = y2r;
+      yi[y + 2 * s + q] = y2i;
+      yr[y + 3 * s + q] = y3r;
+      yi[y + 3 * s + q] = y3i;
+    }
+  }
+}
+
+/* Forward transform of 'half' complex points in place, exp(-2 pi i n k / half) */
+void fft_complex(const struct FFTPlan *plan, double *re, double *im)
+{
+  size_t n = plan->half, s = 1, q;
+  double *xr = re, *xi = im, *yr = plan->work + 2 * plan->half, *yi = yr + plan->half, *t;
+  double ar, ai, br, bi;
+  for (; n >= 4; n /= 4, s *= 4) {
+    fft_radix4_pass(plan, n, s, xr, xi, yr, yi);
+    t = xr; xr = yr; yr = t;
+    t = xi; xi = yi; yi = t;
+  }
+  if (n == 2) {
+    /* Odd powers of two end with a radix 2 pass without twiddles */
+    for (q = 0; q < s; ++q) {
+      ar = xr[q];
+      ai = xi[q];
+      br = xr[q + s];
+      bi = xi[q + s];
+      yr[q] = ar + br;
+      yi[q] = ai + bi;
+      yr[q + s] = ar - br;
+      yi[q + s] = ai - bi;
+    }
+    t = xr; xr = yr; yr = t;
+    t = xi; xi = yi; yi = t;
+  }
+  if (xr != re) {
+    memcpy(re, xr, sizeof(double) * plan->half);
+    memcpy(im, xi, sizeof(double) * plan->half);
+  }
+}
+
+/* Transforms 'size' real samples into size / 2 + 1 bins. The even and odd samples are packed into
+ * one complex transform of half the length, which is split into the real spectrum afterwards. */
+void fft_real_forward(const struct FFTPlan *plan, const double *in, double *re, double *im)
+{
+  size_t k, j, h = plan->half;
+  double zkr, zki, zjr, zji, ar, ai, br, bi, wr, wi;
+  for (k = 0; k < h; ++k) {
+    re[k] = in[2 * k];
+    im[k] = in[2 * k + 1];
+  }
+  fft_complex(plan, re, im);
+  zkr = re[0];
+  zki = im[0];
+  re[0] = zkr + zki;
+  im[0] = 0;
+  re[h] = zkr - zki;
+  im[h] = 0;
+  for (k = 1; k <= h / 2; ++k) {
+    j = h - k;
+    zkr = re[k];
+    zki = im[k];
+    zjr = re[j];
+    zji = im[j];
+    ar = zkr + zjr;
+    ai = zki - zji;
+    br = zkr - zjr;
+    bi = zki + zji;
+    wr = plan->r_re[k];
+    wi = plan->r_im[k];
+    re[k] = 0.5 * (ar + wr * bi + wi * br);
+    im[k] = 0.5 * (ai - wr * br + wi * bi);
+    re[j] = 0.5 * (ar - wr * bi - wi * br);
+    im[j] = 0.5 * (-ai - wr * br + wi * bi);
+  }
+}
+
+/* Inverse of fft_real_forward including the 1 / size scaling, the input is left unchanged */
+void fft_real_inverse(const struct FFTPlan *plan, const double *re, const double *im, double *out)
+{
+  size_t k, j, h = plan->half;
+  double *zr = plan->work, *zi = plan->work + h;
+  double scale = 1.0 / plan->size, sr, si, dr, di, er, ei, odr, odi, wr, wi;
+  zr[0] = (re[0] + re[h]) * scale;
+  zi[0] = (re[0] - re[h]) * scale;
+  for (k = 1; k <= h / 2; ++k) {
+    j = h - k;
+    sr = re[k] + re[j];
+    si = im[k] - im[j];
+    dr = re[k] - re[j];
+    di = im[k] + im[j];
+    wr = plan->r_re[k];
+    wi = plan->r_im[k];
+    er = sr * scale;
+    ei = si * scale;
+    odr = (dr * wr + di * wi) * scale;
+    odi = (di * wr - dr * wi) * scale;
+    zr[k] = er - odi;
+    zi[k] = ei + odr;
+    zr[j] = er + odi;
+    zi[j] = odr - ei;
+  }
+  /* Exchanging real and imaginary parts turns the forward transform into the inverse one */
+  fft_complex(plan, zi, zr);
+  for (k = 0; k < h; ++k) {
+    out[2 * k] = zr[k];
+    out[2 * k + 1] = zi[k];
+  }
+}
+
+/* Complex multiply and accumulate of two spectra over all bins, acc += x * h */
+void fft_spectrum_mac(double *acc_re, double *acc_im, const double *x_re, const double *x_im,
+  const double *h_re, const double *h_im, size_t bins)
+{
+  size_t k;
+  fft_vec_t ar, ai, xr, xi, hr, hi;
+  for (k = 0; k + FFT_LANES <= bins; k += FFT_LANES) {
+    FFT_LOAD(ar, &acc_re[k]);
+    FFT_LOAD(ai, &acc_im[k]);
+    FFT_LOAD(xr, &x_re[k]);
+    FFT_LOAD(xi, &x_im[k]);
+    FFT_LOAD(hr, &h_re[k]);
+    FFT_LOAD(hi, &h_im[k]);
+    ar += xr * hr - xi * hi;
+    ai += xr * hi + xi * hr;
+    FFT_STORE(&acc_re[k], ar);
+    FFT_STORE(&acc_im[k], ai);
+  }
+  for (; k < bins; ++k) {
+    acc_re[k] += x_re[k] * h_re[k] - x_im[k] * h_im[k];
+    acc_im[k] += x_re[k] * h_im[k] + x_im[k] * h_re[k];
+  }
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Real input FFT with a radix 4 Stockham kernel on split complex arrays
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#ifndef _FFT_H_
+#define _FFT_H_
+
+#include <stddef.h>
+
+#define FFT_LANES  2   /* Butterflies or bins per vector, one SSE2 register */
+
+/* Spectra are kept as separate arrays of real and imaginary parts, so that the butterflies
+ * and the spectral products run over contiguous memory and map onto vector registers */
+struct FFTPlan {
+  size_t size;          /* Number of real samples, a power of two and at least 4 */
+  size_t half;          /* Length of the complex transform, size / 2 */
+  double *w_re;         /* Twiddles exp(-2 pi i k / half) of the complex transform */
+  double *w_im;
+  double *r_re;         /* Twiddles exp(-2 pi i k / size) which split the packed real transform */
+  double *r_im;
+  double *work;         /* Two complex scratch arrays of 'half' points each */
+};
+
+int fft_init(struct FFTPlan *plan, size_t size);
+void fft_free(struct FFTPlan *plan);
+void fft_complex(const struct FFTPlan *plan, double *re, double *im);
+void fft_real_forward(const struct FFTPlan *plan, const double *in, double *re, double *im);
+void fft_real_inverse(const struct FFTPlan *plan, const double *re, const double *im, double *out);
+void fft_spectrum_mac(double *acc_re, double *acc_im, const double *x_re, const double *x_im,
+  const double *h_re, const double *h_im, size_t bins);
+
+#endif /* _FFT_H_ */
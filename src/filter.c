@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Biquad and state variable filters with cascades and modulated cut-off
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <memory.h>
+#include <math.h>
+#include "fsynth.h"
+#include "trace.h"
+
+#define FILTER_BLOCK      512   /* Samples which pass all sections before the next block */
+#define FILTER_MOD_BLOCK  32    /* Samples between two coefficient updates of a modulated filter */
+#define FILTER_DENORMAL   1e-30 /* States below this level are flushed to zero */
+#define FILTER_LANES      2     /* Sections of a cascade which are computed side by side, one SSE2 register */
+#define FILTER_DELAY      (2 * (FILTER_LANES - 1))  /* Steps until a sample has passed all lanes */
+
+typedef struct {
+  double b0, b1, b2, a1, a2;  /* Biquad coefficients, normalized to a0 = 1 */
+  double g1, g2, g3;          /* Integrator gains of the state variable filter */
+  double m0, m1, m2;          /* Output mix of input, band pass and low pass of the state variable filter */
+  double s1, s2;              /* State of either structure */
+} FilterState;
+
+/* One vector element per section, more lanes than registers would spill the states to the stack */
+typedef double lane_t __attribute__((vector_size(sizeof(double) * FILTER_LANES)));
+
+/* Coefficients and states of up to FILTER_LANES sections */
+typedef struct {
+  lane_t c[6];      /* b0, b1, b2, a1, a2 of biquads or g1, g2, g3, m0, m1, m2 of SVFs */
+  lane_t s1;
+  lane_t s2;
+  lane_t y;         /* Output of every lane from the last step */
+  lane_t y1;        /* and from the step before, which is the input of the next lane */
+} FilterGroup;
+
+FSFilter *fs_create_filter(int structure)
+{
+  FSFilter *filter;
+  fs_clear_error();
+  if (structure != FS_FILTER_BIQUAD && structure != FS_FILTER_SVF) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return NULL;
+  }
+  filter = (FSFilter*) malloc(sizeof(FSFilter));
+  if (filter == NULL) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  memset(filter, 0, sizeof(FSFilter));
+  filter->structure = structure;
+  return filter;
+}
+
+void fs_delete_filter(FSFilter **filter)
+{
+  if (filter != NULL && (*filter) != NULL) {
+    free(*filter);
+    *filter = NULL;
+  }
+}
+
+int fs_add_filter_section(FSFilter *filter, int filter_type, double cutoff, double q, double gain)
+{
+  FSFilterSection *section;
+  fs_clear_error();
+  if (filter == NULL || filter_type < FS_FILTER_LOWPASS || filter_type > FS_FILTER_HIGHSHELF ||
+      cutoff <= 0 || q <= 0) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  if (filter->section_count >= FS_MAX_FILTER_SECTIONS) {
+    fs_set_error(FS_INDEX_OUT_OF_RANGE);
+    return fs_get_error();
+  }
+  section = &filter->sections[filter->section_count++];
+  section->filter_type = filter_type;
+  section->cutoff = cutoff;
+  section->q = q;
+  section->gain = gain;
+  return fs_get_error();
+}
+
+int fs_set_filter_modulation(FSFilter *filter, const FSampleBuffer *cutoff_mod, double depth)
+{
+  fs_clear_error();
+  if (filter == NULL || (cutoff_mod != NULL && INVALID_BUFFER(cutoff_mod))) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  filter->cutoff_mod = cutoff_mod;
+  filter->cutoff_lane = NULL;
+  filter->mod_depth = depth;
+  return fs_get_error();
+}
+
+int fs_set_filter_automation(FSFilter *filter, const FSAutomation *cutoff_lane, double depth)
+{
+  fs_clear_error();
+  if (filter == NULL) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  filter->cutoff_lane = cutoff_lane;
+  filter->cutoff_mod = NULL;
+  filter->mod_depth = depth;
+  return fs_get_error();
+}
+
+/* Audio EQ cookbook coefficients (R. Bristow-Johnson) */
+void biquad_coefficients(FilterState *f, const FSFilterSection *section, double w0)
+{
+  double a0, cw = cos(w0), alpha = sin(w0) / (2 * section->q);
+  double amp = pow(10, section->gain / 40), sq = 2 * sqrt(amp) * alpha;
+  switch (section->filter_type) {
+  case FS_FILTER_LOWPASS:
+    f->b0 = f->b2 = (1 - cw) / 2; f->b1 = 1 - cw;
+    a0 = 1 + alpha; f->a1 = -2 * cw; f->a2 = 1 - alpha;
+    break;
+  case FS_FILTER_HIGHPASS:
+    f->b0 = f->b2 = (1 + cw) / 2; f->b1 = -(1 + cw);
+    a0 = 1 + alpha; f->a1 = -2 * cw; f->a2 = 1 - alpha;
+    break;
+  case FS_FILTER_BANDPASS:
+    f->b0 = alpha; f->b1 = 0; f->b2 = -alpha;
+    a0 = 1 + alpha; f->a1 = -2 * cw; f->a2 = 1 - alpha;
+    break;
+  case FS_FILTER_NOTCH:
+    f->b0 = f->b2 = 1; f->b1 = -2 * cw;
+    a0 = 1 + alpha; f->a1 = -2 * cw; f->a2 = 1 - alpha;
+    break;
+  case FS_FILTER_PEAK:
+    f->b0 = 1 + alpha * amp; f->b1 = -2 * cw; f->b2 = 1 - alpha * amp;
+    a0 = 1 + alpha / amp; f->a1 = -2 * cw; f->a2 = 1 - alpha / amp;
+    break;
+  case FS_FILTER_LOWSHELF:
+    f->b0 = amp * ((amp + 1) - (amp - 1) * cw + sq);
+    f->b1 = 2 * amp * ((amp - 1) - (amp + 1) * cw);
+    f->b2 = amp * ((amp + 1) - (amp - 1) * cw - sq);
+    a0 = (amp + 1) + (amp - 1) * cw + sq;
+    f->a1 = -2 * ((amp - 1) + (amp + 1) * cw);
+    f->a2 = (amp + 1) + (amp - 1) * cw - sq;
+    break;
+  default:
+    f->b0 = amp * ((amp + 1) + (amp - 1) * cw + sq);
+    f->b1 = -2 * amp * ((amp - 1) + (amp + 1) * cw);
+    f->b2 = amp * ((amp + 1) + (amp - 1) * cw - sq);
+    a0 = (amp + 1) - (amp - 1) * cw + sq;
+    f->a1 = 2 * ((amp - 1) - (amp + 1) * cw);
+    f->a2 = (amp + 1) - (amp - 1) * cw - sq;
+    break;
+  }
+  f->b0 /= a0; f->b1 /= a0; f->b2 /= a0;
+  f->a1 /= a0; f->a2 /= a0;
+}
+
+/* Trapezoidal integrated state variable filter (A. Simper, Cytomic) */
+void svf_coefficients(FilterState *f, const FSFilterSection *section, double w0)
+{
+  double amp = pow(10, section->gain / 40), g = tan(w0 / 2), k = 1 / section->q;
+  f->m0 = 0; f->m1 = 0; f->m2 = 0;
+  switch (section->filter_type) {
+  case FS_FILTER_LOWPASS:
+    f->m2 = 1;
+    break;
+  case FS_FILTER_HIGHPASS:
+    f->m0 = 1; f->m1 = -k; f->m2 = -1;
+    break;
+  case FS_FILTER_BANDPASS:
+    f->m1 = k;
+    break;
+  case FS_FILTER_NOTCH:
+    f->m0 = 1; f->m1 = -k;
+    break;
+  case FS_FILTER_PEAK:
+    k = 1 / (section->q * amp);
+    f->m0 = 1; f->m1 = k * (amp * amp - 1);
+    break;
+  case FS_FILTER_LOWSHELF:
+    g /= sqrt(amp);
+    f->m0 = 1; f->m1 = k * (amp - 1); f->m2 = amp * amp - 1;
+    break;
+  default:
+    g *= sqrt(amp);
+    f->m0 = amp * amp; f->m1 = k * (1 - amp) * amp; f->m2 = 1 - amp * amp;
+    break;
+  }
+  f->g1 = 1 / (1 + g * (g + k));
+  f->g2 = g * f->g1;
+  f->g3 = g * f->g2;
+}
+
+void filter_coefficients(FilterState *f, int structure, const FSFilterSection *section, double cutoff, uint32_t sample_rate)
+{
+  /* Frequencies at or above Nyquist would turn the filters unstable */
+  double w0 = 2 * M_PI * MIN(MAX(cutoff, 1.0), 0.49 * sample_rate) / sample_rate;
+  if (structure == FS_FILTER_SVF) {
+    svf_coefficients(f, section, w0);
+  } else {
+    biquad_coefficients(f, section, w0);
+  }
+}
+
+/* Transposed direct form II */
+void biquad_run(FilterState *f, sample_t *samples, size_t count)
+{
+  size_t idx;
+  double in, out, s1 = f->s1, s2 = f->s2;
+  const double b0 = f->b0, b1 = f->b1, b2 = f->b2, a1 = f->a1, a2 = f->a2;
+  for (idx = 0; idx < count; ++idx) {
+    in = samples[idx];
+    out = b0 * in + s1;
+    s1 = b1 * in - a1 * out + s2;
+    s2 = b2 * in - a2 * out;
+    samples[idx] = out;
+  }
+  f->s1 = (fabs(s1) < FILTER_DENORMAL) ? 0 : s1;
+  f->s2 = (fabs(s2) < FILTER_DENORMAL) ? 0 : s2;
+}
+
+void svf_run(FilterState *f, sample_t *samples, size_t count)
+{
+  size_t idx;
+  double in, v1, v2, v3, ic1 = f->s1, ic2 = f->s2;
+  const double g1 = f->g1, g2 = f->g2, g3 = f->g3, m0 = f->m0, m1 = f->m1, m2 = f->m2;
+  for (idx = 0; idx < count; ++idx) {
+    in = samples[idx];
+    v3 = in - ic2;
+    v1 = g1 * ic1 + g2 * v3;
+    v2 = ic2 + g2 * ic1 + g3 * v3;
+    ic1 = 2 * v1 - ic1;
+    ic2 = 2 * v2 - ic2;
+    samples[idx] = m0 * in + m1 * v1 + m2 * v2;
+  }
+  f->s1 = (fabs(ic1) < FILTER_DENORMAL) ? 0 : ic1;
+  f->s2 = (fabs(ic2) < FILTER_DENORMAL) ? 0 : ic2;
+}
+
+/* Returns the cut-off factor of the modulation signal or lane at the given position, a signal
+ * shorter than the buffer holds its last value */
+double modulation_factor(const FSFilter *filter, size_t pos, uint32_t sample_rate)
+{
+  const FSampleBuffer *mod = filter->cutoff_mod;
+  if (filter->cutoff_lane != NULL) {
+    return pow(2, fs_get_automation_level(filter->cutoff_lane, pos / (double)sample_rate) * filter->mod_depth);
+  }
+  return pow(2, mod->samples[MIN(pos, mod->sample_count - 1)] * filter->mod_depth);
+}
+
+int filter_modulated(const FSFilter *filter)
+{
+  return filter->cutoff_mod != NULL || filter->cutoff_lane != NULL;
+}
+
+void apply_section(FSampleBuffer *buffer, const FSFilter *filter, const FSFilterSection *section)
+{
+  size_t pos, count, block = filter_modulated(filter) ? FILTER_MOD_BLOCK : FILTER_BLOCK;
+  FilterState state;
+  memset(&state, 0, sizeof(state));
+  filter_coefficients(&state, filter->structure, section, section->cutoff, buffer->sample_rate);
+  for (pos = 0; pos < buffer->sample_count; pos += count) {
+    count = MIN(block, buffer->sample_count - pos);
+    if (filter_modulated(filter)) {
+      filter_coefficients(&state, filter->structure, section,
+        section->cutoff * modulation_factor(filter, pos, buffer->sample_rate), buffer->sample_rate);
+    }
+    if (filter->structure == FS_FILTER_SVF) {
+      svf_run(&state, &buffer->samples[pos], count);
+    } else {
+      biquad_run(&state, &buffer->samples[pos], count);
+    }
+  }
+}
+
+/* Loads the coefficients of up to FILTER_LANES sections into the lanes of a group,
+ * unused lanes pass their input unchanged */
+void group_coefficients(FilterGroup *g, const FSFilter *filter, size_t first, double factor, uint32_t sample_rate)
+{
+  size_t lane;
+  FilterState f;
+  const FSFilterSection *section;
+  for (lane = 0; lane < FILTER_LANES; ++lane) {
+    memset(&f, 0, sizeof(f));
+    f.b0 = f.m0 = 1;
+    if (first + lane < filter->section_count) {
+      section = &filter->sections[first + lane];
+      filter_coefficients(&f, filter->structure, section, section->cutoff * factor, sample_rate);
+    }
+    g->c[0][lane] = (filter->structure == FS_FILTER_SVF) ? f.g1 : f.b0;
+    g->c[1][lane] = (filter->structure == FS_FILTER_SVF) ? f.g2 : f.b1;
+    g->c[2][lane] = (filter->structure == FS_FILTER_SVF) ? f.g3 : f.b2;
+    g->c[3][lane] = (filter->structure == FS_FILTER_SVF) ? f.m0 : f.a1;
+    g->c[4][lane] = (filter->structure == FS_FILTER_SVF) ? f.m1 : f.a2;
+    g->c[5][lane] = f.m2;
+  }
+}
+
+/* Lane l filters the sample which lane l - 1 finished two steps earlier, so all sections of
+ * the group compute in parallel and a lane has two steps to pass its result on. The output
+ * is delayed by FILTER_DELAY steps, step is the number of steps done so far */
+void biquad_group_run(FilterGroup *g, sample_t *samples, size_t step, size_t count, int drain)
+{
+  size_t idx;
+  const lane_t b0 = g->c[0], b1 = g->c[1], b2 = g->c[2], a1 = g->c[3], a2 = g->c[4];
+  lane_t x, y = g->y, y1 = g->y1, s1 = g->s1, s2 = g->s2;
+  for (idx = 0; idx < count; ++idx, ++step) {
+    x = (lane_t){ drain ? 0 : samples[step], y1[0] };
+    y1 = y;
+    y = b0 * x + s1;
+    s1 = b1 * x - a1 * y + s2;
+    s2 = b2 * x - a2 * y;
+    if (step >= FILTER_DELAY) samples[step - FILTER_DELAY] = y[FILTER_LANES - 1];
+  }
+  g->y = y;
+  g->y1 = y1;
+  g->s1 = s1;
+  g->s2 = s2;
+}
+
+void svf_group_run(FilterGroup *g, sample_t *samples, size_t step, size_t count, int drain)
+{
+  size_t idx;
+  const lane_t g1 = g->c[0], g2 = g->c[1], g3 = g->c[2], m0 = g->c[3], m1 = g->c[4], m2 = g->c[5];
+  lane_t x, v1, v2, v3, y = g->y, y1 = g->y1, ic1 = g->s1, ic2 = g->s2;
+  for (idx = 0; idx < count; ++idx, ++step) {
+    x = (lane_t){ drain ? 0 : samples[step], y1[0] };
+    y1 = y;
+    v3 = x - ic2;
+    v1 = g1 * ic1 + g2 * v3;
+    v2 = ic2 + g2 * ic1 + g3 * v3;
+    ic1 = 2 * v1 - ic1;
+    ic2 = 2 * v2 - ic2;
+    y = m0 * x + m1 * v1 + m2 * v2;
+    if (step >= FILTER_DELAY) samples[step - FILTER_DELAY] = y[FILTER_LANES - 1];
+  }
+  g->y = y;
+  g->y1 = y1;
+  g->s1 = ic1;
+  g->s2 = ic2;
+}
+
+/* Runs the sections first..first+FILTER_LANES as one group over the whole buffer */
+void apply_group(FSampleBuffer *buffer, const FSFilter *filter, size_t first)
+{
+  size_t pos, count, block = filter_modulated(filter) ? FILTER_MOD_BLOCK : FILTER_BLOCK;
+  size_t n = buffer->sample_count;
+  FilterGroup g;
+  memset(&g, 0, sizeof(g));
+  group_coefficients(&g, filter, first, 1, buffer->sample_rate);
+  for (pos = 0; pos < n; pos += count) {
+    count = MIN(block, n - pos);
+    if (filter_modulated(filter)) {
+      group_coefficients(&g, filter, first, modulation_factor(filter, pos, buffer->sample_rate), buffer->sample_rate);
+    }
+    if (filter->structure == FS_FILTER_SVF) {
+      svf_group_run(&g, buffer->samples, pos, count, 0);
+    } else {
+      biquad_group_run(&g, buffer->samples, pos, count, 0);
+    }
+  }
+  /* Feeding zeros after the end pushes the last samples through the later lanes, the
+   * lanes which already passed the end don't matter any more */
+  if (filter->structure == FS_FILTER_SVF) {
+    svf_group_run(&g, buffer->samples, n, FILTER_DELAY, 1);
+  } else {
+    biquad_group_run(&g, buffer->samples, n, FILTER_DELAY, 1);
+  }
+}
+
+int fs_apply_filter(FSampleBuffer *buffer, const FSFilter *filter)
+{
+  size_t first;
+  unsigned int ch;
+  FSampleBuffer view;
+  fs_clear_error();
+  if (INVALID_BUFFER(buffer) || filter == NULL) {
+    fs_set_error(INVALID_BUFFER(buffer) ? FS_INVALID_BUFFER : FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  if (filter->cutoff_mod != NULL && filter->cutoff_mod->sample_rate != buffer->sample_rate) {
+    fs_set_error(FS_DIFF_SAMPLE_RATE);
+    return fs_get_error();
+  }
+  if (fs_unshare_samples(buffer, 1) != FS_OK) {
+    return fs_get_error();
+  }
+  FS_TRACE_KERNEL("fs_apply_filter", FS_TOTAL_SAMPLES(buffer));
+  /* Each channel runs through its own filter state */
+  for (ch = 0; ch < buffer->channels; ++ch) {
+    view = fs_channel_view(buffer, ch);
+    if (filter->section_count == 1) {
+      apply_section(&view, filter, &filter->sections[0]);
+    } else {
+      /* The recursion of a section can't be vectorized, but the sections of a cascade can */
+      for (first = 0; first < filter->section_count; first += FILTER_LANES) {
+        apply_group(&view, filter, first);
+      }
+    }
+  }
+  fs_add_stats(FS_TOTAL_SAMPLES(buffer), buffer->buffer_size * 2);
+  FS_TRACE_END();
+  return fs_get_error();
+}
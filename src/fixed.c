@@ -0,0 +1,340 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Fixed point rendering into Q15 and Q31 buffers, which hold PCM samples directly
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <memory.h>
+#include <math.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "fsynth.h"
+#include "trace.h"
+
+#define FIXED_BLOCK       256   /* Envelope levels of a block are converted to gains at once */
+#define FIXED_TABLE_BITS  12    /* Sine table with 4096 entries, the interpolation error is below 2^-21 */
+#define FIXED_FRAC_BITS   (32 - FIXED_TABLE_BITS)
+#define Q31_ONE           2147483648.0
+#define Q15_ONE           32768.0
+
+typedef int32_t q31_vec_t __attribute__((vector_size(16)));
+typedef uint32_t q31_uvec_t __attribute__((vector_size(16)));
+
+/* One extra entry lets the interpolation read past the last one without wrapping */
+int32_t fixed_table[(1 << FIXED_TABLE_BITS) + 1];
+pthread_once_t fixed_table_once = PTHREAD_ONCE_INIT;
+
+void init_fixed_table(void)
+{
+  size_t idx;
+  for (idx = 0; idx <= (1 << FIXED_TABLE_BITS); ++idx) {
+    fixed_table[idx] = (int32_t)lrint(sin(2 * M_PI * idx / (1 << FIXED_TABLE_BITS)) * 2147483647.0);
+  }
+}
+
+int16_t sat16(int32_t x)
+{
+  return (int16_t)MIN(32767, MAX(-32768, x));
+}
+
+int32_t sat32(int64_t x)
+{
+  return (int32_t)MIN(INT32_MAX, MAX(INT32_MIN, x));
+}
+
+int16_t q15_mul(int16_t a, int16_t b)
+{
+  return sat16(((int32_t)a * b) >> 15);
+}
+
+int32_t q31_mul(int32_t a, int32_t b)
+{
+  return sat32(((int64_t)a * b) >> 31);
+}
+
+/* Rounds a Q31 value to Q15 */
+int16_t q31_to_q15(int32_t x)
+{
+  return sat16((int32_t)(((int64_t)x + 0x8000) >> 16));
+}
+
+int32_t fixed_sine(uint32_t phase)
+{
+  uint32_t idx = phase >> FIXED_FRAC_BITS;
+  int64_t frac = phase & ((1u << FIXED_FRAC_BITS) - 1);
+  return fixed_table[idx] + (int32_t)(((fixed_table[idx + 1] - (int64_t)fixed_table[idx]) * frac) >> FIXED_FRAC_BITS);
+}
+
+/* Waveforms in Q31 computed from the phase accumulator, one period is the range of the integer */
+int32_t fixed_wave(int func_type, uint32_t phase, uint32_t *noise)
+{
+  switch (func_type) {
+  case FS_WAVE_SINE:
+    return fixed_sine(phase);
+  case FS_WAVE_COSINE:
+    return fixed_sine(phase + 0x40000000u);
+  case FS_WAVE_SAW:
+    return (int32_t)(phase ^ 0x80000000u);
+  case FS_WAVE_TRIANGLE:
+    if (phase < 0x80000000u) return (int32_t)((phase << 1) ^ 0x80000000u);
+    return sat32((3LL << 31) - 2 * (int64_t)phase);
+  case FS_WAVE_RECT:
+    return (phase < 0x80000000u) ? -INT32_MAX : INT32_MAX;
+  default:
+    /* Linear congruential generator, the upper bits are used */
+    *noise = *noise * 1664525u + 1013904223u;
+    return (int32_t)*noise;
+  }
+}
+
+FSFixedBuffer *fs_create_fixed_buffer(uint32_t sample_rate, size_t sample_count, int format)
+{
+  FSFixedBuffer *buffer;
+  fs_clear_error();
+  if (format != FS_FIXED_Q15 && format != FS_FIXED_Q31) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return NULL;
+  }
+  buffer = (FSFixedBuffer*) malloc(sizeof(FSFixedBuffer));
+  if (buffer == NULL) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  buffer->sample_rate = sample_rate;
+  buffer->sample_count = sample_count;
+  buffer->format = format;
+  buffer->buffer_size = sample_count * ((format == FS_FIXED_Q15) ? sizeof(int16_t) : sizeof(int32_t));
+  buffer->samples = calloc(1, MAX(buffer->buffer_size, 1));
+  if (buffer->samples == NULL) {
+    free(buffer);
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  fs_add_alloc_stats(buffer->buffer_size);
+  fs_add_live_bytes(buffer->buffer_size);
+  return buffer;
+}
+
+void fs_delete_fixed_buffer(FSFixedBuffer **buffer)
+{
+  if (buffer != NULL && (*buffer) != NULL) {
+    fs_add_live_bytes(-(int64_t)(*buffer)->buffer_size);
+    free((*buffer)->samples);
+    free(*buffer);
+    *buffer = NULL;
+  }
+}
+
+int fs_generate_fixed_wave(FSFixedBuffer *buffer, int func_type, double freq, double amp)
+{
+  size_t idx;
+  uint32_t phase = 0, step, noise = 1;
+  int64_t gain;
+  int32_t x;
+  int16_t *q15;
+  int32_t *q31;
+  fs_clear_error();
+  if (buffer == NULL || buffer->samples == NULL) {
+    fs_set_error(FS_INVALID_BUFFER);
+    return fs_get_error();
+  }
+  if (freq <= 0 || buffer->sample_rate == 0 || func_type < FS_WAVE_SINE || func_type > FS_WAVE_NOISE) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  pthread_once(&fixed_table_once, init_fixed_table);
+  step = (uint32_t)(int64_t)llrint(freq / buffer->sample_rate * 4294967296.0);
+  gain = llrint(amp * Q31_ONE);
+  FS_TRACE_KERNEL("fs_generate_fixed_wave", buffer->sample_count);
+  if (buffer->format == FS_FIXED_Q15) {
+    q15 = (int16_t*) buffer->samples;
+    for (idx = 0; idx < buffer->sample_count; ++idx, phase += step) {
+      x = sat32((fixed_wave(func_type, phase, &noise) * gain) >> 31);
+      q15[idx] = q31_to_q15(x);
+    }
+  } else {
+    q31 = (int32_t*) buffer->samples;
+    for (idx = 0; idx < buffer->sample_count; ++idx, phase += step) {
+      q31[idx] = sat32((fixed_wave(func_type, phase, &noise) * gain) >> 31);
+    }
+  }
+  fs_add_stats(buffer->sample_count, buffer->buffer_size);
+  FS_TRACE_END();
+  return fs_get_error();
+}
+
+/* The products of a block, the intrinsics work on 8 samples at once */
+void q15_mult_block(int16_t *dest, const int16_t *src, size_t count)
+{
+  size_t idx = 0;
+#ifdef __SSE2__
+  __m128i a, b, r, ovf;
+  const __m128i min = _mm_set1_epi16(-32768);
+  for (; idx + 8 <= count; idx += 8) {
+    a = _mm_loadu_si128((const __m128i*)&dest[idx]);
+    b = _mm_loadu_si128((const __m128i*)&src[idx]);
+    /* Bits 15 to 30 of the 32 bit products */
+    r = _mm_or_si128(_mm_slli_epi16(_mm_mulhi_epi16(a, b), 1), _mm_srli_epi16(_mm_mullo_epi16(a, b), 15));
+    /* Only -1 * -1 leaves the range, it wraps to -32768 and is turned into 32767 */
+    ovf = _mm_and_si128(_mm_cmpeq_epi16(a, min), _mm_cmpeq_epi16(b, min));
+    _mm_storeu_si128((__m128i*)&dest[idx], _mm_xor_si128(r, ovf));
+  }
+#endif
+  for (; idx < count; ++idx) {
+    dest[idx] = q15_mul(dest[idx], src[idx]);
+  }
+}
+
+void q15_add_block(int16_t *dest, const int16_t *src, size_t count, int subtract)
+{
+  size_t idx = 0;
+#ifdef __SSE2__
+  __m128i a, b;
+  for (; idx + 8 <= count; idx += 8) {
+    a = _mm_loadu_si128((const __m128i*)&dest[idx]);
+    b = _mm_loadu_si128((const __m128i*)&src[idx]);
+    _mm_storeu_si128((__m128i*)&dest[idx], subtract ? _mm_subs_epi16(a, b) : _mm_adds_epi16(a, b));
+  }
+#endif
+  for (; idx < count; ++idx) {
+    dest[idx] = sat16(subtract ? (int32_t)dest[idx] - src[idx] : (int32_t)dest[idx] + src[idx]);
+  }
+}
+
+/* SSE2 has no saturating 32 bit arithmetic, the overflow is detected from the sign bits of the
+ * wrapped result and the lanes which overflowed take the limit of the sign of the first operand */
+void q31_add_block(int32_t *dest, const int32_t *src, size_t count, int subtract)
+{
+  size_t idx = 0;
+  q31_vec_t a, b, r, ovf, limit;
+  for (; idx + 4 <= count; idx += 4) {
+    memcpy(&a, &dest[idx], sizeof(a));
+    memcpy(&b, &src[idx], sizeof(b));
+    if (subtract) {
+      r = (q31_vec_t)((q31_uvec_t)a - (q31_uvec_t)b);
+      ovf = ((a ^ b) & (a ^ r)) >> 31;
+    } else {
+      r = (q31_vec_t)((q31_uvec_t)a + (q31_uvec_t)b);
+      ovf = ((a ^ r) & (b ^ r)) >> 31;
+    }
+    limit = (a >> 31) ^ INT32_MAX;
+    r = (limit & ovf) | (r & ~ovf);
+    memcpy(&dest[idx], &r, sizeof(r));
+  }
+  for (; idx < count; ++idx) {
+    dest[idx] = sat32(subtract ? (int64_t)dest[idx] - src[idx] : (int64_t)dest[idx] + src[idx]);
+  }
+}
+
+void q31_mult_block(int32_t *dest, const int32_t *src, size_t count)
+{
+  size_t idx;
+  for (idx = 0; idx < count; ++idx) {
+    dest[idx] = q31_mul(dest[idx], src[idx]);
+  }
+}
+
+int fs_modulate_fixed_buffer(FSFixedBuffer *dest, const FSFixedBuffer *src, int modulate_type)
+{
+  size_t count;
+  fs_clear_error();
+  if (dest == NULL || src == NULL || dest->samples == NULL || src->samples == NULL) {
+    fs_set_error(FS_INVALID_BUFFER);
+    return fs_get_error();
+  }
+  if (dest->format != src->format ||
+      (modulate_type != FS_MOD_ADD && modulate_type != FS_MOD_SUB && modulate_type != FS_MOD_MULT)) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  count = MIN(dest->sample_count, src->sample_count);
+  FS_TRACE_KERNEL("fs_modulate_fixed_buffer", count);
+  if (dest->format == FS_FIXED_Q15) {
+    if (modulate_type == FS_MOD_MULT) {
+      q15_mult_block((int16_t*) dest->samples, (const int16_t*) src->samples, count);
+    } else {
+      q15_add_block((int16_t*) dest->samples, (const int16_t*) src->samples, count, modulate_type == FS_MOD_SUB);
+    }
+  } else {
+    if (modulate_type == FS_MOD_MULT) {
+      q31_mult_block((int32_t*) dest->samples, (const int32_t*) src->samples, count);
+    } else {
+      q31_add_block((int32_t*) dest->samples, (const int32_t*) src->samples, count, modulate_type == FS_MOD_SUB);
+    }
+  }
+  fs_add_stats(count, 3 * count * ((dest->format == FS_FIXED_Q15) ? sizeof(int16_t) : sizeof(int32_t)));
+  FS_TRACE_END();
+  return fs_get_error();
+}
+
+int fs_apply_fixed_envelope(FSFixedBuffer *buffer, const FSEnvelope *envelope)
+{
+  size_t pos, idx, n;
+  sample_t levels[FIXED_BLOCK];
+  int16_t gains15[FIXED_BLOCK];
+  int32_t gains31[FIXED_BLOCK];
+  FSEnvelopeState state;
+  fs_clear_error();
+  if (buffer == NULL || buffer->samples == NULL || envelope == NULL) {
+    fs_set_error(FS_INVALID_BUFFER);
+    return fs_get_error();
+  }
+  fs_envelope_start(&state, envelope, buffer->sample_rate);
+  FS_TRACE_KERNEL("fs_apply_fixed_envelope", buffer->sample_count);
+  for (pos = 0; pos < buffer->sample_count; pos += n) {
+    n = MIN(FIXED_BLOCK, buffer->sample_count - pos);
+    fs_envelope_render(&state, levels, n);
+    /* Levels beyond the range of the format are clipped */
+    if (buffer->format == FS_FIXED_Q15) {
+      for (idx = 0; idx < n; ++idx) {
+        gains15[idx] = (int16_t)MIN(32767., MAX(-32768., levels[idx] * Q15_ONE));
+      }
+      q15_mult_block((int16_t*) buffer->samples + pos, gains15, n);
+    } else {
+      for (idx = 0; idx < n; ++idx) {
+        gains31[idx] = (int32_t)MIN(2147483647., MAX(-2147483648., levels[idx] * Q31_ONE));
+      }
+      q31_mult_block((int32_t*) buffer->samples + pos, gains31, n);
+    }
+  }
+  fs_add_stats(buffer->sample_count, buffer->buffer_size * 2);
+  FS_TRACE_END();
+  return fs_get_error();
+}
+
+FSampleBuffer *fs_fixed_to_sample_buffer(const FSFixedBuffer *buffer)
+{
+  size_t idx;
+  FSampleBuffer *pout;
+  fs_clear_error();
+  if (buffer == NULL || buffer->samples == NULL) {
+    fs_set_error(FS_INVALID_BUFFER);
+    return NULL;
+  }
+  pout = fs_create_sample_buffer_raw(buffer->sample_rate, buffer->sample_count);
+  if (pout == NULL) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  if (buffer->format == FS_FIXED_Q15) {
+    FOREACH_SAMPLE(pout, idx) {
+      pout->samples[idx] = ((const int16_t*) buffer->samples)[idx] * (1.0 / Q15_ONE);
+    }
+  } else {
+    FOREACH_SAMPLE(pout, idx) {
+      pout->samples[idx] = ((const int32_t*) buffer->samples)[idx] * (1.0 / Q31_ONE);
+    }
+  }
+  fs_add_stats(pout->sample_count, buffer->buffer_size + pout->buffer_size);
+  return pout;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Frequency modulation synthesis with several operators
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <memory.h>
+#include <math.h>
+#include <pthread.h>
+#include "fsynth.h"
+#include "trace.h"
+
+#define FM_BLOCK        64    /* Samples per block, the envelopes are rendered for a whole block */
+#define FM_TABLE_BITS   12    /* Sine table with 4096 entries, linear interpolation keeps errors below -130 dB */
+#define FM_FRAC_BITS    (32 - FM_TABLE_BITS)
+#define FM_PHASE_SCALE  (4294967296.0 / (2 * M_PI))  /* Radians to phase accumulator units */
+
+/* One extra entry lets the interpolation read past the last one without wrapping */
+double fm_table[(1 << FM_TABLE_BITS) + 1];
+pthread_once_t fm_table_once = PTHREAD_ONCE_INIT;
+
+typedef struct {
+  uint64_t phase;       /* One period is the range of the integer, wrapping is free */
+  uint64_t step;        /* 64 bits keep the pitch exact over hours, the table only needs the upper 32 */
+  sample_t out;         /* Output of the last sample */
+  sample_t out1;        /* and of the sample before, for the feedback */
+  size_t mod_count;
+  int mods[FS_MAX_FM_OPERATORS];
+  FSEnvelopeState env;
+  sample_t levels[FM_BLOCK];
+} FMOperatorState;
+
+void init_fm_table(void)
+{
+  size_t idx;
+  for (idx = 0; idx <= (1 << FM_TABLE_BITS); ++idx) {
+    fm_table[idx] = sin(2 * M_PI * idx / (1 << FM_TABLE_BITS));
+  }
+}
+
+double fm_sine(uint32_t phase)
+{
+  uint32_t idx = phase >> FM_FRAC_BITS;
+  double frac = (phase & ((1u << FM_FRAC_BITS) - 1)) * (1.0 / (1u << FM_FRAC_BITS));
+  return fm_table[idx] + frac * (fm_table[idx + 1] - fm_table[idx]);
+}
+
+/* Phase offsets beyond +-pi are common with high modulation indices, the conversion goes through
+ * 64 bit so that they wrap instead of overflowing */
+uint32_t fm_phase_offset(double radians)
+{
+  return (uint32_t)(int64_t)(radians * FM_PHASE_SCALE);
+}
+
+int fs_set_fm_algorithm(FSFMPatch *patch, int algorithm)
+{
+  size_t idx;
+  fs_clear_error();
+  if (patch == NULL || patch->operator_count > FS_MAX_FM_OPERATORS) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  memset(patch->modulators, 0, sizeof(patch->modulators));
+  patch->carriers = 0;
+  for (idx = 0; idx < patch->operator_count; ++idx) {
+    switch (algorithm) {
+    case FS_FM_STACK:
+      if (idx + 1 < patch->operator_count) patch->modulators[idx] = 1u << (idx + 1);
+      if (idx == 0) patch->carriers = 1;
+      break;
+    case FS_FM_PARALLEL:
+      patch->carriers |= 1u << idx;
+      break;
+    case FS_FM_PAIRS:
+      if ((idx & 1) == 0) {
+        patch->carriers |= 1u << idx;
+        if (idx + 1 < patch->operator_count) patch->modulators[idx] = 1u << (idx + 1);
+      }
+      break;
+    default:
+      fs_set_error(FS_INVALID_ARGUMENT);
+      return fs_get_error();
+    }
+  }
+  return fs_get_error();
+}
+
+int fs_generate_fm(FSampleBuffer *buffer, const FSFMPatch *patch, double freq, double amp)
+{
+  size_t pos, idx, n, op, k, count;
+  double mod, out, ratio;
+  FMOperatorState *st, ops[FS_MAX_FM_OPERATORS];
+  fs_clear_error();
+  if (INVALID_BUFFER(buffer)) {
+    fs_set_error(FS_INVALID_BUFFER);
+    return fs_get_error();
+  }
+  if (patch == NULL || patch->operator_count == 0 || patch->operator_count > FS_MAX_FM_OPERATORS || freq <= 0) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  /* A negative phase step can't be converted into the unsigned accumulator */
+  for (op = 0; op < patch->operator_count; ++op) {
+    if (!(patch->operators[op].ratio >= 0)) {
+      fs_set_error(FS_INVALID_ARGUMENT);
+      return fs_get_error();
+    }
+  }
+  if (fs_unshare_samples(buffer, 0) != FS_OK) {
+    return fs_get_error();
+  }
+  pthread_once(&fm_table_once, init_fm_table);
+  count = patch->operator_count;
+  memset(ops, 0, sizeof(FMOperatorState) * count);
+  for (op = 0; op < count; ++op) {
+    st = &ops[op];
+    ratio = fmod(freq * patch->operators[op].ratio / buffer->sample_rate, 1.0);
+    st->step = (uint64_t)(ratio * 9223372036854775808.0) * 2;
+    for (k = 0; k < count; ++k) {
+      if ((patch->modulators[op] >> k) & 1) st->mods[st->mod_count++] = (int)k;
+    }
+    fs_envelope_start(&st->env, patch->operators[op].envelope, buffer->sample_rate);
+    if (patch->operators[op].envelope == NULL) {
+      for (idx = 0; idx < FM_BLOCK; ++idx) {
+        st->levels[idx] = patch->operators[op].level;
+      }
+    }
+  }
+  FS_TRACE_KERNEL("fs_generate_fm", buffer->sample_count);
+  for (pos = 0; pos < buffer->sample_count; pos += n) {
+    n = MIN(FM_BLOCK, buffer->sample_count - pos);
+    for (op = 0; op < count; ++op) {
+      if (patch->operators[op].envelope != NULL) {
+        fs_envelope_render(&ops[op].env, ops[op].levels, n);
+        for (idx = 0; idx < n; ++idx) {
+          ops[op].levels[idx] *= patch->operators[op].level;
+        }
+      }
+    }
+    for (idx = 0; idx < n; ++idx) {
+      out = 0;
+      /* Higher operators come first, so that they modulate the lower ones within the same sample.
+       * Routings towards higher operators see the output of the previous sample. */
+      for (op = count; op-- > 0;) {
+        st = &ops[op];
+        mod = patch->operators[op].feedback * 0.5 * (st->out + st->out1);
+        for (k = 0; k < st->mod_count; ++k) {
+          mod += ops[st->mods[k]].out;
+        }
+        st->out1 = st->out;
+        st->out = fm_sine((uint32_t)(st->phase >> 32) + fm_phase_offset(mod)) * st->levels[idx];
+        st->phase += st->step;
+        if ((patch->carriers >> op) & 1) out += st->out;
+      }
+      buffer->samples[pos + idx] = out * amp;
+    }
+  }
+  fs_spread_channel(buffer);
+  fs_add_stats(buffer->sample_count, sizeof(sample_t) * buffer->sample_count);
+  FS_TRACE_END();
+  return fs_get_error();
+}
@@ -42,6 +42,7 @@
 #define FS_WAVE_TRIANGLE       4
 #define FS_WAVE_RECT           5
 #define FS_WAVE_NOISE          6
+#define FS_WAVE_FM             7   /* Operators of an FSFMPatch, only used by sequencer tracks */
 
 /* Modulation types */
 #define FS_MOD_ADD             1
@@ -59,10 +60,75 @@
 #define FS_CURVE_SQUARE        3
 #define FS_CURVE_CUBIC         4
 #define FS_CURVE_HOLD          5
+#define FS_CURVE_EXP           6   /* Automation lanes only, between two levels of the same sign */
+
+/* Maximum number of segments within an envelope */
+#define FS_MAX_ENV_SEGMENTS    32
+
+/* Filter types */
+#define FS_FILTER_LOWPASS      1
+#define FS_FILTER_HIGHPASS     2
+#define FS_FILTER_BANDPASS     3
+#define FS_FILTER_NOTCH        4
+#define FS_FILTER_PEAK         5
+#define FS_FILTER_LOWSHELF     6
+#define FS_FILTER_HIGHSHELF    7
+
+/* Filter structures */
+#define FS_FILTER_BIQUAD       0
+#define FS_FILTER_SVF          1
+
+/* Maximum number of cascaded sections within a filter */
+#define FS_MAX_FILTER_SECTIONS 16
+
+/* FM operator routings */
+#define FS_FM_STACK            1   /* Every operator modulates the one before it, operator 0 is heard */
+#define FS_FM_PARALLEL         2   /* All operators are heard, without modulation */
+#define FS_FM_PAIRS            3   /* Each odd operator modulates the even one before it, the even ones are heard */
+
+/* Maximum number of operators within an FM patch */
+#define FS_MAX_FM_OPERATORS    8
+
+/* Maximum number of channels within a sample buffer */
+#define FS_MAX_CHANNELS        8
+
+/* Channel argument which selects all channels of a wave file */
+#define FS_ALL_CHANNELS        -1
+
+/* Scheduler event types */
+#define FS_EVENT_NOTE_ON       1
+#define FS_EVENT_NOTE_OFF      2
+#define FS_EVENT_PARAM         3
+#define FS_EVENT_TEMPO         4
+
+/* Parameters of FS_EVENT_PARAM events */
+#define FS_PARAM_GAIN          1   /* Output level of the scheduler */
+#define FS_PARAM_DETUNE        2   /* Pitch offset of all voices in cents */
+#define FS_PARAM_WAVEFORM      3   /* Waveform type of all voices */
+
+/* Maximum number of scheduler voices which sound at the same time */
+#define FS_MAX_VOICES          32
 
 /* Wave output formats */
 #define WAVE_PCM_8BIT        8
 #define WAVE_PCM_16BIT       16
+#define WAVE_PCM_24BIT       24
+#define WAVE_PCM_32BIT       32
+#define WAVE_FLOAT_FLAG      0x100
+#define WAVE_FLOAT_32BIT     (WAVE_FLOAT_FLAG | 32)
+#define WAVE_FLOAT_64BIT     (WAVE_FLOAT_FLAG | 64)
+
+/* Sample buffer storage */
+#define FS_STORAGE_HEAP        0
+#define FS_STORAGE_FILE        1
+
+/* Fixed point sample formats, the number of fraction bits */
+#define FS_FIXED_Q15           15
+#define FS_FIXED_Q31           31
+
+/* Wave stream flags */
+#define FS_STREAM_DIRECT       (1<<0)
+#define FS_STREAM_RAW          (1<<1)
 
 /* Function macros */
 #define dB(x) (pow(10, (x)/20.))
@@ -74,6 +140,10 @@
 #define FOREACH_SAMPLE(buffer, idx) \
   for (idx = 0; idx < buffer->sample_count; ++idx)
 
+/* Samples of all channels, the channels lie one after the other (planar layout) */
+#define FS_TOTAL_SAMPLES(buffer) ((buffer)->sample_count * (buffer)->channels)
+#define FS_CHANNEL(buffer, ch) (&(buffer)->samples[(size_t)(ch) * (buffer)->sample_count])
+
 #define INVALID_BUFFER(buffer) \
   (buffer == NULL || buffer->buffer_size == 0 || buffer->sample_count == 0 || buffer->sample_rate == 0)
 
@@ -92,25 +162,180 @@ typedef int (*FShellCallback)(int, char **);
 typedef struct {
   uint32_t sample_rate;
   size_t buffer_size;
-  size_t sample_count;
+  size_t sample_count;  /* Samples per channel */
+  unsigned int channels;  /* Number of channels, each one holds sample_count samples */
   size_t hull_ptr;
   sample_t hull_level;
   sample_t *samples;
+  void *map_addr;       /* Base address, if the samples are a view into a file mapping */
+  size_t map_size;
+  int storage;          /* FS_STORAGE_HEAP or FS_STORAGE_FILE */
+  int map_fd;           /* Temporary file which holds the samples of a file storage buffer */
+  unsigned int *refs;   /* Number of clones sharing the samples, NULL if they aren't shared */
 } FSampleBuffer;
 
+typedef struct {
+  uint32_t sample_rate;
+  size_t sample_count;
+  size_t buffer_size;
+  int format;           /* FS_FIXED_Q15 with int16_t or FS_FIXED_Q31 with int32_t samples */
+  void *samples;
+} FSFixedBuffer;
+
+typedef struct {
+  int curve_type;
+  double duration;      /* Length of the segment in seconds */
+  double level;         /* Level which is reached at the end of the segment */
+} FSEnvSegment;
+
+typedef struct {
+  size_t segment_count;
+  FSEnvSegment segments[FS_MAX_ENV_SEGMENTS];
+} FSEnvelope;
+
+typedef struct {
+  const FSEnvelope *envelope;
+  uint32_t sample_rate;
+  size_t segment;       /* Index of the next segment */
+  size_t remaining;     /* Samples left within the current segment */
+  int curve_type;
+  double level;         /* Level at the end of the current segment */
+  double lerp;          /* Linear level of the next sample */
+  double step;          /* Linear increment per sample */
+  double tan_value;     /* tan(lerp), updated with the addition theorem */
+  double tan_step;      /* tan(step) */
+} FSEnvelopeState;
+
+typedef struct FSAutomation FSAutomation;
+
+typedef struct {
+  const FSAutomation *lane;
+  uint32_t sample_rate;
+  uint64_t position;    /* Sample position of the next level */
+  uint64_t end;         /* Position where the current segment ends */
+  size_t point;         /* Index of the breakpoint which ends the current segment */
+  int curve_type;
+  double from;          /* Level at the start of the current segment */
+  double to;            /* Level at the end of the current segment */
+  double x;             /* Progress through the segment from 0 to 1 of the next level */
+  double step;          /* Progress per sample */
+  double value;         /* Next level of an exponential segment */
+  double factor;        /* Level ratio per sample of an exponential segment */
+  double tan_value;     /* tan(x * pi / 4), updated with the addition theorem */
+  double tan_step;      /* tan(step * pi / 4) */
+} FSAutomationState;
+
+typedef struct {
+  int filter_type;
+  double cutoff;        /* Cut-off, center or corner frequency in Hz */
+  double q;             /* Resonance, 0.7071 gives a flat Butterworth response */
+  double gain;          /* Gain of peak and shelf filters in dB */
+} FSFilterSection;
+
+typedef struct {
+  int structure;        /* FS_FILTER_BIQUAD or FS_FILTER_SVF */
+  size_t section_count;
+  FSFilterSection sections[FS_MAX_FILTER_SECTIONS];
+  const FSampleBuffer *cutoff_mod;  /* Optional signal which moves all cut-off frequencies */
+  const FSAutomation *cutoff_lane;  /* Optional automation lane, used instead of cutoff_mod */
+  double mod_depth;     /* Octaves per unit of the modulation signal or lane */
+} FSFilter;
+
+typedef struct {
+  double freq;          /* Frequency in Hz */
+  double amp;
+  double phase;         /* Start phase in radians, 0 starts like a sine and pi/2 like a cosine */
+} FSPartial;
+
+typedef struct {
+  double ratio;         /* Frequency relative to the note, not negative */
+  double level;         /* Output level, for modulators the phase deviation in radians */
+  double feedback;      /* Phase deviation in radians by the own output */
+  const FSEnvelope *envelope;  /* Level over time, NULL keeps the level constant */
+} FSOperator;
+
+typedef struct {
+  size_t operator_count;
+  FSOperator operators[FS_MAX_FM_OPERATORS];
+  uint32_t modulators[FS_MAX_FM_OPERATORS];  /* Bit j of entry i lets operator j modulate operator i */
+  uint32_t carriers;    /* Bit i adds operator i to the output */
+} FSFMPatch;
+
 typedef struct {
   int func_type;
   FSampleBuffer* hull_curve;
   FSampleBuffer* output;
+  FSEnvelope *envelope;   /* Used instead of hull_curve if not NULL */
+  uint32_t sample_rate;   /* Sample rate of the output, if an envelope is used */
+  const FSFMPatch *fm_patch;  /* Operators of the FS_WAVE_FM type */
 } FSTrackChannel;
 
-/* Error handling */
+typedef struct FSScheduler FSScheduler;
+
+typedef struct {
+  uint64_t events;      /* Events which have been processed */
+  uint64_t blocks;      /* Blocks which have been rendered between events */
+  uint64_t samples;     /* Samples which have been rendered */
+  size_t pending;       /* Events which are still queued */
+} FSSchedulerStats;
+
+typedef struct {
+  int fd;
+  unsigned char *map_addr;
+  size_t map_size;
+  int format;
+  uint16_t channels;
+  uint16_t block_align;
+  uint32_t sample_rate;
+  size_t data_offset;
+  size_t frame_count;
+} FWaveFile;
+
+typedef struct FWaveStream FWaveStream;
+
+typedef struct FSConvolver FSConvolver;
+
+typedef struct {
+  uint64_t samples_processed;  /* Samples which have been read or written by the kernels */
+  uint64_t bytes_moved;        /* Bytes which have been read or written by the kernels */
+  uint64_t allocations;        /* Number of sample buffer allocations */
+  uint64_t bytes_allocated;    /* Total size of all sample buffer allocations */
+  uint64_t bytes_live;         /* Size of all sample buffers which currently exist */
+  uint64_t bytes_peak;         /* Highest value of bytes_live */
+} FSStats;
+
+typedef struct {
+  size_t block_count;      /* Number of blocks within the ring */
+  size_t block_size;       /* Size of each block in bytes */
+  size_t high_water;       /* Maximum number of blocks which were queued at once */
+  size_t producer_stalls;  /* How often the renderer had to wait for a free block */
+  size_t consumer_stalls;  /* How often the writer thread had to wait for data */
+  uint64_t bytes_written;
+  uint64_t bytes_spliced;  /* Bytes which have been moved into a pipe with vmsplice */
+  int direct_io;           /* Non zero if the data has been written with O_DIRECT */
+} FWaveStreamStats;
+
+/* Error handling, the error code belongs to the calling thread */
 void fs_set_error(int code);
 void fs_set_warning(int code);
 int fs_get_error(void);
 int fs_clear_error(void);
 void fs_print_error(int code);
 
+/* Kernel statistics of the calling thread */
+void fs_add_stats(uint64_t samples, uint64_t bytes);
+void fs_add_alloc_stats(uint64_t bytes);
+void fs_add_live_bytes(int64_t delta);
+
+/* Copies the first channel into the others, generators render the first channel only */
+void fs_spread_channel(FSampleBuffer *buffer);
+
+/* Copy on write, gives a buffer its own samples before a kernel modifies them. With keep 0 the
+ * content isn't copied, since the kernel overwrites every sample. */
+int fs_unshare_samples(FSampleBuffer *buffer, int keep);
+void fs_get_stats(FSStats *stats);
+void fs_reset_stats(void);
+
 /**
  * @brief Creates a buffer with given sample rate and the amount of samples.
  * @param sample_rate the sample rate for the buffer
@@ -120,7 +345,65 @@ void fs_print_error(int code);
 FSampleBuffer *fs_create_sample_buffer_raw(uint32_t sample_rate, size_t sample_count);
 
 /**
- * @brief Creates a new sample buffer by copying the properties from an already existing buffer.
+ * @brief Creates a buffer whose samples are stored on the heap or in a memory mapped temporary file.
+ * File storage lets buffers grow beyond the physical memory, the kernel writes the pages back to
+ * the file instead of the swap space. The file is deleted at once and vanishes with the buffer.
+ * @param sample_rate the sample rate for the new buffer
+ * @param sample_count the amount of samples for the new buffer
+ * @param storage FS_STORAGE_HEAP or FS_STORAGE_FILE
+ * @return a pointer to the new buffer or NULL on failure
+ */
+FSampleBuffer *fs_create_sample_buffer_storage(uint32_t sample_rate, size_t sample_count, int storage);
+
+/**
+ * @brief Creates a buffer with several channels. The samples of each channel are stored
+ *        contiguously one channel after the other, so kernels run over each channel like
+ *        over a mono buffer and the channels are only interleaved when they are written to a file.
+ * @param sample_rate the sample rate for the buffer
+ * @param sample_count the amount of samples of each channel
+ * @param channels the number of channels, from 1 to FS_MAX_CHANNELS
+ * @return a pointer to the new buffer or NULL on failure
+ */
+FSampleBuffer *fs_create_multichannel_buffer(uint32_t sample_rate, size_t sample_count, unsigned int channels);
+
+/**
+ * @brief Returns a mono buffer object which refers to one channel of a buffer. The view shares
+ *        the samples and must neither be resized nor deleted, it's valid until the buffer changes its size.
+ * @param buffer the buffer object
+ * @param channel the channel index, starting with 0
+ * @return the view of the channel
+ */
+FSampleBuffer fs_channel_view(const FSampleBuffer *buffer, unsigned int channel);
+
+/**
+ * @brief Copies one channel of a buffer into a channel of another one, e.g. to build a stereo
+ *        buffer from two mono buffers. A shorter source leaves the rest of the channel unchanged.
+ * @param dest the target buffer object
+ * @param dest_channel the channel index within the target buffer
+ * @param src the source buffer object
+ * @param src_channel the channel index within the source buffer
+ * @return FS_OK or an error code on failure
+ */
+int fs_copy_channel(FSampleBuffer *dest, unsigned int dest_channel, const FSampleBuffer *src, unsigned int src_channel);
+
+/**
+ * @brief Moves the samples of a buffer to another storage.
+ * @param buffer the buffer object
+ * @param storage FS_STORAGE_HEAP or FS_STORAGE_FILE
+ * @return FS_OK or an error code on failure
+ */
+int fs_set_buffer_storage(FSampleBuffer *buffer, int storage);
+
+/**
+ * @brief Sets the size from which new or growing buffers use file storage.
+ * The temporary files are created in $TMPDIR or /tmp.
+ * @param bytes the minimum buffer size in bytes, 0 keeps all buffers on the heap
+ */
+void fs_set_storage_threshold(size_t bytes);
+
+/**
+ * @brief Creates a new sample buffer by copying the properties, including the number of channels,
+ *        from an already existing buffer.
  * @param buffer the source buffer object
  * @return a pointer to the new buffer or NULL on failure
  */
@@ -136,13 +419,35 @@ FSampleBuffer *fs_create_sample_buffer(uint32_t sample_rate, double duration);
 
 /**
  * @brief Creates an exact copy of an existing buffer object with all properties and data.
+ *        The copy shares the samples with the original and takes no time or memory of its own,
+ *        the first kernel which modifies one of the buffers copies the samples (copy on write).
  * @param buffer the buffer to copy
  * @return a pointer to the new buffer or NULL on failure
  */
 FSampleBuffer *fs_clone_sample_buffer(FSampleBuffer *buffer);
 
+/**
+ * @brief Converts a buffer to another sample rate with a polyphase windowed sinc filter.
+ * Any ratio of integer rates is supported, ratios with more than 1024 phases are interpolated
+ * between the phases of the filter table. The pass band reaches 95% of the lower Nyquist frequency.
+ * @param buffer the source buffer
+ * @param sample_rate the sample rate of the new buffer
+ * @return a pointer to the new buffer or NULL on failure
+ */
+FSampleBuffer *fs_resample_buffer(FSampleBuffer *buffer, uint32_t sample_rate);
+
+/**
+ * @brief Converts the samples of a buffer to another sample rate, see fs_resample_buffer.
+ * @param buffer the buffer object
+ * @param sample_rate the new sample rate
+ * @return FS_OK or an error code on failure
+ */
+int fs_resample_buffer_inplace(FSampleBuffer *buffer, uint32_t sample_rate);
+
 /**
  * @brief Cats two sample buffers together and return a new one with that data.
+ *        Both buffers have the same number of channels or the second one is mono,
+ *        a mono buffer is appended to every channel.
  * @param buffer_a the first buffer
  * @param buffer_b the second buffer
  * @return a new buffer with combined data or NULL on failure
@@ -186,6 +491,8 @@ int fs_resize_sample_buffer(FSampleBuffer *buffer, size_t new_size);
  *        The result of the modulation will be stored back to the destination buffer (dest).
  *        The function call will fail, if the sample rate of the two buffers are different or
  *        if the source buffer is smaller than the destination buffer.
+ *        A mono source modulates every channel of the destination, otherwise the number
+ *        of channels must match.
  * @param dest The dest buffer object
  * @param src The source buffer object
  * @param modulate_type The type of the modulation which shall be performed.
@@ -294,21 +601,349 @@ int fs_sustain(FSampleBuffer *buffer, double time);
  */
 int fs_release(FSampleBuffer *buffer, int curve_type);
 
+/**
+ * @brief Creates an empty envelope object.
+ * @return a pointer to the new envelope or NULL on failure
+ */
+FSEnvelope *fs_create_envelope(void);
+
+/**
+ * @brief Deletes an envelope object and frees its memory.
+ * @param envelope a pointer to the envelope object which should be deleted
+ */
+void fs_delete_envelope(FSEnvelope **envelope);
+
+/**
+ * @brief Appends a segment to an envelope. The level changes from the end level of
+ *        the previous segment (or zero) to the given level within the given time.
+ * @param envelope the envelope object
+ * @param curve_type possible values are: FS_CURVE_LINEAR, FS_CURVE_TAN, FS_CURVE_SQUARE,
+ *        FS_CURVE_CUBIC and FS_CURVE_HOLD, which keeps the previous level
+ * @param time the duration of the segment in seconds
+ * @param level the level which is reached at the end of the segment
+ * @return FS_OK or an error code on failure
+ */
+int fs_add_envelope_segment(FSEnvelope *envelope, int curve_type, double time, double level);
+
+/**
+ * @brief Returns the total duration of all segments of an envelope.
+ * @param envelope the envelope object
+ * @return the duration in seconds
+ */
+double fs_get_envelope_duration(const FSEnvelope *envelope);
+
+/**
+ * @brief Resets an evaluation state to the beginning of an envelope.
+ * @param state the state object which shall be initialized
+ * @param envelope the envelope which is evaluated
+ * @param sample_rate the sample rate used for evaluation
+ */
+void fs_envelope_start(FSEnvelopeState *state, const FSEnvelope *envelope, uint32_t sample_rate);
+
+/**
+ * @brief Evaluates the next samples of an envelope incrementally, without any
+ *        transcendental function calls per sample. After the last segment the level is zero.
+ * @param state the evaluation state
+ * @param out the output array for the envelope levels
+ * @param count the number of levels which shall be written
+ */
+void fs_envelope_render(FSEnvelopeState *state, sample_t *out, size_t count);
+
+/**
+ * @brief Multiplies the content of a buffer with an envelope in a single pass.
+ * @param buffer the target buffer object
+ * @param envelope the envelope which shall be applied
+ * @return FS_OK or an error code on failure
+ */
+int fs_apply_envelope(FSampleBuffer *buffer, const FSEnvelope *envelope);
+
+/**
+ * @brief Generates a base waveform shaped by an envelope. Both are computed block by block
+ *        in one pass, so no separate hull curve buffer is needed.
+ * @param buffer the target buffer object
+ * @param func_type the wave form type (e.g: FS_WAVE_SINE)
+ * @param freq the frequency in Hz with fraction part
+ * @param amp the amplitude value as percentage value with range from 0.0 - 1.0
+ * @param envelope the envelope which shapes the amplitude
+ * @return FS_OK or an error code on failure
+ */
+int fs_generate_enveloped_wave(FSampleBuffer *buffer, int func_type, double freq, double amp, const FSEnvelope *envelope);
+
+/**
+ * @brief Creates a fixed point buffer, which holds the samples in the layout of PCM data.
+ *        It needs a quarter (Q15) or half (Q31) of the memory of a sample buffer.
+ * @param sample_rate the sample rate
+ * @param sample_count the number of samples
+ * @param format FS_FIXED_Q15 or FS_FIXED_Q31
+ * @return a pointer to the new buffer, which is filled with zeros, or NULL on failure
+ */
+FSFixedBuffer *fs_create_fixed_buffer(uint32_t sample_rate, size_t sample_count, int format);
+
+/**
+ * @brief Deletes a fixed point buffer and frees its memory.
+ * @param buffer a pointer to the buffer object which should be deleted
+ */
+void fs_delete_fixed_buffer(FSFixedBuffer **buffer);
+
+/**
+ * @brief Generates a base waveform with integer arithmetic only. The phase is a 32 bit
+ *        accumulator, the sine is interpolated from a Q31 table.
+ * @param buffer the target buffer object
+ * @param func_type the wave form type, one of:
+ *        FS_WAVE_SINE, FS_WAVE_COSINE, FS_WAVE_SAW, FS_WAVE_TRIANGLE, FS_WAVE_RECT or FS_WAVE_NOISE
+ * @param freq the frequency in Hz with fraction part
+ * @param amp the amplitude value with range from 0.0 - 1.0
+ * @return FS_OK or an error code on failure
+ */
+int fs_generate_fixed_wave(FSFixedBuffer *buffer, int func_type, double freq, double amp);
+
+/**
+ * @brief Multiplies the content of a fixed point buffer with an envelope. The levels are
+ *        converted to fixed point gains block by block and applied with saturation.
+ * @param buffer the target buffer object
+ * @param envelope the envelope which shall be applied
+ * @return FS_OK or an error code on failure
+ */
+int fs_apply_fixed_envelope(FSFixedBuffer *buffer, const FSEnvelope *envelope);
+
+/**
+ * @brief Modulates a fixed point buffer by another one with saturating arithmetic,
+ *        results beyond the range of the format are clipped instead of wrapping around.
+ * @param dest the target buffer object
+ * @param src the modulation source, which must have the same format
+ * @param modulate_type FS_MOD_ADD, FS_MOD_SUB or FS_MOD_MULT
+ * @return FS_OK or an error code on failure
+ */
+int fs_modulate_fixed_buffer(FSFixedBuffer *dest, const FSFixedBuffer *src, int modulate_type);
+
+/**
+ * @brief Converts a fixed point buffer into a new sample buffer.
+ * @param buffer the fixed point buffer
+ * @return a pointer to the new buffer or NULL on failure
+ */
+FSampleBuffer *fs_fixed_to_sample_buffer(const FSFixedBuffer *buffer);
+
 /**
  * @brief This function writes all sample values from the given buffer object
- *        into a WAVE file with the specified data format and the number of audio channels
+ *        into a WAVE file with the specified data format and the number of audio channels.
+ *        Channel n of the file takes channel n modulo the channels of the buffer, so a mono
+ *        buffer is written to every channel.
  * @param buffer The buffer with the data which should be written
  * @return FS_OK or an error code on failure
  */
 int fs_samples_to_wave_file(FSampleBuffer *buffer, const char *fname, int format, int channels);
 
+/**
+ * @brief Opens a WAVE file for streamed output. The samples are converted by the calling thread
+ *        into a ring of blocks, a background thread writes the filled blocks to disk.
+ *        If the target is a pipe, the blocks are handed over with vmsplice instead of being copied
+ *        and the header carries placeholder sizes, since it can't be updated afterwards.
+ * @param fname the name of the output file, a named pipe or "-" for the standard output
+ * @param sample_rate the sample rate of the stream
+ * @param format the output format (e.g: WAVE_PCM_16BIT)
+ * @param channels the number of audio channels, each sample is written to every channel
+ * @param flags stream flags, FS_STREAM_DIRECT bypasses the page cache where supported,
+ *        FS_STREAM_RAW writes plain PCM data without a WAVE header
+ * @return a pointer to the stream object or NULL on failure
+ */
+FWaveStream *fs_open_wave_stream(const char *fname, uint32_t sample_rate, int format, int channels, int flags);
+
+/**
+ * @brief Appends samples to a wave stream. The call returns as soon as the samples are converted,
+ *        it blocks only if all blocks of the ring are waiting to be written.
+ * @param stream the stream object
+ * @param samples the samples which shall be written
+ * @param count the number of samples
+ * @return FS_OK or an error code on failure
+ */
+int fs_write_wave_stream(FWaveStream *stream, const sample_t *samples, size_t count);
+
+/**
+ * @brief Appends the samples of a fixed point buffer to a wave stream. If the stream has a single
+ *        channel and the matching PCM format (WAVE_PCM_16BIT for Q15, WAVE_PCM_32BIT for Q31)
+ *        the samples are copied into the ring without any conversion.
+ * @param stream the stream object
+ * @param buffer the buffer with the samples which shall be written
+ * @return FS_OK or an error code on failure
+ */
+int fs_write_wave_stream_fixed(FWaveStream *stream, const FSFixedBuffer *buffer);
+
+/**
+ * @brief Appends all channels of a buffer to a wave stream, they are interleaved while the
+ *        samples are converted. Channel n of the stream takes channel n modulo the channels
+ *        of the buffer.
+ * @param stream the stream object
+ * @param buffer the buffer with the samples which shall be written
+ * @return FS_OK or an error code on failure
+ */
+int fs_write_wave_stream_buffer(FWaveStream *stream, const FSampleBuffer *buffer);
+
+/**
+ * @brief Flushes all pending blocks, updates the file header and closes the stream.
+ * @param stream a pointer to the stream object which should be closed
+ * @param stats optional pointer which receives the ring statistics, may be NULL
+ * @return FS_OK or an error code on failure
+ */
+int fs_close_wave_stream(FWaveStream **stream, FWaveStreamStats *stats);
+
+/**
+ * @brief Sets the ring dimensions for wave streams which will be opened afterwards.
+ * @param block_count the number of blocks, at least two
+ * @param block_size the size of each block in bytes, rounded up to the page size
+ */
+void fs_set_wave_stream_ring(size_t block_count, size_t block_size);
+
+/**
+ * @brief Returns the ring statistics of the last wave stream which has been closed by the calling thread.
+ * @param stats pointer which receives the statistics
+ */
+void fs_get_wave_stream_stats(FWaveStreamStats *stats);
+
 /**
  * @brief Converts the content of a sample buffer into a format which can be used by common audio hardware for playback.
+ *        The channels of the buffer are interleaved.
  * @param buffer the buffer with the samples which shall be converted
  * @return a pointer to the output data, after usage the used memory can be freed by calling the standard function free()
  */
 void *fs_convert_samples(FSampleBuffer *buffer, int format);
 
+/**
+ * @brief Creates a filter object without sections, which passes the signal unchanged.
+ * @param structure FS_FILTER_BIQUAD for direct form biquads or FS_FILTER_SVF for state
+ *        variable filters, which stay well behaved when the cut-off is modulated quickly
+ * @return a pointer to the new filter or NULL on failure
+ */
+FSFilter *fs_create_filter(int structure);
+
+/**
+ * @brief Deletes a filter object and frees its memory.
+ * @param filter a pointer to the filter object which should be deleted
+ */
+void fs_delete_filter(FSFilter **filter);
+
+/**
+ * @brief Appends a second order section to the cascade of a filter.
+ * @param filter the filter object
+ * @param filter_type possible values are: FS_FILTER_LOWPASS, FS_FILTER_HIGHPASS, FS_FILTER_BANDPASS,
+ *        FS_FILTER_NOTCH, FS_FILTER_PEAK, FS_FILTER_LOWSHELF and FS_FILTER_HIGHSHELF
+ * @param cutoff the cut-off, center or corner frequency in Hz
+ * @param q the resonance, must be greater than zero
+ * @param gain the gain of peak and shelf sections in dB, ignored by the other types
+ * @return FS_OK or an error code on failure
+ */
+int fs_add_filter_section(FSFilter *filter, int filter_type, double cutoff, double q, double gain);
+
+/**
+ * @brief Lets a signal move the cut-off frequencies of all sections. A modulation value v
+ *        multiplies the frequencies by 2^(v * depth), the signal must have the sample rate
+ *        of the filtered buffer. The coefficients follow the signal every 32 samples.
+ * @param filter the filter object
+ * @param cutoff_mod the modulation signal, or NULL for fixed frequencies
+ * @param depth the modulation depth in octaves
+ * @return FS_OK or an error code on failure
+ */
+int fs_set_filter_modulation(FSFilter *filter, const FSampleBuffer *cutoff_mod, double depth);
+
+/**
+ * @brief Lets an automation lane move the cut-off frequencies of all sections like
+ *        fs_set_filter_modulation, without a modulation signal of the length of the buffer.
+ *        The lane is read every 32 samples, its time starts at the first sample of the buffer.
+ * @param filter the filter object
+ * @param cutoff_lane the automation lane, or NULL for fixed frequencies
+ * @param depth the modulation depth in octaves per unit of the lane
+ * @return FS_OK or an error code on failure
+ */
+int fs_set_filter_automation(FSFilter *filter, const FSAutomation *cutoff_lane, double depth);
+
+/**
+ * @brief Runs the content of a buffer through all sections of a filter.
+ * @param buffer the target buffer object
+ * @param filter the filter which shall be applied
+ * @return FS_OK or an error code on failure
+ */
+int fs_apply_filter(FSampleBuffer *buffer, const FSFilter *filter);
+
+/**
+ * @brief Creates a convolver for block streams, which applies an impulse response with a
+ *        uniformly partitioned FFT convolution. The cost per block is O(B log B) for the
+ *        transforms plus one spectral product per partition, independent of the block position.
+ * @param ir the impulse response, it is cut into partitions of block_size samples
+ * @param block_size the number of samples per block, a power of two of at least 2
+ * @return a pointer to the new convolver or NULL on failure
+ */
+FSConvolver *fs_create_convolver(const FSampleBuffer *ir, size_t block_size);
+
+/**
+ * @brief Deletes a convolver and frees its memory.
+ * @param conv a pointer to the convolver which should be deleted
+ */
+void fs_delete_convolver(FSConvolver **conv);
+
+/**
+ * @brief Returns the number of samples which are processed by each call of fs_convolve_block.
+ * @param conv the convolver object
+ * @return the block size or 0 if conv is NULL
+ */
+size_t fs_get_convolver_block_size(const FSConvolver *conv);
+
+/**
+ * @brief Clears the history of a convolver, the next block starts without the tail of the previous ones.
+ * @param conv the convolver object
+ */
+void fs_reset_convolver(FSConvolver *conv);
+
+/**
+ * @brief Convolves the next block of a stream with the impulse response, without additional latency.
+ * @param conv the convolver object
+ * @param in the input block with block_size samples
+ * @param out receives block_size output samples, may be the same memory as in
+ * @return FS_OK or an error code on failure
+ */
+int fs_convolve_block(FSConvolver *conv, const sample_t *in, sample_t *out);
+
+/**
+ * @brief Applies an impulse response to a buffer, for example the response of a room as reverb.
+ *        The buffer grows by the length of the response minus one, so that the tail is kept.
+ * @param buffer the target buffer object
+ * @param ir the impulse response with the sample rate of the buffer
+ * @param wet the amount of the convolved signal, 1 replaces the signal and 0 keeps it dry
+ * @return FS_OK or an error code on failure
+ */
+int fs_convolve_buffer(FSampleBuffer *buffer, const FSampleBuffer *ir, double wet);
+
+/**
+ * @brief Generates the sum of many sine partials in one pass over the buffer. The partials are
+ *        computed by recursive complex rotations, several of them side by side in vector registers.
+ * @param buffer the target buffer object
+ * @param partials an array with frequency, amplitude and start phase of every partial,
+ *        partials at or above the Nyquist frequency are left out
+ * @param count the number of partials
+ * @param add zero replaces the content of the buffer, otherwise the partials are added to it
+ * @return FS_OK or an error code on failure
+ */
+int fs_generate_partials(FSampleBuffer *buffer, const FSPartial *partials, size_t count, int add);
+
+/**
+ * @brief Sets the modulation routing and the carriers of an FM patch for its operator count.
+ * @param patch the patch, operator_count must be set before
+ * @param algorithm FS_FM_STACK, FS_FM_PARALLEL or FS_FM_PAIRS
+ * @return FS_OK or an error code on failure
+ */
+int fs_set_fm_algorithm(FSFMPatch *patch, int algorithm);
+
+/**
+ * @brief Generates a tone with the operators of an FM patch. Each operator is a sine whose phase
+ *        is shifted by the outputs of its modulators, all operators are computed together block
+ *        by block from phase accumulators. Operators are evaluated from the highest to the lowest,
+ *        a routing towards a higher operator uses the output of the previous sample.
+ * @param buffer the target buffer object
+ * @param patch the operators and their routing, the ratios must not be negative
+ * @param freq the frequency of the note, the operator frequencies are ratios of it
+ * @param amp the amplitude of the output
+ * @return FS_OK or an error code on failure
+ */
+int fs_generate_fm(FSampleBuffer *buffer, const FSFMPatch *patch, double freq, double amp);
+
 /**
  * @brief Generates a pink noise which means a set of overlapped functions with limited bandwidth and randomized amplitudes
  * @param buffer the buffer with the samples which shall be converted
@@ -331,7 +966,11 @@ int fs_generate_pink_noise(FSampleBuffer *buffer, int func_type, double min_freq
 size_t fs_parse_notes(const char *seq, uint16_t *data, size_t length);
 
 /**
- * @brief Generates a sequencer track with an output sample buffer and a given hull curve
+ * @brief Generates a sequencer track with an output sample buffer and a given hull curve.
+ *        If the channel carries an envelope, each note is generated with fs_generate_enveloped_wave
+ *        and has the length of the envelope, otherwise the hull_curve buffer is used.
+ *        With the FS_WAVE_FM type the notes are generated by fs_generate_fm with the fm_patch
+ *        of the channel and shaped by the envelope or hull curve in the same way.
  * @param channel pointer to a FSTrackChannel pointer
  * @param octave Octave adjustment as a relative value
  * @param data pointer to MIDI data
@@ -340,4 +979,217 @@ size_t fs_parse_notes(const char *seq, uint16_t *data, size_t length);
  */
 int fs_track_sequence(FSTrackChannel *channel, int octave, uint16_t *data, size_t length);
 
+/**
+ * @brief Creates an event scheduler, which renders notes, parameter and tempo changes at the
+ *        exact sample of their timestamp. The audio between two events is rendered as one block,
+ *        so the state of the voices only changes at events.
+ * @param sample_rate the sample rate of the rendered audio
+ * @param bpm the initial tempo in beats per minute, event times are given in beats
+ * @return a pointer to the new scheduler or NULL on failure
+ */
+FSScheduler *fs_create_scheduler(uint32_t sample_rate, double bpm);
+
+/**
+ * @brief Deletes a scheduler and all events which are still queued.
+ * @param scheduler pointer to the scheduler pointer
+ */
+void fs_delete_scheduler(FSScheduler **scheduler);
+
+/**
+ * @brief Sets the sound of the voices. A note rises within the attack time to its velocity,
+ *        falls within the decay time to the sustain level and holds it until its note off
+ *        event, after which it fades out within the release time. Notes with a sustain level
+ *        of zero end after the decay.
+ * @param scheduler the scheduler object
+ * @param func_type the waveform: FS_WAVE_SINE, FS_WAVE_COSINE, FS_WAVE_SAW, FS_WAVE_TRIANGLE, FS_WAVE_RECT or FS_WAVE_NOISE
+ * @param attack the attack time in seconds
+ * @param decay the decay time in seconds
+ * @param sustain the sustain level relative to the velocity
+ * @param release the release time in seconds
+ * @return FS_OK or an error code on failure
+ */
+int fs_set_scheduler_voice(FSScheduler *scheduler, int func_type, double attack, double decay, double sustain, double release);
+
+/**
+ * @brief Queues an event. Events may be added in any order, events with the same time are
+ *        processed in the order they have been added. Events before the current position are
+ *        processed at the beginning of the next rendered block.
+ * @param scheduler the scheduler object
+ * @param beat the time of the event in beats
+ * @param type FS_EVENT_NOTE_ON, FS_EVENT_NOTE_OFF, FS_EVENT_PARAM or FS_EVENT_TEMPO
+ * @param data the MIDI note number of note events or the FS_PARAM_* id of parameter events
+ * @param value the velocity of a note on event, the value of a parameter or the new tempo in beats per minute
+ * @return FS_OK or an error code on failure
+ */
+int fs_schedule_event(FSScheduler *scheduler, double beat, int type, int data, double value);
+
+/**
+ * @brief Renders the next samples of the schedule into a buffer and processes all events up to
+ *        its end. Successive calls continue where the previous one stopped, so a schedule can be
+ *        rendered in pieces of any size while events are still being added.
+ * @param scheduler the scheduler object
+ * @param buffer the buffer which is overwritten, every channel gets the same signal
+ * @return FS_OK or an error code on failure
+ */
+int fs_render_schedule(FSScheduler *scheduler, FSampleBuffer *buffer);
+
+/**
+ * @brief Returns the time from the current position until the last queued event has been
+ *        processed and its release has faded out, this is the length which is left to render.
+ * @param scheduler the scheduler object
+ * @return the remaining duration in seconds
+ */
+double fs_get_schedule_duration(const FSScheduler *scheduler);
+
+/**
+ * @brief Provides the counters of a scheduler, the number of blocks only depends on the events.
+ * @param scheduler the scheduler object
+ * @param stats receives the counters
+ */
+void fs_get_scheduler_stats(const FSScheduler *scheduler, FSSchedulerStats *stats);
+
+/**
+ * @brief Binds an automation lane to a parameter of all voices. A gain lane multiplies the
+ *        gain of the voices sample by sample, a detune lane adds its cents to the detune and
+ *        is read every 256 samples. The time of the lane counts from the first sample the
+ *        scheduler has rendered, also if it's bound later.
+ * @param scheduler the scheduler object
+ * @param param FS_PARAM_GAIN or FS_PARAM_DETUNE
+ * @param lane the automation lane, or NULL to remove it. It isn't copied and must exist
+ *        as long as the scheduler renders.
+ * @return FS_OK or an error code on failure
+ */
+int fs_set_scheduler_automation(FSScheduler *scheduler, int param, const FSAutomation *lane);
+
+/**
+ * @brief Creates an empty automation lane. A lane is a list of breakpoints which is
+ *        evaluated block by block, so a slowly changing parameter of a long buffer costs
+ *        a few values instead of a modulation buffer of the same length.
+ * @return lane object or NULL on failure
+ */
+FSAutomation *fs_create_automation(void);
+
+/**
+ * @brief Releases an automation lane and sets the pointer to NULL.
+ * @param lane pointer to the lane object
+ */
+void fs_delete_automation(FSAutomation **lane);
+
+/**
+ * @brief Adds a breakpoint to the end of a lane. The curve leads from the level of the
+ *        previous breakpoint to this one, two breakpoints at the same time give a jump.
+ *        The lane holds the level of the first breakpoint before it and of the last one after it.
+ * @param lane the lane object
+ * @param time time of the breakpoint in seconds, not before the previous one
+ * @param curve_type possible values are: FS_CURVE_LINEAR, FS_CURVE_TAN, FS_CURVE_SQUARE,
+ *        FS_CURVE_CUBIC, FS_CURVE_HOLD, which jumps at the breakpoint, and FS_CURVE_EXP,
+ *        which needs levels of the same sign and suits frequencies
+ * @param level the level of the breakpoint
+ * @return FS_OK or an error code on failure
+ */
+int fs_add_automation_point(FSAutomation *lane, double time, int curve_type, double level);
+
+/**
+ * @brief Returns the level of a lane at the given time.
+ * @param lane the lane object
+ * @param time the time in seconds
+ * @return the level, 0 if the lane is empty
+ */
+double fs_get_automation_level(const FSAutomation *lane, double time);
+
+/**
+ * @brief Returns the time of the last breakpoint of a lane.
+ * @param lane the lane object
+ * @return the time in seconds
+ */
+double fs_get_automation_duration(const FSAutomation *lane);
+
+/**
+ * @brief Starts the incremental evaluation of a lane at its first sample.
+ * @param state the evaluation state
+ * @param lane the lane object, it must exist as long as the state is used
+ * @param sample_rate the sample rate of the levels
+ */
+void fs_automation_start(FSAutomationState *state, const FSAutomation *lane, uint32_t sample_rate);
+
+/**
+ * @brief Moves the evaluation of a lane to another sample position.
+ * @param state the evaluation state
+ * @param position the sample position of the next level
+ */
+void fs_automation_seek(FSAutomationState *state, uint64_t position);
+
+/**
+ * @brief Writes the next levels of a lane. Within a segment each level costs a few
+ *        operations, the breakpoint times are rounded to samples.
+ * @param state the evaluation state
+ * @param out receives count levels
+ * @param count the number of levels
+ */
+void fs_automation_render(FSAutomationState *state, sample_t *out, size_t count);
+
+/**
+ * @brief Multiplies a buffer with the levels of a lane, e.g. a volume automation.
+ * @param buffer the buffer object, every channel is multiplied with the same levels
+ * @param lane the lane object, its time starts at the first sample of the buffer
+ * @return FS_OK or an error code on failure
+ */
+int fs_apply_automation(FSampleBuffer *buffer, const FSAutomation *lane);
+
+/**
+ * @brief Generates a base waveform whose frequency and amplitude follow automation lanes.
+ *        It replaces fs_modulate_frequency with a frequency buffer, the lanes are rendered
+ *        block by block.
+ * @param buffer the target buffer object
+ * @param func_type the wave form type (e.g: FS_WAVE_SINE)
+ * @param freq lane with the frequency in Hz
+ * @param amp lane with the amplitude, or NULL for an amplitude of 1
+ * @return FS_OK or an error code on failure
+ */
+int fs_generate_automated_wave(FSampleBuffer *buffer, int func_type, const FSAutomation *freq, const FSAutomation *amp);
+
+/**
+ * @brief Opens a WAVE or RF64 file by mapping it into memory and parses the format and data chunks.
+ *        No sample data is read at this point, the pages are faulted in on first access.
+ * @param fname the name of the file
+ * @return a pointer to the wave file object or NULL on failure
+ */
+FWaveFile *fs_open_wave_file(const char *fname);
+
+/**
+ * @brief Unmaps and closes a wave file object which has been opened by fs_open_wave_file.
+ * @param wave a pointer to the wave file object which should be closed
+ */
+void fs_close_wave_file(FWaveFile **wave);
+
+/**
+ * @brief Converts a block of frames from one channel of a mapped wave file into sample values.
+ *        This allows processing of large files block by block without decoding the whole file.
+ * @param wave the wave file object
+ * @param channel the channel index, starting with 0
+ * @param offset the index of the first frame to be converted
+ * @param out the output array, which must be able to carry count samples
+ * @param count the maximum number of samples to be converted
+ * @return the number of samples which have been written to the output array
+ */
+size_t fs_read_wave_samples(FWaveFile *wave, int channel, size_t offset, sample_t *out, size_t count);
+
+/**
+ * @brief Creates a sample buffer from one channel of a mapped wave file.
+ *        If the file carries mono float data in the sample_t format the buffer is a zero-copy
+ *        private view of the file mapping, otherwise the samples are converted in a single pass.
+ * @param wave the wave file object
+ * @param channel the channel index, starting with 0, or FS_ALL_CHANNELS for a buffer with all channels
+ * @return a pointer to the new buffer or NULL on failure
+ */
+FSampleBuffer *fs_wave_file_to_buffer(FWaveFile *wave, int channel);
+
+/**
+ * @brief Loads one channel of a WAVE or RF64 file into a new sample buffer.
+ * @param fname the name of the file
+ * @param channel the channel index, starting with 0, or FS_ALL_CHANNELS for a buffer with all channels
+ * @return a pointer to the new buffer or NULL on failure
+ */
+FSampleBuffer *fs_load_wave_file(const char *fname, int channel);
+
 #endif /* _FSYNTH_H_ */
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Open addressing hash map with string keys and a global string intern pool
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "hashmap.h"
+
+#define CTRL_EMPTY       0x80
+#define CTRL_DELETED     0xfe
+#define ARENA_CHUNK      65536
+
+struct ArenaChunk {
+  struct ArenaChunk *next;
+  size_t used;
+  size_t size;
+  char data[];
+};
+
+struct HashMap intern_pool = HMAP_INITIALIZER;
+struct ArenaChunk *intern_arena = NULL;
+pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t hash_fnv1a64(const char *data, size_t data_size)
+{
+  size_t i;
+  uint64_t hv = 0xcbf29ce484222325ULL;
+  for (i = 0; i < data_size; ++i) {
+    hv = (hv ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+  }
+  /* Final avalanche, so that the low bits and the tag bits are both well distributed */
+  hv ^= hv >> 33;
+  hv *= 0xff51afd7ed558ccdULL;
+  hv ^= hv >> 33;
+  return hv;
+}
+
+/* Returns a bit mask of all slots within a group which carry the given control byte */
+unsigned int group_match(const unsigned char *ctrl, unsigned char byte)
+{
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+  return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+  int i;
+  unsigned int mask = 0;
+  for (i = 0; i < HMAP_GROUP; ++i) {
+    if (ctrl[i] == byte) mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+/* Returns a bit mask of all empty or deleted slots within a group */
+unsigned int group_match_free(const unsigned char *ctrl)
+{
+#ifdef __SSE2__
+  return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+#else
+  int i;
+  unsigned int mask = 0;
+  for (i = 0; i < HMAP_GROUP; ++i) {
+    if (ctrl[i] & 0x80) mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+struct HashEntry *hmap_lookup(struct HashMap *map, const char *key, uint64_t hash)
+{
+  unsigned int match;
+  size_t group, step = 0, groups;
+  struct HashEntry *entry;
+  if (map->capacity == 0) return NULL;
+  groups = map->capacity / HMAP_GROUP;
+  group = (hash >> 7) & (groups - 1);
+  while (step < groups) {
+    match = group_match(&map->ctrl[group * HMAP_GROUP], hash & 0x7f);
+    while (match != 0) {
+      entry = &map->entries[group * HMAP_GROUP + __builtin_ctz(match)];
+      if (entry->hash == hash && (entry->key == key || strcmp(entry->key, key) == 0)) {
+        return entry;
+      }
+      match &= match - 1;
+    }
+    /* A group with an empty slot terminates every probe sequence */
+    if (group_match(&map->ctrl[group * HMAP_GROUP], CTRL_EMPTY) != 0) break;
+    /* Triangular probing visits every group, since the number of groups is a power of two */
+    group = (group + ++step) & (groups - 1);
+  }
+  return NULL;
+}
+
+struct HashEntry *hmap_insert_slot(struct HashMap *map, const char *key, uint64_t hash, void *value)
+{
+  unsigned int match;
+  size_t slot, group, step = 0, groups = map->capacity / HMAP_GROUP;
+  group = (hash >> 7) & (groups - 1);
+  while ((match = group_match_free(&map->ctrl[group * HMAP_GROUP])) == 0) {
+    group = (group + ++step) & (groups - 1);
+  }
+  slot = group * HMAP_GROUP + __builtin_ctz(match);
+  if (map->ctrl[slot] == CTRL_DELETED) {
+    --map->deleted;
+  }
+  map->ctrl[slot] = hash & 0x7f;
+  map->entries[slot].hash = hash;
+  map->entries[slot].key = key;
+  map->entries[slot].value = value;
+  ++map->count;
+  return &map->entries[slot];
+}
+
+int hmap_rehash(struct HashMap *map, size_t capacity)
+{
+  size_t idx;
+  struct HashMap temp = HMAP_INITIALIZER;
+  temp.capacity = capacity;
+  temp.ctrl = (unsigned char*) malloc(capacity);
+  temp.entries = (struct HashEntry*) malloc(sizeof(struct HashEntry) * capacity);
+  if (temp.ctrl == NULL || temp.entries == NULL) {
+    free(temp.ctrl);
+    free(temp.entries);
+    return -1;
+  }
+  memset(temp.ctrl, CTRL_EMPTY, capacity);
+  for (idx = 0; idx < map->capacity; ++idx) {
+    if (!(map->ctrl[idx] & 0x80)) {
+      hmap_insert_slot(&temp, map->entries[idx].key, map->entries[idx].hash, map->entries[idx].value);
+    }
+  }
+  free(map->ctrl);
+  free(map->entries);
+  *map = temp;
+  return 0;
+}
+
+struct HashEntry *hmap_insert(struct HashMap *map, const char *key, uint64_t hash, void *value)
+{
+  size_t capacity;
+  /* Keep the load including tombstones below 7/8, grow only if the live entries need it */
+  if ((map->count + map->deleted + 1) * 8 > map->capacity * 7) {
+    capacity = map->capacity;
+    if (capacity == 0) {
+      capacity = HMAP_GROUP;
+    } else if ((map->count + 1) * 2 > capacity) {
+      capacity *= 2;
+    }
+    if (hmap_rehash(map, capacity) != 0) return NULL;
+  }
+  return hmap_insert_slot(map, key, hash, value);
+}
+
+struct HashEntry *hmap_find(struct HashMap *map, const char *key)
+{
+  return hmap_lookup(map, key, hash_fnv1a64(key, strlen(key)));
+}
+
+void *hmap_get(struct HashMap *map, const char *key)
+{
+  struct HashEntry *entry = hmap_find(map, key);
+  return (entry != NULL) ? entry->value : NULL;
+}
+
+struct HashEntry *hmap_put(struct HashMap *map, const char *key, void *value)
+{
+  uint64_t hash = hash_fnv1a64(key, strlen(key));
+  struct HashEntry *entry = hmap_lookup(map, key, hash);
+  if (entry != NULL) {
+    entry->value = value;
+    return entry;
+  }
+  key = intern_string(key);
+  if (key == NULL) return NULL;
+  return hmap_insert(map, key, hash, value);
+}
+
+int hmap_remove(struct HashMap *map, const char *key)
+{
+  size_t slot;
+  struct HashEntry *entry = hmap_find(map, key);
+  if (entry == NULL) return -1;
+  slot = entry - map->entries;
+  /* If the group still has an empty slot no probe sequence passes it, so no tombstone is needed */
+  if (group_match(&map->ctrl[slot - slot % HMAP_GROUP], CTRL_EMPTY) != 0) {
+    map->ctrl[slot] = CTRL_EMPTY;
+  } else {
+    map->ctrl[slot] = CTRL_DELETED;
+    ++map->deleted;
+  }
+  --map->count;
+  return 0;
+}
+
+struct HashEntry *hmap_next(struct HashMap *map, size_t *iter)
+{
+  while (*iter < map->capacity) {
+    if (!(map->ctrl[*iter] & 0x80)) {
+      return &map->entries[(*iter)++];
+    }
+    ++(*iter);
+  }
+  return NULL;
+}
+
+void hmap_free(struct HashMap *map)
+{
+  free(map->ctrl);
+  free(map->entries);
+  memset(map, 0, sizeof(struct HashMap));
+}
+
+char *arena_alloc(size_t size)
+{
+  char *ptr;
+  size_t chunk_size;
+  struct ArenaChunk *chunk = intern_arena;
+  if (chunk == NULL || chunk->size - chunk->used < size) {
+    chunk_size = (size > ARENA_CHUNK) ? size : ARENA_CHUNK;
+    chunk = (struct ArenaChunk*) malloc(sizeof(struct ArenaChunk) + chunk_size);
+    if (chunk == NULL) return NULL;
+    chunk->next = intern_arena;
+    chunk->used = 0;
+    chunk->size = chunk_size;
+    intern_arena = chunk;
+  }
+  ptr = chunk->data + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+const char *intern_string(const char *str)
+{
+  char *copy;
+  const char *key;
+  size_t length = strlen(str);
+  uint64_t hash = hash_fnv1a64(str, length);
+  struct HashEntry *entry;
+  pthread_mutex_lock(&intern_lock);
+  entry = hmap_lookup(&intern_pool, str, hash);
+  if (entry != NULL) {
+    /* The entry lies in the slot array, which another insert may reallocate after the unlock */
+    key = entry->key;
+    pthread_mutex_unlock(&intern_lock);
+    return key;
+  }
+  copy = arena_alloc(length + 1);
+  if (copy != NULL) {
+    memcpy(copy, str, length + 1);
+    if (hmap_insert(&intern_pool, copy, hash, copy) == NULL) {
+      copy = NULL;
+    }
+  }
+  pthread_mutex_unlock(&intern_lock);
+  return copy;
+}
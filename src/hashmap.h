@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Open addressing hash map with string keys and a global string intern pool
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#ifndef _HASHMAP_H_
+#define _HASHMAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of slots which are probed at once */
+#define HMAP_GROUP     16
+
+struct HashEntry {
+  uint64_t hash;
+  const char *key;      /* Interned copy of the key */
+  void *value;
+};
+
+struct HashMap {
+  size_t capacity;      /* Number of slots, a power of two and a multiple of HMAP_GROUP */
+  size_t count;         /* Number of live entries */
+  size_t deleted;       /* Number of tombstones */
+  unsigned char *ctrl;  /* One control byte per slot: empty, deleted or 7 bits of the hash */
+  struct HashEntry *entries;
+};
+
+/* A zero initialized map is empty and valid, memory is allocated on the first insertion */
+#define HMAP_INITIALIZER { 0, 0, 0, NULL, NULL }
+
+struct HashEntry *hmap_find(struct HashMap *map, const char *key);
+void *hmap_get(struct HashMap *map, const char *key);
+struct HashEntry *hmap_put(struct HashMap *map, const char *key, void *value);
+int hmap_remove(struct HashMap *map, const char *key);
+struct HashEntry *hmap_next(struct HashMap *map, size_t *iter);
+void hmap_free(struct HashMap *map);
+const char *intern_string(const char *str);
+uint64_t hash_fnv1a64(const char *data, size_t data_size);
+
+#endif /* _HASHMAP_H_ */
@@ -12,55 +12,92 @@
  */
 
 #include <stdlib.h>
+#include <memory.h>
 #include <math.h>
 #include "fsynth.h"
+#include "trace.h"
+
+#define ENVELOPE_BLOCK   256
+
+void envelope_segment_begin(FSEnvelopeState *state, int curve_type, double start, double end, size_t count)
+{
+  state->curve_type = curve_type;
+  state->remaining = count;
+  state->lerp = start;
+  state->level = end;
+  state->step = (count > 0 && curve_type != FS_CURVE_HOLD) ? (end - start) / count : 0;
+  if (curve_type == FS_CURVE_TAN) {
+    state->tan_value = tan(start);
+    state->tan_step = tan(state->step);
+  }
+}
+
+/* Writes the next count levels of the current segment, count must not exceed the remaining samples */
+void envelope_segment_run(FSEnvelopeState *state, sample_t *out, size_t count)
+{
+  size_t idx;
+  double x = state->lerp, t = state->tan_value;
+  switch (state->curve_type) {
+  case FS_CURVE_LINEAR:
+    for (idx = 0; idx < count; ++idx, x += state->step) out[idx] = x;
+    break;
+  case FS_CURVE_SQUARE:
+    for (idx = 0; idx < count; ++idx, x += state->step) out[idx] = x * x;
+    break;
+  case FS_CURVE_CUBIC:
+    for (idx = 0; idx < count; ++idx, x += state->step) out[idx] = x * x * x;
+    break;
+  case FS_CURVE_TAN:
+    /* tan(a + b) = (tan(a) + tan(b)) / (1 - tan(a) * tan(b)) */
+    for (idx = 0; idx < count; ++idx) {
+      out[idx] = t;
+      t = (t + state->tan_step) / (1 - t * state->tan_step);
+    }
+    x += state->step * count;
+    break;
+  default:
+    for (idx = 0; idx < count; ++idx) out[idx] = x;
+    break;
+  }
+  state->lerp = x;
+  state->tan_value = t;
+  state->remaining -= count;
+}
 
 int fs_attack_decay(FSampleBuffer *buffer, int curve_type, double time, double level)
 {
-  size_t idx, start_pos, end_pos;
-  sample_t start_level, end_level, x;
-  sample_t range, pos, lerp;
+  size_t start_pos, end_pos;
+  unsigned int ch;
+  sample_t start_level, end_level;
+  FSEnvelopeState state;
   fs_clear_error();
   if (INVALID_BUFFER(buffer)) {
     fs_set_error(FS_INVALID_BUFFER);
     return fs_get_error();
   }
+  if (curve_type < FS_CURVE_LINEAR || curve_type > FS_CURVE_HOLD) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
   start_pos = buffer->hull_ptr;
   end_pos = buffer->hull_ptr + fs_get_buffer_position(buffer, time);
   end_pos = MIN(buffer->sample_count, end_pos);
   if (end_pos < start_pos) {
     fs_set_error(FS_INVALID_OPERATION | FS_INVALID_ARGUMENT);
-  } else {
+  } else if (fs_unshare_samples(buffer, 1) == FS_OK) {
     start_level = buffer->hull_level;
     end_level = buffer->hull_level + (sample_t)level;
-    range = end_pos - start_pos;
-    for (idx = start_pos; idx < end_pos; ++idx) {
-      pos = idx - start_pos;
-      x = pos / range;
-      lerp = LERP(start_level, end_level, x);
-      switch (curve_type) {
-        case FS_CURVE_LINEAR:
-          buffer->samples[idx] = lerp;
-          break;
-        case FS_CURVE_TAN:
-          buffer->samples[idx] = tan(lerp);
-          break;
-        case FS_CURVE_SQUARE:
-          buffer->samples[idx] = lerp * lerp;
-          break;
-        case FS_CURVE_CUBIC:
-          buffer->samples[idx] = lerp * lerp * lerp;
-          break;
-        case FS_CURVE_HOLD:
-          buffer->samples[idx] = buffer->hull_level;
-          break;
-        default:
-          fs_set_error(FS_INVALID_ARGUMENT);
-          return fs_get_error();
-      }
+    FS_TRACE_KERNEL("fs_attack_decay", end_pos - start_pos);
+    envelope_segment_begin(&state, curve_type, start_level, end_level, end_pos - start_pos);
+    envelope_segment_run(&state, &buffer->samples[start_pos], end_pos - start_pos);
+    /* Every channel carries the same hull */
+    for (ch = 1; ch < buffer->channels; ++ch) {
+      memcpy(&FS_CHANNEL(buffer, ch)[start_pos], &buffer->samples[start_pos], sizeof(sample_t) * (end_pos - start_pos));
     }
     buffer->hull_ptr = end_pos;
     buffer->hull_level = end_level;
+    fs_add_stats((end_pos - start_pos) * buffer->channels, sizeof(sample_t) * (end_pos - start_pos) * buffer->channels);
+    FS_TRACE_END();
   }
   return fs_get_error();
 }
@@ -77,3 +114,121 @@ int fs_release(FSampleBuffer *buffer, int curve_type)
   fs_attack_decay(buffer, curve_type, time, -buffer->hull_level);
   return fs_get_error();
 }
+
+FSEnvelope *fs_create_envelope(void)
+{
+  FSEnvelope *envelope;
+  fs_clear_error();
+  envelope = (FSEnvelope*) malloc(sizeof(FSEnvelope));
+  if (envelope == NULL) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  memset(envelope, 0, sizeof(FSEnvelope));
+  return envelope;
+}
+
+void fs_delete_envelope(FSEnvelope **envelope)
+{
+  if (envelope != NULL && (*envelope) != NULL) {
+    free(*envelope);
+    *envelope = NULL;
+  }
+}
+
+int fs_add_envelope_segment(FSEnvelope *envelope, int curve_type, double time, double level)
+{
+  FSEnvSegment *segment;
+  fs_clear_error();
+  if (envelope == NULL || time < 0 || curve_type < FS_CURVE_LINEAR || curve_type > FS_CURVE_HOLD) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  if (envelope->segment_count >= FS_MAX_ENV_SEGMENTS) {
+    fs_set_error(FS_INDEX_OUT_OF_RANGE);
+    return fs_get_error();
+  }
+  segment = &envelope->segments[envelope->segment_count];
+  if (curve_type == FS_CURVE_HOLD) {
+    level = (envelope->segment_count > 0) ? segment[-1].level : 0;
+  }
+  segment->curve_type = curve_type;
+  segment->duration = time;
+  segment->level = level;
+  ++envelope->segment_count;
+  return fs_get_error();
+}
+
+double fs_get_envelope_duration(const FSEnvelope *envelope)
+{
+  size_t idx;
+  double duration = 0;
+  if (envelope != NULL) {
+    for (idx = 0; idx < envelope->segment_count; ++idx) {
+      duration += envelope->segments[idx].duration;
+    }
+  }
+  return duration;
+}
+
+void fs_envelope_start(FSEnvelopeState *state, const FSEnvelope *envelope, uint32_t sample_rate)
+{
+  memset(state, 0, sizeof(FSEnvelopeState));
+  state->envelope = envelope;
+  state->sample_rate = sample_rate;
+  state->curve_type = FS_CURVE_HOLD;
+}
+
+void fs_envelope_render(FSEnvelopeState *state, sample_t *out, size_t count)
+{
+  size_t n;
+  const FSEnvSegment *segment;
+  while (count > 0) {
+    if (state->remaining == 0) {
+      if (state->envelope == NULL || state->segment >= state->envelope->segment_count) {
+        memset(out, 0, sizeof(sample_t) * count);
+        break;
+      }
+      segment = &state->envelope->segments[state->segment++];
+      envelope_segment_begin(state, segment->curve_type, state->level, segment->level,
+        (size_t)(segment->duration * state->sample_rate));
+      continue;
+    }
+    n = MIN(count, state->remaining);
+    envelope_segment_run(state, out, n);
+    out += n;
+    count -= n;
+  }
+}
+
+int fs_apply_envelope(FSampleBuffer *buffer, const FSEnvelope *envelope)
+{
+  size_t pos, idx, n;
+  unsigned int ch;
+  sample_t *samples, levels[ENVELOPE_BLOCK];
+  FSEnvelopeState state;
+  fs_clear_error();
+  if (INVALID_BUFFER(buffer) || envelope == NULL) {
+    fs_set_error(FS_INVALID_BUFFER);
+    return fs_get_error();
+  }
+  if (fs_unshare_samples(buffer, 1) != FS_OK) {
+    return fs_get_error();
+  }
+  fs_envelope_start(&state, envelope, buffer->sample_rate);
+  FS_TRACE_KERNEL("fs_apply_envelope", FS_TOTAL_SAMPLES(buffer));
+  for (pos = 0; pos < buffer->sample_count; pos += n) {
+    n = MIN(ENVELOPE_BLOCK, buffer->sample_count - pos);
+    fs_envelope_render(&state, levels, n);
+    /* The levels of a block are rendered once and applied to every channel */
+    for (ch = 0; ch < buffer->channels; ++ch) {
+      samples = &FS_CHANNEL(buffer, ch)[pos];
+      for (idx = 0; idx < n; ++idx) {
+        samples[idx] *= levels[idx];
+      }
+    }
+  }
+  fs_add_stats(FS_TOTAL_SAMPLES(buffer), buffer->buffer_size * 2);
+  FS_TRACE_END();
+  return fs_get_error();
+}
@@ -12,8 +12,56 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "fsynth.h"
 #include "logging.h"
+#include "hashmap.h"
+
+#define LOG_RING_SLOTS    256
+#define LOG_SLOT_SIZE     256
+#define LOG_MAX_RINGS     64
+#define LOG_IDLE_NS       2000000
+
+#define LOG_LEN_INT       0
+#define LOG_LEN_LONG      1
+#define LOG_LEN_LLONG     2
+#define LOG_LEN_SIZE      3
+#define LOG_LEN_LDOUBLE   4
+
+#define LOG_KIND_FORMAT   1
+#define LOG_KIND_MESSAGE  2
+
+struct LogRecord {
+  uint64_t time;           /* Nanoseconds since the logger was started */
+  const char *format;      /* Format string of binary records, which carry the encoded arguments */
+  uint32_t thread;
+  uint16_t level;
+  uint16_t size;           /* Number of used data bytes */
+  char data[LOG_SLOT_SIZE - 24];
+};
+
+/* Single producer ring owned by one thread, drained by the log thread */
+struct LogRing {
+  _Alignas(64) atomic_size_t head;
+  _Alignas(64) atomic_size_t tail;
+  atomic_int closed;
+  uint32_t thread;
+  struct LogRecord slots[LOG_RING_SLOTS];
+};
+
+/* One printf conversion of a format string */
+struct LogSpec {
+  size_t size;             /* Length of the whole conversion including the '%' */
+  size_t length_pos;       /* Offset of the length modifier */
+  int stars;               /* Number of '*' width and precision arguments */
+  int length;
+  char conversion;
+};
 
 #ifndef DEBUG
 int log_level = LOG_INFO | LOG_WARN | LOG_ERR;
@@ -21,6 +69,37 @@ int log_level = LOG_INFO | LOG_WARN | LOG_ERR;
 int log_level = LOG_INFO | LOG_WARN | LOG_ERR | LOG_DEBUG;
 #endif
 
+atomic_int log_mode = LOG_MODE_SYNC;
+atomic_int log_running = 0;
+atomic_uint log_thread_ids = 0;
+atomic_uint_least64_t log_records = 0;
+atomic_uint_least64_t log_dropped = 0;
+pthread_t log_thread;
+pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t log_key_once = PTHREAD_ONCE_INIT;
+pthread_key_t log_key;
+struct LogRing *log_rings[LOG_MAX_RINGS];
+size_t log_ring_count = 0;
+__thread struct LogRing *log_thread_ring = NULL;
+struct timespec log_epoch;
+FILE *log_file = NULL;
+struct HashMap log_formats = HMAP_INITIALIZER;
+uint32_t log_format_count = 0;
+
+const char *level_prefix(int level)
+{
+  switch (level) {
+  case LOG_ERR:
+    return "Error: ";
+  case LOG_WARN:
+    return "Warning: ";
+  case LOG_INFO:
+    return "Info: ";
+  default:
+    return "Debug: ";
+  }
+}
+
 void fs_set_log_level(int level)
 {
   log_level = level;
@@ -31,35 +110,471 @@ int fs_get_log_level(void)
   return log_level;
 }
 
+size_t parse_spec(const char *p, struct LogSpec *spec)
+{
+  const char *s = p + 1;
+  spec->stars = 0;
+  spec->length = LOG_LEN_INT;
+  while (*s != 0 && strchr("-+ #0'", *s) != NULL) ++s;
+  if (*s == '*') {
+    ++spec->stars;
+    ++s;
+  }
+  while (*s >= '0' && *s <= '9') ++s;
+  if (*s == '.') {
+    ++s;
+    if (*s == '*') {
+      ++spec->stars;
+      ++s;
+    }
+    while (*s >= '0' && *s <= '9') ++s;
+  }
+  spec->length_pos = s - p;
+  if (s[0] == 'l' && s[1] == 'l') {
+    spec->length = LOG_LEN_LLONG;
+    s += 2;
+  } else if (s[0] == 'h' && s[1] == 'h') {
+    s += 2;
+  } else if (*s == 'l') {
+    spec->length = LOG_LEN_LONG;
+    ++s;
+  } else if (*s == 'j') {
+    spec->length = LOG_LEN_LLONG;
+    ++s;
+  } else if (*s == 'z' || *s == 't') {
+    spec->length = LOG_LEN_SIZE;
+    ++s;
+  } else if (*s == 'L') {
+    spec->length = LOG_LEN_LDOUBLE;
+    ++s;
+  } else if (*s == 'h') {
+    ++s;
+  }
+  spec->conversion = *s;
+  if (*s != 0) ++s;
+  spec->size = s - p;
+  return spec->size;
+}
+
+int put_value(char *out, size_t room, size_t *pos, const void *value, size_t size)
+{
+  if (*pos + size > room) return 0;
+  memcpy(out + *pos, value, size);
+  *pos += size;
+  return 1;
+}
+
+/* Stores the arguments in their binary form, the conversions are applied by the decoder */
+size_t encode_args(char *out, size_t room, const char *format, va_list args)
+{
+  int idx;
+  size_t pos = 0;
+  uint16_t length;
+  int64_t iv;
+  uint64_t uv;
+  double dv;
+  const char *sv;
+  struct LogSpec spec;
+  while ((format = strchr(format, '%')) != NULL) {
+    format += parse_spec(format, &spec);
+    if (spec.conversion == '%') continue;
+    for (idx = 0; idx < spec.stars; ++idx) {
+      iv = va_arg(args, int);
+      if (!put_value(out, room, &pos, &iv, sizeof(iv))) return pos;
+    }
+    switch (spec.conversion) {
+    case 'd': case 'i':
+      if (spec.length == LOG_LEN_LLONG) iv = va_arg(args, long long);
+      else if (spec.length == LOG_LEN_LONG) iv = va_arg(args, long);
+      else if (spec.length == LOG_LEN_SIZE) iv = (int64_t)va_arg(args, size_t);
+      else iv = va_arg(args, int);
+      if (!put_value(out, room, &pos, &iv, sizeof(iv))) return pos;
+      break;
+    case 'u': case 'o': case 'x': case 'X': case 'c':
+      if (spec.length == LOG_LEN_LLONG) uv = va_arg(args, unsigned long long);
+      else if (spec.length == LOG_LEN_LONG) uv = va_arg(args, unsigned long);
+      else if (spec.length == LOG_LEN_SIZE) uv = va_arg(args, size_t);
+      else uv = va_arg(args, unsigned int);
+      if (!put_value(out, room, &pos, &uv, sizeof(uv))) return pos;
+      break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      dv = (spec.length == LOG_LEN_LDOUBLE) ? (double)va_arg(args, long double) : va_arg(args, double);
+      if (!put_value(out, room, &pos, &dv, sizeof(dv))) return pos;
+      break;
+    case 's':
+      sv = va_arg(args, const char*);
+      if (sv == NULL) sv = "(null)";
+      if (pos + sizeof(length) >= room) return pos;
+      length = (uint16_t)MIN(strlen(sv), room - pos - sizeof(length));
+      put_value(out, room, &pos, &length, sizeof(length));
+      put_value(out, room, &pos, sv, length);
+      break;
+    case 'p':
+      uv = (uintptr_t)va_arg(args, void*);
+      if (!put_value(out, room, &pos, &uv, sizeof(uv))) return pos;
+      break;
+    default:
+      /* Unsupported conversions end the record, the decoder prints the remaining format text */
+      return pos;
+    }
+  }
+  return pos;
+}
+
+void log_ring_closed(void *ring)
+{
+  atomic_store(&((struct LogRing*)ring)->closed, 1);
+}
+
+void create_log_key(void)
+{
+  pthread_key_create(&log_key, log_ring_closed);
+}
+
+/* Returns the ring of the calling thread, it is registered with the log thread on first use */
+struct LogRing *thread_ring(void)
+{
+  struct LogRing *ring = log_thread_ring;
+  if (ring != NULL) return ring;
+  ring = (struct LogRing*) aligned_alloc(64, sizeof(struct LogRing));
+  if (ring == NULL) return NULL;
+  memset(ring, 0, sizeof(struct LogRing));
+  ring->thread = atomic_fetch_add(&log_thread_ids, 1) + 1;
+  pthread_mutex_lock(&log_lock);
+  if (log_ring_count < LOG_MAX_RINGS) {
+    log_rings[log_ring_count++] = ring;
+  } else {
+    free(ring);
+    ring = NULL;
+  }
+  pthread_mutex_unlock(&log_lock);
+  if (ring != NULL) {
+    pthread_once(&log_key_once, create_log_key);
+    pthread_setspecific(log_key, ring);
+    log_thread_ring = ring;
+  }
+  return ring;
+}
+
+uint64_t log_time(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)(now.tv_sec - log_epoch.tv_sec) * 1000000000ULL + now.tv_nsec - log_epoch.tv_nsec;
+}
+
+void print_message(int level, const char *format, va_list args)
+{
+  char text[LOG_SLOT_SIZE];
+  vsnprintf(text, sizeof(text), format, args);
+  fprintf(stderr, "%s%s\n", level_prefix(level), text);
+}
+
+int push_message(int mode, int level, const char *format, va_list args)
+{
+  int length;
+  size_t head;
+  struct LogRecord *record;
+  struct LogRing *ring = thread_ring();
+  if (ring == NULL) return 0;
+  head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SLOTS) {
+    /* The renderer is never blocked by a slow log output */
+    atomic_fetch_add(&log_dropped, 1);
+    return 1;
+  }
+  record = &ring->slots[head % LOG_RING_SLOTS];
+  record->time = log_time();
+  record->thread = ring->thread;
+  record->level = level;
+  if (mode == LOG_MODE_BINARY) {
+    record->format = format;
+    record->size = encode_args(record->data, sizeof(record->data), format, args);
+  } else {
+    record->format = NULL;
+    length = vsnprintf(record->data, sizeof(record->data), format, args);
+    record->size = (uint16_t)MIN((size_t)MAX(0, length), sizeof(record->data) - 1);
+  }
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return 1;
+}
+
 void fs_log(int level, const char *format, ...)
 {
   va_list args;
-  if ((log_level & LOG_ERR) && (level == LOG_ERR)) {
-    fprintf(stderr, "Error: ");
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    fputc('\n', stderr);
+  int mode;
+  if (!(log_level & level)) return;
+  va_start(args, format);
+  mode = atomic_load_explicit(&log_mode, memory_order_acquire);
+  if (mode == LOG_MODE_SYNC || !push_message(mode, level, format, args)) {
     va_end(args);
-  }
-  if ((log_level & LOG_WARN) && (level == LOG_WARN)) {
-    fprintf(stderr, "Warning: ");
     va_start(args, format);
-    vfprintf(stderr, format, args);
-    fputc('\n', stderr);
-    va_end(args);
+    print_message(level, format, args);
   }
-  if ((log_level & LOG_INFO) && (level == LOG_INFO)) {
-    fprintf(stderr, "Info: ");
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    fputc('\n', stderr);
-    va_end(args);
+  va_end(args);
+}
+
+void write_binary_record(const struct LogRecord *record)
+{
+  uint8_t kind;
+  uint16_t length;
+  uint32_t id;
+  struct HashEntry *entry = hmap_find(&log_formats, record->format);
+  if (entry == NULL) {
+    /* Every format string is stored once, messages refer to it by its id */
+    id = ++log_format_count;
+    hmap_put(&log_formats, record->format, (void*)(uintptr_t)id);
+    kind = LOG_KIND_FORMAT;
+    length = strlen(record->format);
+    fwrite(&kind, sizeof(kind), 1, log_file);
+    fwrite(&id, sizeof(id), 1, log_file);
+    fwrite(&length, sizeof(length), 1, log_file);
+    fwrite(record->format, 1, length, log_file);
+  } else {
+    id = (uint32_t)(uintptr_t)entry->value;
   }
-  if ((log_level & LOG_DEBUG) && (level == LOG_DEBUG)) {
-    fprintf(stderr, "Debug: ");
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    fputc('\n', stderr);
-    va_end(args);
+  kind = LOG_KIND_MESSAGE;
+  fwrite(&kind, sizeof(kind), 1, log_file);
+  fwrite(&record->level, sizeof(record->level), 1, log_file);
+  fwrite(&record->thread, sizeof(record->thread), 1, log_file);
+  fwrite(&record->time, sizeof(record->time), 1, log_file);
+  fwrite(&id, sizeof(id), 1, log_file);
+  fwrite(&record->size, sizeof(record->size), 1, log_file);
+  fwrite(record->data, 1, record->size, log_file);
+}
+
+/* Writes all pending records and frees the rings of finished threads, returns the number of records */
+size_t drain_rings(void)
+{
+  size_t idx, tail, head, count = 0;
+  struct LogRing *ring;
+  struct LogRecord *record;
+  pthread_mutex_lock(&log_lock);
+  for (idx = 0; idx < log_ring_count; ++idx) {
+    ring = log_rings[idx];
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    for (; tail != head; ++tail, ++count) {
+      record = &ring->slots[tail % LOG_RING_SLOTS];
+      if (record->format != NULL && log_file != NULL) {
+        write_binary_record(record);
+      } else if (record->format == NULL) {
+        fprintf(stderr, "%s%.*s\n", level_prefix(record->level), (int)record->size, record->data);
+      }
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    if (atomic_load(&ring->closed) && tail == atomic_load_explicit(&ring->head, memory_order_acquire)) {
+      free(ring);
+      log_rings[idx--] = log_rings[--log_ring_count];
+    }
+  }
+  pthread_mutex_unlock(&log_lock);
+  if (count > 0 && log_file != NULL) {
+    fflush(log_file);
+  }
+  atomic_fetch_add(&log_records, count);
+  return count;
+}
+
+void *log_thread_main(void *arg)
+{
+  struct timespec idle = { 0, LOG_IDLE_NS };
+  while (atomic_load(&log_running)) {
+    if (drain_rings() == 0) {
+      nanosleep(&idle, NULL);
+    }
+  }
+  return NULL;
+}
+
+int fs_log_start(int mode, const char *fname)
+{
+  static const char magic[8] = { 'F', 'S', 'L', 'O', 'G', 0, 1, 0 };
+  fs_log_stop();
+  if (mode == LOG_MODE_SYNC) return 0;
+  if (mode == LOG_MODE_BINARY) {
+    if (fname == NULL || (log_file = fopen(fname, "wb")) == NULL) return -1;
+    fwrite(magic, 1, sizeof(magic), log_file);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &log_epoch);
+  atomic_store(&log_running, 1);
+  if (pthread_create(&log_thread, NULL, log_thread_main, NULL) != 0) {
+    atomic_store(&log_running, 0);
+    if (log_file != NULL) {
+      fclose(log_file);
+      log_file = NULL;
+    }
+    return -1;
+  }
+  atomic_store_explicit(&log_mode, mode, memory_order_release);
+  return 0;
+}
+
+void fs_log_stop(void)
+{
+  if (!atomic_load(&log_running)) return;
+  atomic_store_explicit(&log_mode, LOG_MODE_SYNC, memory_order_release);
+  atomic_store(&log_running, 0);
+  pthread_join(log_thread, NULL);
+  drain_rings();
+  if (log_file != NULL) {
+    fclose(log_file);
+    log_file = NULL;
+  }
+  hmap_free(&log_formats);
+  log_format_count = 0;
+}
+
+void fs_get_log_stats(size_t *rings, uint64_t *records, uint64_t *dropped)
+{
+  pthread_mutex_lock(&log_lock);
+  *rings = log_ring_count;
+  pthread_mutex_unlock(&log_lock);
+  *records = atomic_load(&log_records);
+  *dropped = atomic_load(&log_dropped);
+}
+
+int read_value(const unsigned char *data, size_t size, size_t *pos, void *value, size_t value_size)
+{
+  if (*pos + value_size > size) return 0;
+  memcpy(value, data + *pos, value_size);
+  *pos += value_size;
+  return 1;
+}
+
+/* Applies the format string to the encoded arguments of a binary record */
+void decode_message(FILE *out, const char *format, const unsigned char *data, size_t size)
+{
+  char spec_text[64], text[LOG_SLOT_SIZE];
+  size_t idx, pos = 0, n, length_pos;
+  uint16_t length;
+  int64_t iv;
+  uint64_t uv;
+  double dv;
+  struct LogSpec spec;
+  while (*format != 0) {
+    if (*format != '%') {
+      fputc(*format++, out);
+      continue;
+    }
+    parse_spec(format, &spec);
+    if (spec.conversion == '%') {
+      fputc('%', out);
+      format += spec.size;
+      continue;
+    }
+    /* Width and precision arguments are inserted as numbers, the length modifier is replaced */
+    n = 0;
+    length_pos = MIN(spec.length_pos, sizeof(spec_text) - 24);
+    for (idx = 0; idx < length_pos; ++idx) {
+      if (format[idx] == '*') {
+        if (!read_value(data, size, &pos, &iv, sizeof(iv))) goto truncated;
+        n += snprintf(spec_text + n, sizeof(spec_text) - n, "%d", (int)iv);
+      } else {
+        spec_text[n++] = format[idx];
+      }
+    }
+    switch (spec.conversion) {
+    case 'd': case 'i':
+      if (!read_value(data, size, &pos, &iv, sizeof(iv))) goto truncated;
+      snprintf(spec_text + n, sizeof(spec_text) - n, "ll%c", spec.conversion);
+      fprintf(out, spec_text, (long long)iv);
+      break;
+    case 'u': case 'o': case 'x': case 'X':
+      if (!read_value(data, size, &pos, &uv, sizeof(uv))) goto truncated;
+      snprintf(spec_text + n, sizeof(spec_text) - n, "ll%c", spec.conversion);
+      fprintf(out, spec_text, (unsigned long long)uv);
+      break;
+    case 'c':
+      if (!read_value(data, size, &pos, &uv, sizeof(uv))) goto truncated;
+      snprintf(spec_text + n, sizeof(spec_text) - n, "c");
+      fprintf(out, spec_text, (int)uv);
+      break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      if (!read_value(data, size, &pos, &dv, sizeof(dv))) goto truncated;
+      snprintf(spec_text + n, sizeof(spec_text) - n, "%c", spec.conversion);
+      fprintf(out, spec_text, dv);
+      break;
+    case 's':
+      if (!read_value(data, size, &pos, &length, sizeof(length))) goto truncated;
+      length = MIN(length, MIN(sizeof(text) - 1, size - pos));
+      memcpy(text, data + pos, length);
+      text[length] = 0;
+      pos += length;
+      snprintf(spec_text + n, sizeof(spec_text) - n, "s");
+      fprintf(out, spec_text, text);
+      break;
+    case 'p':
+      if (!read_value(data, size, &pos, &uv, sizeof(uv))) goto truncated;
+      snprintf(spec_text + n, sizeof(spec_text) - n, "p");
+      fprintf(out, spec_text, (void*)(uintptr_t)uv);
+      break;
+    default:
+      goto truncated;
+    }
+    format += spec.size;
+  }
+  return;
+truncated:
+  fputs(format, out);
+}
+
+int fs_log_decode(const char *fname, FILE *out)
+{
+  char magic[8];
+  char **formats = NULL, **temp;
+  uint8_t kind;
+  uint16_t level, length, size;
+  uint32_t id, thread, format_count = 0;
+  uint64_t time;
+  unsigned char data[LOG_SLOT_SIZE];
+  int result = 0;
+  FILE *fin = fopen(fname, "rb");
+  if (fin == NULL) return -1;
+  if (fread(magic, 1, sizeof(magic), fin) != sizeof(magic) || memcmp(magic, "FSLOG", 6) != 0) {
+    fclose(fin);
+    return -1;
+  }
+  while (fread(&kind, sizeof(kind), 1, fin) == 1) {
+    if (kind == LOG_KIND_FORMAT) {
+      if (fread(&id, sizeof(id), 1, fin) != 1 || fread(&length, sizeof(length), 1, fin) != 1 ||
+          id != format_count + 1) {
+        result = -1;
+        break;
+      }
+      temp = (char**) realloc(formats, sizeof(char*) * id);
+      if (temp == NULL) {
+        result = -1;
+        break;
+      }
+      formats = temp;
+      formats[format_count] = (char*) malloc(length + 1);
+      if (formats[format_count] == NULL || fread(formats[format_count], 1, length, fin) != length) {
+        free(formats[format_count]);
+        result = -1;
+        break;
+      }
+      formats[format_count++][length] = 0;
+    } else if (kind == LOG_KIND_MESSAGE) {
+      if (fread(&level, sizeof(level), 1, fin) != 1 || fread(&thread, sizeof(thread), 1, fin) != 1 ||
+          fread(&time, sizeof(time), 1, fin) != 1 || fread(&id, sizeof(id), 1, fin) != 1 ||
+          fread(&size, sizeof(size), 1, fin) != 1 || size > sizeof(data) ||
+          fread(data, 1, size, fin) != size || id == 0 || id > format_count) {
+        result = -1;
+        break;
+      }
+      fprintf(out, "%12.6f T%u %s", time * 1e-9, (unsigned int)thread, level_prefix(level));
+      decode_message(out, formats[id - 1], data, size);
+      fputc('\n', out);
+    } else {
+      result = -1;
+      break;
+    }
+  }
+  while (format_count > 0) {
+    free(formats[--format_count]);
   }
+  free(formats);
+  fclose(fin);
+  return result;
 }
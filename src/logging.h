@@ -11,11 +11,47 @@
  * @date 2017-04-06
  */
 
+#ifndef _LOGGING_H_
+#define _LOGGING_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
 #define LOG_DEBUG     0x01
 #define LOG_INFO      0x02
 #define LOG_WARN      0x04
 #define LOG_ERR       0x08
 
-void fs_log(int level, const char *fromat, ...);
+/* Output modes */
+#define LOG_MODE_SYNC     0  /* Formats and prints every message immediately */
+#define LOG_MODE_ASYNC    1  /* Formats into a per thread ring, a background thread prints the text */
+#define LOG_MODE_BINARY   2  /* Stores the raw arguments, a background thread writes binary records */
+
+/* Messages below this level are removed at compile time, e.g. -DFS_LOG_THRESHOLD=LOG_INFO */
+#ifndef FS_LOG_THRESHOLD
+#define FS_LOG_THRESHOLD  LOG_DEBUG
+#endif
+
+extern int log_level;
+
+/* A disabled level costs a single test, arguments are not evaluated */
+#define FS_LOG(level, ...) \
+  do { \
+    if ((level) >= FS_LOG_THRESHOLD && (log_level & (level))) fs_log((level), __VA_ARGS__); \
+  } while (0)
+
+#define FS_LOG_DEBUG(...)   FS_LOG(LOG_DEBUG, __VA_ARGS__)
+#define FS_LOG_INFO(...)    FS_LOG(LOG_INFO, __VA_ARGS__)
+#define FS_LOG_WARN(...)    FS_LOG(LOG_WARN, __VA_ARGS__)
+#define FS_LOG_ERR(...)     FS_LOG(LOG_ERR, __VA_ARGS__)
+
+void fs_log(int level, const char *fromat, ...) __attribute__((format(printf, 2, 3)));
 void fs_set_log_level(int level);
 int fs_get_log_level(void);
+int fs_log_start(int mode, const char *fname);
+void fs_log_stop(void);
+void fs_get_log_stats(size_t *rings, uint64_t *records, uint64_t *dropped);
+int fs_log_decode(const char *fname, FILE *out);
+
+#endif /* _LOGGING_H_ */
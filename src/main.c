@@ -12,25 +12,143 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
 
 #include "fsynth.h"
+#include "batch.h"
+#include "cache.h"
+#include "memo.h"
+#include "profiler.h"
+#include "logging.h"
+#include "trace.h"
 
 void shell_loop();
 void shell_cleanup();
 void shell_register();
+int shell_run_script(const char *fname);
 
 int prompt(const char *prn, char *buffer, int max_len);
 
-int main(int argc, char **argv)
+void print_banner(FILE *con)
 {
 #ifndef DEBUG
-  printf("FSynth: version %s build on %s %s\n", FS_VERSION, __DATE__, __TIME__);
+  fprintf(con, "FSynth: version %s build on %s %s\n", FS_VERSION, __DATE__, __TIME__);
 #else
-  printf("FSynth: version %s DEBUG build on %s %s\n", FS_VERSION, __DATE__, __TIME__);
+  fprintf(con, "FSynth: version %s DEBUG build on %s %s\n", FS_VERSION, __DATE__, __TIME__);
 #endif
-  printf("GCC: %s\n", __VERSION__);
+  fprintf(con, "GCC: %s\n", __VERSION__);
+}
+
+void print_usage(const char *name)
+{
+  printf("usage: %s [-f script_file|-] [-w script_file] [-b job_file|- [-j threads]] [-c cache_dir] [-p] [-t trace_file] [-d log_file] [-h] [-v]\n", name);
+  printf("\t-f file\tExecutes the commands from file, '-' reads them from stdin\n");
+  printf("\t\texecution stops at the first failing command with exit code 1\n");
+  printf("\t-w file\tRuns the script again after every change, unchanged commands are memoized\n");
+  printf("\t-b, --batch file\n");
+  printf("\t\tRuns the scripts listed in file concurrently, each with its own buffers\n");
+  printf("\t\tand reports status and timing of every job, exit code 1 if one failed.\n");
+  printf("\t\tA script given with -f runs before, it sets what the jobs can't change,\n");
+  printf("\t\te.g. 'log', 'trace', 'stream ring' or 'storage threshold'\n");
+  printf("\t-j, --jobs n\n");
+  printf("\t\tNumber of batch worker threads, by default one per processor, only with -b\n");
+  printf("\t-c dir\tKeeps expensive buffers in the directory and reuses them in later runs\n");
+  printf("\t-p\tProfiles every command and prints the report to stderr at exit\n");
+  printf("\t-t file\tWrites a Chrome trace of all commands and kernels at exit\n");
+  printf("\t-d file\tDecodes a binary log file written by 'log binary'\n");
+  printf("\t-h\tShows this help\n");
+  printf("\t-v\tShows the version\n");
+}
+
+int main(int argc, char **argv)
+{
+  int opt, threads = 0, result = FS_OK;
+  const char *script = NULL, *jobs = NULL, *watch = NULL;
+  static const struct option long_options[] = {
+    { "batch", required_argument, NULL, 'b' },
+    { "jobs", required_argument, NULL, 'j' },
+    { NULL, 0, NULL, 0 }
+  };
+  while ((opt = getopt_long(argc, argv, "f:w:b:j:c:pt:d:hv", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'f':
+      script = optarg;
+      break;
+    case 'w':
+      watch = optarg;
+      break;
+    case 'b':
+      jobs = optarg;
+      break;
+    case 'j':
+      threads = atoi(optarg);
+      if (threads <= 0) {
+        fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+        return 2;
+      }
+      break;
+    case 'c':
+      if (cache_open(optarg, 0) != FS_OK) {
+        fprintf(stderr, "Can't open the cache directory: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'p':
+      profile_enable(1);
+      break;
+    case 't':
+      if (trace_start(optarg) != 0) {
+        fprintf(stderr, "Can't start the trace: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'd':
+      if (fs_log_decode(optarg, stdout) != 0) {
+        fprintf(stderr, "Can't decode log file: %s\n", optarg);
+        return 1;
+      }
+      return 0;
+    case 'v':
+      print_banner(stdout);
+      return 0;
+    case 'h':
+      print_usage(argv[0]);
+      return 0;
+    default:
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+  if (threads > 0 && jobs == NULL) {
+    fprintf(stderr, "The number of threads needs a job file (-b)\n");
+    return 2;
+  }
+  /* Closed pipes are reported as IO error instead of terminating the process */
+  signal(SIGPIPE, SIG_IGN);
   shell_register();
-  shell_loop();
+  if (jobs != NULL) {
+    /* The settings of the whole process are made before the workers start */
+    if (script != NULL) result = shell_run_script(script);
+    if (!FAILED(result)) result = run_batch(jobs, threads);
+  } else if (watch != NULL) {
+    result = watch_script(watch);
+  } else if (script != NULL) {
+    result = shell_run_script(script);
+  } else {
+    /* The banner must not end up in audio data streamed to stdout */
+    print_banner(isatty(STDOUT_FILENO) ? stdout : stderr);
+    shell_loop();
+  }
+  if (profile_enabled()) {
+    profile_report(stderr);
+  }
+  if (trace_stop() != 0) {
+    fprintf(stderr, "Can't write the trace file\n");
+  }
   shell_cleanup();
-  return 0;
+  fs_log_stop();
+  return FAILED(result) ? 1 : 0;
 }
@@ -0,0 +1,440 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Memoization of shell commands and the watch mode of scripts
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "memo.h"
+#include "buffers.h"
+#include "cache.h"
+#include "hashmap.h"
+#include "logging.h"
+
+#define MEMO_DEFAULT_BUDGET  (256 * 1048576)
+#define MEMO_COPY_RATE       2e9    /* Bytes per second, faster commands are executed again instead */
+#define CACHE_READ_RATE      1e9    /* Bytes per second, faster commands aren't written to the disk cache */
+#define MEMO_SETTLE_TIME     100    /* Milliseconds without further changes before a script is run again */
+
+struct MemoFileStamp {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+};
+
+struct MemoEntry {
+  uint64_t last_use;
+  int output_count;
+  struct MemoSnapshot *outputs[MEMO_MAX_OUTPUTS];
+  int has_file;
+  struct MemoFileStamp file;  /* State of the written file right after the command */
+  size_t bytes;
+  double cost;                /* Execution time of the command in seconds */
+};
+
+/* Every thread has its own table, like the buffers which refer to it */
+__thread struct HashMap memo_map = HMAP_INITIALIZER;  /* Memo entries by the hex string of the key */
+__thread int memo_active = 0;
+__thread size_t memo_budget = MEMO_DEFAULT_BUDGET;
+__thread uint64_t memo_clock = 0;
+__thread FMemoStats memo_stats = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+int shell_run_script(const char *fname);
+
+uint64_t memo_hash(uint64_t hv, const void *data, size_t size)
+{
+  size_t i;
+  const unsigned char *p = (const unsigned char*) data;
+  for (i = 0; i < size; ++i) {
+    hv = (hv ^ p[i]) * 0x100000001b3ULL;
+  }
+  return hv;
+}
+
+/* Version of the idx-th buffer which is changed by a command, never 0 */
+uint64_t output_version(uint64_t key, int idx)
+{
+  uint64_t version = memo_hash(key, &idx, sizeof(idx));
+  return (version != 0) ? version : 1;
+}
+
+/* Key of a buffer version in the disk cache, which is shared by builds of other versions */
+uint64_t cache_key(uint64_t version)
+{
+  uint32_t sample_size = sizeof(sample_t);
+  uint64_t hv = memo_hash(version, FS_VERSION, sizeof(FS_VERSION));
+  return memo_hash(hv, &sample_size, sizeof(sample_size));
+}
+
+/* Index of the first argument with the same name, so that keys don't depend on buffer names */
+int alias_index(int argc, char **argv, int idx)
+{
+  int first;
+  for (first = 1; first < idx && strcmp(argv[first], argv[idx]) != 0; ++first);
+  return first;
+}
+
+int stamp_file(const char *fname, struct MemoFileStamp *stamp)
+{
+  struct stat st;
+  if (stat(fname, &st) != 0) return FS_ERROR;
+  memset(stamp, 0, sizeof(struct MemoFileStamp));
+  stamp->dev = st.st_dev;
+  stamp->ino = st.st_ino;
+  stamp->size = st.st_size;
+  stamp->mtime = st.st_mtim;
+  return FS_OK;
+}
+
+void format_key(char *str, uint64_t key)
+{
+  snprintf(str, 17, "%016llx", (unsigned long long)key);
+}
+
+void memo_release(struct MemoSnapshot *snapshot)
+{
+  if (--snapshot->refs == 0) {
+    fs_delete_sample_buffer(&snapshot->sb);
+    free(snapshot);
+  }
+}
+
+void delete_memo_entry(struct MemoEntry *entry)
+{
+  int idx;
+  for (idx = 0; idx < entry->output_count; ++idx) {
+    memo_release(entry->outputs[idx]);
+  }
+  memo_stats.bytes -= entry->bytes;
+  --memo_stats.entries;
+  free(entry);
+}
+
+void memo_clear(void)
+{
+  size_t iter = 0;
+  struct HashEntry *entry;
+  while ((entry = hmap_next(&memo_map, &iter)) != NULL) {
+    delete_memo_entry((struct MemoEntry*) entry->value);
+  }
+  hmap_free(&memo_map);
+}
+
+void memo_enable(int enable, size_t budget)
+{
+  memo_active = enable;
+  if (budget > 0) {
+    memo_budget = budget;
+  }
+  if (!enable) {
+    memo_clear();
+  }
+}
+
+int memo_enabled(void)
+{
+  return memo_active;
+}
+
+/* Drops the least recently used entries, the snapshots stay alive while buffers still use them */
+void evict_memo_entries(const struct MemoEntry *keep)
+{
+  size_t iter;
+  struct HashEntry *entry, *lru;
+  struct MemoEntry *me;
+  while (memo_stats.bytes > memo_budget) {
+    lru = NULL;
+    iter = 0;
+    while ((entry = hmap_next(&memo_map, &iter)) != NULL) {
+      me = (struct MemoEntry*) entry->value;
+      if (me != keep && (lru == NULL || me->last_use < ((struct MemoEntry*) lru->value)->last_use)) {
+        lru = entry;
+      }
+    }
+    if (lru == NULL) break;
+    me = (struct MemoEntry*) lru->value;
+    hmap_remove(&memo_map, lru->key);
+    delete_memo_entry(me);
+    ++memo_stats.evicted;
+  }
+}
+
+int restore_memo_entry(FMemoCall *call, char **argv)
+{
+  int idx;
+  char key[17];
+  struct MemoEntry *entry;
+  struct MemoFileStamp stamp;
+  format_key(key, call->key);
+  entry = (struct MemoEntry*) hmap_get(&memo_map, key);
+  if (entry == NULL || entry->output_count != call->output_count ||
+      (entry->has_file && (stamp_file(argv[call->file_arg], &stamp) != FS_OK ||
+      memcmp(&stamp, &entry->file, sizeof(stamp)) != 0))) {
+    ++memo_stats.misses;
+    return FS_ERROR;
+  }
+  for (idx = 0; idx < call->output_count; ++idx) {
+    if (attach_snapshot(argv[call->outputs[idx]], entry->outputs[idx], output_version(call->key, idx)) != FS_OK) {
+      return FS_ERROR;
+    }
+  }
+  entry->last_use = ++memo_clock;
+  ++memo_stats.hits;
+  memo_stats.saved_time += entry->cost;
+  return FS_OK;
+}
+
+/* Maps the buffers of all outputs from the disk cache, written files can't be restored from it */
+int load_cached_outputs(FMemoCall *call, char **argv)
+{
+  int idx, jdx;
+  FSampleBuffer *loaded[MEMO_MAX_OUTPUTS];
+  if (call->file_arg >= 0) return FS_ERROR;
+  for (idx = 0; idx < call->output_count; ++idx) {
+    loaded[idx] = cache_load(cache_key(output_version(call->key, idx)));
+    if (loaded[idx] == NULL) {
+      for (jdx = 0; jdx < idx; ++jdx) {
+        fs_delete_sample_buffer(&loaded[jdx]);
+      }
+      return FS_ERROR;
+    }
+  }
+  for (idx = 0; idx < call->output_count; ++idx) {
+    if (register_buffer(argv[call->outputs[idx]], loaded[idx]) != FS_OK) {
+      for (jdx = idx + 1; jdx < call->output_count; ++jdx) {
+        fs_delete_sample_buffer(&loaded[jdx]);
+      }
+      return FS_ERROR;
+    }
+    set_buffer_version(argv[call->outputs[idx]], output_version(call->key, idx));
+  }
+  return FS_OK;
+}
+
+/* Hashes the command line together with the versions of its input buffers and files, if the
+ * memo table or the disk cache know the key the command isn't executed and its buffers take
+ * the stored samples */
+int memo_begin(FMemoCall *call, int argc, char **argv, const char *args)
+{
+  int idx, kind, alias;
+  uint64_t version, hv = 0xcbf29ce484222325ULL;
+  size_t arg_count = (args != NULL) ? strlen(args) : 0;
+  struct MemoFileStamp stamp;
+  memset(call, 0, sizeof(FMemoCall));
+  call->file_arg = -1;
+  if (args == NULL) return MEMO_MISS;
+  call->known = 1;
+  hv = memo_hash(hv, argv[0], strlen(argv[0]) + 1);
+  memset(&stamp, 0, sizeof(stamp));
+  for (idx = 1; idx < argc; ++idx) {
+    kind = ((size_t)idx <= arg_count) ? args[idx - 1] : MEMO_ARG_VALUE;
+    version = 0;
+    switch (kind) {
+    case MEMO_ARG_BUFFER:
+    case MEMO_ARG_INPUT:
+    case MEMO_ARG_NEW:
+      /* Equal renders of differently named buffers share the key */
+      alias = alias_index(argc, argv, idx);
+      hv = memo_hash(hv, &alias, sizeof(alias));
+      if (kind != MEMO_ARG_NEW) {
+        if (get_buffer_version(argv[idx], &version) != FS_OK || version == 0) call->known = 0;
+        hv = memo_hash(hv, &version, sizeof(version));
+      }
+      if (kind != MEMO_ARG_INPUT && call->output_count < MEMO_MAX_OUTPUTS) {
+        call->outputs[call->output_count++] = idx;
+      }
+      break;
+    case MEMO_ARG_FILE:
+      hv = memo_hash(hv, argv[idx], strlen(argv[idx]) + 1);
+      if (stamp_file(argv[idx], &stamp) != FS_OK) call->known = 0;
+      hv = memo_hash(hv, &stamp, sizeof(stamp));
+      break;
+    case MEMO_ARG_OUTFILE:
+      hv = memo_hash(hv, argv[idx], strlen(argv[idx]) + 1);
+      if (strcmp(argv[idx], "-") == 0) call->known = 0;
+      call->file_arg = idx;
+      break;
+    default:
+      hv = memo_hash(hv, argv[idx], strlen(argv[idx]) + 1);
+      /* Options like the modulation source of a filter name buffers without a fixed position */
+      if (get_buffer_version(argv[idx], &version) == FS_OK) {
+        if (version == 0) call->known = 0;
+        hv = memo_hash(hv, &version, sizeof(version));
+      }
+      break;
+    }
+  }
+  /* Commands which only print something are always executed */
+  call->active = (call->output_count > 0 || call->file_arg >= 0);
+  call->key = hv;
+  clock_gettime(CLOCK_MONOTONIC, &call->start);
+  if (!call->active || !call->known) return MEMO_MISS;
+  if ((memo_active && restore_memo_entry(call, argv) == FS_OK) ||
+      (cache_enabled() && load_cached_outputs(call, argv) == FS_OK)) {
+    FS_LOG_DEBUG("Memo hit: %s %s", argv[0], (argc > 1) ? argv[1] : "");
+    return MEMO_HIT;
+  }
+  return MEMO_MISS;
+}
+
+/* Assigns the new versions to the changed buffers and stores their samples in the memo and the
+ * disk cache, unless they can be computed faster than copied or read */
+void memo_end(FMemoCall *call, char **argv, int result)
+{
+  int idx, known = call->known && !FAILED(result);
+  size_t bytes = 0;
+  char key[17];
+  double elapsed;
+  struct timespec now;
+  struct MemoEntry *entry, *old;
+  FSampleBuffer *outputs[MEMO_MAX_OUTPUTS];
+  if (!call->active) return;
+  for (idx = 0; idx < call->output_count; ++idx) {
+    set_buffer_version(argv[call->outputs[idx]], known ? output_version(call->key, idx) : 0);
+  }
+  if (!known || (!memo_active && !cache_enabled())) return;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = (now.tv_sec - call->start.tv_sec) + (now.tv_nsec - call->start.tv_nsec) * 1e-9;
+  for (idx = 0; idx < call->output_count; ++idx) {
+    outputs[idx] = get_buffer_by_name(argv[call->outputs[idx]]);
+    if (outputs[idx] == NULL) return;
+    bytes += outputs[idx]->buffer_size;
+  }
+  if (cache_enabled() && call->file_arg < 0 && elapsed * CACHE_READ_RATE >= bytes) {
+    for (idx = 0; idx < call->output_count; ++idx) {
+      if (cache_store(cache_key(output_version(call->key, idx)), outputs[idx]) != FS_OK) {
+        FS_LOG_WARN("Can't write cache entry for: %s", argv[call->outputs[idx]]);
+      }
+    }
+  }
+  if (!memo_active || elapsed * MEMO_COPY_RATE < bytes || bytes > memo_budget) return;
+  entry = (struct MemoEntry*) calloc(1, sizeof(struct MemoEntry));
+  if (entry == NULL) return;
+  if (call->file_arg >= 0) {
+    entry->has_file = (stamp_file(argv[call->file_arg], &entry->file) == FS_OK);
+    if (!entry->has_file) {
+      free(entry);
+      return;
+    }
+  }
+  for (idx = 0; idx < call->output_count; ++idx) {
+    entry->outputs[idx] = (struct MemoSnapshot*) calloc(1, sizeof(struct MemoSnapshot));
+    if (entry->outputs[idx] == NULL) break;
+    entry->output_count = idx + 1;
+    entry->outputs[idx]->refs = 1;
+    entry->outputs[idx]->sb = fs_clone_sample_buffer(outputs[idx]);
+    if (entry->outputs[idx]->sb == NULL) break;
+  }
+  entry->bytes = bytes;
+  entry->cost = elapsed;
+  entry->last_use = ++memo_clock;
+  ++memo_stats.entries;
+  memo_stats.bytes += bytes;
+  format_key(key, call->key);
+  if (idx < call->output_count) {
+    delete_memo_entry(entry);
+    return;
+  }
+  old = (struct MemoEntry*) hmap_get(&memo_map, key);
+  if (hmap_put(&memo_map, key, entry) == NULL) {
+    delete_memo_entry(entry);
+    return;
+  }
+  if (old != NULL) {
+    delete_memo_entry(old);
+  }
+  ++memo_stats.stored;
+  evict_memo_entries(entry);
+}
+
+void memo_get_stats(FMemoStats *stats)
+{
+  *stats = memo_stats;
+  stats->budget = memo_budget;
+}
+
+void memo_print_stats(FILE *out)
+{
+  fprintf(out, "memo:\t\t%s, %u entries with %llu byte, budget %llu byte\n", memo_active ? "on" : "off",
+    (unsigned int)memo_stats.entries, (unsigned long long)memo_stats.bytes, (unsigned long long)memo_budget);
+  fprintf(out, "lookups:\t%llu hits, %llu misses, %llu stored, %llu evicted\n",
+    (unsigned long long)memo_stats.hits, (unsigned long long)memo_stats.misses,
+    (unsigned long long)memo_stats.stored, (unsigned long long)memo_stats.evicted);
+  fprintf(out, "saved time:\t%.3f s\n", memo_stats.saved_time);
+}
+
+/* Blocks until the script is written or replaced, editors often save a file in several steps
+ * so the events are collected until the directory settles */
+int wait_for_change(int fd, const char *name)
+{
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *event;
+  struct pollfd pfd;
+  ssize_t length, pos;
+  int changed = 0;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while (!changed || poll(&pfd, 1, MEMO_SETTLE_TIME) > 0) {
+    length = read(fd, events, sizeof(events));
+    if (length < 0) {
+      if (errno == EINTR) continue;
+      return FS_ERROR;
+    }
+    for (pos = 0; pos < length; pos += sizeof(struct inotify_event) + event->len) {
+      event = (const struct inotify_event*) &events[pos];
+      if (event->len > 0 && strcmp(event->name, name) == 0) changed = 1;
+    }
+  }
+  return FS_OK;
+}
+
+/* Runs the script after every change, commands whose inputs didn't change are taken from the memo */
+int watch_script(const char *fname)
+{
+  int fd, result = FS_OK;
+  char *dir_copy, *base_copy;
+  FMemoStats before, after;
+  dir_copy = strdup(fname);
+  base_copy = strdup(fname);
+  fd = inotify_init1(IN_CLOEXEC);
+  if (dir_copy == NULL || base_copy == NULL || fd < 0 ||
+      inotify_add_watch(fd, dirname(dir_copy), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    FS_LOG_ERR("Can't watch script file: %s", fname);
+    if (fd >= 0) close(fd);
+    free(dir_copy);
+    free(base_copy);
+    return FS_ERROR | FS_FILE_IO_ERROR;
+  }
+  memo_enable(1, 0);
+  FS_LOG_INFO("Watching %s, stop with Ctrl-C", fname);
+  do {
+    /* Every run starts without buffers like a new script, the memo keeps their samples */
+    delete_buffers();
+    memo_get_stats(&before);
+    result = shell_run_script(fname);
+    memo_get_stats(&after);
+    FS_LOG_INFO("%s: %u commands from the memo, %.3f s saved", fname, (unsigned int)(after.hits - before.hits),
+      after.saved_time - before.saved_time);
+  } while (wait_for_change(fd, basename(base_copy)) == FS_OK);
+  close(fd);
+  free(dir_copy);
+  free(base_copy);
+  return result;
+}
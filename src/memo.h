@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Memoization of shell commands and the watch mode of scripts
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#ifndef _MEMO_H_
+#define _MEMO_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "fsynth.h"
+
+/* Kinds of command arguments, one character per argument starting with argv[1],
+ * arguments beyond the end of the string are plain values */
+#define MEMO_ARG_VALUE     '-'  /* Plain value, it's read as buffer if it names one */
+#define MEMO_ARG_BUFFER    'b'  /* Buffer which is read and changed in place */
+#define MEMO_ARG_INPUT     'r'  /* Buffer which is only read */
+#define MEMO_ARG_NEW       'n'  /* Buffer which is created or replaced */
+#define MEMO_ARG_FILE      'f'  /* File which is read */
+#define MEMO_ARG_OUTFILE   'F'  /* File which is written, '-' for stdout is never memoized */
+
+#define MEMO_MAX_OUTPUTS   4
+
+#define MEMO_MISS          0
+#define MEMO_HIT           1
+
+/* Samples of a buffer after a command, shared by the memo table and the buffers which use them */
+struct MemoSnapshot {
+  FSampleBuffer *sb;
+  size_t refs;
+};
+
+typedef struct {
+  int active;           /* The command changes buffers or files */
+  int known;            /* All inputs have a known version */
+  uint64_t key;         /* Hash of the command line and the versions of all inputs */
+  int outputs[MEMO_MAX_OUTPUTS];  /* Argument index of every changed buffer */
+  int output_count;
+  int file_arg;         /* Argument index of the written file or -1 */
+  struct timespec start;
+} FMemoCall;
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t stored;
+  uint64_t evicted;
+  size_t entries;
+  size_t bytes;
+  size_t budget;
+  double saved_time;    /* Sum of the execution times of all hits in seconds */
+} FMemoStats;
+
+void memo_enable(int enable, size_t budget);
+int memo_enabled(void);
+int memo_begin(FMemoCall *call, int argc, char **argv, const char *args);
+void memo_end(FMemoCall *call, char **argv, int result);
+void memo_release(struct MemoSnapshot *snapshot);
+void memo_clear(void);
+void memo_get_stats(FMemoStats *stats);
+void memo_print_stats(FILE *out);
+int watch_script(const char *fname);
+
+#endif /* _MEMO_H_ */
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Additive synthesis with a bank of recursive sine oscillators
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <memory.h>
+#include <math.h>
+#include "fsynth.h"
+#include "trace.h"
+
+#define OSC_LANES    2     /* Partials per vector, one SSE2 register */
+#define OSC_VECTORS  4     /* Vectors which are rotated side by side to hide the latency of the recursion */
+#define OSC_GROUP    (OSC_LANES * OSC_VECTORS)
+#define OSC_BLOCK    256   /* Samples which are summed over all partials before they are written */
+
+typedef double osc_t __attribute__((vector_size(sizeof(double) * OSC_LANES)));
+
+/* Each partial is a phasor amp * exp(i phase), which is rotated by exp(i w) every sample,
+ * the imaginary part is the output. A rotation costs four multiplications instead of a sin(). */
+typedef struct {
+  osc_t re[OSC_VECTORS];
+  osc_t im[OSC_VECTORS];
+  osc_t rot_re[OSC_VECTORS];
+  osc_t rot_im[OSC_VECTORS];
+  osc_t amp[OSC_VECTORS];
+} OscGroup;
+
+/* Adds the partials of a group to the lanes of acc and advances the phasors by count samples */
+void render_group(OscGroup *g, osc_t *acc, size_t count)
+{
+  size_t idx;
+  const osc_t c0 = g->rot_re[0], c1 = g->rot_re[1], c2 = g->rot_re[2], c3 = g->rot_re[3];
+  const osc_t s0 = g->rot_im[0], s1 = g->rot_im[1], s2 = g->rot_im[2], s3 = g->rot_im[3];
+  osc_t re0 = g->re[0], re1 = g->re[1], re2 = g->re[2], re3 = g->re[3];
+  osc_t im0 = g->im[0], im1 = g->im[1], im2 = g->im[2], im3 = g->im[3], t0, t1, t2, t3;
+  for (idx = 0; idx < count; ++idx) {
+    acc[idx] += (im0 + im1) + (im2 + im3);
+    t0 = re0 * c0 - im0 * s0;
+    t1 = re1 * c1 - im1 * s1;
+    t2 = re2 * c2 - im2 * s2;
+    t3 = re3 * c3 - im3 * s3;
+    im0 = re0 * s0 + im0 * c0;
+    im1 = re1 * s1 + im1 * c1;
+    im2 = re2 * s2 + im2 * c2;
+    im3 = re3 * s3 + im3 * c3;
+    re0 = t0;
+    re1 = t1;
+    re2 = t2;
+    re3 = t3;
+  }
+  g->re[0] = re0; g->re[1] = re1; g->re[2] = re2; g->re[3] = re3;
+  g->im[0] = im0; g->im[1] = im1; g->im[2] = im2; g->im[3] = im3;
+}
+
+/* Rounding lets the magnitude of the phasors drift, it is pulled back to the amplitude after each block */
+void normalize_group(OscGroup *g)
+{
+  size_t vec, lane;
+  double mag;
+  for (vec = 0; vec < OSC_VECTORS; ++vec) {
+    for (lane = 0; lane < OSC_LANES; ++lane) {
+      mag = sqrt(g->re[vec][lane] * g->re[vec][lane] + g->im[vec][lane] * g->im[vec][lane]);
+      if (mag > 0) {
+        g->re[vec][lane] *= g->amp[vec][lane] / mag;
+        g->im[vec][lane] *= g->amp[vec][lane] / mag;
+      }
+    }
+  }
+}
+
+int fs_generate_partials(FSampleBuffer *buffer, const FSPartial *partials, size_t count, int add)
+{
+  size_t idx, pos, n, group, group_count = (count + OSC_GROUP - 1) / OSC_GROUP, vec, lane;
+  unsigned int ch;
+  double w, amp;
+  sample_t *samples;
+  osc_t acc[OSC_BLOCK];
+  OscGroup *groups, *g;
+  fs_clear_error();
+  if (INVALID_BUFFER(buffer) || (partials == NULL && count > 0)) {
+    fs_set_error(INVALID_BUFFER(buffer) ? FS_INVALID_BUFFER : FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  /* Without add every sample is overwritten, so shared samples needn't be copied */
+  if (fs_unshare_samples(buffer, add) != FS_OK) {
+    return fs_get_error();
+  }
+  /* Unused lanes of the last group stay zero and add nothing */
+  groups = (OscGroup*) calloc(MAX(group_count, 1), sizeof(OscGroup));
+  if (groups == NULL) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return fs_get_error();
+  }
+  for (idx = 0; idx < count; ++idx) {
+    /* Partials at or above the Nyquist frequency would alias and are left out */
+    if (fabs(partials[idx].freq) * 2 >= buffer->sample_rate) continue;
+    g = &groups[idx / OSC_GROUP];
+    vec = (idx % OSC_GROUP) / OSC_LANES;
+    lane = idx % OSC_LANES;
+    w = M_PI * 2. * partials[idx].freq / buffer->sample_rate;
+    amp = partials[idx].amp;
+    g->re[vec][lane] = amp * cos(partials[idx].phase);
+    g->im[vec][lane] = amp * sin(partials[idx].phase);
+    g->rot_re[vec][lane] = cos(w);
+    g->rot_im[vec][lane] = sin(w);
+    g->amp[vec][lane] = fabs(amp);
+  }
+  FS_TRACE_KERNEL("fs_generate_partials", buffer->sample_count);
+  for (pos = 0; pos < buffer->sample_count; pos += OSC_BLOCK) {
+    n = MIN(OSC_BLOCK, buffer->sample_count - pos);
+    memset(acc, 0, sizeof(osc_t) * n);
+    for (group = 0; group < group_count; ++group) {
+      render_group(&groups[group], acc, n);
+      normalize_group(&groups[group]);
+    }
+    for (idx = 0; idx < n; ++idx) {
+      if (add) {
+        buffer->samples[pos + idx] += acc[idx][0] + acc[idx][1];
+      } else {
+        buffer->samples[pos + idx] = acc[idx][0] + acc[idx][1];
+      }
+    }
+    /* The sum of a block is added to the other channels while it's still in the cache */
+    for (ch = 1; add && ch < buffer->channels; ++ch) {
+      samples = &FS_CHANNEL(buffer, ch)[pos];
+      for (idx = 0; idx < n; ++idx) {
+        samples[idx] += acc[idx][0] + acc[idx][1];
+      }
+    }
+  }
+  if (!add) fs_spread_channel(buffer);
+  fs_add_stats(FS_TOTAL_SAMPLES(buffer), sizeof(sample_t) * FS_TOTAL_SAMPLES(buffer) * (add ? 2 : 1));
+  FS_TRACE_END();
+  free(groups);
+  return fs_get_error();
+}
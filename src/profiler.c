@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Per command profiling of the shell
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "profiler.h"
+#include "hashmap.h"
+
+#define PROFILE_TOP        10
+#define PROFILE_LINE_SIZE  128
+
+struct ProfileRecord {
+  const char *command;
+  uint64_t calls;
+  double wall_time;
+  double cpu_time;
+  double max_wall_time;
+  FSStats stats;
+};
+
+struct ProfileCall {
+  double wall_time;
+  char line[PROFILE_LINE_SIZE];
+};
+
+int profile_active = 0;
+struct HashMap profile_map = HMAP_INITIALIZER;
+struct ProfileCall profile_top[PROFILE_TOP]; /* Most expensive single invocations, sorted by wall time */
+size_t profile_top_count = 0;
+pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;  /* Batch jobs report from several threads */
+
+double elapsed_time(const struct timespec *start, const struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+void profile_enable(int enable)
+{
+  profile_active = enable;
+}
+
+int profile_enabled(void)
+{
+  return profile_active;
+}
+
+void profile_begin(FProfileMark *mark)
+{
+  fs_get_stats(&mark->stats);
+  /* The process clock includes the time spent by the stream writer thread */
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &mark->cpu);
+  clock_gettime(CLOCK_MONOTONIC, &mark->wall);
+}
+
+void profile_add_call(const char *line, double wall_time)
+{
+  size_t pos = profile_top_count;
+  if (pos == PROFILE_TOP) {
+    if (profile_top[PROFILE_TOP - 1].wall_time >= wall_time) return;
+    --pos;
+  } else {
+    ++profile_top_count;
+  }
+  while (pos > 0 && profile_top[pos - 1].wall_time < wall_time) {
+    profile_top[pos] = profile_top[pos - 1];
+    --pos;
+  }
+  profile_top[pos].wall_time = wall_time;
+  strncpy(profile_top[pos].line, line, PROFILE_LINE_SIZE - 1);
+  profile_top[pos].line[PROFILE_LINE_SIZE - 1] = 0;
+}
+
+void profile_end(FProfileMark *mark, const char *command, const char *line)
+{
+  double wall_time, cpu_time;
+  struct timespec wall, cpu;
+  struct ProfileRecord *record;
+  FSStats stats;
+  clock_gettime(CLOCK_MONOTONIC, &wall);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+  fs_get_stats(&stats);
+  wall_time = elapsed_time(&mark->wall, &wall);
+  cpu_time = elapsed_time(&mark->cpu, &cpu);
+  pthread_mutex_lock(&profile_lock);
+  record = (struct ProfileRecord*) hmap_get(&profile_map, command);
+  if (record == NULL) {
+    record = (struct ProfileRecord*) malloc(sizeof(struct ProfileRecord));
+    if (record == NULL || hmap_put(&profile_map, command, record) == NULL) {
+      pthread_mutex_unlock(&profile_lock);
+      free(record);
+      return;
+    }
+    memset(record, 0, sizeof(struct ProfileRecord));
+    record->command = intern_string(command);
+  }
+  ++record->calls;
+  record->wall_time += wall_time;
+  record->cpu_time += cpu_time;
+  record->max_wall_time = (wall_time > record->max_wall_time) ? wall_time : record->max_wall_time;
+  record->stats.samples_processed += stats.samples_processed - mark->stats.samples_processed;
+  record->stats.bytes_moved += stats.bytes_moved - mark->stats.bytes_moved;
+  record->stats.allocations += stats.allocations - mark->stats.allocations;
+  record->stats.bytes_allocated += stats.bytes_allocated - mark->stats.bytes_allocated;
+  profile_add_call(line, wall_time);
+  pthread_mutex_unlock(&profile_lock);
+}
+
+int compare_records(const void *a, const void *b)
+{
+  const struct ProfileRecord *ra = *(const struct ProfileRecord**)a;
+  const struct ProfileRecord *rb = *(const struct ProfileRecord**)b;
+  if (ra->wall_time < rb->wall_time) return 1;
+  if (ra->wall_time > rb->wall_time) return -1;
+  return 0;
+}
+
+/* Returns all records sorted by their total wall time, the array must be freed by the caller */
+struct ProfileRecord **sorted_records(size_t *count)
+{
+  size_t iter = 0, n = 0;
+  struct HashEntry *entry;
+  struct ProfileRecord **records;
+  records = (struct ProfileRecord**) malloc(sizeof(struct ProfileRecord*) * (profile_map.count + 1));
+  if (records == NULL) return NULL;
+  while ((entry = hmap_next(&profile_map, &iter)) != NULL) {
+    records[n++] = (struct ProfileRecord*) entry->value;
+  }
+  qsort(records, n, sizeof(struct ProfileRecord*), compare_records);
+  *count = n;
+  return records;
+}
+
+double per_second(uint64_t value, double time)
+{
+  return (time > 0) ? value / time : 0;
+}
+
+void profile_report(FILE *out)
+{
+  size_t idx, count;
+  double total = 0;
+  struct ProfileRecord *r, **records = sorted_records(&count);
+  if (records == NULL) return;
+  for (idx = 0; idx < count; ++idx) {
+    total += records[idx]->wall_time;
+  }
+  fprintf(out, "%-10s %7s %10s %10s %10s %6s %12s %10s %8s\n", "command", "calls", "wall ms",
+    "cpu ms", "max ms", "share", "Msamples/s", "MB/s", "allocs");
+  for (idx = 0; idx < count; ++idx) {
+    r = records[idx];
+    fprintf(out, "%-10s %7llu %10.3f %10.3f %10.3f %5.1f%% %12.2f %10.1f %8llu\n", r->command,
+      (unsigned long long)r->calls, r->wall_time * 1e3, r->cpu_time * 1e3, r->max_wall_time * 1e3,
+      (total > 0) ? r->wall_time * 100 / total : 0,
+      per_second(r->stats.samples_processed, r->wall_time) * 1e-6,
+      per_second(r->stats.bytes_moved, r->wall_time) / 1048576., (unsigned long long)r->stats.allocations);
+  }
+  if (profile_top_count > 0) {
+    fprintf(out, "\nmost expensive calls:\n");
+    for (idx = 0; idx < profile_top_count; ++idx) {
+      fprintf(out, "%10.3f ms  %s\n", profile_top[idx].wall_time * 1e3, profile_top[idx].line);
+    }
+  }
+  free(records);
+}
+
+int profile_dump(const char *fname)
+{
+  size_t idx, count;
+  struct ProfileRecord *r, **records;
+  FILE *fout = fopen(fname, "w");
+  if (fout == NULL) {
+    return FS_ERROR;
+  }
+  records = sorted_records(&count);
+  if (records == NULL) {
+    fclose(fout);
+    return FS_ERROR;
+  }
+  fprintf(fout, "command,calls,wall_s,cpu_s,max_wall_s,samples,samples_per_s,bytes,bytes_per_s,"
+    "allocations,bytes_allocated\n");
+  for (idx = 0; idx < count; ++idx) {
+    r = records[idx];
+    fprintf(fout, "%s,%llu,%.9f,%.9f,%.9f,%llu,%.1f,%llu,%.1f,%llu,%llu\n", r->command,
+      (unsigned long long)r->calls, r->wall_time, r->cpu_time, r->max_wall_time,
+      (unsigned long long)r->stats.samples_processed, per_second(r->stats.samples_processed, r->wall_time),
+      (unsigned long long)r->stats.bytes_moved, per_second(r->stats.bytes_moved, r->wall_time),
+      (unsigned long long)r->stats.allocations, (unsigned long long)r->stats.bytes_allocated);
+  }
+  free(records);
+  return (fclose(fout) == 0) ? FS_OK : FS_ERROR;
+}
+
+void profile_reset(void)
+{
+  size_t iter = 0;
+  struct HashEntry *entry;
+  pthread_mutex_lock(&profile_lock);
+  while ((entry = hmap_next(&profile_map, &iter)) != NULL) {
+    free(entry->value);
+  }
+  hmap_free(&profile_map);
+  profile_top_count = 0;
+  pthread_mutex_unlock(&profile_lock);
+}
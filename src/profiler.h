@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Per command profiling of the shell
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <stdio.h>
+#include <time.h>
+
+#include "fsynth.h"
+
+typedef struct {
+  struct timespec wall;
+  struct timespec cpu;
+  FSStats stats;
+} FProfileMark;
+
+void profile_enable(int enable);
+int profile_enabled(void);
+void profile_begin(FProfileMark *mark);
+void profile_end(FProfileMark *mark, const char *command, const char *line);
+void profile_report(FILE *out);
+int profile_dump(const char *fname);
+void profile_reset(void);
+
+#endif /* _PROFILER_H_ */
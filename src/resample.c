@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Polyphase windowed sinc sample rate conversion
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <memory.h>
+#include <math.h>
+#include "fsynth.h"
+#include "trace.h"
+
+#define RESAMPLE_ZERO_CROSSINGS  32     /* Zero crossings of the sinc on each side of the center */
+#define RESAMPLE_ROLLOFF         0.95   /* Cut-off frequency relative to the lower Nyquist frequency */
+#define RESAMPLE_KAISER_BETA     9.0    /* Stop band attenuation of about 90 dB */
+#define RESAMPLE_MAX_PHASES      1024   /* Ratios with up to this many phases use an exact filter per phase */
+#define RESAMPLE_PHASES          512    /* Table size for other ratios, between the phases is interpolated */
+
+typedef struct {
+  uint64_t up;          /* Output samples per 'down' input samples, the reduced ratio */
+  uint64_t down;
+  size_t half;          /* Input samples on each side of the output position */
+  size_t taps;          /* Coefficients per phase, 2 * half */
+  size_t phases;        /* Rows of the table, plus one extra row if interpolated */
+  int interpolate;
+  sample_t *table;
+} FResampler;
+
+uint64_t gcd(uint64_t a, uint64_t b)
+{
+  uint64_t t;
+  while (b != 0) {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/* Modified Bessel function of the first kind and order zero */
+double bessel_i0(double x)
+{
+  double sum = 1, term = 1, q = x * x / 4;
+  int k;
+  for (k = 1; k < 64 && term > sum * 1e-17; ++k) {
+    term *= q / ((double)k * k);
+    sum += term;
+  }
+  return sum;
+}
+
+/* Kaiser windowed sinc, x is the distance in input samples and cutoff is relative to the input Nyquist */
+double filter_tap(double x, double cutoff, double half)
+{
+  double r = x / half, s = M_PI * cutoff * x;
+  if (fabs(r) >= 1) return 0;
+  return cutoff * ((s == 0) ? 1 : sin(s) / s) *
+    bessel_i0(RESAMPLE_KAISER_BETA * sqrt(1 - r * r)) / bessel_i0(RESAMPLE_KAISER_BETA);
+}
+
+int init_resampler(FResampler *rs, uint32_t in_rate, uint32_t out_rate)
+{
+  size_t row, k;
+  double cutoff, frac, sum;
+  sample_t *coef;
+  uint64_t g = gcd(in_rate, out_rate);
+  rs->up = out_rate / g;
+  rs->down = in_rate / g;
+  cutoff = RESAMPLE_ROLLOFF * MIN(1.0, (double)out_rate / in_rate);
+  /* Downsampling widens the filter, so that the number of zero crossings stays the same */
+  rs->half = (size_t)ceil(RESAMPLE_ZERO_CROSSINGS / cutoff);
+  rs->half += rs->half & 1;
+  rs->taps = 2 * rs->half;
+  rs->interpolate = (rs->up > RESAMPLE_MAX_PHASES);
+  rs->phases = rs->interpolate ? RESAMPLE_PHASES + 1 : rs->up;
+  rs->table = (sample_t*) malloc(sizeof(sample_t) * rs->taps * rs->phases);
+  if (rs->table == NULL) {
+    return FS_ERROR;
+  }
+  for (row = 0; row < rs->phases; ++row) {
+    frac = (double)row / (rs->interpolate ? RESAMPLE_PHASES : rs->up);
+    coef = &rs->table[row * rs->taps];
+    sum = 0;
+    for (k = 0; k < rs->taps; ++k) {
+      coef[k] = filter_tap((double)k - (double)(rs->half - 1) - frac, cutoff, (double)rs->half);
+      sum += coef[k];
+    }
+    /* Every phase passes DC with unity gain */
+    for (k = 0; k < rs->taps; ++k) {
+      coef[k] /= sum;
+    }
+  }
+  return FS_OK;
+}
+
+/* Four independent sums break the dependency chain, so the loop maps onto vector registers */
+sample_t dot_product(const sample_t *x, const sample_t *h, size_t count)
+{
+  sample_t a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+  size_t k;
+  for (k = 0; k + 4 <= count; k += 4) {
+    a0 += x[k] * h[k];
+    a1 += x[k + 1] * h[k + 1];
+    a2 += x[k + 2] * h[k + 2];
+    a3 += x[k + 3] * h[k + 3];
+  }
+  for (; k < count; ++k) {
+    a0 += x[k] * h[k];
+  }
+  return (a0 + a1) + (a2 + a3);
+}
+
+/* Filters the output sample at input position pos + phase / up, window holds the zero padded
+ * input at the buffer edges */
+sample_t resample_at(const FResampler *rs, const FSampleBuffer *src, size_t pos, uint64_t phase, sample_t *window)
+{
+  size_t k, row;
+  double fpos, mix;
+  const sample_t *x;
+  const sample_t *h;
+  ptrdiff_t first = (ptrdiff_t)pos - (ptrdiff_t)(rs->half - 1), idx;
+  if (first >= 0 && (size_t)first + rs->taps <= src->sample_count) {
+    x = &src->samples[first];
+  } else {
+    for (k = 0; k < rs->taps; ++k) {
+      idx = first + (ptrdiff_t)k;
+      window[k] = (idx >= 0 && (size_t)idx < src->sample_count) ? src->samples[idx] : 0;
+    }
+    x = window;
+  }
+  if (!rs->interpolate) {
+    return dot_product(x, &rs->table[phase * rs->taps], rs->taps);
+  }
+  fpos = (double)phase * RESAMPLE_PHASES / rs->up;
+  row = (size_t)fpos;
+  mix = fpos - row;
+  h = &rs->table[row * rs->taps];
+  return (1 - mix) * dot_product(x, h, rs->taps) + mix * dot_product(x, h + rs->taps, rs->taps);
+}
+
+FSampleBuffer *fs_resample_buffer(FSampleBuffer *buffer, uint32_t sample_rate)
+{
+  size_t idx, pos, count;
+  uint64_t phase;
+  unsigned int ch;
+  sample_t *window, *out;
+  FResampler rs;
+  FSampleBuffer *pout, view;
+  fs_clear_error();
+  if (INVALID_BUFFER(buffer) || sample_rate == 0) {
+    fs_set_error(INVALID_BUFFER(buffer) ? FS_INVALID_BUFFER : FS_INVALID_ARGUMENT);
+    return NULL;
+  }
+  if (sample_rate == buffer->sample_rate) {
+    return fs_clone_sample_buffer(buffer);
+  }
+  if (init_resampler(&rs, buffer->sample_rate, sample_rate) != FS_OK) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  count = (size_t)(((uint64_t)buffer->sample_count * rs.up + rs.down / 2) / rs.down);
+  pout = fs_create_multichannel_buffer(sample_rate, MAX(count, 1), buffer->channels);
+  window = (sample_t*) malloc(sizeof(sample_t) * rs.taps);
+  if (pout == NULL || window == NULL) {
+    fs_delete_sample_buffer(&pout);
+    free(window);
+    free(rs.table);
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  FS_TRACE_KERNEL("fs_resample_buffer", FS_TOTAL_SAMPLES(pout));
+  for (ch = 0; ch < buffer->channels; ++ch) {
+    view = fs_channel_view(buffer, ch);
+    out = FS_CHANNEL(pout, ch);
+    pos = 0;
+    phase = 0;
+    FOREACH_SAMPLE(pout, idx) {
+      out[idx] = resample_at(&rs, &view, pos, phase, window);
+      /* The position advances by down / up input samples, kept as an exact fraction */
+      phase += rs.down;
+      pos += phase / rs.up;
+      phase %= rs.up;
+    }
+  }
+  pout->hull_ptr = (size_t)((uint64_t)buffer->hull_ptr * rs.up / rs.down);
+  pout->hull_level = buffer->hull_level;
+  fs_add_stats(FS_TOTAL_SAMPLES(pout), buffer->buffer_size + pout->buffer_size);
+  FS_TRACE_END();
+  free(window);
+  free(rs.table);
+  return pout;
+}
+
+int fs_resample_buffer_inplace(FSampleBuffer *buffer, uint32_t sample_rate)
+{
+  FSampleBuffer swap;
+  FSampleBuffer *pout = fs_resample_buffer(buffer, sample_rate);
+  if (pout != NULL) {
+    /* The buffer object keeps its address, the old samples leave with the temporary one */
+    swap = *buffer;
+    *buffer = *pout;
+    *pout = swap;
+    fs_delete_sample_buffer(&pout);
+  }
+  return fs_get_error();
+}
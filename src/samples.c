@@ -11,13 +11,234 @@
  * @date 2017-03-10
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <memory.h>
 #include <math.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "fsynth.h"
+#include "trace.h"
 
-FSampleBuffer *fs_create_sample_buffer_raw(uint32_t sample_rate, size_t sample_count)
+__thread FSStats kernel_stats = { 0, 0, 0, 0, 0, 0 };  /* Counted per thread */
+size_t storage_threshold = 0; /* Buffers of at least this size use file storage, 0 for none */
+
+void fs_add_stats(uint64_t samples, uint64_t bytes)
+{
+  kernel_stats.samples_processed += samples;
+  kernel_stats.bytes_moved += bytes;
+}
+
+void fs_add_alloc_stats(uint64_t bytes)
+{
+  ++kernel_stats.allocations;
+  kernel_stats.bytes_allocated += bytes;
+}
+
+void fs_add_live_bytes(int64_t delta)
+{
+  kernel_stats.bytes_live += delta;
+  kernel_stats.bytes_peak = MAX(kernel_stats.bytes_peak, kernel_stats.bytes_live);
+}
+
+void fs_get_stats(FSStats *stats)
+{
+  *stats = kernel_stats;
+}
+
+void fs_reset_stats(void)
+{
+  memset(&kernel_stats, 0, sizeof(FSStats));
+}
+
+void fs_set_storage_threshold(size_t bytes)
+{
+  storage_threshold = bytes;
+}
+
+int select_storage(size_t bytes)
+{
+  return (storage_threshold > 0 && bytes >= storage_threshold) ? FS_STORAGE_FILE : FS_STORAGE_HEAP;
+}
+
+/* Creates an anonymous temporary file, it is deleted at once and lives as long as the descriptor */
+int create_storage_file(void)
+{
+  int fd;
+  char path[PATH_MAX];
+  const char *dir = getenv("TMPDIR");
+  snprintf(path, sizeof(path), "%s/fsynth_samples_XXXXXX", (dir != NULL) ? dir : "/tmp");
+  fd = mkstemp(path);
+  if (fd >= 0) {
+    unlink(path);
+  }
+  return fd;
+}
+
+/* Resizes the storage file and maps it again, the samples up to the smaller size are kept */
+int map_storage_file(FSampleBuffer *buffer, size_t old_size, size_t new_size)
+{
+  void *addr;
+  size_t map_size = MAX(new_size, sizeof(sample_t));
+  if (ftruncate(buffer->map_fd, map_size) != 0) {
+    return FS_ERROR;
+  }
+  /* Reserve the blocks now, a full disk would otherwise raise SIGBUS on the first write */
+  if (map_size > old_size && posix_fallocate(buffer->map_fd, old_size, map_size - old_size) != 0) {
+    return FS_ERROR;
+  }
+  addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, buffer->map_fd, 0);
+  if (addr == MAP_FAILED) {
+    return FS_ERROR;
+  }
+  if (buffer->map_addr != NULL) {
+    munmap(buffer->map_addr, buffer->map_size);
+  }
+  /* Kernels run front to back, so the kernel can read ahead and drop pages behind */
+  madvise(addr, map_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+  madvise(addr, map_size, MADV_HUGEPAGE);
+#endif
+  buffer->map_addr = addr;
+  buffer->map_size = map_size;
+  buffer->samples = (sample_t*) addr;
+  return FS_OK;
+}
+
+/* Allocates zeroed storage for buffer_size bytes */
+int alloc_samples(FSampleBuffer *buffer, int storage)
+{
+  if (storage == FS_STORAGE_FILE) {
+    buffer->map_fd = create_storage_file();
+    if (buffer->map_fd < 0) {
+      return FS_ERROR;
+    }
+    buffer->storage = FS_STORAGE_FILE;
+    if (map_storage_file(buffer, 0, buffer->buffer_size) != FS_OK) {
+      close(buffer->map_fd);
+      buffer->storage = FS_STORAGE_HEAP;
+      return FS_ERROR;
+    }
+    /* The blocks of a new file are already zero */
+    return FS_OK;
+  }
+  buffer->samples = (sample_t*) malloc(buffer->buffer_size);
+  if (buffer->samples == NULL) {
+    return FS_ERROR;
+  }
+  memset(buffer->samples, 0, buffer->buffer_size);
+  return FS_OK;
+}
+
+/* Drops the reference of a clone, the storage stays as long as other buffers share it */
+int drop_reference(FSampleBuffer *buffer)
+{
+  if (buffer->refs == NULL) return 1;
+  if (__atomic_sub_fetch(buffer->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+    buffer->refs = NULL;
+    return 0;
+  }
+  free(buffer->refs);
+  buffer->refs = NULL;
+  return 1;
+}
+
+/* Returns 1 if the storage has been freed, 0 if it's still used by clones */
+int release_samples(FSampleBuffer *buffer)
+{
+  int last = drop_reference(buffer);
+  if (last && buffer->map_addr != NULL) {
+    munmap(buffer->map_addr, buffer->map_size);
+  } else if (last && buffer->buffer_size > 0) {
+    free(buffer->samples);
+  }
+  if (last && buffer->storage == FS_STORAGE_FILE) {
+    close(buffer->map_fd);
+  }
+  buffer->samples = NULL;
+  buffer->map_addr = NULL;
+  buffer->map_size = 0;
+  buffer->storage = FS_STORAGE_HEAP;
+  return last;
+}
+
+/* Copies up to copy_count samples of each channel into new storage for new_size samples per channel and releases the old one */
+int move_samples(FSampleBuffer *buffer, size_t new_size, size_t copy_count, int storage)
+{
+  unsigned int ch;
+  FSampleBuffer target;
+  memset(&target, 0, sizeof(FSampleBuffer));
+  target.buffer_size = sizeof(sample_t) * new_size * buffer->channels;
+  if (alloc_samples(&target, storage) != FS_OK) {
+    return FS_ERROR;
+  }
+  copy_count = MIN(copy_count, MIN(new_size, buffer->sample_count));
+  for (ch = 0; ch < buffer->channels; ++ch) {
+    memcpy(&target.samples[ch * new_size], FS_CHANNEL(buffer, ch), sizeof(sample_t) * copy_count);
+  }
+  if (!release_samples(buffer)) {
+    /* The old samples still belong to clones, so the new ones add to the live bytes */
+    fs_add_live_bytes(buffer->buffer_size);
+  }
+  buffer->samples = target.samples;
+  buffer->map_addr = target.map_addr;
+  buffer->map_size = target.map_size;
+  buffer->storage = target.storage;
+  buffer->map_fd = target.map_fd;
+  fs_add_alloc_stats(target.buffer_size);
+  return FS_OK;
+}
+
+int fs_unshare_samples(FSampleBuffer *buffer, int keep)
+{
+  int storage;
+  if (buffer->refs == NULL) {
+    return FS_OK;
+  }
+  if (__atomic_load_n(buffer->refs, __ATOMIC_ACQUIRE) == 1) {
+    /* The other clones are gone, the storage belongs to this buffer alone */
+    free(buffer->refs);
+    buffer->refs = NULL;
+    return FS_OK;
+  }
+  storage = (buffer->storage == FS_STORAGE_FILE) ? FS_STORAGE_FILE : select_storage(buffer->buffer_size);
+  if (move_samples(buffer, buffer->sample_count, keep ? buffer->sample_count : 0, storage) != FS_OK) {
+    fs_set_error((storage == FS_STORAGE_FILE) ? FS_FILE_IO_ERROR : FS_OUT_OF_MEMORY);
+    return FS_ERROR;
+  }
+  return FS_OK;
+}
+
+/* Moves the channels to their offsets for a new channel size, the planes are moved after the
+ * storage has grown and before it shrinks. The added samples of each channel are zeroed. */
+void move_planes(FSampleBuffer *buffer, size_t old_count, size_t new_count)
+{
+  unsigned int ch;
+  if (new_count > old_count) {
+    for (ch = buffer->channels; ch-- > 0; ) {
+      memmove(&buffer->samples[ch * new_count], &buffer->samples[ch * old_count], sizeof(sample_t) * old_count);
+      memset(&buffer->samples[ch * new_count + old_count], 0, sizeof(sample_t) * (new_count - old_count));
+    }
+  } else {
+    for (ch = 1; ch < buffer->channels; ++ch) {
+      memmove(&buffer->samples[ch * new_count], &buffer->samples[ch * old_count], sizeof(sample_t) * new_count);
+    }
+  }
+}
+
+void fs_spread_channel(FSampleBuffer *buffer)
+{
+  unsigned int ch;
+  for (ch = 1; ch < buffer->channels; ++ch) {
+    memcpy(FS_CHANNEL(buffer, ch), buffer->samples, sizeof(sample_t) * buffer->sample_count);
+  }
+  fs_add_stats(buffer->sample_count * (buffer->channels - 1), sizeof(sample_t) * buffer->sample_count * (buffer->channels - 1) * 2);
+}
+
+FSampleBuffer *create_buffer_channels(uint32_t sample_rate, size_t sample_count, unsigned int channels, int storage)
 {
   FSampleBuffer *buffer;
   fs_clear_error();
@@ -29,18 +250,87 @@ FSampleBuffer *fs_create_sample_buffer_raw(uint32_t sample_rate, size_t sample_c
   memset(buffer, 0, sizeof(FSampleBuffer));
   buffer->sample_count = sample_count;
   buffer->sample_rate = sample_rate;
-  buffer->buffer_size = sizeof(sample_t) * sample_count;
-  buffer->samples = (sample_t*) malloc(buffer->buffer_size);
-  if (buffer == NULL) {
-    fs_set_error(FS_OUT_OF_MEMORY);
+  buffer->channels = channels;
+  buffer->buffer_size = sizeof(sample_t) * sample_count * channels;
+  if (alloc_samples(buffer, storage) != FS_OK) {
+    free(buffer);
+    fs_set_error((storage == FS_STORAGE_FILE) ? FS_FILE_IO_ERROR : FS_OUT_OF_MEMORY);
     return NULL;
   }
-  memset(buffer->samples, 0, buffer->buffer_size);
+  fs_add_alloc_stats(buffer->buffer_size);
+  fs_add_live_bytes(buffer->buffer_size);
   return buffer;
 }
 
+FSampleBuffer *fs_create_sample_buffer_storage(uint32_t sample_rate, size_t sample_count, int storage)
+{
+  return create_buffer_channels(sample_rate, sample_count, 1, storage);
+}
+
+FSampleBuffer *fs_create_multichannel_buffer(uint32_t sample_rate, size_t sample_count, unsigned int channels)
+{
+  if (channels == 0 || channels > FS_MAX_CHANNELS) {
+    fs_clear_error();
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return NULL;
+  }
+  return create_buffer_channels(sample_rate, sample_count, channels, select_storage(sizeof(sample_t) * sample_count * channels));
+}
+
+FSampleBuffer fs_channel_view(const FSampleBuffer *buffer, unsigned int channel)
+{
+  FSampleBuffer view = *buffer;
+  view.samples = FS_CHANNEL(buffer, channel);
+  view.channels = 1;
+  view.buffer_size = sizeof(sample_t) * buffer->sample_count;
+  view.refs = NULL;
+  view.map_addr = NULL;
+  view.map_size = 0;
+  view.storage = FS_STORAGE_HEAP;
+  return view;
+}
+
+int fs_copy_channel(FSampleBuffer *dest, unsigned int dest_channel, const FSampleBuffer *src, unsigned int src_channel)
+{
+  size_t count;
+  fs_clear_error();
+  if (INVALID_BUFFER(dest) || INVALID_BUFFER(src)) {
+    fs_set_error(FS_INVALID_BUFFER);
+  } else if (dest_channel >= dest->channels || src_channel >= src->channels) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+  } else if (dest->sample_rate != src->sample_rate) {
+    fs_set_error(FS_DIFF_SAMPLE_RATE);
+  } else if (fs_unshare_samples(dest, 1) == FS_OK) {
+    count = MIN(dest->sample_count, src->sample_count);
+    memmove(FS_CHANNEL(dest, dest_channel), FS_CHANNEL(src, src_channel), sizeof(sample_t) * count);
+    fs_add_stats(count, sizeof(sample_t) * count * 2);
+  }
+  return fs_get_error();
+}
+
+FSampleBuffer *fs_create_sample_buffer_raw(uint32_t sample_rate, size_t sample_count)
+{
+  return fs_create_sample_buffer_storage(sample_rate, sample_count, select_storage(sizeof(sample_t) * sample_count));
+}
+
+int fs_set_buffer_storage(FSampleBuffer *buffer, int storage)
+{
+  fs_clear_error();
+  if (INVALID_BUFFER(buffer) || (storage != FS_STORAGE_HEAP && storage != FS_STORAGE_FILE)) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+  } else if (buffer->storage != storage || buffer->map_addr != NULL) {
+    if (move_samples(buffer, buffer->sample_count, buffer->sample_count, storage) != FS_OK) {
+      fs_set_error((storage == FS_STORAGE_FILE) ? FS_FILE_IO_ERROR : FS_OUT_OF_MEMORY);
+    }
+  }
+  return fs_get_error();
+}
+
 FSampleBuffer *fs_create_sample_buffer_prop(FSampleBuffer *buffer)
 {
+  if (buffer->channels > 1) {
+    return fs_create_multichannel_buffer(buffer->sample_rate, buffer->sample_count, buffer->channels);
+  }
   return fs_create_sample_buffer_raw(buffer->sample_rate, buffer->sample_count);
 }
 
@@ -51,37 +341,93 @@ int fs_clear_sample_buffer(FSampleBuffer *buffer)
     fs_set_error(FS_INVALID_BUFFER);
     return fs_get_error();
   }
+  if (fs_unshare_samples(buffer, 0) != FS_OK) {
+    return fs_get_error();
+  }
   memset(buffer->samples, 0, buffer->buffer_size);
+  fs_add_stats(FS_TOTAL_SAMPLES(buffer), buffer->buffer_size);
   return fs_get_error();
 }
 
 int fs_resize_sample_buffer(FSampleBuffer *buffer, size_t new_size)
 {
+  size_t old_size, old_count, new_bytes;
+  int storage;
   fs_clear_error();
   if (!INVALID_BUFFER(buffer)) {
-    buffer->buffer_size = sizeof(sample_t) * new_size;
+    old_size = buffer->buffer_size;
+    old_count = buffer->sample_count;
+    new_bytes = sizeof(sample_t) * new_size * buffer->channels;
+    if (buffer->storage == FS_STORAGE_FILE) {
+      if (fs_unshare_samples(buffer, 1) != FS_OK) {
+        return fs_get_error();
+      }
+      if (new_size < old_count) move_planes(buffer, old_count, new_size);
+      if (map_storage_file(buffer, old_size, new_bytes) != FS_OK) {
+        fs_set_error(FS_FILE_IO_ERROR);
+        return fs_get_error();
+      }
+      if (new_size > old_count) move_planes(buffer, old_count, new_size);
+      buffer->buffer_size = new_bytes;
+      buffer->sample_count = new_size;
+      fs_add_alloc_stats(new_bytes);
+      fs_add_live_bytes((int64_t)new_bytes - (int64_t)old_size);
+      return fs_get_error();
+    }
+    storage = select_storage(new_bytes);
+    if (buffer->map_addr != NULL || storage == FS_STORAGE_FILE) {
+      /* File mapped views can't grow and large buffers move into file storage */
+      if (move_samples(buffer, new_size, new_size, storage) != FS_OK) {
+        fs_set_error((storage == FS_STORAGE_FILE) ? FS_FILE_IO_ERROR : FS_OUT_OF_MEMORY);
+        return fs_get_error();
+      }
+      buffer->buffer_size = new_bytes;
+      buffer->sample_count = new_size;
+      fs_add_live_bytes((int64_t)new_bytes - (int64_t)old_size);
+      return fs_get_error();
+    }
+    if (fs_unshare_samples(buffer, 1) != FS_OK) {
+      return fs_get_error();
+    }
+    if (new_size < old_count && buffer->channels > 1) move_planes(buffer, old_count, new_size);
+    buffer->buffer_size = new_bytes;
     buffer->samples = (sample_t*) realloc(buffer->samples, buffer->buffer_size);
     if (buffer->samples == NULL) {
       fs_set_error(FS_OUT_OF_MEMORY);
       buffer->sample_count = 0;
       buffer->buffer_size = 0;
     } else {
+      if (new_size > old_count && buffer->channels > 1) move_planes(buffer, old_count, new_size);
       buffer->sample_count = new_size;
+      fs_add_alloc_stats(buffer->buffer_size);
     }
+    fs_add_live_bytes((int64_t)buffer->buffer_size - (int64_t)old_size);
   }
   return fs_get_error();
 }
 
 int fs_cat_sample_buffers_inplace(FSampleBuffer *buffer_a, FSampleBuffer *buffer_b)
 {
-  size_t new_size, old_size;
+  size_t new_size, old_size, count_b;
+  unsigned int ch;
   fs_clear_error();
   if (!INVALID_BUFFER(buffer_a) && !INVALID_BUFFER(buffer_b)) {
-    new_size = buffer_a->sample_count + buffer_b->sample_count;
+    if (buffer_b->channels != 1 && buffer_b->channels != buffer_a->channels) {
+      fs_set_error(FS_INVALID_ARGUMENT);
+      return fs_get_error();
+    }
+    /* buffer_b may be buffer_a, so its size is taken before the resize */
+    count_b = buffer_b->sample_count;
+    new_size = buffer_a->sample_count + count_b;
     old_size = buffer_a->sample_count;
+    FS_TRACE_KERNEL("fs_cat_sample_buffers_inplace", new_size);
     if (!FAILED(fs_resize_sample_buffer(buffer_a, new_size))) {
-      memcpy(&buffer_a->samples[old_size-1], buffer_b->samples, buffer_b->buffer_size);
+      for (ch = 0; ch < buffer_a->channels; ++ch) {
+        memcpy(&FS_CHANNEL(buffer_a, ch)[old_size], FS_CHANNEL(buffer_b, (buffer_b->channels == 1) ? 0 : ch), sizeof(sample_t) * count_b);
+      }
+      fs_add_stats(count_b * buffer_a->channels, sizeof(sample_t) * count_b * buffer_a->channels * 2);
     }
+    FS_TRACE_END();
   } else {
     fs_set_error(FS_INVALID_BUFFER);
   }
@@ -90,12 +436,25 @@ int fs_cat_sample_buffers_inplace(FSampleBuffer *buffer_a, FSampleBuffer *buffer
 
 FSampleBuffer *fs_cat_sample_buffers(FSampleBuffer *buffer_a, FSampleBuffer *buffer_b)
 {
+  unsigned int ch;
   FSampleBuffer *pout = NULL;
   fs_clear_error();
   if (!INVALID_BUFFER(buffer_a) && !INVALID_BUFFER(buffer_b)) {
-    pout = fs_create_sample_buffer_raw(buffer_a->sample_rate, buffer_a->sample_count + buffer_b->sample_count);
-    memcpy(pout->samples, buffer_a->samples, buffer_a->buffer_size);
-    memcpy(&pout->samples[buffer_a->sample_count-1], buffer_b->samples, buffer_b->buffer_size);
+    if (buffer_b->channels != 1 && buffer_b->channels != buffer_a->channels) {
+      fs_set_error(FS_INVALID_ARGUMENT);
+      return NULL;
+    }
+    FS_TRACE_KERNEL("fs_cat_sample_buffers", buffer_a->sample_count + buffer_b->sample_count);
+    pout = fs_create_multichannel_buffer(buffer_a->sample_rate, buffer_a->sample_count + buffer_b->sample_count, buffer_a->channels);
+    if (pout != NULL) {
+      for (ch = 0; ch < pout->channels; ++ch) {
+        memcpy(FS_CHANNEL(pout, ch), FS_CHANNEL(buffer_a, ch), sizeof(sample_t) * buffer_a->sample_count);
+        memcpy(&FS_CHANNEL(pout, ch)[buffer_a->sample_count], FS_CHANNEL(buffer_b, (buffer_b->channels == 1) ? 0 : ch),
+               sizeof(sample_t) * buffer_b->sample_count);
+      }
+      fs_add_stats(FS_TOTAL_SAMPLES(pout), pout->buffer_size * 2);
+    }
+    FS_TRACE_END();
   } else {
     fs_set_error(FS_INVALID_BUFFER);
   }
@@ -130,14 +489,31 @@ int fs_repeat_sample_buffer_inplace(FSampleBuffer *buffer, int times)
 
 FSampleBuffer *fs_clone_sample_buffer(FSampleBuffer *buffer)
 {
-  FSampleBuffer *clone = fs_create_sample_buffer_raw(buffer->sample_rate, buffer->sample_count);
-  memcpy(clone->samples, buffer->samples, buffer->buffer_size);
+  FSampleBuffer *clone;
+  fs_clear_error();
+  if (buffer == NULL) {
+    fs_set_error(FS_INVALID_BUFFER);
+    return NULL;
+  }
+  clone = (FSampleBuffer*) malloc(sizeof(FSampleBuffer));
+  if (clone != NULL && buffer->refs == NULL) {
+    buffer->refs = (unsigned int*) malloc(sizeof(unsigned int));
+    if (buffer->refs != NULL) *buffer->refs = 1;
+  }
+  if (clone == NULL || buffer->refs == NULL) {
+    free(clone);
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  /* Both buffers refer to the same samples, the first kernel which writes to one of them copies */
+  __atomic_add_fetch(buffer->refs, 1, __ATOMIC_ACQ_REL);
+  *clone = *buffer;
   return clone;
 }
 
 FSampleBuffer *fs_create_sample_buffer(uint32_t sample_rate, double duration)
 {
-  uint32_t sample_count = (uint32_t)(sample_rate * duration);
+  size_t sample_count = (size_t)(sample_rate * duration);
   return fs_create_sample_buffer_raw(sample_rate, sample_count);
 }
 
@@ -147,10 +523,13 @@ int fs_scale_samples(FSampleBuffer *buffer, double level)
   fs_clear_error();
   if (INVALID_BUFFER(buffer)) {
     fs_set_error(FS_INVALID_BUFFER);
-  } else {
-    FOREACH_SAMPLE(buffer, idx) {
+  } else if (fs_unshare_samples(buffer, 1) == FS_OK) {
+    FS_TRACE_KERNEL("fs_scale_samples", FS_TOTAL_SAMPLES(buffer));
+    for (idx = 0; idx < FS_TOTAL_SAMPLES(buffer); ++idx) {
       buffer->samples[idx] *= level;
     }
+    fs_add_stats(FS_TOTAL_SAMPLES(buffer), buffer->buffer_size * 2);
+    FS_TRACE_END();
   }
   return fs_get_error();
 }
@@ -224,7 +603,7 @@ sample_t rect(double phase)
 
 int fs_normalize_buffer(FSampleBuffer *buffer)
 {
-  int idx;
+  size_t idx;
   sample_t min_max_val;
   sample_t x, min_val = 1e300, max_val = 0;
   fs_clear_error();
@@ -232,67 +611,97 @@ int fs_normalize_buffer(FSampleBuffer *buffer)
     fs_set_error(FS_INVALID_BUFFER);
     return fs_get_error();
   }
-  FOREACH_SAMPLE(buffer, idx) {
+  if (fs_unshare_samples(buffer, 1) != FS_OK) {
+    return fs_get_error();
+  }
+  /* All channels share one scale, so the balance between them stays */
+  FS_TRACE_KERNEL("fs_normalize_buffer", FS_TOTAL_SAMPLES(buffer));
+  for (idx = 0; idx < FS_TOTAL_SAMPLES(buffer); ++idx) {
     min_val = MIN(min_val, buffer->samples[idx]);
     max_val = MAX(max_val, buffer->samples[idx]);
   }
   min_max_val = max_val - min_val;
   if (min_max_val == 0) {
+    FS_TRACE_END();
     fs_set_error(FS_DIVIDED_BY_ZERO);
     return fs_get_error();
   }
-  FOREACH_SAMPLE(buffer, idx) {
+  for (idx = 0; idx < FS_TOTAL_SAMPLES(buffer); ++idx) {
     x = buffer->samples[idx];
     x = (x - min_val) / min_max_val;
     x = (x - .5) * 2.;
     buffer->samples[idx] = x;
   }
+  fs_add_stats(FS_TOTAL_SAMPLES(buffer) * 2, buffer->buffer_size * 3);
+  FS_TRACE_END();
   return fs_get_error();
 }
 
-int fs_modulate_buffer(FSampleBuffer *dest, FSampleBuffer *src, int modulate_type)
+int modulate_channel(sample_t *dest, const sample_t *src, size_t count, int modulate_type)
 {
-  int idx;
-  fs_clear_error();
-  if (INVALID_BUFFER(dest) || INVALID_BUFFER(src)) {
-    fs_set_error(FS_INVALID_BUFFER);
-    return fs_get_error();
-  }
-  if (dest->sample_count < src->sample_count) {
-    fs_set_error(FS_DIFF_SAMPLE_RATE);
-    return fs_get_error();
-  }
-  FOREACH_SAMPLE(dest, idx) {
+  size_t idx;
+  for (idx = 0; idx < count; ++idx) {
     switch (modulate_type) {
     case FS_MOD_ADD:
-      dest->samples[idx] += src->samples[idx];
+      dest[idx] += src[idx];
       break;
     case FS_MOD_SUB:
-      dest->samples[idx] -= src->samples[idx];
+      dest[idx] -= src[idx];
       break;
     case FS_MOD_MULT:
-      dest->samples[idx] *= src->samples[idx];
+      dest[idx] *= src[idx];
       break;
     case FS_MOD_DIV:
-      dest->samples[idx] /= src->samples[idx];
+      dest[idx] /= src[idx];
       break;
     case FS_MOD_SQUARE:
-      dest->samples[idx] *= src->samples[idx] * src->samples[idx];
+      dest[idx] *= src[idx] * src[idx];
       break;
     case FS_MOD_ROOT:
-      dest->samples[idx] *= sqrt(src->samples[idx]);
+      dest[idx] *= sqrt(src[idx]);
       break;
     case FS_MOD_LOG:
-      dest->samples[idx] *= log(src->samples[idx]);
+      dest[idx] *= log(src[idx]);
       break;
     case FS_MOD_LOG10:
-      dest->samples[idx] *= log10(src->samples[idx]);
+      dest[idx] *= log10(src[idx]);
       break;
     default:
+      return FS_ERROR;
+    }
+  }
+  return FS_OK;
+}
+
+int fs_modulate_buffer(FSampleBuffer *dest, FSampleBuffer *src, int modulate_type)
+{
+  unsigned int ch;
+  fs_clear_error();
+  if (INVALID_BUFFER(dest) || INVALID_BUFFER(src)) {
+    fs_set_error(FS_INVALID_BUFFER);
+    return fs_get_error();
+  }
+  if (dest->sample_count < src->sample_count) {
+    fs_set_error(FS_DIFF_SAMPLE_RATE);
+    return fs_get_error();
+  }
+  if (src->channels != 1 && src->channels != dest->channels) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  if (fs_unshare_samples(dest, 1) != FS_OK) {
+    return fs_get_error();
+  }
+  /* Each channel is modulated by the matching channel of the source, or by its only one */
+  FS_TRACE_KERNEL("fs_modulate_buffer", FS_TOTAL_SAMPLES(dest));
+  for (ch = 0; ch < dest->channels; ++ch) {
+    if (modulate_channel(FS_CHANNEL(dest, ch), FS_CHANNEL(src, (src->channels == 1) ? 0 : ch), src->sample_count, modulate_type) != FS_OK) {
       fs_set_error(FS_INVALID_ARGUMENT);
       break;
     }
   }
+  fs_add_stats(FS_TOTAL_SAMPLES(dest), dest->buffer_size * 3);
+  FS_TRACE_END();
   return fs_get_error();
 }
 
@@ -334,11 +743,16 @@ int fs_generate_wave_func(FSampleBuffer *buffer, int func_type, double freq, dou
     fs_set_error(FS_INVALID_BUFFER);
     return fs_get_error();
   }
-  if (freq == 0) {
+  if (freq == 0 || func_type < FS_WAVE_SINE || func_type > FS_WAVE_NOISE) {
     fs_set_error(FS_INVALID_ARGUMENT);
     return fs_get_error();
   }
+  /* Every sample is overwritten, so shared samples needn't be copied */
+  if (fs_unshare_samples(buffer, 0) != FS_OK) {
+    return fs_get_error();
+  }
   shift = M_PI * 2. / ((double)buffer->sample_rate / freq);
+  FS_TRACE_KERNEL("fs_generate_wave_func", buffer->sample_count);
   FOREACH_SAMPLE(buffer, idx) {
     if (wave_func_intern(&buffer->samples[idx], func_type, phase, amp) != FS_OK) {
       fs_set_error(FS_INVALID_ARGUMENT);
@@ -346,13 +760,77 @@ int fs_generate_wave_func(FSampleBuffer *buffer, int func_type, double freq, dou
     }
     phase = fmod(phase + shift, M_PI * 2.);
   }
+  fs_spread_channel(buffer);
+  fs_add_stats(buffer->sample_count, sizeof(sample_t) * buffer->sample_count);
+  FS_TRACE_END();
+  return fs_get_error();
+}
+
+int fs_generate_enveloped_wave(FSampleBuffer *buffer, int func_type, double freq, double amp, const FSEnvelope *envelope)
+{
+  size_t pos, idx, n;
+  double shift, phase = 0;
+  sample_t x, levels[256];
+  FSEnvelopeState state;
+  fs_clear_error();
+  if (INVALID_BUFFER(buffer) || envelope == NULL) {
+    fs_set_error(FS_INVALID_BUFFER);
+    return fs_get_error();
+  }
+  if (freq == 0 || func_type < FS_WAVE_SINE || func_type > FS_WAVE_NOISE) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  if (fs_unshare_samples(buffer, 0) != FS_OK) {
+    return fs_get_error();
+  }
+  shift = M_PI * 2. / ((double)buffer->sample_rate / freq);
+  fs_envelope_start(&state, envelope, buffer->sample_rate);
+  FS_TRACE_KERNEL("fs_generate_enveloped_wave", buffer->sample_count);
+  for (pos = 0; pos < buffer->sample_count; pos += n) {
+    /* The levels of a block stay in the cache until the waveform is multiplied in */
+    n = MIN(sizeof(levels) / sizeof(sample_t), buffer->sample_count - pos);
+    fs_envelope_render(&state, levels, n);
+    for (idx = 0; idx < n; ++idx) {
+      if (wave_func_intern(&x, func_type, phase, amp) != FS_OK) {
+        FS_TRACE_END();
+        fs_set_error(FS_INVALID_ARGUMENT);
+        return fs_get_error();
+      }
+      buffer->samples[pos + idx] = x * levels[idx];
+      phase = fmod(phase + shift, M_PI * 2.);
+    }
+  }
+  fs_spread_channel(buffer);
+  fs_add_stats(buffer->sample_count, sizeof(sample_t) * buffer->sample_count);
+  FS_TRACE_END();
   return fs_get_error();
 }
 
 int fs_generate_pink_noise(FSampleBuffer *buffer, int func_type, double min_freq, double max_freq, int overlays)
 {
+  int idx, count = MAX(overlays - 1, 0);
   double freq, amplitude;
-  FSampleBuffer *temp = fs_create_sample_buffer_prop(buffer);
+  FSPartial *partials;
+  FSampleBuffer *temp;
+  if (func_type == FS_WAVE_SINE || func_type == FS_WAVE_COSINE) {
+    /* Sine overlays are summed by the oscillator bank in a single pass */
+    fs_clear_error();
+    partials = (FSPartial*) malloc(sizeof(FSPartial) * MAX(count, 1));
+    if (partials == NULL) {
+      fs_set_error(FS_OUT_OF_MEMORY);
+      return fs_get_error();
+    }
+    for (idx = 0; idx < count; ++idx) {
+      partials[idx].freq = min_freq + RAND_F * max_freq;
+      partials[idx].amp = ((rand() & 0xffff) / 65535. - .5) * 2.;
+      partials[idx].phase = (func_type == FS_WAVE_COSINE) ? M_PI / 2 : 0;
+    }
+    fs_generate_partials(buffer, partials, count, 1);
+    free(partials);
+    return fs_get_error();
+  }
+  temp = fs_create_sample_buffer_prop(buffer);
   if (FAILED(fs_get_error())) {
     return fs_get_error();
   }
@@ -370,29 +848,51 @@ int fs_generate_pink_noise(FSampleBuffer *buffer, int func_type, double min_freq
 
 int fs_modulate_frequency(FSampleBuffer *dest, FSampleBuffer *source, int func_type, double amp)
 {
-  int idx;
-  double shift, phase = 0;
+  size_t idx;
+  unsigned int ch, channels;
+  double scale, phase;
+  sample_t *out;
+  const sample_t *freq;
   fs_clear_error();
   if (INVALID_BUFFER(dest) || INVALID_BUFFER(source)) {
     fs_set_error(FS_INVALID_BUFFER);
     return fs_get_error();
   }
-  FOREACH_SAMPLE(dest, idx) {
-    shift = M_PI * 2. / ((double)dest->sample_rate / source->samples[idx]);
-    if (wave_func_intern(&dest->samples[idx], func_type, phase, amp) != FS_OK) {
-      fs_set_error(FS_INVALID_ARGUMENT);
-      break;
+  if (func_type < FS_WAVE_SINE || func_type > FS_WAVE_NOISE || (source->channels != 1 && source->channels != dest->channels)) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  if (fs_unshare_samples(dest, 0) != FS_OK) {
+    return fs_get_error();
+  }
+  /* A mono source gives the same waveform for every channel, it's rendered once and copied */
+  channels = (source->channels == 1) ? 1 : dest->channels;
+  scale = M_PI * 2. / dest->sample_rate;
+  FS_TRACE_KERNEL("fs_modulate_frequency", dest->sample_count * channels);
+  for (ch = 0; ch < channels; ++ch) {
+    out = FS_CHANNEL(dest, ch);
+    freq = FS_CHANNEL(source, ch);
+    phase = 0;
+    for (idx = 0; idx < dest->sample_count; ++idx) {
+      wave_func_intern(&out[idx], func_type, phase, amp);
+      /* The phase only leaves one period now and then, fmod is needed only there */
+      phase += scale * freq[idx];
+      if (phase >= M_PI * 2. || phase <= -M_PI * 2.) phase = fmod(phase, M_PI * 2.);
     }
-    phase = fmod(phase + shift, M_PI * 2.);
   }
+  if (channels == 1) fs_spread_channel(dest);
+  fs_add_stats(dest->sample_count * channels, sizeof(sample_t) * dest->sample_count * channels * 2);
+  FS_TRACE_END();
   return fs_get_error();
 }
 
 void fs_delete_sample_buffer(FSampleBuffer **buffer)
 {
+  size_t size;
   if (buffer != NULL && (*buffer) != NULL) {
-    if ((*buffer)->buffer_size > 0) {
-      free((*buffer)->samples);
+    size = (*buffer)->buffer_size;
+    if (release_samples(*buffer)) {
+      fs_add_live_bytes(-(int64_t)size);
     }
     free(*buffer);
     *buffer = NULL;
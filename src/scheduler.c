@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Event scheduler, renders the audio between timestamped events as blocks
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <memory.h>
+#include <math.h>
+#include "fsynth.h"
+#include "trace.h"
+
+#define SCHED_BLOCK       256   /* Envelope levels which are rendered at once */
+#define SCHED_MIN_QUEUE   64
+
+int wave_func_intern(sample_t *out, int func_type, double phase, double amp);
+
+typedef struct {
+  double beat;
+  uint64_t order;       /* Keeps events with the same time in the order they have been added */
+  int type;
+  int data;
+  double value;
+} SchedEvent;
+
+typedef struct {
+  int note;             /* MIDI note number, -1 for a free voice */
+  int releasing;
+  double freq;          /* Frequency of the note without detune */
+  double phase;
+  double step;          /* Phase increment per sample */
+  double velocity;
+  double level;         /* Envelope level of the last sample, the release starts there */
+  double release_step;  /* Level decrement per sample after the note off */
+  size_t env_left;      /* Samples until attack and decay are over */
+  uint64_t started;     /* The voice which started first is stolen first */
+  FSEnvelopeState env;
+} SchedVoice;
+
+struct FSScheduler {
+  uint32_t sample_rate;
+  SchedEvent *queue;    /* Binary heap, the next event is the first one */
+  size_t count;
+  size_t capacity;
+  uint64_t next_order;
+  double bpm;
+  double anchor_beat;   /* Beat at anchor_pos, the last tempo change */
+  uint64_t anchor_pos;
+  uint64_t position;    /* Samples which have been rendered */
+  int func_type;
+  double gain;
+  double detune;        /* Cents */
+  double sustain;
+  double release;
+  FSEnvelope envelope;  /* Attack and decay of every note */
+  size_t env_samples;
+  uint64_t notes;
+  const FSAutomation *gain_lane;
+  const FSAutomation *detune_lane;
+  FSAutomationState gain_state;
+  FSAutomationState detune_state;
+  double lane_detune;   /* Cents of the detune lane within the current block */
+  SchedVoice voices[FS_MAX_VOICES];
+  FSSchedulerStats stats;
+};
+
+int event_before(const SchedEvent *a, const SchedEvent *b)
+{
+  return a->beat < b->beat || (a->beat == b->beat && a->order < b->order);
+}
+
+void heap_push(SchedEvent *heap, size_t *count, const SchedEvent *event)
+{
+  size_t idx = (*count)++, parent;
+  while (idx > 0) {
+    parent = (idx - 1) / 2;
+    if (!event_before(event, &heap[parent])) break;
+    heap[idx] = heap[parent];
+    idx = parent;
+  }
+  heap[idx] = *event;
+}
+
+void heap_pop(SchedEvent *heap, size_t *count, SchedEvent *event)
+{
+  size_t idx = 0, child;
+  SchedEvent last = heap[--(*count)];
+  *event = heap[0];
+  while ((child = idx * 2 + 1) < *count) {
+    if (child + 1 < *count && event_before(&heap[child + 1], &heap[child])) ++child;
+    if (!event_before(&heap[child], &last)) break;
+    heap[idx] = heap[child];
+    idx = child;
+  }
+  heap[idx] = last;
+}
+
+/* Sample position of a beat with the current tempo, beats before the last tempo change map onto it */
+uint64_t beat_position(double beat, double anchor_beat, uint64_t anchor_pos, double bpm, uint32_t sample_rate)
+{
+  if (beat <= anchor_beat) return anchor_pos;
+  return anchor_pos + (uint64_t)llround((beat - anchor_beat) * 60. / bpm * sample_rate);
+}
+
+double voice_step(const FSScheduler *scheduler, double freq)
+{
+  return M_PI * 2. * freq * pow(2, (scheduler->detune + scheduler->lane_detune) / 1200.) / scheduler->sample_rate;
+}
+
+void update_voice_steps(FSScheduler *scheduler)
+{
+  size_t idx;
+  for (idx = 0; idx < FS_MAX_VOICES; ++idx) {
+    scheduler->voices[idx].step = voice_step(scheduler, scheduler->voices[idx].freq);
+  }
+}
+
+void start_release(FSScheduler *scheduler, SchedVoice *voice)
+{
+  size_t count = (size_t)(scheduler->release * scheduler->sample_rate);
+  if (count == 0 || voice->level <= 0) {
+    voice->note = -1;
+    return;
+  }
+  voice->releasing = 1;
+  voice->release_step = voice->level / count;
+}
+
+void start_note(FSScheduler *scheduler, int note, double velocity)
+{
+  size_t idx;
+  SchedVoice *voice = &scheduler->voices[0];
+  for (idx = 0; idx < FS_MAX_VOICES; ++idx) {
+    if (scheduler->voices[idx].note < 0) {
+      voice = &scheduler->voices[idx];
+      break;
+    }
+    if (scheduler->voices[idx].started < voice->started) voice = &scheduler->voices[idx];
+  }
+  memset(voice, 0, sizeof(SchedVoice));
+  voice->note = note;
+  voice->freq = 440. * pow(2, (note - 69) / 12.);
+  voice->step = voice_step(scheduler, voice->freq);
+  voice->velocity = velocity;
+  voice->env_left = scheduler->env_samples;
+  voice->started = scheduler->notes++;
+  fs_envelope_start(&voice->env, &scheduler->envelope, scheduler->sample_rate);
+}
+
+/* Voice parameters change only here, between two blocks */
+void apply_event(FSScheduler *scheduler, const SchedEvent *event, uint64_t at)
+{
+  size_t idx;
+  double beat;
+  switch (event->type) {
+  case FS_EVENT_NOTE_ON:
+    start_note(scheduler, event->data, event->value);
+    break;
+  case FS_EVENT_NOTE_OFF:
+    for (idx = 0; idx < FS_MAX_VOICES; ++idx) {
+      if (scheduler->voices[idx].note == event->data && !scheduler->voices[idx].releasing) {
+        start_release(scheduler, &scheduler->voices[idx]);
+      }
+    }
+    break;
+  case FS_EVENT_PARAM:
+    if (event->data == FS_PARAM_GAIN) {
+      scheduler->gain = event->value;
+    } else if (event->data == FS_PARAM_WAVEFORM) {
+      scheduler->func_type = (int)event->value;
+    } else if (event->data == FS_PARAM_DETUNE) {
+      scheduler->detune = event->value;
+      update_voice_steps(scheduler);
+    }
+    break;
+  case FS_EVENT_TEMPO:
+    /* A late tempo change takes effect at the current beat */
+    beat = scheduler->anchor_beat + (at - scheduler->anchor_pos) * scheduler->bpm / 60. / scheduler->sample_rate;
+    scheduler->anchor_beat = MAX(event->beat, beat);
+    scheduler->anchor_pos = at;
+    scheduler->bpm = event->value;
+    break;
+  }
+  ++scheduler->stats.events;
+}
+
+/* Envelope levels of the next count samples of a voice, the voice is freed when it has faded out */
+void voice_levels(FSScheduler *scheduler, SchedVoice *voice, sample_t *levels, size_t count)
+{
+  size_t idx, n = 0;
+  double level;
+  if (voice->releasing) {
+    level = voice->level;
+    for (idx = 0; idx < count; ++idx) {
+      level -= voice->release_step;
+      levels[idx] = MAX(level, 0);
+    }
+    if (level <= 0) voice->note = -1;
+    return;
+  }
+  if (voice->env_left > 0) {
+    n = MIN(count, voice->env_left);
+    fs_envelope_render(&voice->env, levels, n);
+    voice->env_left -= n;
+  }
+  for (idx = n; idx < count; ++idx) {
+    levels[idx] = scheduler->sustain;
+  }
+  if (voice->env_left == 0 && scheduler->sustain == 0) voice->note = -1;
+}
+
+/* Renders count samples from the sample position at, the blocks are aligned to multiples of
+ * SCHED_BLOCK so that the detune lane is read at the same samples however the buffer is split */
+void render_voices(FSScheduler *scheduler, sample_t *out, size_t count, uint64_t at)
+{
+  size_t idx, pos, n, v;
+  double amp;
+  sample_t x, levels[SCHED_BLOCK], gains[SCHED_BLOCK];
+  SchedVoice *voice;
+  memset(out, 0, sizeof(sample_t) * count);
+  for (pos = 0; pos < count; pos += n) {
+    n = MIN(SCHED_BLOCK - (size_t)((at + pos) % SCHED_BLOCK), count - pos);
+    /* The lanes are rendered once per block for all voices */
+    if (scheduler->gain_lane != NULL) fs_automation_render(&scheduler->gain_state, gains, n);
+    if (scheduler->detune_lane != NULL) {
+      fs_automation_render(&scheduler->detune_state, levels, n);
+      if ((at + pos) % SCHED_BLOCK == 0) {
+        scheduler->lane_detune = levels[0];
+        update_voice_steps(scheduler);
+      }
+    }
+    for (v = 0; v < FS_MAX_VOICES; ++v) {
+      voice = &scheduler->voices[v];
+      if (voice->note < 0) continue;
+      amp = voice->velocity * scheduler->gain;
+      voice_levels(scheduler, voice, levels, n);
+      voice->level = levels[n - 1];
+      if (scheduler->gain_lane != NULL) {
+        for (idx = 0; idx < n; ++idx) levels[idx] *= gains[idx];
+      }
+      for (idx = 0; idx < n; ++idx) {
+        wave_func_intern(&x, scheduler->func_type, voice->phase, 1);
+        out[pos + idx] += x * levels[idx] * amp;
+        voice->phase = fmod(voice->phase + voice->step, M_PI * 2.);
+      }
+    }
+  }
+}
+
+FSScheduler *fs_create_scheduler(uint32_t sample_rate, double bpm)
+{
+  size_t idx;
+  FSScheduler *scheduler;
+  fs_clear_error();
+  if (sample_rate == 0 || bpm <= 0) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return NULL;
+  }
+  scheduler = (FSScheduler*) malloc(sizeof(FSScheduler));
+  if (scheduler == NULL) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  memset(scheduler, 0, sizeof(FSScheduler));
+  scheduler->sample_rate = sample_rate;
+  scheduler->bpm = bpm;
+  scheduler->gain = 1;
+  for (idx = 0; idx < FS_MAX_VOICES; ++idx) {
+    scheduler->voices[idx].note = -1;
+  }
+  if (FAILED(fs_set_scheduler_voice(scheduler, FS_WAVE_SINE, 0.01, 0.1, 0.7, 0.2))) {
+    fs_delete_scheduler(&scheduler);
+  }
+  return scheduler;
+}
+
+void fs_delete_scheduler(FSScheduler **scheduler)
+{
+  if (scheduler != NULL && (*scheduler) != NULL) {
+    free((*scheduler)->queue);
+    free(*scheduler);
+    *scheduler = NULL;
+  }
+}
+
+int fs_set_scheduler_voice(FSScheduler *scheduler, int func_type, double attack, double decay, double sustain, double release)
+{
+  fs_clear_error();
+  if (scheduler == NULL || func_type < FS_WAVE_SINE || func_type > FS_WAVE_NOISE ||
+      attack < 0 || decay < 0 || sustain < 0 || release < 0) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  scheduler->func_type = func_type;
+  scheduler->sustain = sustain;
+  scheduler->release = release;
+  memset(&scheduler->envelope, 0, sizeof(FSEnvelope));
+  fs_add_envelope_segment(&scheduler->envelope, FS_CURVE_LINEAR, attack, 1);
+  fs_add_envelope_segment(&scheduler->envelope, FS_CURVE_LINEAR, decay, sustain);
+  /* Counted like fs_envelope_render counts the samples of each segment */
+  scheduler->env_samples = (size_t)(attack * scheduler->sample_rate) + (size_t)(decay * scheduler->sample_rate);
+  return fs_get_error();
+}
+
+int fs_schedule_event(FSScheduler *scheduler, double beat, int type, int data, double value)
+{
+  size_t capacity;
+  SchedEvent event, *queue;
+  fs_clear_error();
+  if (scheduler == NULL || !(beat >= 0) ||
+      ((type == FS_EVENT_NOTE_ON || type == FS_EVENT_NOTE_OFF) && (data < 0 || data > 127)) ||
+      (type == FS_EVENT_PARAM && (data < FS_PARAM_GAIN || data > FS_PARAM_WAVEFORM)) ||
+      (type == FS_EVENT_PARAM && data == FS_PARAM_WAVEFORM && (value < FS_WAVE_SINE || value > FS_WAVE_NOISE)) ||
+      (type == FS_EVENT_TEMPO && value <= 0) || type < FS_EVENT_NOTE_ON || type > FS_EVENT_TEMPO) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  if (scheduler->count == scheduler->capacity) {
+    capacity = MAX(SCHED_MIN_QUEUE, scheduler->capacity * 2);
+    queue = (SchedEvent*) realloc(scheduler->queue, sizeof(SchedEvent) * capacity);
+    if (queue == NULL) {
+      fs_set_error(FS_OUT_OF_MEMORY);
+      return fs_get_error();
+    }
+    scheduler->queue = queue;
+    scheduler->capacity = capacity;
+  }
+  event.beat = beat;
+  event.order = scheduler->next_order++;
+  event.type = type;
+  event.data = data;
+  event.value = value;
+  heap_push(scheduler->queue, &scheduler->count, &event);
+  return fs_get_error();
+}
+
+int fs_render_schedule(FSScheduler *scheduler, FSampleBuffer *buffer)
+{
+  size_t pos, count;
+  uint64_t at, next;
+  SchedEvent event;
+  fs_clear_error();
+  if (scheduler == NULL || INVALID_BUFFER(buffer)) {
+    fs_set_error((scheduler == NULL) ? FS_INVALID_ARGUMENT : FS_INVALID_BUFFER);
+    return fs_get_error();
+  }
+  if (buffer->sample_rate != scheduler->sample_rate) {
+    fs_set_error(FS_DIFF_SAMPLE_RATE);
+    return fs_get_error();
+  }
+  if (fs_unshare_samples(buffer, 0) != FS_OK) {
+    return fs_get_error();
+  }
+  FS_TRACE_KERNEL("fs_render_schedule", buffer->sample_count);
+  for (pos = 0; pos < buffer->sample_count; pos += count) {
+    at = scheduler->position + pos;
+    next = UINT64_MAX;
+    while (scheduler->count > 0) {
+      next = beat_position(scheduler->queue[0].beat, scheduler->anchor_beat, scheduler->anchor_pos,
+        scheduler->bpm, scheduler->sample_rate);
+      if (next > at) break;
+      heap_pop(scheduler->queue, &scheduler->count, &event);
+      apply_event(scheduler, &event, at);
+      next = UINT64_MAX;
+    }
+    /* Nothing changes until the next event, so the samples up to there are one block */
+    count = (size_t)MIN(next - at, (uint64_t)(buffer->sample_count - pos));
+    render_voices(scheduler, &buffer->samples[pos], count, at);
+    ++scheduler->stats.blocks;
+  }
+  scheduler->position += buffer->sample_count;
+  scheduler->stats.samples += buffer->sample_count;
+  fs_spread_channel(buffer);
+  fs_add_stats(buffer->sample_count, sizeof(sample_t) * buffer->sample_count);
+  FS_TRACE_END();
+  return fs_get_error();
+}
+
+double fs_get_schedule_duration(const FSScheduler *scheduler)
+{
+  size_t idx, count;
+  uint64_t at, end, anchor_pos;
+  double bpm, anchor_beat;
+  size_t tail = MAX(scheduler->env_samples, (size_t)(scheduler->release * scheduler->sample_rate));
+  SchedEvent event, *queue;
+  end = scheduler->position;
+  for (idx = 0; idx < FS_MAX_VOICES; ++idx) {
+    if (scheduler->voices[idx].note >= 0) end = scheduler->position + tail;
+  }
+  /* The tempo changes are replayed on a copy of the queue */
+  count = scheduler->count;
+  queue = (SchedEvent*) malloc(sizeof(SchedEvent) * MAX(count, 1));
+  if (queue == NULL) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return 0;
+  }
+  memcpy(queue, scheduler->queue, sizeof(SchedEvent) * count);
+  bpm = scheduler->bpm;
+  anchor_beat = scheduler->anchor_beat;
+  anchor_pos = scheduler->anchor_pos;
+  while (count > 0) {
+    heap_pop(queue, &count, &event);
+    at = MAX(scheduler->position, beat_position(event.beat, anchor_beat, anchor_pos, bpm, scheduler->sample_rate));
+    if (event.type == FS_EVENT_TEMPO) {
+      anchor_beat = MAX(event.beat, anchor_beat + (at - anchor_pos) * bpm / 60. / scheduler->sample_rate);
+      anchor_pos = at;
+      bpm = event.value;
+    }
+    end = MAX(end, at + ((event.type == FS_EVENT_NOTE_ON || event.type == FS_EVENT_NOTE_OFF) ? tail : 0));
+  }
+  free(queue);
+  return (end - scheduler->position) / (double)scheduler->sample_rate;
+}
+
+void fs_get_scheduler_stats(const FSScheduler *scheduler, FSSchedulerStats *stats)
+{
+  *stats = scheduler->stats;
+  stats->pending = scheduler->count;
+}
+
+int fs_set_scheduler_automation(FSScheduler *scheduler, int param, const FSAutomation *lane)
+{
+  FSAutomationState *state;
+  fs_clear_error();
+  if (scheduler == NULL || (param != FS_PARAM_GAIN && param != FS_PARAM_DETUNE)) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  if (param == FS_PARAM_GAIN) {
+    scheduler->gain_lane = lane;
+    state = &scheduler->gain_state;
+  } else {
+    scheduler->detune_lane = lane;
+    scheduler->lane_detune = fs_get_automation_level(lane, scheduler->position / (double)scheduler->sample_rate);
+    update_voice_steps(scheduler);
+    state = &scheduler->detune_state;
+  }
+  fs_automation_start(state, lane, scheduler->sample_rate);
+  fs_automation_seek(state, scheduler->position);
+  return fs_get_error();
+}
@@ -16,6 +16,7 @@
 #include <memory.h>
 #include <math.h>
 #include "fsynth.h"
+#include "trace.h"
 
 const double midi_notes[] = {
 /*   C       C#      D       D#      E       F       F#      G      G#       A      A#       H                 */
@@ -114,17 +115,35 @@ int fs_track_sequence(FSTrackChannel *channel, int octave, uint16_t *data, size_
   uint8_t note, amp;
   FSampleBuffer *tone;
   fs_clear_error();
-  tone = fs_create_sample_buffer_prop(channel->hull_curve);
+  if (channel->envelope != NULL) {
+    tone = fs_create_sample_buffer(channel->sample_rate, fs_get_envelope_duration(channel->envelope));
+  } else {
+    tone = fs_create_sample_buffer_prop(channel->hull_curve);
+  }
   if (FAILED(fs_get_error())) {
     return fs_get_error();
   }
+  FS_TRACE_KERNEL("fs_track_sequence", tone->sample_count * length);
   for (idx = 0; idx < length; ++idx) {
     note = (data[idx] + octave * 12) & 0x7f;  /* Low byte used for note */
     amp = data[idx] >> 8;     /* High byte used for amplitude */
-    fs_generate_wave_func(tone, channel->func_type, midi_notes[note], dB(-amp));
-    fs_modulate_buffer(tone, channel->hull_curve, FS_MOD_MULT);
+    if (channel->func_type == FS_WAVE_FM) {
+      fs_generate_fm(tone, channel->fm_patch, midi_notes[note], dB(-amp));
+      if (!FAILED(fs_get_error())) {
+        if (channel->envelope != NULL) {
+          fs_apply_envelope(tone, channel->envelope);
+        } else {
+          fs_modulate_buffer(tone, channel->hull_curve, FS_MOD_MULT);
+        }
+      }
+    } else if (channel->envelope != NULL) {
+      fs_generate_enveloped_wave(tone, channel->func_type, midi_notes[note], dB(-amp), channel->envelope);
+    } else {
+      fs_generate_wave_func(tone, channel->func_type, midi_notes[note], dB(-amp));
+      fs_modulate_buffer(tone, channel->hull_curve, FS_MOD_MULT);
+    }
     if (FAILED(fs_get_error())) {
-      return fs_get_error();
+      break;
     }
     if (idx == 0) {
       channel->output = fs_clone_sample_buffer(tone);
@@ -132,5 +151,6 @@ int fs_track_sequence(FSTrackChannel *channel, int octave, uint16_t *data, size_
       fs_cat_sample_buffers_inplace(channel->output, tone);
     }
   }
+  FS_TRACE_END();
   return fs_get_error();
 }
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Span tracing in the Chrome trace event format (chrome://tracing, Perfetto)
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "hashmap.h"
+#include "logging.h"
+
+#define TRACE_CHUNK_EVENTS  4096
+#define TRACE_MAX_THREADS   256   /* Threads which are traced at the same time */
+
+struct TraceEvent {
+  uint64_t time;           /* Nanoseconds since the trace was started */
+  const char *name;        /* Interned, NULL for the end of a span */
+  const char *buffer;      /* Interned buffer name or NULL */
+  uint64_t samples;
+  int category;
+};
+
+struct TraceChunk {
+  struct TraceChunk *next;
+  size_t count;
+  struct TraceEvent events[TRACE_CHUNK_EVENTS];
+};
+
+/* Events of one thread, only the owning thread appends to it. When the thread exits,
+ * the next thread with the same name continues the list, so short lived stream writers
+ * don't use up the table */
+struct TraceThread {
+  unsigned int tid;
+  const char *name;
+  int busy;                /* Owned by a running thread */
+  struct TraceChunk *first;
+  struct TraceChunk *last;
+};
+
+int trace_active = 0;
+char *trace_fname = NULL;
+struct timespec trace_epoch;
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+struct TraceThread trace_threads[TRACE_MAX_THREADS];
+unsigned int trace_thread_count = 0;
+unsigned int trace_generation = 0;
+uint64_t trace_dropped = 0;  /* Events which couldn't be recorded, guarded by trace_lock */
+__thread struct TraceThread *trace_thread = NULL;
+__thread unsigned int trace_thread_generation = 0;
+
+const char *trace_categories[] = { "command", "kernel", "io" };
+
+uint64_t trace_time(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)(now.tv_sec - trace_epoch.tv_sec) * 1000000000ULL + now.tv_nsec - trace_epoch.tv_nsec;
+}
+
+/* Takes the list of a finished thread with the same name or a new one, name is interned */
+struct TraceThread *acquire_trace_thread(const char *name)
+{
+  unsigned int idx;
+  struct TraceThread *thread = NULL;
+  pthread_mutex_lock(&trace_lock);
+  for (idx = 0; idx < trace_thread_count && thread == NULL; ++idx) {
+    if (!trace_threads[idx].busy && trace_threads[idx].name == name) thread = &trace_threads[idx];
+  }
+  if (thread == NULL && trace_thread_count < TRACE_MAX_THREADS) {
+    thread = &trace_threads[trace_thread_count];
+    memset(thread, 0, sizeof(struct TraceThread));
+    thread->tid = ++trace_thread_count;
+    thread->name = name;
+  }
+  if (thread != NULL) thread->busy = 1;
+  pthread_mutex_unlock(&trace_lock);
+  trace_thread = thread;
+  trace_thread_generation = trace_generation;
+  return thread;
+}
+
+/* Returns the event list of the calling thread, a new trace invalidates the lists of the last one */
+struct TraceThread *current_trace_thread(void)
+{
+  if (trace_thread != NULL && trace_thread_generation == trace_generation) {
+    return trace_thread;
+  }
+  return acquire_trace_thread(NULL);
+}
+
+void drop_event(void)
+{
+  pthread_mutex_lock(&trace_lock);
+  ++trace_dropped;
+  pthread_mutex_unlock(&trace_lock);
+}
+
+struct TraceEvent *add_event(void)
+{
+  struct TraceChunk *chunk;
+  struct TraceThread *thread = current_trace_thread();
+  if (thread == NULL) {
+    drop_event();
+    return NULL;
+  }
+  chunk = thread->last;
+  if (chunk == NULL || chunk->count == TRACE_CHUNK_EVENTS) {
+    chunk = (struct TraceChunk*) malloc(sizeof(struct TraceChunk));
+    if (chunk == NULL) {
+      drop_event();
+      return NULL;
+    }
+    chunk->next = NULL;
+    chunk->count = 0;
+    if (thread->last != NULL) {
+      thread->last->next = chunk;
+    } else {
+      thread->first = chunk;
+    }
+    thread->last = chunk;
+  }
+  return &chunk->events[chunk->count++];
+}
+
+void trace_begin(int category, const char *name, const char *buffer, uint64_t samples)
+{
+  struct TraceEvent *event = add_event();
+  if (event == NULL) return;
+  /* Command names and buffer names live in temporary buffers, the pool keeps a copy */
+  event->name = intern_string(name);
+  event->buffer = (buffer != NULL) ? intern_string(buffer) : NULL;
+  event->samples = samples;
+  event->category = category;
+  event->time = trace_time();
+}
+
+void trace_end(void)
+{
+  struct TraceEvent *event;
+  uint64_t time = trace_time();
+  event = add_event();
+  if (event == NULL) return;
+  event->name = NULL;
+  event->time = time;
+}
+
+void trace_thread_name(const char *name)
+{
+  struct TraceThread *thread;
+  if (!trace_active) return;
+  if (trace_thread != NULL && trace_thread_generation == trace_generation) {
+    thread = trace_thread;
+    thread->name = intern_string(name);
+  } else {
+    acquire_trace_thread(intern_string(name));
+  }
+}
+
+void trace_thread_exit(void)
+{
+  pthread_mutex_lock(&trace_lock);
+  if (trace_thread != NULL && trace_thread_generation == trace_generation) {
+    trace_thread->busy = 0;
+  }
+  pthread_mutex_unlock(&trace_lock);
+  trace_thread = NULL;
+}
+
+int trace_start(const char *fname)
+{
+  trace_stop();
+  trace_fname = strdup(fname);
+  if (trace_fname == NULL) return -1;
+  pthread_mutex_lock(&trace_lock);
+  trace_thread_count = 0;
+  trace_dropped = 0;
+  ++trace_generation;
+  pthread_mutex_unlock(&trace_lock);
+  clock_gettime(CLOCK_MONOTONIC, &trace_epoch);
+  trace_active = 1;
+  trace_thread_name("main");
+  return 0;
+}
+
+void write_string(FILE *fout, const char *str)
+{
+  fputc('"', fout);
+  for (; *str != 0; ++str) {
+    if (*str == '"' || *str == '\\') fputc('\\', fout);
+    fputc(*str, fout);
+  }
+  fputc('"', fout);
+}
+
+void write_event(FILE *fout, const struct TraceEvent *event, unsigned int tid, int *first)
+{
+  fprintf(fout, "%s\n{\"pid\":%d,\"tid\":%u,\"ts\":%.3f,", *first ? "" : ",", (int)getpid(), tid,
+    event->time * 1e-3);
+  if (event->name == NULL) {
+    fprintf(fout, "\"ph\":\"E\"}");
+  } else {
+    fprintf(fout, "\"ph\":\"B\",\"cat\":\"%s\",\"name\":", trace_categories[event->category]);
+    write_string(fout, event->name);
+    fprintf(fout, ",\"args\":{");
+    if (event->buffer != NULL) {
+      fprintf(fout, "\"buffer\":");
+      write_string(fout, event->buffer);
+      fprintf(fout, "%s", (event->samples > 0) ? "," : "");
+    }
+    if (event->samples > 0) {
+      fprintf(fout, "\"samples\":%llu", (unsigned long long)event->samples);
+    }
+    fprintf(fout, "}}");
+  }
+  *first = 0;
+}
+
+/* Writes all recorded events, all traced threads must have finished their spans */
+int trace_stop(void)
+{
+  unsigned int idx;
+  size_t pos;
+  int first = 1, result = 0;
+  uint64_t dropped;
+  struct TraceChunk *chunk, *next;
+  struct TraceThread *thread;
+  FILE *fout;
+  if (!trace_active) return 0;
+  trace_active = 0;
+  fout = fopen(trace_fname, "w");
+  if (fout != NULL) {
+    fprintf(fout, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  } else {
+    result = -1;
+  }
+  pthread_mutex_lock(&trace_lock);
+  for (idx = 0; idx < trace_thread_count; ++idx) {
+    thread = &trace_threads[idx];
+    if (fout != NULL && thread->name != NULL) {
+      fprintf(fout, "%s\n{\"pid\":%d,\"tid\":%u,\"ph\":\"M\",\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+        first ? "" : ",", (int)getpid(), thread->tid, thread->name);
+      first = 0;
+    }
+    for (chunk = thread->first; chunk != NULL; chunk = next) {
+      for (pos = 0; fout != NULL && pos < chunk->count; ++pos) {
+        write_event(fout, &chunk->events[pos], thread->tid, &first);
+      }
+      next = chunk->next;
+      free(chunk);
+    }
+    thread->first = thread->last = NULL;
+  }
+  trace_thread_count = 0;
+  ++trace_generation;
+  dropped = trace_dropped;
+  pthread_mutex_unlock(&trace_lock);
+  if (dropped > 0) {
+    FS_LOG_WARN("The trace misses %llu events, more than %d threads were traced at once or memory ran out",
+      (unsigned long long)dropped, TRACE_MAX_THREADS);
+  }
+  if (fout != NULL) {
+    fprintf(fout, "\n]}\n");
+    if (fclose(fout) != 0) result = -1;
+  }
+  free(trace_fname);
+  trace_fname = NULL;
+  return result;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Span tracing in the Chrome trace event format (chrome://tracing, Perfetto)
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_COMMAND   0
+#define TRACE_KERNEL    1
+#define TRACE_IO        2
+
+extern int trace_active;
+
+/* A disabled trace costs a single test per span */
+#define FS_TRACE_BEGIN(category, name, buffer, samples) \
+  do { \
+    if (trace_active) trace_begin((category), (name), (buffer), (samples)); \
+  } while (0)
+
+#define FS_TRACE_END() \
+  do { \
+    if (trace_active) trace_end(); \
+  } while (0)
+
+#define FS_TRACE_KERNEL(name, samples)  FS_TRACE_BEGIN(TRACE_KERNEL, (name), NULL, (samples))
+
+int trace_start(const char *fname);
+int trace_stop(void);
+void trace_begin(int category, const char *name, const char *buffer, uint64_t samples);
+void trace_end(void);
+void trace_thread_name(const char *name);
+
+/* Called by a traced thread before it ends, a later thread with the same name takes its events over */
+void trace_thread_exit(void);
+
+#endif /* _TRACE_H_ */
@@ -11,94 +11,605 @@
  * @date 2017-03-10
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <memory.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include "fsynth.h"
+#include "trace.h"
+
+#define WAVE_HEADER_SIZE  44
+#define STREAM_ALIGN      4096
 
 typedef struct {
-  uint16_t wFromatTag;
-  uint16_t wChannels;
-  uint32_t dwSamplesPerSec;
-  uint32_t dwAvgBytesPerSec;
-  uint16_t wBlockAlign;
-  uint16_t wBitsPerSample;
-} FmtHeader;
-
-const char riff[] = "RIFF";
-const char wave[] = "WAVE";
-const char fmt[]  = "fmt ";
-const char data[] = "data";
+  unsigned char *data;
+  size_t length;
+  int spliced;      /* Pages are still referenced by the pipe */
+  uint64_t mark;    /* Total amount of bytes in the pipe after this block */
+} FStreamBlock;
+
+struct FWaveStream {
+  int fd;
+  int flags;
+  int seekable;
+  size_t pipe_size;     /* Capacity of the target pipe or 0 if it's no pipe */
+  uint64_t pushed;
+  int format;
+  int channels;
+  uint32_t sample_rate;
+  size_t frame_size;
+  size_t block_size;
+  size_t block_count;
+  unsigned char *ring_memory;
+  FStreamBlock *ring;
+  atomic_size_t head;   /* Next block which will be published by the renderer */
+  atomic_size_t tail;   /* Next block which will be written by the writer thread */
+  sem_t free_blocks;
+  sem_t filled_blocks;
+  pthread_t thread;
+  atomic_int io_error;
+  size_t fill;
+  uint64_t data_size;
+  FWaveStreamStats stats;
+};
+
+size_t stream_block_count = 8;
+size_t stream_block_size = 256 * 1024;
+__thread FWaveStreamStats last_stream_stats;  /* Statistics of the last stream the thread has closed */
+
+void write_le16(unsigned char *p, uint16_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+void write_le32(unsigned char *p, uint32_t v)
+{
+  write_le16(p, v & 0xffff);
+  write_le16(p + 2, v >> 16);
+}
+
+void fill_wave_header(unsigned char *hdr, uint32_t sample_rate, int format, int channels, uint64_t data_size)
+{
+  int bytes = (format & 0xff) / 8;
+  uint32_t size32 = (data_size > 0xffffffffULL - 36) ? 0xffffffff : (uint32_t)data_size;
+  memcpy(hdr, "RIFF", 4);
+  write_le32(hdr + 4, (size32 == 0xffffffff) ? size32 : size32 + 36);
+  memcpy(hdr + 8, "WAVEfmt ", 8);
+  write_le32(hdr + 16, 16); /* length format header */
+  write_le16(hdr + 20, (format & WAVE_FLOAT_FLAG) ? 3 : 1);
+  write_le16(hdr + 22, channels);
+  write_le32(hdr + 24, sample_rate);
+  write_le32(hdr + 28, sample_rate * channels * bytes);
+  write_le16(hdr + 32, channels * bytes);
+  write_le16(hdr + 34, format & 0xff);
+  memcpy(hdr + 36, "data", 4);
+  write_le32(hdr + 40, size32);
+}
+
+int valid_wave_format(int format)
+{
+  return format == WAVE_PCM_8BIT || format == WAVE_PCM_16BIT || format == WAVE_PCM_24BIT ||
+    format == WAVE_PCM_32BIT || format == WAVE_FLOAT_32BIT || format == WAVE_FLOAT_64BIT;
+}
+
+/* Converts the samples of one plane into every step-th slot of out */
+void convert_plane(const sample_t *in, size_t count, int format, size_t step, unsigned char *out)
+{
+  size_t idx;
+  sample_t x;
+  int32_t v;
+  float f32;
+  double f64;
+  for (idx = 0; idx < count; ++idx, out += step) {
+    x = in[idx];
+    switch (format) {
+    case WAVE_PCM_8BIT:
+      out[0] = (unsigned char)MIN(255, MAX(0, (x + 1) * 128));
+      break;
+    case WAVE_PCM_16BIT:
+      write_le16(out, (int16_t)MIN(32767, MAX(-32768, x * 32767)));
+      break;
+    case WAVE_PCM_24BIT:
+      v = (int32_t)MIN(8388607, MAX(-8388608, x * 8388607));
+      out[0] = v & 0xff;
+      out[1] = (v >> 8) & 0xff;
+      out[2] = (v >> 16) & 0xff;
+      break;
+    case WAVE_PCM_32BIT:
+      write_le32(out, (int32_t)MIN(2147483647., MAX(-2147483648., x * 2147483647.)));
+      break;
+    case WAVE_FLOAT_32BIT:
+      f32 = (float)x;
+      memcpy(out, &f32, 4);
+      break;
+    case WAVE_FLOAT_64BIT:
+      f64 = (double)x;
+      memcpy(out, &f64, 8);
+      break;
+    }
+  }
+}
+
+/* Interleaves count frames of planar samples, the planes lie stride samples apart. Channel ch
+ * of a frame takes plane ch modulo planes, so a single plane is written to every channel. */
+void convert_planes(const sample_t *in, size_t stride, int planes, size_t count, int format, int channels, unsigned char *out)
+{
+  size_t idx;
+  int ch, bytes = (format & 0xff) / 8, converted = MIN(planes, channels);
+  for (ch = 0; ch < converted; ++ch) {
+    convert_plane(&in[ch * stride], count, format, channels * bytes, out + ch * bytes);
+  }
+  for (idx = 0; idx < count && converted < channels; ++idx, out += channels * bytes) {
+    for (ch = converted; ch < channels; ++ch) {
+      memcpy(out + ch * bytes, out + (ch % converted) * bytes, bytes);
+    }
+  }
+  fs_add_stats(count * converted, count * (sizeof(sample_t) * converted + channels * bytes));
+}
 
 void *fs_convert_samples(FSampleBuffer *buffer, int format)
 {
-  int idx;
-  unsigned char *buffer_8bit;
-  short *buffer_16bit;
-  if (format == WAVE_PCM_8BIT) {
-    buffer_8bit = (unsigned char*) malloc(buffer->sample_count);
-    FOREACH_SAMPLE(buffer, idx) {
-      buffer_8bit[idx] = (unsigned char)((buffer->samples[idx]+1) * 128);
+  void *data_ptr;
+  if (!valid_wave_format(format)) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return NULL;
+  }
+  data_ptr = malloc(FS_TOTAL_SAMPLES(buffer) * ((format & 0xff) / 8));
+  if (data_ptr == NULL) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  FS_TRACE_KERNEL("fs_convert_samples", FS_TOTAL_SAMPLES(buffer));
+  convert_planes(buffer->samples, buffer->sample_count, buffer->channels, buffer->sample_count, format, buffer->channels, data_ptr);
+  FS_TRACE_END();
+  return data_ptr;
+}
+
+void disable_direct_io(FWaveStream *stream)
+{
+  if (stream->flags & FS_STREAM_DIRECT) {
+    fcntl(stream->fd, F_SETFL, fcntl(stream->fd, F_GETFL) & ~O_DIRECT);
+    stream->flags &= ~FS_STREAM_DIRECT;
+  }
+}
+
+int write_stream_block(FWaveStream *stream, FStreamBlock *block)
+{
+  ssize_t result;
+  size_t offset = 0;
+  if (block->length % STREAM_ALIGN) {
+    /* Only the last block can be unaligned, which isn't allowed for direct IO */
+    disable_direct_io(stream);
+  }
+  while (offset < block->length) {
+    result = write(stream->fd, block->data + offset, block->length - offset);
+    if (result < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EINVAL && (stream->flags & FS_STREAM_DIRECT)) {
+        disable_direct_io(stream);
+        continue;
+      }
+      return FS_ERROR;
     }
-    return buffer_8bit;
-  } else if (format == WAVE_PCM_16BIT) {
-    buffer_16bit = (short*) malloc(buffer->sample_count * 2);
-    FOREACH_SAMPLE(buffer, idx) {
-      buffer_16bit[idx] = (short)(buffer->samples[idx] * 32767);
+    offset += result;
+  }
+  stream->stats.bytes_written += block->length;
+  return FS_OK;
+}
+
+void wait_semaphore(sem_t *sem, size_t *stalls)
+{
+  if (sem_trywait(sem) == 0) return;
+  ++(*stalls);
+  while (sem_wait(sem) != 0 && errno == EINTR);
+}
+
+int splice_stream_block(FWaveStream *stream, FStreamBlock *block)
+{
+  ssize_t result;
+  struct iovec iov;
+  size_t offset = 0;
+  while (offset < block->length) {
+    iov.iov_base = block->data + offset;
+    iov.iov_len = block->length - offset;
+    result = vmsplice(stream->fd, &iov, 1, 0);
+    if (result < 0) {
+      if (errno == EINTR) continue;
+      if (offset == 0 && (errno == EINVAL || errno == ENOSYS)) {
+        stream->pipe_size = 0;
+        return write_stream_block(stream, block);
+      }
+      return FS_ERROR;
     }
-    return buffer_16bit;
+    offset += result;
+  }
+  block->spliced = 1;
+  stream->stats.bytes_written += block->length;
+  stream->stats.bytes_spliced += block->length;
+  return FS_OK;
+}
+
+int push_stream_block(FWaveStream *stream, FStreamBlock *block)
+{
+  int result;
+  block->spliced = 0;
+  if (atomic_load(&stream->io_error)) {
+    return FS_ERROR;
+  }
+  if (stream->pipe_size > 0 && block->length >= stream->pipe_size) {
+    result = splice_stream_block(stream, block);
   } else {
-    fs_set_error(FS_INVALID_ARGUMENT);
+    result = write_stream_block(stream, block);
+  }
+  stream->pushed += block->length;
+  block->mark = stream->pushed;
+  return result;
+}
+
+void release_stream_blocks(FWaveStream *stream, size_t *released, size_t tail)
+{
+  FStreamBlock *block;
+  while (*released < tail) {
+    block = &stream->ring[*released % stream->block_count];
+    /* A spliced block can be reused not before the pipe has been filled with newer data */
+    if (block->spliced && stream->pushed - block->mark < stream->pipe_size) break;
+    ++(*released);
+    sem_post(&stream->free_blocks);
+  }
+}
+
+void *stream_writer_thread(void *arg)
+{
+  FWaveStream *stream = (FWaveStream*) arg;
+  FStreamBlock *block;
+  size_t tail, released = 0;
+  trace_thread_name("stream writer");
+  while (1) {
+    wait_semaphore(&stream->filled_blocks, &stream->stats.consumer_stalls);
+    tail = atomic_load_explicit(&stream->tail, memory_order_relaxed);
+    /* A wake up without a published block marks the end of the stream */
+    if (tail == atomic_load_explicit(&stream->head, memory_order_acquire)) break;
+    block = &stream->ring[tail % stream->block_count];
+    FS_TRACE_BEGIN(TRACE_IO, "write_block", NULL, 0);
+    if (push_stream_block(stream, block) != FS_OK) {
+      atomic_store(&stream->io_error, 1);
+    }
+    FS_TRACE_END();
+    atomic_store_explicit(&stream->tail, tail + 1, memory_order_release);
+    release_stream_blocks(stream, &released, tail + 1);
   }
+  trace_thread_exit();
   return NULL;
 }
 
-int fs_samples_to_wave_file(FSampleBuffer *buffer, const char *fname, int format, int channels)
+FStreamBlock *current_block(FWaveStream *stream)
 {
-  size_t fsize, fdata;
-  FmtHeader fmthdr;
-  void *data_ptr;
+  return &stream->ring[atomic_load_explicit(&stream->head, memory_order_relaxed) % stream->block_count];
+}
+
+void submit_block(FWaveStream *stream)
+{
+  size_t head, queued;
+  current_block(stream)->length = stream->fill;
+  head = atomic_load_explicit(&stream->head, memory_order_relaxed) + 1;
+  atomic_store_explicit(&stream->head, head, memory_order_release);
+  sem_post(&stream->filled_blocks);
+  queued = head - atomic_load_explicit(&stream->tail, memory_order_acquire);
+  stream->stats.high_water = MAX(stream->stats.high_water, queued);
+  stream->fill = 0;
+}
+
+void publish_block(FWaveStream *stream)
+{
+  submit_block(stream);
+  /* Take ownership of the next block */
+  wait_semaphore(&stream->free_blocks, &stream->stats.producer_stalls);
+}
+
+int open_stream_target(FWaveStream *stream, const char *fname, int flags)
+{
+  struct stat st;
+  stream->fd = -1;
+  if (strcmp(fname, "-") == 0) {
+    fflush(stdout);
+    stream->fd = dup(STDOUT_FILENO);
+  } else {
+    if (flags & FS_STREAM_DIRECT) {
+      stream->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+      if (stream->fd >= 0) stream->flags |= FS_STREAM_DIRECT;
+    }
+    if (stream->fd < 0) {
+      stream->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+  }
+  if (stream->fd < 0 || fstat(stream->fd, &st) != 0) {
+    return FS_ERROR;
+  }
+  stream->seekable = S_ISREG(st.st_mode);
+  if (S_ISFIFO(st.st_mode)) {
+    disable_direct_io(stream);
+    /* Try to enlarge the pipe to the block size, the capacity decides when spliced blocks are free again */
+    fcntl(stream->fd, F_SETPIPE_SZ, (int)MIN(stream->block_size, 1024 * 1024));
+    stream->pipe_size = MAX(0, fcntl(stream->fd, F_GETPIPE_SZ));
+  }
+  return FS_OK;
+}
+
+FWaveStream *fs_open_wave_stream(const char *fname, uint32_t sample_rate, int format, int channels, int flags)
+{
+  size_t idx;
+  FWaveStream *stream;
+  fs_clear_error();
+  if (!valid_wave_format(format) || channels < 1 || channels > FS_MAX_CHANNELS || sample_rate == 0) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return NULL;
+  }
+  stream = (FWaveStream*) malloc(sizeof(FWaveStream));
+  if (stream == NULL) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  memset(stream, 0, sizeof(FWaveStream));
+  stream->format = format;
+  stream->channels = channels;
+  stream->sample_rate = sample_rate;
+  stream->frame_size = channels * ((format & 0xff) / 8);
+  stream->block_count = stream_block_count;
+  stream->block_size = stream_block_size;
+  stream->flags = flags & FS_STREAM_RAW;
+  /* Anonymous mappings keep spliced pages valid, even after the ring has been released */
+  stream->ring = (FStreamBlock*) malloc(sizeof(FStreamBlock) * stream->block_count);
+  stream->ring_memory = mmap(NULL, stream->block_count * stream->block_size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (stream->ring == NULL || stream->ring_memory == MAP_FAILED) {
+    if (stream->ring_memory != MAP_FAILED) {
+      munmap(stream->ring_memory, stream->block_count * stream->block_size);
+    }
+    free(stream->ring);
+    free(stream);
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  for (idx = 0; idx < stream->block_count; ++idx) {
+    stream->ring[idx].data = stream->ring_memory + idx * stream->block_size;
+    stream->ring[idx].length = 0;
+  }
+  if (open_stream_target(stream, fname, flags) != FS_OK) {
+    if (stream->fd >= 0) close(stream->fd);
+    munmap(stream->ring_memory, stream->block_count * stream->block_size);
+    free(stream->ring);
+    free(stream);
+    fs_set_error(FS_FILE_IO_ERROR);
+    return NULL;
+  }
+  stream->stats.block_count = stream->block_count;
+  stream->stats.block_size = stream->block_size;
+  stream->stats.direct_io = (stream->flags & FS_STREAM_DIRECT) ? 1 : 0;
+  /* The producer owns the first block right from the start */
+  sem_init(&stream->free_blocks, 0, stream->block_count - 1);
+  sem_init(&stream->filled_blocks, 0, 0);
+  atomic_init(&stream->head, 0);
+  atomic_init(&stream->tail, 0);
+  atomic_init(&stream->io_error, 0);
+  if (pthread_create(&stream->thread, NULL, stream_writer_thread, stream) != 0) {
+    /* Without a writer the producer would wait for a free block forever */
+    sem_destroy(&stream->free_blocks);
+    sem_destroy(&stream->filled_blocks);
+    close(stream->fd);
+    munmap(stream->ring_memory, stream->block_count * stream->block_size);
+    free(stream->ring);
+    free(stream);
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  if (!(stream->flags & FS_STREAM_RAW)) {
+    /* Reserve space for the header, it is updated when the stream is closed */
+    fill_wave_header(current_block(stream)->data, sample_rate, format, channels, 0xffffffff);
+    stream->fill = WAVE_HEADER_SIZE;
+  }
+  return stream;
+}
+
+/* Appends count frames of planar samples, see convert_planes */
+void write_stream_planes(FWaveStream *stream, const sample_t *samples, size_t stride, int planes, size_t count)
+{
+  size_t frames, space, part;
+  unsigned char frame[64];
+  while (count > 0) {
+    if (atomic_load(&stream->io_error)) {
+      fs_set_error(FS_FILE_IO_ERROR);
+      break;
+    }
+    space = stream->block_size - stream->fill;
+    frames = MIN(count, space / stream->frame_size);
+    convert_planes(samples, stride, planes, frames, stream->format, stream->channels, current_block(stream)->data + stream->fill);
+    stream->fill += frames * stream->frame_size;
+    stream->data_size += frames * stream->frame_size;
+    samples += frames;
+    count -= frames;
+    space = stream->block_size - stream->fill;
+    if (count > 0 && space > 0) {
+      /* Split a frame across two blocks, so that all blocks but the last one stay aligned */
+      convert_planes(samples, stride, planes, 1, stream->format, stream->channels, frame);
+      memcpy(current_block(stream)->data + stream->fill, frame, space);
+      stream->fill += space;
+      publish_block(stream);
+      part = stream->frame_size - space;
+      memcpy(current_block(stream)->data, frame + space, part);
+      stream->fill = part;
+      stream->data_size += stream->frame_size;
+      ++samples;
+      --count;
+    } else if (space == 0) {
+      publish_block(stream);
+    }
+  }
+}
 
-  /* Clear error flags */
+int fs_write_wave_stream(FWaveStream *stream, const sample_t *samples, size_t count)
+{
+  fs_clear_error();
+  if (stream == NULL) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  FS_TRACE_KERNEL("fs_write_wave_stream", count);
+  write_stream_planes(stream, samples, 0, 1, count);
+  FS_TRACE_END();
+  return fs_get_error();
+}
+
+int fs_write_wave_stream_buffer(FWaveStream *stream, const FSampleBuffer *buffer)
+{
+  fs_clear_error();
+  if (stream == NULL || INVALID_BUFFER(buffer)) {
+    fs_set_error((stream == NULL) ? FS_INVALID_ARGUMENT : FS_INVALID_BUFFER);
+    return fs_get_error();
+  }
+  FS_TRACE_KERNEL("fs_write_wave_stream_buffer", FS_TOTAL_SAMPLES(buffer));
+  write_stream_planes(stream, buffer->samples, buffer->sample_count, buffer->channels, buffer->sample_count);
+  FS_TRACE_END();
+  return fs_get_error();
+}
+
+int fs_write_wave_stream_fixed(FWaveStream *stream, const FSFixedBuffer *buffer)
+{
+  size_t pos, idx, n, bytes, part;
+  sample_t block[256];
+  const unsigned char *data;
+  int direct;
   fs_clear_error();
+  if (stream == NULL || buffer == NULL || buffer->samples == NULL) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  direct = stream->channels == 1 && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ &&
+    ((buffer->format == FS_FIXED_Q15 && stream->format == WAVE_PCM_16BIT) ||
+     (buffer->format == FS_FIXED_Q31 && stream->format == WAVE_PCM_32BIT));
+  if (!direct) {
+    /* Other layouts take the way through the floating point conversion */
+    for (pos = 0; pos < buffer->sample_count && !FAILED(fs_get_error()); pos += n) {
+      n = MIN(256, buffer->sample_count - pos);
+      for (idx = 0; idx < n; ++idx) {
+        block[idx] = (buffer->format == FS_FIXED_Q15) ?
+          ((const int16_t*) buffer->samples)[pos + idx] / 32768. :
+          ((const int32_t*) buffer->samples)[pos + idx] / 2147483648.;
+      }
+      fs_write_wave_stream(stream, block, n);
+    }
+    return fs_get_error();
+  }
+  /* The samples already have the byte layout of the file, so they are copied as they are.
+   * The block size is a multiple of the page size, hence frames are never split. */
+  FS_TRACE_KERNEL("fs_write_wave_stream_fixed", buffer->sample_count);
+  data = (const unsigned char*) buffer->samples;
+  bytes = buffer->sample_count * stream->frame_size;
+  while (bytes > 0) {
+    if (atomic_load(&stream->io_error)) {
+      fs_set_error(FS_FILE_IO_ERROR);
+      break;
+    }
+    part = MIN(bytes, stream->block_size - stream->fill);
+    memcpy(current_block(stream)->data + stream->fill, data, part);
+    stream->fill += part;
+    stream->data_size += part;
+    data += part;
+    bytes -= part;
+    if (stream->fill == stream->block_size) {
+      publish_block(stream);
+    }
+  }
+  fs_add_stats(buffer->sample_count, buffer->buffer_size);
+  FS_TRACE_END();
+  return fs_get_error();
+}
 
-  /* Open file in binary mode */
-  FILE* fout = fopen(fname, "wb");
-  if (!fout) {
+int fs_close_wave_stream(FWaveStream **stream, FWaveStreamStats *stats)
+{
+  FWaveStream *ws;
+  unsigned char hdr[WAVE_HEADER_SIZE];
+  fs_clear_error();
+  if (stream == NULL || *stream == NULL) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return fs_get_error();
+  }
+  ws = *stream;
+  FS_TRACE_BEGIN(TRACE_IO, "fs_close_wave_stream", NULL, 0);
+  if (ws->fill > 0) {
+    /* Don't wait for a free block, spliced blocks are only released by newer data */
+    submit_block(ws);
+  }
+  sem_post(&ws->filled_blocks);
+  pthread_join(ws->thread, NULL);
+  FS_TRACE_END();
+  disable_direct_io(ws);
+  if (atomic_load(&ws->io_error)) {
+    fs_set_error(FS_FILE_IO_ERROR);
+  } else if (ws->seekable && !(ws->flags & FS_STREAM_RAW)) {
+    fill_wave_header(hdr, ws->sample_rate, ws->format, ws->channels, ws->data_size);
+    if (pwrite(ws->fd, hdr, WAVE_HEADER_SIZE, 0) != WAVE_HEADER_SIZE) {
+      fs_set_error(FS_FILE_IO_ERROR);
+    }
+  }
+  if (close(ws->fd) != 0) {
     fs_set_error(FS_FILE_IO_ERROR);
+  }
+  last_stream_stats = ws->stats;
+  if (stats != NULL) {
+    *stats = ws->stats;
+  }
+  sem_destroy(&ws->free_blocks);
+  sem_destroy(&ws->filled_blocks);
+  munmap(ws->ring_memory, ws->block_count * ws->block_size);
+  free(ws->ring);
+  free(ws);
+  *stream = NULL;
+  return fs_get_error();
+}
+
+void fs_set_wave_stream_ring(size_t block_count, size_t block_size)
+{
+  stream_block_count = MAX(2, block_count);
+  stream_block_size = MAX(1, (block_size + STREAM_ALIGN - 1) / STREAM_ALIGN) * STREAM_ALIGN;
+}
+
+void fs_get_wave_stream_stats(FWaveStreamStats *stats)
+{
+  *stats = last_stream_stats;
+}
+
+int fs_samples_to_wave_file(FSampleBuffer *buffer, const char *fname, int format, int channels)
+{
+  FWaveStream *stream;
+  int error;
+
+  fs_clear_error();
+  if (INVALID_BUFFER(buffer)) {
+    fs_set_error(FS_INVALID_BUFFER);
     return fs_get_error();
   }
 
-  /* Write RIFF header */
-  fwrite(riff, 4, 1, fout);
-  if (format == WAVE_PCM_8BIT) fdata = buffer->sample_count;
-  if (format == WAVE_PCM_16BIT) fdata = buffer->sample_count * 2;
-  fsize = fdata + sizeof(FmtHeader) + 16;
-  fwrite(&fsize, 4, 1, fout);
-
-  /* Write Wave and format header */
-  fwrite(wave, 4, 1, fout);
-  fwrite(fmt, 4, 1, fout);
-  fsize = 16; /* length format header */
-  fwrite(&fsize, 4, 1, fout);
-
-  /* Fill format header */
-  fmthdr.wFromatTag = 1;  /* PCM format */
-  fmthdr.wChannels = channels;
-  fmthdr.wBitsPerSample = format;
-  fmthdr.dwSamplesPerSec = buffer->sample_rate;
-  fmthdr.dwAvgBytesPerSec = format / 8 * buffer->sample_rate;
-  fmthdr.wBlockAlign = fmthdr.wChannels * ((fmthdr.wBitsPerSample + 7) / 8);
-  fwrite(&fmthdr, sizeof(FmtHeader), 1, fout);
-
-  /* Write data chunk */
-  data_ptr = fs_convert_samples(buffer, format);
-  fwrite(data, 4, 1, fout);
-  fwrite(&fdata, 4, 1, fout);
-  fwrite(data_ptr, fdata, 1, fout);
-
-  free(data_ptr);
-  fclose(fout);
+  /* The conversion runs here while the writer thread flushes the previous blocks */
+  stream = fs_open_wave_stream(fname, buffer->sample_rate, format, channels, 0);
+  if (stream == NULL) {
+    return fs_get_error();
+  }
+  fs_write_wave_stream_buffer(stream, buffer);
+  error = fs_get_error();
+  fs_close_wave_stream(&stream, NULL);
+  if (FAILED(error)) {
+    fs_set_error(error);
+  }
   return fs_get_error();
 }
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2018 Pierre Biermann
+ *
+ * Permission is hereby granted and free of charge.
+ * Published under the terms of the MIT license, see LICENSE file for further information.
+ */
+
+/**
+ * @brief Memory mapped Wave and RF64 file reader
+ * @author Pierre Biermann
+ * @date 2026-10-19
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fsynth.h"
+#include "trace.h"
+
+#define WAVE_TAG_PCM          0x0001
+#define WAVE_TAG_FLOAT        0x0003
+#define WAVE_TAG_EXTENSIBLE   0xfffe
+
+uint16_t read_le16(const unsigned char *p)
+{
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+uint32_t read_le32(const unsigned char *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint64_t read_le64(const unsigned char *p)
+{
+  return (uint64_t)read_le32(p) | ((uint64_t)read_le32(p + 4) << 32);
+}
+
+int parse_fmt_chunk(FWaveFile *wave, const unsigned char *chunk, uint32_t size)
+{
+  uint16_t tag, bits;
+  if (size < 16) return FS_ERROR;
+  tag = read_le16(chunk);
+  wave->channels = read_le16(chunk + 2);
+  wave->sample_rate = read_le32(chunk + 4);
+  wave->block_align = read_le16(chunk + 12);
+  bits = read_le16(chunk + 14);
+  if (tag == WAVE_TAG_EXTENSIBLE && size >= 40) {
+    tag = read_le16(chunk + 24); /* First two bytes of the sub format GUID */
+  }
+  if (wave->channels == 0 || wave->sample_rate == 0 || wave->block_align < wave->channels * ((bits + 7) / 8)) {
+    return FS_ERROR;
+  }
+  if (tag == WAVE_TAG_PCM && (bits == 8 || bits == 16 || bits == 24 || bits == 32)) {
+    wave->format = bits;
+  } else if (tag == WAVE_TAG_FLOAT && (bits == 32 || bits == 64)) {
+    wave->format = WAVE_FLOAT_FLAG | bits;
+  } else {
+    return FS_ERROR;
+  }
+  return FS_OK;
+}
+
+int parse_wave_chunks(FWaveFile *wave)
+{
+  const unsigned char *p = wave->map_addr;
+  size_t pos = 12, chunk_size, data_size = 0;
+  uint64_t ds64_data_size = 0;
+  int has_fmt = 0, has_data = 0, rf64;
+  if (wave->map_size < 12 || memcmp(p + 8, "WAVE", 4) != 0) return FS_ERROR;
+  if (memcmp(p, "RIFF", 4) == 0) {
+    rf64 = 0;
+  } else if (memcmp(p, "RF64", 4) == 0) {
+    rf64 = 1;
+  } else {
+    return FS_ERROR;
+  }
+  while (pos + 8 <= wave->map_size && !has_data) {
+    chunk_size = read_le32(p + pos + 4);
+    if (memcmp(p + pos, "ds64", 4) == 0 && rf64 && chunk_size >= 24 && pos + 8 + 24 <= wave->map_size) {
+      ds64_data_size = read_le64(p + pos + 16);
+    } else if (memcmp(p + pos, "fmt ", 4) == 0) {
+      if (pos + 8 + chunk_size > wave->map_size) return FS_ERROR;
+      if (parse_fmt_chunk(wave, p + pos + 8, chunk_size) != FS_OK) return FS_ERROR;
+      has_fmt = 1;
+    } else if (memcmp(p + pos, "data", 4) == 0) {
+      wave->data_offset = pos + 8;
+      data_size = chunk_size;
+      if (rf64 && chunk_size == 0xffffffff) {
+        data_size = ds64_data_size;
+      }
+      /* Streamed files may carry a placeholder size, so the data is clamped to the file end */
+      if (data_size == 0 || data_size > wave->map_size - wave->data_offset) {
+        data_size = wave->map_size - wave->data_offset;
+      }
+      has_data = 1;
+    }
+    pos += 8 + chunk_size + (chunk_size & 1);
+  }
+  if (!has_fmt || !has_data) return FS_ERROR;
+  wave->frame_count = data_size / wave->block_align;
+  return FS_OK;
+}
+
+FWaveFile *fs_open_wave_file(const char *fname)
+{
+  struct stat st;
+  FWaveFile *wave;
+  fs_clear_error();
+  wave = (FWaveFile*) malloc(sizeof(FWaveFile));
+  if (wave == NULL) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  memset(wave, 0, sizeof(FWaveFile));
+  wave->fd = open(fname, O_RDONLY);
+  if (wave->fd < 0 || fstat(wave->fd, &st) != 0 || st.st_size < 12) {
+    fs_set_error(FS_FILE_IO_ERROR);
+    fs_close_wave_file(&wave);
+    return NULL;
+  }
+  wave->map_size = st.st_size;
+  wave->map_addr = mmap(NULL, wave->map_size, PROT_READ, MAP_PRIVATE, wave->fd, 0);
+  if (wave->map_addr == MAP_FAILED) {
+    wave->map_addr = NULL;
+    fs_set_error(FS_FILE_IO_ERROR);
+    fs_close_wave_file(&wave);
+    return NULL;
+  }
+  madvise(wave->map_addr, wave->map_size, MADV_SEQUENTIAL);
+  if (parse_wave_chunks(wave) != FS_OK) {
+    fs_set_error(FS_FILE_IO_ERROR | FS_INVALID_ARGUMENT);
+    fs_close_wave_file(&wave);
+    return NULL;
+  }
+  return wave;
+}
+
+void fs_close_wave_file(FWaveFile **wave)
+{
+  if (wave != NULL && (*wave) != NULL) {
+    if ((*wave)->map_addr != NULL) {
+      munmap((*wave)->map_addr, (*wave)->map_size);
+    }
+    if ((*wave)->fd >= 0) {
+      close((*wave)->fd);
+    }
+    free(*wave);
+    *wave = NULL;
+  }
+}
+
+size_t fs_read_wave_samples(FWaveFile *wave, int channel, size_t offset, sample_t *out, size_t count)
+{
+  size_t idx, stride;
+  const unsigned char *p;
+  float f32;
+  double f64;
+  int32_t i32;
+  fs_clear_error();
+  if (wave == NULL || out == NULL || channel < 0 || channel >= wave->channels) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return 0;
+  }
+  if (offset >= wave->frame_count) {
+    return 0;
+  }
+  count = MIN(count, wave->frame_count - offset);
+  stride = wave->block_align;
+  p = wave->map_addr + wave->data_offset + offset * stride + channel * ((wave->format & 0xff) / 8);
+  switch (wave->format) {
+  case WAVE_PCM_8BIT:
+    for (idx = 0; idx < count; ++idx, p += stride) {
+      out[idx] = (p[0] - 128) / 128.;
+    }
+    break;
+  case WAVE_PCM_16BIT:
+    for (idx = 0; idx < count; ++idx, p += stride) {
+      out[idx] = (int16_t)read_le16(p) / 32768.;
+    }
+    break;
+  case WAVE_PCM_24BIT:
+    for (idx = 0; idx < count; ++idx, p += stride) {
+      i32 = (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+      out[idx] = i32 / 8388608.;
+    }
+    break;
+  case WAVE_PCM_32BIT:
+    for (idx = 0; idx < count; ++idx, p += stride) {
+      out[idx] = (int32_t)read_le32(p) / 2147483648.;
+    }
+    break;
+  case WAVE_FLOAT_32BIT:
+    for (idx = 0; idx < count; ++idx, p += stride) {
+      memcpy(&f32, p, sizeof(f32));
+      out[idx] = f32;
+    }
+    break;
+  case WAVE_FLOAT_64BIT:
+    for (idx = 0; idx < count; ++idx, p += stride) {
+      memcpy(&f64, p, sizeof(f64));
+      out[idx] = f64;
+    }
+    break;
+  default:
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return 0;
+  }
+  fs_add_stats(count, count * (sizeof(sample_t) + (wave->format & 0xff) / 8));
+  return count;
+}
+
+FSampleBuffer *map_wave_view(FWaveFile *wave)
+{
+  FSampleBuffer *buffer;
+  void *addr;
+  buffer = (FSampleBuffer*) malloc(sizeof(FSampleBuffer));
+  if (buffer == NULL) {
+    fs_set_error(FS_OUT_OF_MEMORY);
+    return NULL;
+  }
+  /* A private writable mapping lets the kernels work in place, modified pages are copied on write */
+  addr = mmap(NULL, wave->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, wave->fd, 0);
+  if (addr == MAP_FAILED) {
+    free(buffer);
+    fs_set_error(FS_FILE_IO_ERROR);
+    return NULL;
+  }
+  madvise(addr, wave->map_size, MADV_SEQUENTIAL);
+  memset(buffer, 0, sizeof(FSampleBuffer));
+  buffer->sample_rate = wave->sample_rate;
+  buffer->sample_count = wave->frame_count;
+  buffer->channels = 1;
+  buffer->buffer_size = sizeof(sample_t) * wave->frame_count;
+  buffer->samples = (sample_t*)((unsigned char*)addr + wave->data_offset);
+  buffer->map_addr = addr;
+  buffer->map_size = wave->map_size;
+  fs_add_live_bytes(buffer->buffer_size);
+  return buffer;
+}
+
+FSampleBuffer *fs_wave_file_to_buffer(FWaveFile *wave, int channel)
+{
+  FSampleBuffer *buffer;
+  int ch, native_format = (sizeof(sample_t) == 8) ? WAVE_FLOAT_64BIT : WAVE_FLOAT_32BIT;
+  fs_clear_error();
+  if (wave == NULL || wave->frame_count == 0 || channel < FS_ALL_CHANNELS || channel >= wave->channels ||
+      (channel == FS_ALL_CHANNELS && wave->channels > FS_MAX_CHANNELS)) {
+    fs_set_error(FS_INVALID_ARGUMENT);
+    return NULL;
+  }
+  if (wave->format == native_format && wave->channels == 1 && (wave->data_offset % sizeof(sample_t)) == 0) {
+    return map_wave_view(wave);
+  }
+  if (channel == FS_ALL_CHANNELS) {
+    buffer = fs_create_multichannel_buffer(wave->sample_rate, wave->frame_count, wave->channels);
+  } else {
+    buffer = fs_create_sample_buffer_raw(wave->sample_rate, wave->frame_count);
+  }
+  if (buffer == NULL) {
+    return NULL;
+  }
+  /* The frames are split into the planes of the buffer, one channel per pass */
+  FS_TRACE_KERNEL("fs_read_wave_samples", FS_TOTAL_SAMPLES(buffer));
+  for (ch = 0; ch < (int)buffer->channels && !FAILED(fs_get_error()); ++ch) {
+    fs_read_wave_samples(wave, (channel == FS_ALL_CHANNELS) ? ch : channel, 0, FS_CHANNEL(buffer, ch), buffer->sample_count);
+  }
+  FS_TRACE_END();
+  if (FAILED(fs_get_error())) {
+    fs_delete_sample_buffer(&buffer);
+  }
+  return buffer;
+}
+
+FSampleBuffer *fs_load_wave_file(const char *fname, int channel)
+{
+  FSampleBuffer *buffer;
+  FWaveFile *wave = fs_open_wave_file(fname);
+  if (wave == NULL) {
+    return NULL;
+  }
+  buffer = fs_wave_file_to_buffer(wave, channel);
+  fs_close_wave_file(&wave);
+  return buffer;
+}